@@ -2,6 +2,7 @@
 
 #include <sb7.h>
 #include <vmath.h>
+#include <sb7cluster.h>
 #include <string>
 #include <fstream>
 #include <vector>
@@ -17,4 +18,29 @@ std::string parseAndClip(std::string& sub, std::string delim);
 //UVs -> Texture mapping coords
 //normals
 //number -> number of points in vertices
-void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number);
\ No newline at end of file
+void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number);
+
+//Same as above, plus the o/g groups of the file
+//groups -> draw range of each group (first vertex, vertex count), same layout as sb7::object sub-objects
+//groupNames -> name of each group
+//groupBounds -> bounding sphere and normal cone of each group (object space)
+void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number,
+              std::vector<SB6M_SUB_OBJECT_DECL> &groups, std::vector<std::string> &groupNames, std::vector<SB6M_CLUSTER_DECL> &groupBounds);
+
+//Same as above, but reads the obj text from an open stream instead of a file
+//in -> stream positioned at the start of the obj text (an std::istringstream over bytes already in memory, say)
+void parse_obj(std::istream &in, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number,
+               std::vector<SB6M_SUB_OBJECT_DECL> &groups, std::vector<std::string> &groupNames, std::vector<SB6M_CLUSTER_DECL> &groupBounds);
+
+//Split a loaded obj into clusters that can be culled on their own
+//vertices, uvs, normals -> reordered in place so each cluster is one contiguous run
+//clusters -> draw range of each cluster (first vertex, vertex count)
+//bounds -> bounding sphere and normal cone of each cluster (object space)
+void cluster_obj(std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals,
+                 std::vector<SB6M_SUB_OBJECT_DECL> &clusters, std::vector<SB6M_CLUSTER_DECL> &bounds);
+
+//Same as above, but each group from load_obj is clustered on its own so no cluster spans two groups
+//groups -> group ranges from load_obj, still valid afterwards
+void cluster_obj(std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals,
+                 const std::vector<SB6M_SUB_OBJECT_DECL> &groups,
+                 std::vector<SB6M_SUB_OBJECT_DECL> &clusters, std::vector<SB6M_CLUSTER_DECL> &bounds);
@@ -32,6 +32,9 @@
 #ifndef SB6M_FILETYPES_ONLY
 
 #include <GL/glcorearb.h>
+#include <sb7cluster.h>
+
+#include <vector>
 
 namespace sb7
 {
@@ -48,13 +51,15 @@ public:
         render_sub_object(0, instance_count, base_instance);
     }
 
+    // A sub-object's first is the index of its first element, counted from
+    // the start of the object's index data.
     void render_sub_object(unsigned int object_index,
                            unsigned int instance_count = 1,
                            unsigned int base_instance = 0);
 
     void get_sub_object_info(unsigned int index, GLuint &first, GLuint &count)
     {
-        if (index >= num_sub_objects)
+        if (index >= sub_object.size())
         {
             first = 0;
             count = 0;
@@ -66,7 +71,25 @@ public:
         }
     }
 
-    unsigned int get_sub_object_count() const           { return num_sub_objects; }
+    // Draws every sub-object, or the object_count sub-objects listed in
+    // object_indices, with a single multi-draw. Instanced draws go through
+    // an indirect buffer.
+    void render_all(const unsigned int * object_indices = NULL,
+                    unsigned int object_count = 0,
+                    unsigned int instance_count = 1,
+                    unsigned int base_instance = 0);
+
+    // Draws every sub-object whose cluster bounds pass the frustum and
+    // normal cone tests. mvp and eye are in object space. Objects without a
+    // cluster list draw everything. Returns the number of sub-objects drawn.
+    unsigned int render_visible(const vmath::mat4& mvp,
+                                const vmath::vec3& eye,
+                                unsigned int instance_count = 1,
+                                unsigned int base_instance = 0);
+
+    bool has_clusters() const                           { return !cluster.empty() && cluster.size() == sub_object.size(); }
+
+    unsigned int get_sub_object_count() const           { return (unsigned int)sub_object.size(); }
     GLuint       get_vao() const                        { return vao; }
     void load(const char * filename);
     void free();
@@ -76,11 +99,17 @@ private:
     GLuint                  vao;
     GLuint                  index_type;
     GLuint                  index_offset;
+    GLuint                  indirect_buffer;
 
-    enum { MAX_SUB_OBJECTS = 256 };
+    std::vector<SB6M_SUB_OBJECT_DECL>   sub_object;
+    std::vector<SB6M_CLUSTER_DECL>      cluster;
 
-    unsigned int            num_sub_objects;
-    SB6M_SUB_OBJECT_DECL    sub_object[MAX_SUB_OBJECTS];
+    // Scratch space for render_all, kept around to avoid per-frame allocation
+    std::vector<GLsizei>                draw_count;
+    std::vector<GLint>                  draw_first;
+    std::vector<const void *>           draw_offset;
+    std::vector<GLuint>                 draw_commands;
+    std::vector<unsigned int>           visible;
 };
 
 }
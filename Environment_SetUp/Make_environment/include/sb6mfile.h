@@ -41,7 +41,8 @@ typedef enum SB6M_CHUNK_TYPE_t
     SB6M_CHUNK_TYPE_VERTEX_ATTRIBS  = SB6M_FOURCC('A','T','R','B'),
     SB6M_CHUNK_TYPE_SUB_OBJECT_LIST = SB6M_FOURCC('O','L','S','T'),
     SB6M_CHUNK_TYPE_COMMENT         = SB6M_FOURCC('C','M','N','T'),
-    SB6M_CHUNK_TYPE_DATA            = SB6M_FOURCC('D','A','T','A')
+    SB6M_CHUNK_TYPE_DATA            = SB6M_FOURCC('D','A','T','A'),
+    SB6M_CHUNK_TYPE_CLUSTER_LIST    = SB6M_FOURCC('C','L','S','T')
 } SB6M_CHUNK_TYPE;
 
 typedef struct SB6M_HEADER_t
@@ -104,7 +105,8 @@ typedef struct SB6M_VERTEX_ATTRIB_CHUNK_t
 
 typedef enum SB6M_DATA_ENCODING_t
 {
-    SB6M_DATA_ENCODING_RAW              = 0
+    SB6M_DATA_ENCODING_RAW              = 0,
+    SB6M_DATA_ENCODING_PACKED           = 1
 } SB6M_DATA_ENCODING;
 
 typedef struct SB6M_DATA_CHUNK_t
@@ -115,6 +117,40 @@ typedef struct SB6M_DATA_CHUNK_t
     unsigned int                data_length;
 } SB6M_DATA_CHUNK;
 
+/*
+ * SB6M_DATA_ENCODING_PACKED: data_offset points at an SB6M_PACKED_HEADER
+ * instead of raw bytes and data_length is the size once decoded. Each
+ * stream decodes into [offset, offset + element_size * element_count) of
+ * the decoded data; anything not covered by a stream decodes to zero.
+ * encoded_offset is relative to the start of the SB6M_PACKED_HEADER.
+ */
+typedef enum SB6M_PACKED_STREAM_TYPE_t
+{
+    SB6M_PACKED_STREAM_VERTEX           = 0,    // Byte delta + zigzag + group bit packing
+    SB6M_PACKED_STREAM_INDEX            = 1     // Triangle list, edge / vertex FIFO coded
+} SB6M_PACKED_STREAM_TYPE;
+
+typedef struct SB6M_PACKED_STREAM_DECL_t
+{
+    unsigned int                type;
+    unsigned int                offset;
+    unsigned int                element_size;
+    unsigned int                element_count;
+    unsigned int                encoded_offset;
+    unsigned int                encoded_length;
+} SB6M_PACKED_STREAM_DECL;
+
+typedef struct SB6M_PACKED_HEADER_t
+{
+    unsigned int                stream_count;
+    SB6M_PACKED_STREAM_DECL     stream[1];
+} SB6M_PACKED_HEADER;
+
+/*
+ * first and count are in elements, and first counts from the start of the
+ * index data. Older readers passed first to glDrawElements as a byte
+ * offset, which only agrees for byte indices at the start of the buffer.
+ */
 typedef struct SB6M_SUB_OBJECT_DECL_t
 {
     unsigned int                first;
@@ -128,6 +164,27 @@ typedef struct SB6M_CHUNK_SUB_OBJECT_LIST_t
     SB6M_SUB_OBJECT_DECL        sub_object[1];
 } SB6M_CHUNK_SUB_OBJECT_LIST;
 
+/*
+ * Per sub-object culling data. When present, entry i of the cluster list
+ * describes sub-object i of the sub-object list: a bounding sphere and a
+ * normal cone (axis plus the sine of the cone's half angle, or 1.0 when the
+ * triangles face too many ways to ever be back-face culled as a group).
+ */
+typedef struct SB6M_CLUSTER_DECL_t
+{
+    float                       center[3];
+    float                       radius;
+    float                       cone_axis[3];
+    float                       cone_cutoff;
+} SB6M_CLUSTER_DECL;
+
+typedef struct SB6M_CHUNK_CLUSTER_LIST_t
+{
+    SB6M_CHUNK_HEADER           header;
+    unsigned int                count;
+    SB6M_CLUSTER_DECL           cluster[1];
+} SB6M_CHUNK_CLUSTER_LIST;
+
 typedef struct SB6M_CHUNK_COMMENT_t
 {
     SB6M_CHUNK_HEADER           header;
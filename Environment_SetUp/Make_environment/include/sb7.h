@@ -45,11 +45,20 @@
 #include "GLFW/glfw3.h"
 
 #include "sb7ext.h"
+#include "sb7jobs.h"
+#include "sb7ktx.h"
+#include "sb7uploadqueue.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 namespace sb7
 {
 
@@ -65,7 +74,13 @@ private:
                                         GLvoid* userParam);
 
 public:
-    application() {}
+    application()
+        : loader_window(NULL),
+          loader_running(false),
+          loader_busy(0)
+    {
+
+    }
     virtual ~application() {}
     virtual void run(sb7::application* the_app)
     {
@@ -156,12 +171,35 @@ public:
             }
         }
 
+        // Staging for loads done off this thread
+        uploads.init();
+
+        // Workers shared by loading, culling and anything else the app splits up
+        jobs.start();
+
+        if (info.flags.loader)
+        {
+            start_loader();
+        }
+
         startup();
 
         do
         {
+            // Issue the copies loaders staged since the last frame
+            uploads.process();
+
+            // Hand over whatever the loader thread has finished
+            process_loads();
+
+            // Jobs that need this thread (the context) to finish
+            jobs.run_main_jobs();
+
             render(glfwGetTime());
 
+            // Pick up any texture saves whose readback has finished
+            sb7::ktx::file::process_saves();
+
             glfwSwapBuffers(window);
             glfwPollEvents();
 
@@ -169,8 +207,23 @@ public:
             running &= (glfwWindowShouldClose(window) != GL_TRUE);
         } while (running);
 
+        // The app's own loading threads stop writing into the upload ring
+        stop_loading();
+
+        // Before shutdown() so loaders waiting on ring space give up
+        uploads.shutdown();
+
+        // Likewise, so shutdown() sees everything the loader made
+        stop_loader();
+
+        // Runs out whatever jobs are left
+        jobs.stop();
+
         shutdown();
 
+        // Finish writing queued saves while the context is still around
+        sb7::ktx::file::process_saves(true);
+
         glfwDestroyWindow(window);
         glfwTerminate();
     }
@@ -210,6 +263,27 @@ public:
 
     }
 
+    // Called once the main loop is over, before the upload queue shuts
+    // down. Anything the app runs that fills upload queue regions (an asset
+    // pipeline's decode threads, say) has to be stopped here.
+    virtual void stop_loading()
+    {
+
+    }
+
+    // Queues work for the loader thread, which runs it with a hidden
+    // context that shares objects with the window's. done then runs on this
+    // thread from the main loop, once a fence says the GPU has finished
+    // everything work issued, so the objects it made are safe to draw with.
+    // Things that aren't shared between contexts (vertex arrays,
+    // framebuffers) belong in done. Without a loader (info.flags.loader not
+    // set, or no shared context to be had) both run right away, here.
+    void load(const std::function<void()>& work,
+              const std::function<void()>& done = std::function<void()>());
+
+    // Loads queued, running or waiting on their fence
+    unsigned int loads_pending();
+
     void setWindowTitle(const char * title)
     {
         glfwSetWindowTitle(window, title);
@@ -282,6 +356,7 @@ public:
                 unsigned int    stereo      : 1;
                 unsigned int    debug       : 1;
                 unsigned int    robust      : 1;
+                unsigned int    loader      : 1;
             };
             unsigned int        all;
         } flags;
@@ -291,6 +366,29 @@ protected:
     APPINFO     info;
     static      sb7::application * app;
     GLFWwindow* window;
+    upload_queue uploads;
+    job_system  jobs;
+
+    struct load_job
+    {
+        std::function<void()>   work;
+        std::function<void()>   done;
+        GLsync                  fence;
+    };
+
+    GLFWwindow*                 loader_window;
+    std::thread                 loader;
+    std::mutex                  loader_lock;
+    std::condition_variable     loader_wake;
+    std::deque<load_job>        loader_queue;       // Not started yet
+    std::deque<load_job>        loader_fenced;      // Ran, waiting on the GPU
+    bool                        loader_running;
+    unsigned int                loader_busy;
+
+    void start_loader();
+    void stop_loader();
+    void process_loads(bool wait = false);
+    static void loader_main(application * self);
 
     static void glfw_onResize(GLFWwindow* window, int w, int h)
     {
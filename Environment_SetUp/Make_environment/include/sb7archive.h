@@ -0,0 +1,157 @@
+/*
+ * Packed asset archive
+ *
+ * Many assets in one file, so a cold start opens and maps one file instead
+ * of stat-ing and reading hundreds. The file starts with a table of contents
+ * hashed on the asset names, followed by the assets themselves, each on a
+ * 4 KiB boundary and already in the form it is handed to GL in:
+ *
+ *     ARCHIVE_MESH     an .sbm file (see sb7::object_writer), vertices raw
+ *     ARCHIVE_TEXTURE  a .ktx file in the machine's byte order
+ *     ARCHIVE_SHADER   GLSL source
+ *     ARCHIVE_RAW      anything else, as it was on disk
+ *
+ * Every blob is followed by at least one zero byte, so shader source can be
+ * compiled straight out of the mapping.
+ *
+ * Names are the paths the assets were packed from. Lookups treat '\' and
+ * '/' alike and ignore "." components, so ".\bin\media\Planet.obj" finds
+ * "bin/media/Planet.obj".
+ */
+
+#ifndef __SB7ARCHIVE_H__
+#define __SB7ARCHIVE_H__
+
+#include <sb6mfile.h>
+#include <sb7mappedfile.h>
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace sb7
+{
+
+enum ARCHIVE_TYPE
+{
+    ARCHIVE_RAW                 = 0,
+    ARCHIVE_MESH                = 1,
+    ARCHIVE_TEXTURE             = 2,
+    ARCHIVE_SHADER              = 3
+};
+
+#define SB7A_MAGIC              0x41374253u     // "SB7A"
+#define SB7A_VERSION            1
+
+// Followed by bucket_count slots (entry index + 1, 0 for empty), then
+// entry_count entries, then names_size bytes of names. Blobs come after.
+struct SB7A_HEADER
+{
+    uint32_t                    magic;
+    uint32_t                    version;
+    uint32_t                    entry_count;
+    uint32_t                    bucket_count;   // Power of two
+    uint32_t                    names_size;
+    uint32_t                    alignment;      // Of every blob's offset
+    uint64_t                    reserved;
+};
+
+struct SB7A_ENTRY
+{
+    uint64_t                    hash;           // archive::hash() of the name
+    uint64_t                    offset;         // From the start of the file
+    uint64_t                    size;
+    uint32_t                    name_offset;    // Into the names, NUL terminated
+    uint32_t                    type;           // ARCHIVE_TYPE
+};
+
+class archive
+{
+public:
+    archive();
+    ~archive();
+
+    // Maps the whole file. Fails if it isn't an archive or any entry points
+    // outside of it.
+    bool open(const char * filename);
+    void close();
+
+    bool                        is_open() const     { return header != NULL; }
+
+    // Entry for name, NULL if there isn't one
+    const SB7A_ENTRY *          find(const char * name) const;
+
+    // Same, also handing back where the blob is. data stays good until the
+    // archive is closed.
+    bool                        find(const char * name, const unsigned char *& data, size_t& size,
+                                     unsigned int * type = NULL) const;
+
+    unsigned int                count() const       { return header ? header->entry_count : 0; }
+    const SB7A_ENTRY&           entry(unsigned int i) const     { return entries[i]; }
+    const char *                name(const SB7A_ENTRY& e) const { return names + e.name_offset; }
+    const unsigned char *       data(const SB7A_ENTRY& e) const { return file.data() + e.offset; }
+
+    // Names as they are stored and hashed
+    static std::string          normalize(const char * name);
+    static uint64_t             hash(const std::string& normalized);
+
+private:
+    archive(const archive&);
+    archive& operator=(const archive&);
+
+    mapped_file                 file;
+    const SB7A_HEADER *         header;
+    const uint32_t *            buckets;
+    const SB7A_ENTRY *          entries;
+    const char *                names;
+};
+
+// A mesh sb7pack made from an OBJ: the triangle soup load_obj would give,
+// positions, texture coordinates and normals one after the other, already
+// clustered, with the o/g groups in the comment chunk as
+// "g <first> <count> <name>" lines. The arrays point into the .sbm.
+struct packed_mesh
+{
+    const float *                       positions;      // vec4 per vertex
+    const float *                       uvs;            // vec2 per vertex, NULL if not packed
+    const float *                       normals;        // vec4 per vertex, NULL if not packed
+    unsigned int                        vertex_count;
+    std::vector<SB6M_SUB_OBJECT_DECL>   clusters;
+    std::vector<SB6M_CLUSTER_DECL>      cluster_bounds;
+    std::vector<SB6M_SUB_OBJECT_DECL>   groups;
+    std::vector<std::string>            group_names;
+    std::vector<SB6M_CLUSTER_DECL>      group_bounds;   // Worked out from the positions
+};
+
+// False if data isn't an .sbm with raw vec4 "position" data
+bool parse_packed_mesh(const unsigned char * data, size_t size, packed_mesh& m);
+
+// Builds archives. Blobs are kept in memory until save().
+class archive_writer
+{
+public:
+    archive_writer();
+
+    // Adding a name twice replaces the first one
+    void add(const char * name, ARCHIVE_TYPE type, const void * data, size_t size);
+    void add(const char * name, ARCHIVE_TYPE type, std::vector<unsigned char>& data);   // Takes data's contents
+
+    size_t                      count() const       { return blobs.size(); }
+
+    bool save(const char * filename) const;
+
+private:
+    struct blob
+    {
+        std::string                 name;
+        ARCHIVE_TYPE                type;
+        std::vector<unsigned char>  data;
+    };
+
+    std::vector<blob>           blobs;
+};
+
+}
+
+#endif /* __SB7ARCHIVE_H__ */
@@ -0,0 +1,194 @@
+/*
+ * Asset loader
+ *
+ * A coroutine front end over the asset pipeline and the job system. Each
+ * loader is a task, so application code can write
+ *
+ *     sb7::task<void> load_scene()
+ *     {
+ *         auto planet = assets.load_mesh("Planet.obj");
+ *         auto sky = assets.load_cubemap("Skycube");
+ *
+ *         mesh = co_await planet;
+ *         texture = co_await sky;
+ *     }
+ *
+ * and everything started before the first co_await overlaps. Files are
+ * read on the pipeline's read thread, decoded on its decode threads and
+ * uploaded on the GL thread in its upload stage, so they show up in the
+ * pipeline's timeline like any other asset.
+ *
+ * Construct the loader on the GL thread. Awaiting a task resumes on the
+ * thread that finished it; loaders that create GL objects finish on the GL
+ * thread.
+ *
+ * Given an upload queue (see sb7uploadqueue.h), meshes and cube faces are
+ * copied into its staging ring on the decode threads, and all the GL
+ * thread does for them is queue the copies out of it. A mesh or cubemap is
+ * handed back once its copies have finished on the GPU, the frame after its
+ * upload stage at the earliest. Anything too big for the ring's free space
+ * goes up directly, as it does without a queue.
+ *
+ * Paths go through the vfs. Anything it finds in an archive (or memory) is
+ * taken from there, already converted and with nothing to read; files in
+ * mounted directories are read by the pipeline.
+ */
+
+#ifndef __SB7ASSETLOADER_H__
+#define __SB7ASSETLOADER_H__
+
+#include "GL/gl3w.h"
+
+#include <sb7assetpipeline.h>
+#include <sb7jobs.h>
+#include <sb7task.h>
+#include <sb7uploadqueue.h>
+#include <sb6mfile.h>
+#include <sb7vfs.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sb7
+{
+
+class asset_loader
+{
+    struct file_state;
+
+public:
+    // An OBJ file in a vertex buffer, with its groups and culling clusters
+    // (see load_obj and cluster_obj). buffer is 0 if the file couldn't be
+    // loaded.
+    struct mesh
+    {
+        GLuint                              buffer;
+        GLuint                              vertex_count;
+        std::vector<SB6M_SUB_OBJECT_DECL>   groups;
+        std::vector<std::string>            group_names;
+        std::vector<SB6M_CLUSTER_DECL>      group_bounds;
+        std::vector<SB6M_SUB_OBJECT_DECL>   clusters;
+        std::vector<SB6M_CLUSTER_DECL>      cluster_bounds;
+    };
+
+    class read_awaiter;
+
+    // What co_await read() hands back: the file contents, and a way onto
+    // the GL thread in this file's upload stage. Packed assets are never
+    // copied, data() points into the archive (or memory mount) and bytes()
+    // is empty.
+    class file
+    {
+    public:
+        struct upload_awaiter
+        {
+            bool await_ready() const { return false; }
+            bool await_suspend(std::coroutine_handle<> h);
+            void await_resume() {}
+
+            std::shared_ptr<file_state>     state;
+        };
+
+        std::vector<unsigned char>& bytes();
+
+        const unsigned char *       data() const;
+        size_t                      size() const;
+        bool                        packed() const;
+        unsigned int                type() const;       // ARCHIVE_TYPE, ARCHIVE_RAW on disk
+
+        // co_await before leaving the decode thread. If the upload stage
+        // has already gone by, this resumes from run_main_jobs() instead.
+        upload_awaiter upload() { return upload_awaiter{ state }; }
+
+    private:
+        friend class read_awaiter;
+
+        std::shared_ptr<file_state>         state;
+    };
+
+    class read_awaiter
+    {
+    public:
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        file await_resume();
+
+    private:
+        friend class asset_loader;
+
+        asset_loader *                      loader;
+        std::string                         path;
+        std::shared_ptr<file_state>         state;
+    };
+
+    asset_loader(asset_pipeline& pipeline, job_system& jobs, upload_queue * uploads = nullptr);
+
+    // co_await read(path) resumes on a decode thread with the file's bytes
+    // (empty if the vfs couldn't find it or it couldn't be read)
+    read_awaiter read(const std::string& path);
+
+    // co_await on_worker() carries on as a job. co_await on_gl_thread()
+    // carries on from the GL thread's next run_main_jobs(), or straight away
+    // if this already is the GL thread.
+    resume_on_worker on_worker() { return resume_on_worker(jobs); }
+
+    struct gl_thread_awaiter
+    {
+        bool await_ready() const { return std::this_thread::get_id() == loader->gl_thread; }
+        void await_suspend(std::coroutine_handle<> h) { loader->jobs.run_on_main([h]{ h.resume(); }); }
+        void await_resume() {}
+
+        asset_loader *                      loader;
+    };
+
+    gl_thread_awaiter on_gl_thread() { return gl_thread_awaiter{ this }; }
+
+    // Parsed and clustered on a decode thread, uploaded on the GL thread
+    task<mesh> load_mesh(std::string path);
+
+    // The six sc_*.bmp sides in directory, as loadCubeTextures would load
+    // them. Returns the texture name, 0 if no side could be read.
+    task<GLuint> load_cubemap(std::string directory);
+
+    // The file load_cubemap reads for side i (0 to 5), after the directory
+    static const char * cube_face(unsigned int i);
+
+    // Compiled on the GL thread, 0 if the file couldn't be read. Nothing
+    // waits for the compile; errors show up when the shader is linked.
+    task<GLuint> load_shader(std::string path, GLenum type);
+
+    // Both stages load at once and are linked when both are in. The link
+    // is polled once a frame (see program::start_link), so any number of
+    // programs compile side by side. 0 if it didn't compile or link.
+    task<GLuint> load_program(std::string vs_path, std::string fs_path);
+
+private:
+    asset_loader(const asset_loader&);
+    asset_loader& operator=(const asset_loader&);
+
+    struct face
+    {
+        std::unique_ptr<unsigned char[]>    pixels;     // RGBA, from decodeCubeSide
+        const unsigned char *               data;       // pixels, or the packed texture's level 0
+        unsigned int                        width;
+        unsigned int                        height;
+        upload_queue::region                staged;     // data copied into the upload queue, if staged.data
+    };
+
+    task<face> load_cube_face(std::string path);
+
+    // Copies size bytes into the upload queue's ring, false if there is no
+    // queue or no room in it right now
+    bool stage(const void * data, size_t size, upload_queue::region& r);
+
+    asset_pipeline&                         pipeline;
+    job_system&                             jobs;
+    upload_queue *                          uploads;
+    std::thread::id                         gl_thread;
+};
+
+}
+
+#endif /* __SB7ASSETLOADER_H__ */
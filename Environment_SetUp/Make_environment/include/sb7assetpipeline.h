@@ -0,0 +1,231 @@
+/*
+ * Asset pipeline
+ *
+ * Loads assets in three stages that run at the same time: a read thread
+ * pulls whole files off disk (everything queued at the time in one batch,
+ * see sb7filereader.h), decode threads turn the bytes into whatever
+ * the asset needs (parsed meshes, shader source, pixels), and the GL thread
+ * does the upload in process(). The stages are joined by bounded queues, so
+ * a fast stage runs at most a few assets ahead of a slow one instead of
+ * holding every file in memory at once. With enough assets in flight the
+ * total time approaches that of the slowest stage rather than the sum.
+ *
+ * Every asset records when each of its stages started and finished, which
+ * can be printed or written out as a trace for chrome://tracing.
+ */
+
+#ifndef __SB7ASSETPIPELINE_H__
+#define __SB7ASSETPIPELINE_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sb7filereader.h>
+
+namespace sb7
+{
+
+// A FIFO that holds at most capacity items. push() waits while it is full
+// and pop() while it is empty; once closed both give up instead.
+template <typename T>
+class bounded_queue
+{
+public:
+    explicit bounded_queue(size_t capacity = 4)
+        : capacity(capacity ? capacity : 1),
+          closed(false)
+    {
+
+    }
+
+    // Returns false, leaving item alone, if the queue was closed
+    bool push(T& item)
+    {
+        std::unique_lock<std::mutex> l(lock);
+
+        while (items.size() >= capacity && !closed)
+            not_full.wait(l);
+
+        if (closed)
+            return false;
+
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> l(lock);
+
+        while (items.empty() && !closed)
+            not_empty.wait(l);
+
+        return take(item);
+    }
+
+    bool try_pop(T& item)
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        return take(item);
+    }
+
+    // Wakes everyone. Items already queued can still be popped.
+    void close()
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+    void reopen(size_t new_capacity)
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        items.clear();
+        capacity = new_capacity ? new_capacity : 1;
+        closed = false;
+    }
+
+private:
+    bounded_queue(const bounded_queue&);
+    bounded_queue& operator=(const bounded_queue&);
+
+    bool take(T& item)
+    {
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+
+        return true;
+    }
+
+    std::mutex                  lock;
+    std::condition_variable     not_full;
+    std::condition_variable     not_empty;
+    std::deque<T>               items;
+    size_t                      capacity;
+    bool                        closed;
+};
+
+class asset_pipeline
+{
+public:
+    // Runs on a decode thread with the contents of the file (empty if the
+    // asset has no file or it couldn't be read). It may keep the bytes.
+    typedef std::function<void(std::vector<unsigned char>& data)> decode_proc;
+
+    // Runs on the GL thread, from process() or finish()
+    typedef std::function<void()> upload_proc;
+
+    // Seconds since start(), negative for stages that haven't happened
+    struct timeline_entry
+    {
+        std::string             name;
+        size_t                  bytes;
+        double                  read_start;
+        double                  read_end;
+        double                  decode_start;
+        double                  decode_end;
+        double                  upload_start;
+        double                  upload_end;
+    };
+
+    asset_pipeline();
+    ~asset_pipeline();
+
+    // decoders = 0 picks a count from the hardware. depth is how many assets
+    // each queue holds before the stage feeding it has to wait.
+    void start(unsigned int decoders = 0, unsigned int depth = 4);
+
+    // Drops anything not yet decoded and joins the threads. Uploads that
+    // are already decoded are thrown away without running.
+    void stop();
+
+    // Any thread, after start(). path may be NULL for an asset that is only
+    // decoded and uploaded. Assets added together are read together.
+    void add(const char * name, const char * path,
+             const decode_proc& decode, const upload_proc& upload);
+
+    // GL thread. Runs uploads that are ready until none are left or budget
+    // seconds have gone (0 means no limit). Returns how many assets added so
+    // far haven't been uploaded yet.
+    unsigned int process(double budget = 0.0);
+
+    // GL thread. Runs uploads as they become ready until every asset added
+    // so far is done.
+    void finish();
+
+    void get_timeline(std::vector<timeline_entry>& timeline);
+
+    // One line per asset plus how long each stage was busy in total,
+    // against how long the whole load took
+    void print_timeline(FILE * out);
+
+    // Chrome trace event JSON, one row per stage
+    bool write_trace(const char * filename);
+
+private:
+    asset_pipeline(const asset_pipeline&);
+    asset_pipeline& operator=(const asset_pipeline&);
+
+    struct record
+    {
+        std::string             name;
+        std::string             path;
+        decode_proc             decode;
+        upload_proc             upload;
+        timeline_entry          times;
+    };
+
+    // What moves between the stages
+    struct item
+    {
+        record *                asset;
+        std::vector<unsigned char> data;
+    };
+
+    double now() const;
+    void stamp(double& at);
+    void run_upload(item& i);
+
+    static void read_main(asset_pipeline * self);
+    static void decode_main(asset_pipeline * self);
+
+    // Records live in a deque so they don't move as more are added
+    std::mutex                  records_lock;
+    std::deque<record>          records;
+    unsigned int                uploaded;
+
+    // to_read is as deep as it needs to be, add() never waits
+    bounded_queue<record *>     to_read;
+    bounded_queue<item>         to_decode;
+    bounded_queue<item>         to_upload;
+
+    std::thread                 reader;
+    file_reader                 io;
+    std::vector<std::thread>    decoders;
+    std::atomic<bool>           stopping;
+
+    std::chrono::steady_clock::time_point   t0;
+};
+
+}
+
+#endif /* __SB7ASSETPIPELINE_H__ */
@@ -0,0 +1,70 @@
+/*
+ * Mesh cluster utility
+ *
+ * Splits indexed triangle lists into small spatially coherent clusters and
+ * computes the bounds needed to throw whole clusters away before they are
+ * submitted: a bounding sphere for frustum culling and a normal cone for
+ * back-face culling. Clusters map one-to-one onto SB6M sub-objects.
+ */
+
+#ifndef __SB7CLUSTER_H__
+#define __SB7CLUSTER_H__
+
+#include "sb6mfile.h"
+#include <vmath.h>
+
+#include <vector>
+
+namespace sb7
+{
+
+namespace cluster
+{
+
+enum
+{
+    MIN_TRIANGLES = 64,
+    MAX_TRIANGLES = 128
+};
+
+struct frustum
+{
+    vmath::vec4 planes[6];      // xyz = inward facing normal, w = distance
+};
+
+// Reorders the triangles of an indexed mesh into clusters of at most
+// max_triangles triangles (and, for meshes large enough to allow it, at
+// least MIN_TRIANGLES). out_indices receives the reordered index list,
+// sub_objects the index range of every cluster and clusters its bounds.
+// position_stride is the distance in bytes between consecutive positions.
+void build(const float * positions,
+           unsigned int position_stride,
+           const unsigned int * indices,
+           unsigned int index_count,
+           std::vector<unsigned int>& out_indices,
+           std::vector<SB6M_SUB_OBJECT_DECL>& sub_objects,
+           std::vector<SB6M_CLUSTER_DECL>& clusters,
+           unsigned int max_triangles = MAX_TRIANGLES);
+
+// Bounding sphere and normal cone of an arbitrary run of triangles
+SB6M_CLUSTER_DECL compute_bounds(const float * positions,
+                                 unsigned int position_stride,
+                                 const unsigned int * indices,
+                                 unsigned int index_count);
+
+// Pulls the six clip planes out of a (model-)view-projection matrix. The
+// planes live in whatever space the matrix transforms from.
+void extract_frustum(const vmath::mat4& mvp, frustum& f);
+
+// Moves cluster bounds by a rotation / translation / uniform scale matrix
+SB6M_CLUSTER_DECL transform(const SB6M_CLUSTER_DECL& c, const vmath::mat4& m);
+
+// True if any part of the cluster may be visible from eye. eye and the
+// frustum must be in the same space as the cluster bounds.
+bool is_visible(const SB6M_CLUSTER_DECL& c, const frustum& f, const vmath::vec3& eye);
+
+}
+
+}
+
+#endif /* __SB7CLUSTER_H__ */
@@ -0,0 +1,121 @@
+/*
+ * Batched file reader
+ *
+ * Reads a whole list of files at once. On Linux it uses io_uring: every
+ * file is opened up front, then reads for all of them are queued together
+ * into one staging buffer that is registered with the kernel, so the
+ * device sees a deep queue and each read costs no syscall of its own. The
+ * ring is driven with the raw syscalls, no liburing needed.
+ *
+ * Where io_uring isn't available (other platforms, old kernels, or it is
+ * disabled) a small pool of threads reads the files with plain blocking
+ * reads instead, several at a time. If the ring stops working partway
+ * through a batch the reader switches to the threads for good, and they
+ * read whatever the ring hadn't finished.
+ *
+ * Either way each file is handed to a callback on the thread that called
+ * read_batch() as soon as it is complete.
+ */
+
+#ifndef __SB7FILEREADER_H__
+#define __SB7FILEREADER_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sb7
+{
+
+class file_reader
+{
+public:
+    enum backend
+    {
+        BACKEND_NONE,
+        BACKEND_IO_URING,
+        BACKEND_THREADS
+    };
+
+    // Called on the thread running read_batch() once per file, in whatever
+    // order they finish. data is only good until the callback returns. ok
+    // is false (and size 0) if the file couldn't be read.
+    typedef std::function<void(unsigned int index, const unsigned char * data, size_t size, bool ok)> done_proc;
+
+    file_reader();
+    ~file_reader();
+
+    // staging is how much is read in one go; files bigger than that get a
+    // buffer of their own. depth is the number of reads in flight. With
+    // force_threads set io_uring isn't tried.
+    bool init(size_t staging = 16 * 1024 * 1024, unsigned int depth = 64, bool force_threads = false);
+    void shutdown();
+
+    backend get_backend() const { return mode; }
+    const char * backend_name() const;
+
+    // Reads every file in paths and returns how many were read in full
+    unsigned int read_batch(const std::vector<std::string>& paths, const done_proc& done);
+
+private:
+    file_reader(const file_reader&);
+    file_reader& operator=(const file_reader&);
+
+    bool init_uring(unsigned int depth);
+    void shutdown_uring();
+    unsigned int read_batch_uring(const std::vector<std::string>& paths, const done_proc& done);
+
+    void init_threads();
+    unsigned int read_batch_threads(const std::vector<std::string>& paths, const done_proc& done);
+    static void worker_main(file_reader * self);
+
+    backend                     mode;
+
+    // io_uring
+    int                         ring_fd;
+    void *                      sq_ring;
+    void *                      cq_ring;
+    size_t                      sq_ring_size;
+    size_t                      cq_ring_size;
+    void *                      sqes;
+    size_t                      sqes_size;
+    unsigned int                sq_entries;
+    unsigned int *              sq_head;
+    unsigned int *              sq_tail;
+    unsigned int *              sq_mask;
+    unsigned int *              sq_array;
+    unsigned int *              cq_head;
+    unsigned int *              cq_tail;
+    unsigned int *              cq_mask;
+    void *                      cqes;
+    bool                        registered;
+
+    unsigned char *             staging;
+    size_t                      staging_size;
+
+    // Thread fallback
+    struct job
+    {
+        const std::string *     path;
+        unsigned int            index;
+        std::vector<unsigned char> data;
+        bool                    ok;
+    };
+
+    std::vector<std::thread>    workers;
+    std::mutex                  lock;
+    std::condition_variable     wake;
+    std::condition_variable     finished;
+    std::deque<job *>           todo;
+    std::deque<job *>           done_jobs;
+    bool                        running;
+};
+
+}
+
+#endif /* __SB7FILEREADER_H__ */
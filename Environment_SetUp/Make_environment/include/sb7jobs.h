@@ -0,0 +1,152 @@
+/*
+ * Job system
+ *
+ * A pool of worker threads with one deque each. A worker pushes and pops
+ * its own jobs at the back (newest first, while its data is still in
+ * cache) and, when it runs dry, steals the oldest job from the front of
+ * another worker's deque. Jobs submitted from outside the pool are dealt
+ * out to the workers in turn.
+ *
+ * Completion is tracked with counters: a job can count itself in a
+ * counter when it finishes, and can be held back until another counter
+ * reaches zero, which is how dependencies are expressed. Jobs that must run
+ * on the main (GL) thread go to a separate queue that the main loop drains
+ * once a frame.
+ */
+
+#ifndef __SB7JOBS_H__
+#define __SB7JOBS_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sb7
+{
+
+class job_system;
+struct job_entry;
+
+// Number of jobs still to finish. Zero means done, and releases any job
+// that was waiting on it. wait() on a counter before destroying it.
+class job_counter
+{
+public:
+    job_counter() : count(0) {}
+
+    bool done() const { return count == 0; }
+
+private:
+    job_counter(const job_counter&);
+    job_counter& operator=(const job_counter&);
+
+    friend class job_system;
+
+    std::atomic<int>            count;
+    std::mutex                  lock;
+    std::vector<job_entry *>    waiting;
+};
+
+class job_system
+{
+public:
+    struct worker_stats
+    {
+        unsigned long long      jobs;           // Jobs run
+        unsigned long long      steals;         // Of those, taken from another worker
+        double                  busy_seconds;   // Running jobs
+        double                  utilization;    // busy_seconds over the time since the last reset
+    };
+
+    struct benchmark_result
+    {
+        double                  ns_per_job;             // Submit, run and retire an empty job
+        double                  ns_per_dependency;      // One link of a chain of dependent jobs
+        double                  parallel_for_speedup;   // Against the same loop on one thread
+        unsigned int            workers;
+    };
+
+    job_system();
+    ~job_system();
+
+    // workers = 0 uses one per hardware thread, less one for the main
+    // thread. The thread calling start() is the main thread from then on.
+    void start(unsigned int workers = 0);
+
+    // Finishes every queued job, then joins the workers
+    void stop();
+
+    unsigned int worker_count() const { return (unsigned int)workers.size(); }
+
+    // Runs fn on a worker. If done is given it counts fn until fn has
+    // run; if after is given fn is held back until after reaches zero.
+    void run(const std::function<void()>& fn, job_counter * done = NULL, job_counter * after = NULL);
+
+    // Same, but fn runs on the main thread, from run_main_jobs() or wait()
+    void run_on_main(const std::function<void()>& fn, job_counter * done = NULL, job_counter * after = NULL);
+
+    // Main thread only. Runs every main thread job queued so far and
+    // returns how many ran.
+    unsigned int run_main_jobs();
+
+    // Runs jobs on this thread until c reaches zero
+    void wait(job_counter& c);
+
+    // Calls fn(first, last) over [begin, end) in chunks of at most grain
+    // (0 picks a grain from the worker count) and returns when all are done
+    void parallel_for(unsigned int begin,
+                      unsigned int end,
+                      unsigned int grain,
+                      const std::function<void(unsigned int, unsigned int)>& fn);
+
+    void get_stats(std::vector<worker_stats>& stats, bool reset = false);
+
+    // Times the scheduler itself on this pool
+    benchmark_result benchmark(unsigned int jobs = 100000);
+
+private:
+    job_system(const job_system&);
+    job_system& operator=(const job_system&);
+
+    typedef job_entry job;
+
+    struct worker
+    {
+        std::thread                         thread;
+        std::mutex                          lock;
+        std::deque<job *>                   jobs;
+
+        std::atomic<unsigned long long>     run;
+        std::atomic<unsigned long long>     steals;
+        std::atomic<unsigned long long>     busy_ns;
+    };
+
+    void submit(job * j);
+    void enqueue(job * j);
+    void finish(job * j);
+    job * find_job(int self, bool& stolen);
+    bool run_one(int self);
+    static void worker_main(job_system * self, int index);
+
+    std::vector<worker *>       workers;
+    std::thread::id             main_thread;
+    std::atomic<unsigned int>   next_worker;
+
+    std::mutex                  sleep_lock;
+    std::condition_variable     wake;
+    std::atomic<unsigned int>   queued;
+    bool                        running;
+
+    std::mutex                  main_lock;
+    std::deque<job *>           main_jobs;
+
+    std::atomic<unsigned long long> stats_start_ns;
+};
+
+}
+
+#endif /* __SB7JOBS_H__ */
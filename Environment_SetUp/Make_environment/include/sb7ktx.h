@@ -1,6 +1,9 @@
 #ifndef __SB6KTX_H__
 #define __SB6KTX_H__
 
+#include <cstddef>
+#include <vector>
+
 namespace sb7
 {
 
@@ -35,8 +38,34 @@ union keyvaluepair
 };
 
 unsigned int load(const char * filename, unsigned int tex = 0);
+
+// Finds the images of a KTX file already in memory without uploading
+// anything. target receives the texture target the file describes, images
+// and image_sizes one entry per level (per face per level, level-major, for
+// non-array cube maps) pointing into data. Only files in the machine's byte
+// order are accepted, since nothing gets copied.
+bool parse(const void * data, size_t size, header& h, unsigned int& target,
+           std::vector<const unsigned char *>& images, std::vector<unsigned int>& image_sizes);
+
+// Queues a save of every level (and face / layer) of tex. The texels are
+// read back through a pixel pack buffer and written by a background thread
+// once a fence says the copy is done, so this never waits on the GPU.
+// Returns false if the texture can't be described by a KTX file.
 bool save(const char * filename, unsigned int target, unsigned int tex);
 
+// Writes a KTX file straight from memory. images holds one pointer per
+// level, or per face per level (level-major) for non-array cube maps, and
+// image_sizes their sizes in bytes. identifier and endianness are filled in.
+bool write(const char * filename, const header& h, const void * const * images, const unsigned int * image_sizes);
+
+// Same, into memory (replacing whatever out held)
+bool write(std::vector<unsigned char>& out, const header& h, const void * const * images, const unsigned int * image_sizes);
+
+// Advances queued saves. Call once a frame on the thread that owns the
+// context; wait = true blocks until every save has been written. Returns
+// the number of saves still in flight.
+unsigned int process_saves(bool wait = false);
+
 }
 
 }
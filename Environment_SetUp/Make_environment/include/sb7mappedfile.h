@@ -0,0 +1,47 @@
+/*
+ * Read-only memory mapped file
+ *
+ * Lets loaders parse and upload file contents in place instead of reading
+ * them into a heap copy first. The mapping is private and read-only, so
+ * loaders must never write through data().
+ */
+
+#ifndef __SB7MAPPEDFILE_H__
+#define __SB7MAPPEDFILE_H__
+
+#include <cstddef>
+
+namespace sb7
+{
+
+class mapped_file
+{
+public:
+    mapped_file();
+    ~mapped_file();
+
+    bool open(const char * filename);
+    void close();
+
+    bool                    is_open() const     { return base != NULL; }
+    const unsigned char *   data() const        { return base; }
+    size_t                  size() const        { return length; }
+
+private:
+    mapped_file(const mapped_file&);
+    mapped_file& operator=(const mapped_file&);
+
+    const unsigned char *   base;
+    size_t                  length;
+
+#ifdef _WIN32
+    void *                  file;
+    void *                  mapping;
+#else
+    int                     fd;
+#endif
+};
+
+}
+
+#endif /* __SB7MAPPEDFILE_H__ */
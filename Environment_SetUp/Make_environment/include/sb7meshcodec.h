@@ -0,0 +1,75 @@
+/*
+ * Mesh stream codec
+ *
+ * Encoders and decoders behind SB6M_DATA_ENCODING_PACKED.
+ *
+ * Vertex streams are coded per byte lane: every byte of a vertex is
+ * replaced by its difference to the same byte of the previous vertex,
+ * zigzagged so small negative steps become small numbers, and groups of 16
+ * such bytes are then stored with 0, 2, 4 or 8 bits each (out of range
+ * values escape to a trailing raw byte).
+ *
+ * Index streams must be triangle lists. Each triangle is coded as one byte
+ * that names an edge shared with a recent triangle (or says there is none)
+ * and how to find the remaining vertex: next unseen vertex, a recently
+ * used vertex, or an explicit varint delta. Triangles may come back
+ * rotated (a, b, c) -> (b, c, a); winding is always preserved.
+ */
+
+#ifndef __SB7MESHCODEC_H__
+#define __SB7MESHCODEC_H__
+
+#include "sb6mfile.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace sb7
+{
+
+namespace meshcodec
+{
+
+// Appends the encoded form of count vertices of element_size bytes to out
+void encode_vertices(std::vector<unsigned char>& out,
+                     const void * vertices,
+                     size_t count,
+                     size_t element_size);
+
+bool decode_vertices(void * vertices,
+                     size_t count,
+                     size_t element_size,
+                     const unsigned char * in,
+                     size_t in_size);
+
+// Appends the encoded form of a triangle list to out
+void encode_indices(std::vector<unsigned char>& out,
+                    const unsigned int * indices,
+                    size_t index_count);
+
+// index_size is the size in bytes of each decoded index (1, 2 or 4)
+bool decode_indices(void * indices,
+                    size_t index_count,
+                    size_t index_size,
+                    const unsigned char * in,
+                    size_t in_size);
+
+// Builds a complete SB6M_PACKED_HEADER plus stream payload from raw data.
+// streams lists the regions of raw to compress, their encoded_offset and
+// encoded_length fields are filled in by this function.
+void encode_data(std::vector<unsigned char>& out,
+                 const void * raw,
+                 const std::vector<SB6M_PACKED_STREAM_DECL>& streams);
+
+// Decodes a packed data chunk payload (starting at the SB6M_PACKED_HEADER)
+// into dst, which must hold the chunk's data_length bytes.
+bool decode_data(void * dst,
+                 size_t dst_size,
+                 const void * packed,
+                 size_t packed_size);
+
+}
+
+}
+
+#endif /* __SB7MESHCODEC_H__ */
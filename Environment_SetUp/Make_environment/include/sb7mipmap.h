@@ -0,0 +1,59 @@
+/*
+ * CPU mip chain generation
+ *
+ * Builds complete mip chains for 8-bit RGBA images at bake time so loaders
+ * never have to call glGenerateMipmap. Each level is filtered from the one
+ * above it in floating point (never from a re-quantized level), optionally
+ * in linear light: sRGB encoded color is decoded before filtering and
+ * encoded again afterwards, alpha is always treated as linear.
+ *
+ * Work is split into bands of rows of every image and spread over worker
+ * threads level by level; each pixel is filtered as one 4-wide SSE vector
+ * where available.
+ */
+
+#ifndef __SB7MIPMAP_H__
+#define __SB7MIPMAP_H__
+
+#include <vector>
+
+namespace sb7
+{
+
+namespace mipmap
+{
+
+enum filter
+{
+    FILTER_BOX,         // Area average, the same as most drivers
+    FILTER_KAISER       // Kaiser windowed sinc, sharper without aliasing
+};
+
+// Levels in a full chain down to 1x1
+unsigned int level_count(unsigned int width, unsigned int height);
+
+// Size of a level, never less than 1 in either direction
+void level_size(unsigned int level,
+                unsigned int width,
+                unsigned int height,
+                unsigned int& level_width,
+                unsigned int& level_height);
+
+// Generates the full mip chain of count images of the same size (the six
+// faces of a cube map, for instance). chains[i][level] receives the tightly
+// packed RGBA pixels of that level, level 0 being a copy of images[i].
+// threads = 0 uses every hardware thread.
+void generate(filter f,
+              const unsigned char * const * images,
+              unsigned int count,
+              unsigned int width,
+              unsigned int height,
+              std::vector<std::vector<unsigned char> > * chains,
+              bool srgb = true,
+              unsigned int threads = 0);
+
+}
+
+}
+
+#endif /* __SB7MIPMAP_H__ */
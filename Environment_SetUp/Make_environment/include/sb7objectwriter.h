@@ -0,0 +1,72 @@
+/*
+ * SB6M writer
+ *
+ * Builds .sbm files that sb7::object::load can read back. Everything goes
+ * into a single DATA chunk (vertices first, indices after them on a 4 byte
+ * boundary) described by ATRB, VRTX and INDX chunks, plus optional
+ * sub-object, cluster and comment chunks.
+ */
+
+#ifndef __SB7OBJECTWRITER_H__
+#define __SB7OBJECTWRITER_H__
+
+#include "sb6mfile.h"
+
+#include <GL/glcorearb.h>
+
+#include <string>
+#include <vector>
+
+namespace sb7
+{
+
+class object_writer
+{
+public:
+    object_writer();
+
+    // Raw vertex data, laid out however the attributes describe it
+    void set_vertex_data(const void * data, unsigned int size, unsigned int total_vertices);
+
+    // vertex_stride is the size of one interleaved vertex, used to pick the
+    // element size when the data is packed. Pass 0 for non-interleaved data.
+    void set_vertex_stride(unsigned int vertex_stride)  { stride = vertex_stride; }
+
+    void add_attrib(const char * name,
+                    unsigned int size,
+                    GLenum type,
+                    unsigned int stride,
+                    unsigned int flags,
+                    unsigned int data_offset);
+
+    // Indices are stored as index_type (GL_UNSIGNED_BYTE, _SHORT or _INT)
+    void set_index_data(GLenum index_type, const unsigned int * indices, unsigned int index_count);
+
+    // first and count are in indices (or vertices for non-indexed data)
+    void add_sub_object(unsigned int first, unsigned int count);
+    void set_sub_objects(const std::vector<SB6M_SUB_OBJECT_DECL>& sub_objects);
+    void set_clusters(const std::vector<SB6M_CLUSTER_DECL>& clusters);
+
+    void set_comment(const char * comment);
+    void set_encoding(SB6M_DATA_ENCODING data_encoding)  { encoding = data_encoding; }
+
+    void write(std::vector<unsigned char>& out) const;
+    bool save(const char * filename) const;
+
+private:
+    std::vector<unsigned char>              vertex_data;
+    unsigned int                            vertex_count;
+    unsigned int                            stride;
+    std::vector<SB6M_VERTEX_ATTRIB_DECL>    attribs;
+    std::vector<unsigned char>              index_data;
+    GLenum                                  index_type;
+    unsigned int                            index_count;
+    std::vector<SB6M_SUB_OBJECT_DECL>       sub_objects;
+    std::vector<SB6M_CLUSTER_DECL>          clusters;
+    std::string                             comment;
+    SB6M_DATA_ENCODING                      encoding;
+};
+
+}
+
+#endif /* __SB7OBJECTWRITER_H__ */
@@ -0,0 +1,190 @@
+/*
+ * Program reflection
+ *
+ * Everything a linked program has active (uniforms, vertex attributes and
+ * uniform blocks, with the offsets of the block members) read from GL once,
+ * straight after the link, into a table keyed by a hash of the name:
+ *
+ *     sb7::program_reflection info;
+ *
+ *     info.reflect(program);
+ *     ...
+ *     glUniformMatrix4fv(info.uniform_location("transform"), 1, GL_FALSE, m);
+ *
+ * The names are string literals hashed at compile time, so a lookup is a
+ * probe of a small table and there are no strings left by the time a frame
+ * is drawn. Anything that isn't active comes back as -1, which glUniform*
+ * ignores; an attribute location wants checking before it is enabled.
+ *
+ * Uniform blocks are laid out from the offsets GL gives, whatever layout
+ * the shader asks for:
+ *
+ *     std::vector<unsigned char> data(info.block_size("Camera"));
+ *
+ *     info.set(data.data(), "Camera.proj", camera.proj_Matrix);
+ *     info.set(data.data(), "Camera.view", camera.view_mat);
+ *
+ * Needs GL 4.3 (or ARB_program_interface_query).
+ */
+
+#ifndef __SB7REFLECTION_H__
+#define __SB7REFLECTION_H__
+
+#include "GL/gl3w.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+namespace sb7
+{
+
+// FNV-1a, 32 bits
+constexpr uint32_t name_hash(const char * name, size_t length)
+{
+    uint32_t h = 0x811c9dc5u;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 0x01000193u;
+    }
+
+    return h;
+}
+
+// A resource name, hashed at compile time when it is a literal
+struct resource_name
+{
+    template <size_t N>
+    consteval resource_name(const char (&name)[N])
+        : hash(name_hash(name, N - 1))
+    {
+
+    }
+
+    // For names that are only known at run time
+    static resource_name from_string(const char * name)
+    {
+        return resource_name(name_hash(name, strlen(name)));
+    }
+
+    uint32_t        hash;
+
+private:
+    explicit constexpr resource_name(uint32_t h) : hash(h) {}
+};
+
+class program_reflection
+{
+public:
+    struct uniform
+    {
+        uint32_t    hash;
+        GLenum      type;
+        GLint       array_size;
+        GLint       location;       // -1 in a block
+        GLint       block;          // Index into blocks(), -1 if not in one
+        GLint       offset;         // Bytes into the block
+        GLint       array_stride;
+        GLint       matrix_stride;
+    };
+
+    struct attribute
+    {
+        uint32_t    hash;
+        GLenum      type;
+        GLint       array_size;
+        GLint       location;
+    };
+
+    struct block
+    {
+        uint32_t    hash;
+        GLuint      index;
+        GLint       binding;
+        GLint       data_size;
+    };
+
+    program_reflection();
+
+    // False (and empty) if the program isn't linked, or two of its names
+    // hash the same
+    bool reflect(GLuint program);
+    void clear();
+
+    GLuint                  program() const     { return name; }
+
+    const uniform *         find_uniform(resource_name n) const;
+    const attribute *       find_attribute(resource_name n) const;
+    const block *           find_block(resource_name n) const;
+
+    GLint uniform_location(resource_name n) const
+    {
+        const uniform * u = find_uniform(n);
+        return u ? u->location : -1;
+    }
+
+    GLint attribute_location(resource_name n) const
+    {
+        const attribute * a = find_attribute(n);
+        return a ? a->location : -1;
+    }
+
+    // Bytes of buffer the block needs, 0 if it isn't active
+    GLint block_size(resource_name n) const
+    {
+        const block * b = find_block(n);
+        return b ? b->data_size : 0;
+    }
+
+    // Copies value into a block's data at the member's offset, false if the
+    // member isn't active. Matrices go in as they are, so they want the
+    // matrix stride std140 and std430 give a mat4.
+    template <typename T>
+    bool set(void * block_data, resource_name member, const T& value) const
+    {
+        const uniform * u = find_uniform(member);
+
+        if (!u || u->block < 0)
+            return false;
+
+        memcpy((unsigned char *)block_data + u->offset, &value, sizeof(T));
+
+        return true;
+    }
+
+    const std::vector<uniform>&     uniforms() const    { return uniform_list; }
+    const std::vector<attribute>&   attributes() const  { return attribute_list; }
+    const std::vector<block>&       blocks() const      { return block_list; }
+
+private:
+    enum
+    {
+        SLOT_EMPTY,
+        SLOT_UNIFORM,
+        SLOT_ATTRIBUTE,
+        SLOT_BLOCK
+    };
+
+    struct slot
+    {
+        uint32_t        hash;
+        unsigned int    kind;
+        unsigned int    index;
+    };
+
+    int find(unsigned int kind, uint32_t hash) const;
+    void insert(unsigned int kind, uint32_t hash, unsigned int index);
+
+    GLuint                          name;
+    std::vector<uniform>            uniform_list;
+    std::vector<attribute>          attribute_list;
+    std::vector<block>              block_list;
+    std::vector<slot>               table;          // Open addressed, a power of two long
+};
+
+}
+
+#endif /* __SB7REFLECTION_H__ */
@@ -0,0 +1,237 @@
+/*
+ * Resource manager
+ *
+ * Meshes, textures and programs loaded through here are only loaded once.
+ * Asking for a path that is already loaded (or loading) hands back another
+ * handle to it, and a path whose files turn out to be the same as something
+ * already loaded under another path shares that one instead of being parsed
+ * and uploaded again:
+ *
+ *     sb7::resource_manager::mesh_handle planet = resources.load_mesh("Planet.obj");
+ *
+ *     co_await planet.loaded();
+ *     if (planet)
+ *         draw(planet->buffer, planet->vertex_count);
+ *
+ * Handles count references. When the last one goes the resource stays
+ * loaded, in case it is asked for again, until the memory is wanted: each
+ * resource knows how much GPU memory it takes, and once the total goes over
+ * the budget the least recently used resources that nobody has a handle to
+ * are deleted. Nothing with a handle is ever deleted, so the total can stay
+ * over budget while everything is in use.
+ *
+ * Loads go through the asset loader (see sb7assetloader.h), so construct
+ * the manager on the GL thread and keep it (and the pipeline) around until
+ * the loads it started are done. Everything here, handles included, is for
+ * the GL thread only.
+ */
+
+#ifndef __SB7RESOURCES_H__
+#define __SB7RESOURCES_H__
+
+#include "GL/gl3w.h"
+
+#include <sb7assetloader.h>
+#include <sb7reflection.h>
+#include <sb7task.h>
+
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace sb7
+{
+
+class resource_manager
+{
+    struct record;
+
+public:
+    typedef asset_loader::mesh mesh;
+
+    struct texture
+    {
+        GLuint                  name;
+        GLenum                  target;
+    };
+
+    struct program
+    {
+        GLuint                  name;
+        program_reflection      reflection;
+    };
+
+    // A counted reference to a resource. get() is NULL while it loads, and
+    // for good if it couldn't be loaded.
+    template <typename T>
+    class handle
+    {
+    public:
+        handle() : r(nullptr) {}
+        handle(const handle& other) : r(other.r) { if (r) r->refs++; }
+        handle(handle&& other) noexcept : r(other.r) { other.r = nullptr; }
+        ~handle() { reset(); }
+
+        handle& operator=(handle other)
+        {
+            record * t = r;
+            r = other.r;
+            other.r = t;
+            return *this;
+        }
+
+        void reset()
+        {
+            if (r)
+                r->owner->release(r);
+            r = nullptr;
+        }
+
+        const T * get() const
+        {
+            record * t = resolve(r);
+
+            if (!t || t->state != READY)
+                return nullptr;
+
+            r->last_used = t->last_used = r->owner->frame;
+
+            if constexpr (std::is_same<T, mesh>::value)
+                return &t->mesh_data;
+            else if constexpr (std::is_same<T, texture>::value)
+                return &t->texture_data;
+            else
+                return &t->program_data;
+        }
+
+        const T *               operator->() const  { return get(); }
+        explicit                operator bool() const { return get() != nullptr; }
+
+        bool                    loading() const     { return r && resolve(r)->state == LOADING; }
+
+        // co_await loaded() resumes once the resource has loaded (or
+        // failed to). Keep the handle until then.
+        struct loaded_awaiter
+        {
+            bool await_ready() const { return !r || resolve(r)->state != LOADING; }
+            void await_suspend(std::coroutine_handle<> h) { resolve(r)->waiters.push_back(h); }
+            void await_resume() {}
+
+            record *            r;
+        };
+
+        loaded_awaiter          loaded() const      { return loaded_awaiter{ r }; }
+
+    private:
+        friend class resource_manager;
+
+        explicit handle(record * r) : r(r) { r->refs++; }
+
+        record *                r;
+    };
+
+    typedef handle<mesh>        mesh_handle;
+    typedef handle<texture>     texture_handle;
+    typedef handle<program>     program_handle;
+
+    resource_manager(asset_loader& assets);
+
+    // Deletes everything that's left, there mustn't be any handles by now
+    ~resource_manager();
+
+    mesh_handle                 load_mesh(const std::string& path);
+
+    // A directory of cube faces (see asset_loader::load_cubemap), or a .ktx
+    // file. KTX files are read and uploaded on the GL thread in one go.
+    texture_handle              load_cubemap(const std::string& directory);
+    texture_handle              load_texture(const std::string& path);
+
+    program_handle              load_program(const std::string& vs_path, const std::string& fs_path);
+
+    // Bytes of GPU memory, 0 for no budget (the default)
+    void                        set_budget(size_t bytes);
+    size_t                      budget() const      { return limit; }
+    size_t                      used() const        { return total; }
+
+    // Call once a frame. Resources used since the last call count as used
+    // this frame.
+    void                        update();
+
+    // Deletes everything nobody has a handle to, whatever the budget
+    void                        purge();
+
+    struct stats
+    {
+        unsigned int            resources;      // Loaded, loading or failed
+        unsigned int            loading;
+        unsigned int            unreferenced;   // Kept in case they're asked for again
+        size_t                  bytes;          // GPU memory of everything loaded
+        size_t                  budget;
+        unsigned int            path_hits;      // Loads that found their path already loaded
+        unsigned int            content_hits;   // ... that found the same files under another path
+        unsigned int            evictions;
+    };
+
+    void                        get_stats(stats& s) const;
+
+private:
+    resource_manager(const resource_manager&);
+    resource_manager& operator=(const resource_manager&);
+
+    enum
+    {
+        LOADING,
+        READY,
+        FAILED
+    };
+
+    struct record
+    {
+        resource_manager *                      owner;
+        unsigned int                            how;        // LOAD_*, see sb7resources.cpp
+        unsigned int                            state;
+        std::string                             key;
+        uint64_t                                content;    // Hash of the files, 0 until known
+        unsigned int                            refs;       // Handles, and records sharing this one
+        size_t                                  bytes;
+        unsigned long long                      last_used;  // Frame
+        record *                                shared;     // Same files, loaded under another path
+        mesh                                    mesh_data;
+        texture                                 texture_data;
+        program                                 program_data;
+        std::vector<std::coroutine_handle<> >   waiters;
+    };
+
+    static record * resolve(record * r)
+    {
+        while (r && r->shared)
+            r = r->shared;
+        return r;
+    }
+
+    record *                    find_or_load(unsigned int how, const std::vector<std::string>& paths);
+    task<void>                  load(record * r, std::vector<std::string> paths);
+    void                        share(record * r, record * target);
+    void                        finish(record * r, bool ok);
+    void                        wake(record * r);
+    void                        release(record * r);
+    void                        evict();
+    void                        destroy(record * r);
+
+    asset_loader&                                               assets;
+    std::unordered_map<std::string, std::unique_ptr<record> >   records;    // By path
+    std::unordered_map<uint64_t, record *>                      by_content;
+    size_t                                                      limit;
+    size_t                                                      total;
+    unsigned long long                                          frame;
+    stats                                                       counters;
+};
+
+}
+
+#endif /* __SB7RESOURCES_H__ */
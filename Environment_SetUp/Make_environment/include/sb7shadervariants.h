@@ -0,0 +1,167 @@
+/*
+ * Shader variants
+ *
+ * One vertex and fragment shader pair with #ifdef'd features, built into a
+ * separate program for each set of features it is drawn with:
+ *
+ *     enum { LIT = 1 << 0, TEXTURED = 1 << 1 };
+ *     static const char * const features[] = { "LIT", "TEXTURED" };
+ *
+ *     variants.init("object_vs.glsl", "object_fs.glsl", features, 2);
+ *     ...
+ *     glUseProgram(variants.get<LIT | TEXTURED>());
+ *
+ * Every feature bit that is set becomes a "#define <name> 1" straight after
+ * the #version line, so a feature that is known where the draw is written
+ * is compiled in (or out) instead of being branched on in the shader. The
+ * template get() takes the feature bits as a compile time constant.
+ *
+ * A variant is built the first time it is asked for and kept from then on;
+ * prepare() starts one early without waiting on the driver (see
+ * program::start_link). The defines are part of the source, so the program
+ * binary cache keeps every variant apart and a warm start compiles none of
+ * them.
+ *
+ * Each variant is reflected (see sb7reflection.h) once it is built, so the
+ * uniform locations of whichever variant is drawn with are at hand:
+ *
+ *     const sb7::program_reflection& info = variants.reflection<LIT>();
+ *
+ * The files can #include others (see shader::preprocess). refresh() throws
+ * every variant away if any file either shader was made from has changed,
+ * and does nothing otherwise.
+ *
+ * Built separable, each stage is compiled into a program of its own, once
+ * for each set of the features that stage mentions, and get() hands back a
+ * program pipeline made from the two:
+ *
+ *     variants.init("object_vs.glsl", "object_fs.glsl", features, 2, true);
+ *     ...
+ *     glBindProgramPipeline(variants.get<LIT | TEXTURED>());
+ *
+ * So N vertex and M fragment variants are N + M compiles and no links of
+ * the pair, rather than a link (and two compiles) for every combination.
+ * Uniforms belong to the stage that declares them, set them on that stage's
+ * program with glProgramUniform*. The vertex shader has to redeclare
+ * gl_PerVertex to be used this way.
+ */
+
+#ifndef __SB7SHADERVARIANTS_H__
+#define __SB7SHADERVARIANTS_H__
+
+#include "GL/gl3w.h"
+#include <sb7reflection.h>
+#include <shader.h>
+
+#include <string>
+#include <vector>
+
+namespace sb7
+{
+
+class shader_variants
+{
+public:
+    enum
+    {
+        MAX_FEATURES            = 8
+    };
+
+    shader_variants();
+    ~shader_variants();
+
+    // Reads both files, false if either can't be read. Feature bit i is
+    // defined as feature_names[i].
+    bool init(const char * vs_filename, const char * fs_filename,
+              const char * const * feature_names, unsigned int feature_count,
+              bool separable = false);
+
+    // Deletes every variant built so far
+    void clear();
+
+    // Reads the files again if any of them changed since they were read,
+    // and clears the variants if so. True if it did.
+    bool refresh();
+
+    // Starts building a variant, get() finishes it
+    void prepare(unsigned int features);
+
+    // True once get() won't have to wait on the driver, straight away if
+    // init() couldn't read the sources
+    bool ready(unsigned int features) const;
+
+    // The variant's program (or pipeline, if separable), built first if it
+    // has to be. 0 if it doesn't build (and stays 0).
+    GLuint get(unsigned int features)
+    {
+        features &= mask;
+        return state[features] == BUILT ? programs[features] : build(features);
+    }
+
+    template <unsigned int features>
+    GLuint get()
+    {
+        static_assert(features < (1u << MAX_FEATURES), "shader_variants: feature bit out of range");
+        return get(features);
+    }
+
+    // The variant's reflection, building it first if it has to be. Empty if
+    // it doesn't build. Separable variants have one for each stage's program.
+    const program_reflection& reflection(unsigned int features, GLenum stage = GL_VERTEX_SHADER)
+    {
+        unsigned int s = stage == GL_VERTEX_SHADER ? 0 : 1;
+
+        get(features);
+
+        return separable ? stage_reflections[s][features & stage_masks[s]] : reflections[features & mask];
+    }
+
+    template <unsigned int features>
+    const program_reflection& reflection(GLenum stage = GL_VERTEX_SHADER)
+    {
+        static_assert(features < (1u << MAX_FEATURES), "shader_variants: feature bit out of range");
+        return reflection(features, stage);
+    }
+
+    bool is_separable() const { return separable; }
+
+    // A variant's source, as it is compiled
+    std::string source(GLenum shader_type, unsigned int features) const;
+
+private:
+    shader_variants(const shader_variants&);
+    shader_variants& operator=(const shader_variants&);
+
+    enum
+    {
+        NOT_BUILT,
+        STARTED,
+        BUILT
+    };
+
+    bool read_sources();
+    GLuint build(unsigned int features);
+    void prepare_stage(unsigned int stage, unsigned int features);
+    void finish_stage(unsigned int stage, unsigned int features);
+
+    std::string                         vs_path;
+    std::string                         fs_path;
+    std::string                         vs_source;
+    std::string                         fs_source;
+    std::vector<shader::dependency>     vs_dependencies;
+    std::vector<shader::dependency>     fs_dependencies;
+    std::vector<std::string>            names;
+    unsigned int                        mask;
+    GLuint                              programs[1 << MAX_FEATURES];       // Pipelines, if separable
+    unsigned char                       state[1 << MAX_FEATURES];
+    program_reflection                  reflections[1 << MAX_FEATURES];
+    bool                                separable;
+    unsigned int                        stage_masks[2];         // The features each stage mentions
+    GLuint                              stage_programs[2][1 << MAX_FEATURES];
+    unsigned char                       stage_state[2][1 << MAX_FEATURES];
+    program_reflection                  stage_reflections[2][1 << MAX_FEATURES];
+};
+
+}
+
+#endif /* __SB7SHADERVARIANTS_H__ */
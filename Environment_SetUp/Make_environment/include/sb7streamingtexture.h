@@ -0,0 +1,81 @@
+/*
+ * Streaming texture
+ *
+ * Opens a baked KTX file (2D or cube map with its full mip chain) so it can
+ * be sampled straight away: storage for every level is allocated up front,
+ * only the small tail of the chain is uploaded on open, and
+ * GL_TEXTURE_BASE_LEVEL keeps the sampler away from levels that aren't
+ * there yet. A loader thread reads the finer levels out of the file,
+ * smallest first, and update() uploads them a slice at a time within a
+ * per-frame byte budget. When a level lands the base level drops and
+ * GL_TEXTURE_MIN_LOD is eased back down over the next few updates, so the
+ * extra detail fades in instead of popping.
+ */
+
+#ifndef __SB7STREAMINGTEXTURE_H__
+#define __SB7STREAMINGTEXTURE_H__
+
+#include <sb7ktx.h>
+#include <sb7vfs.h>
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace sb7
+{
+
+class streaming_texture
+{
+public:
+    streaming_texture();
+    ~streaming_texture();
+
+    // Uploads every level no bigger than tail_size pixels and starts
+    // streaming the rest. Returns the texture name, or 0 on failure.
+    unsigned int open(const char * filename, unsigned int tail_size = 64);
+    void close();
+
+    // Call once a frame on the thread that owns the context. Uploads at
+    // most budget bytes (always at least one slice when anything is ready)
+    // and takes what it used off budget, so several textures can share one
+    // budget. Returns true once every level is resident and faded in.
+    bool update(size_t& budget);
+
+    unsigned int    texture() const         { return tex; }
+    unsigned int    target() const          { return tex_target; }
+    unsigned int    resident_level() const  { return base_level; }
+    bool            is_resident() const     { return base_level == 0 && min_lod == 0.0f; }
+
+private:
+    streaming_texture(const streaming_texture&);
+    streaming_texture& operator=(const streaming_texture&);
+
+    static void load_levels(streaming_texture * self);
+
+    vfs::file                                   file;
+    ktx::file::header                           h;
+    unsigned int                                tex;
+    unsigned int                                tex_target;
+    unsigned int                                levels;
+    unsigned int                                faces;
+    std::vector<const unsigned char *>          images;
+    std::vector<unsigned int>                   image_sizes;
+
+    // Written by the loader, one per image; a level may be touched by the
+    // uploader once loaded_level has dropped to it
+    std::vector<std::vector<unsigned char> >    staging;
+    std::atomic<unsigned int>                   loaded_level;
+    std::atomic<bool>                           stop;
+    std::thread                                 loader;
+
+    unsigned int                                base_level;
+    float                                       min_lod;
+    unsigned int                                upload_face;
+    unsigned int                                upload_row;
+};
+
+}
+
+#endif /* __SB7STREAMINGTEXTURE_H__ */
@@ -0,0 +1,195 @@
+/*
+ * Coroutine tasks
+ *
+ * sb7::task<T> is the return type of a coroutine that produces a T. Tasks
+ * start running as soon as they are called and run until their first
+ * co_await, so calling several loaders one after the other starts them all
+ * and they overlap; co_await on a task then waits for that one result.
+ *
+ * Whoever finishes last, the task object or the coroutine, frees the frame.
+ * Dropping a task without awaiting it is fine: the coroutine carries on and
+ * cleans up after itself. A task can only be awaited once.
+ *
+ * resume_on_worker and resume_on_main move a coroutine onto a job system
+ * worker, or onto the main (GL) thread through run_main_jobs().
+ */
+
+#ifndef __SB7TASK_H__
+#define __SB7TASK_H__
+
+#include <sb7jobs.h>
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace sb7
+{
+
+template <typename T = void> class task;
+
+namespace detail
+{
+
+// Stands in for the waiting coroutine once the task has finished
+inline void * task_done_marker()
+{
+    static char marker;
+    return &marker;
+}
+
+struct task_promise_base
+{
+    task_promise_base() : waiter(nullptr), refs(2) {}
+
+    std::suspend_never initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            task_promise_base& p = h.promise();
+            void * w = p.waiter.exchange(task_done_marker());
+
+            // Once refs drops, the task object may destroy the frame at any
+            // time, so p isn't touched after this
+            if (p.refs.fetch_sub(1) == 1)
+                h.destroy();
+
+            return w ? std::coroutine_handle<>::from_address(w) : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    // Nothing in sb7 throws, and there is nobody to rethrow to
+    void unhandled_exception() { std::terminate(); }
+
+    std::atomic<void *>     waiter;     // Coroutine awaiting the result, or the done marker
+    std::atomic<int>        refs;       // Task object and running coroutine
+};
+
+template <typename T>
+struct task_result
+{
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T& result() { return *value; }
+
+    std::optional<T>        value;
+};
+
+template <>
+struct task_result<void>
+{
+    void return_void() {}
+    void result() {}
+};
+
+}
+
+template <typename T>
+class task
+{
+public:
+    struct promise_type : detail::task_promise_base, detail::task_result<T>
+    {
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    task() : h(nullptr) {}
+    task(task&& other) noexcept : h(other.h) { other.h = nullptr; }
+    ~task() { release(); }
+
+    task& operator=(task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            h = other.h;
+            other.h = nullptr;
+        }
+
+        return *this;
+    }
+
+    bool valid() const { return h != nullptr; }
+    bool done() const { return h && h.promise().waiter.load() == detail::task_done_marker(); }
+
+    struct awaiter
+    {
+        std::coroutine_handle<promise_type> h;
+
+        bool await_ready() const { return h.promise().waiter.load() == detail::task_done_marker(); }
+
+        // Loses the race if the task finishes first, and resumes straight away
+        bool await_suspend(std::coroutine_handle<> waiting)
+        {
+            void * expected = nullptr;
+
+            return h.promise().waiter.compare_exchange_strong(expected, waiting.address());
+        }
+
+        T await_resume()
+        {
+            if constexpr (std::is_void<T>::value)
+                return;
+            else
+                return std::move(h.promise().result());
+        }
+    };
+
+    awaiter operator co_await() { return awaiter{ h }; }
+
+private:
+    task(const task&);
+    task& operator=(const task&);
+
+    explicit task(std::coroutine_handle<promise_type> handle) : h(handle) {}
+
+    void release()
+    {
+        if (h && h.promise().refs.fetch_sub(1) == 1)
+            h.destroy();
+
+        h = nullptr;
+    }
+
+    std::coroutine_handle<promise_type> h;
+};
+
+// co_await resume_on_worker(jobs) carries on as a job on one of the workers
+struct resume_on_worker
+{
+    explicit resume_on_worker(job_system& jobs) : jobs(jobs) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> h) { jobs.run([h]{ h.resume(); }); }
+    void await_resume() {}
+
+    job_system&             jobs;
+};
+
+// co_await resume_on_main(jobs) carries on from the main thread's next
+// run_main_jobs()
+struct resume_on_main
+{
+    explicit resume_on_main(job_system& jobs) : jobs(jobs) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> h) { jobs.run_on_main([h]{ h.resume(); }); }
+    void await_resume() {}
+
+    job_system&             jobs;
+};
+
+}
+
+#endif /* __SB7TASK_H__ */
@@ -0,0 +1,84 @@
+/*
+ * Texture block codec
+ *
+ * CPU encoders and decoders for S3TC block compression, used to bake
+ * compressed KTX files offline (or at first run). Images are 8-bit RGBA,
+ * rows tightly packed unless a stride is given. Every 4x4 block becomes 8
+ * bytes (BC1) or 16 bytes (BC3); partial blocks at the right and bottom
+ * edges repeat their last row / column.
+ *
+ * Blocks are spread over worker threads by block row, and the palette
+ * search runs four pixels at a time with SSE2 where available.
+ */
+
+#ifndef __SB7TEXCODEC_H__
+#define __SB7TEXCODEC_H__
+
+#include <cstddef>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT     0x83F0
+#endif
+
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT    0x83F3
+#endif
+
+namespace sb7
+{
+
+namespace texcodec
+{
+
+enum format
+{
+    FORMAT_BC1,         // RGB, 4 bits per pixel (DXT1)
+    FORMAT_BC3          // RGBA, 8 bits per pixel (DXT5)
+};
+
+enum quality
+{
+    QUALITY_FAST,       // Bounding box endpoints
+    QUALITY_NORMAL,     // Principal axis endpoints, both BC3 alpha modes
+    QUALITY_HIGH        // As normal plus least squares endpoint refinement
+};
+
+// GL internal format and base format to put in a KTX header
+unsigned int gl_internal_format(format f);
+unsigned int gl_base_format(format f);
+
+size_t block_size(format f);
+size_t compressed_size(format f, unsigned int width, unsigned int height);
+
+// Compresses width x height RGBA pixels into out, which must hold
+// compressed_size() bytes. stride is in bytes (0 = width * 4). threads = 0
+// uses every hardware thread.
+void compress(format f,
+              quality q,
+              const unsigned char * rgba,
+              unsigned int width,
+              unsigned int height,
+              unsigned int stride,
+              unsigned char * out,
+              unsigned int threads = 0);
+
+// Expands compressed blocks back to width x height tightly packed RGBA
+void decompress(format f,
+                const unsigned char * blocks,
+                unsigned int width,
+                unsigned int height,
+                unsigned char * rgba);
+
+// Peak signal to noise ratio in dB over the first channels components of
+// two tightly packed RGBA images. Identical images return HUGE_VAL.
+double psnr(const unsigned char * a,
+            const unsigned char * b,
+            unsigned int width,
+            unsigned int height,
+            unsigned int channels);
+
+}
+
+}
+
+#endif /* __SB7TEXCODEC_H__ */
@@ -0,0 +1,178 @@
+/*
+ * Upload queue
+ *
+ * Moves buffer and texture uploads off the GL thread. Any thread can
+ * reserve space in a staging ring, fill it and queue a copy out of it;
+ * the GL thread only issues the copies in process() and fences each batch.
+ * Ring space is handed back once its fence has signalled, so the ring is
+ * never written while the GPU may still be reading it.
+ *
+ * The ring is a persistently, coherently mapped buffer when
+ * glBufferStorage is available. Otherwise it is plain memory and copies are
+ * issued straight from it, which still keeps the filling off the GL thread.
+ *
+ * Copies are grouped into assets. An asset is resident once every copy
+ * queued for it has been issued and completed on the GPU.
+ */
+
+#ifndef __SB7UPLOADQUEUE_H__
+#define __SB7UPLOADQUEUE_H__
+
+#include "GL/gl3w.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace sb7
+{
+
+class upload_queue
+{
+public:
+    typedef unsigned int asset;
+
+    // Called on the GL thread from process() when an asset becomes resident
+    typedef void (*resident_proc)(asset a, void * user);
+
+    // Staging space handed out by reserve()
+    struct region
+    {
+        void *          data;
+        size_t          size;
+        unsigned int    id;
+    };
+
+    upload_queue();
+    ~upload_queue();
+
+    // GL thread only. shutdown() issues everything already queued and
+    // waits for it; regions reserved and not queued yet are dropped, and
+    // copy calls or cancel() on them do nothing afterwards. Stop whatever
+    // is still writing into regions first, their memory goes with the ring.
+    bool init(size_t ring_size = 16 * 1024 * 1024);
+    void shutdown();
+
+    // Issues queued copies, fences them and retires finished batches.
+    // Call once a frame. Returns the number of assets not yet resident.
+    unsigned int process();
+
+    // Any thread. Starts an asset; finish() it once every copy is queued.
+    asset begin(resident_proc callback = NULL, void * user = NULL);
+    void finish(asset a);
+
+    bool is_resident(asset a);
+
+    // Any thread. Reserves size bytes of staging, waiting for the GL thread
+    // to free some if wait is set (so never wait on the GL thread itself).
+    // Returns false if size can't fit the ring or the queue is shut down.
+    // Every reserved region must be handed to exactly one copy call, or
+    // given back with cancel() if it won't be.
+    bool reserve(size_t size, region& r, bool wait = true);
+
+    // Any thread. Gives back a reserved region without copying out of it.
+    void cancel(const region& r);
+
+    // Any thread. Queue a copy out of a filled region. buffer_data replaces
+    // the data store of buffer like glBufferData, the others write into
+    // existing storage. For texture copies face is the target passed to
+    // glTexSubImage (a cube map face, say), type GL_NONE means format is a
+    // compressed internal format, and rows are padded to four bytes as in a
+    // KTX file.
+    void buffer_data(asset a, const region& r, GLuint buffer, GLenum usage);
+    void buffer_sub_data(asset a, const region& r, GLuint buffer, GLintptr offset);
+    void tex_sub_image(asset a, const region& r, GLuint texture, GLenum face, GLint level,
+                       GLint x, GLint y, GLint z, GLsizei width, GLsizei height, GLsizei depth,
+                       GLenum format, GLenum type);
+
+    // Staging bytes reserved and not yet handed back
+    size_t bytes_in_flight();
+
+private:
+    upload_queue(const upload_queue&);
+    upload_queue& operator=(const upload_queue&);
+
+    enum command_type
+    {
+        COMMAND_BUFFER_DATA,
+        COMMAND_BUFFER_SUB_DATA,
+        COMMAND_TEX_SUB_IMAGE
+    };
+
+    struct command
+    {
+        command_type    kind;
+        asset           owner;
+        unsigned int    id;
+        size_t          offset;
+        size_t          size;
+        GLuint          name;
+        GLenum          face;
+        GLenum          usage;
+        GLintptr        dst_offset;
+        GLint           level;
+        GLint           x, y, z;
+        GLsizei         width, height, depth;
+        GLenum          format;
+        GLenum          type;
+    };
+
+    // Ring space in reservation order
+    struct allocation
+    {
+        size_t          offset;
+        size_t          size;
+        unsigned int    batch;          // 0 until its copy has been issued
+        bool            queued;         // Its copy is waiting for process()
+        bool            cancelled;      // Given back, nothing will read it
+    };
+
+    struct batch
+    {
+        GLsync          fence;
+        unsigned int    id;
+    };
+
+    struct asset_state
+    {
+        unsigned int    copies;         // Queued but not yet issued
+        unsigned int    batch;          // Last batch any copy went out in
+        bool            finished;
+        resident_proc   callback;
+        void *          user;
+    };
+
+    bool is_outstanding(const region& r) const;
+    void queue(command& c, const region& r);
+    void issue(const command& c);
+    bool free_allocations();
+    void retire();
+
+    std::mutex                  lock;
+    std::condition_variable     space;
+    bool                        running;
+    bool                        persistent;
+
+    GLuint                      ring;
+    unsigned char *             base;
+    size_t                      capacity;
+    size_t                      head;
+
+    std::deque<allocation>      allocations;
+    unsigned int                first_allocation;
+
+    std::vector<command>        commands;
+    std::deque<batch>           batches;
+    unsigned int                next_batch;
+    unsigned int                completed_batch;
+
+    std::map<asset, asset_state> assets;
+    asset                       next_asset;
+};
+
+}
+
+#endif /* __SB7UPLOADQUEUE_H__ */
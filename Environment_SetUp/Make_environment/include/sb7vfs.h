@@ -0,0 +1,124 @@
+/*
+ * Virtual file system
+ *
+ * Every loader opens its files through here, so there is one place that
+ * decides where a file comes from and one place to measure it. Paths are
+ * looked up in the mounts, most recently mounted first:
+ *
+ *     mount(directory)         files on disk under directory
+ *     mount_archive(filename)  an sb7 archive (see sb7archive.h)
+ *     mount_memory(name, ...)  a single file already in memory
+ *
+ * Each mount can sit under a prefix, so mount("assets", "media") makes
+ * "media/Planet.obj" open "assets/Planet.obj". Nothing is mounted to start
+ * with; mount(".") gives the old behaviour of paths relative to the working
+ * directory. Absolute paths skip the mounts and go straight to the disk.
+ *
+ * Paths are normalized the same way archive names are ('\' and '/' alike,
+ * "." components dropped), so the Windows style paths the application uses
+ * work anywhere. Where a path was found is remembered until the mounts
+ * change, so opening a file again costs no search. Files that weren't found
+ * aren't remembered, since they may yet be written.
+ *
+ * Everything here is safe to call from any thread.
+ */
+
+#ifndef __SB7VFS_H__
+#define __SB7VFS_H__
+
+#include <sb7archive.h>
+#include <sb7mappedfile.h>
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+namespace sb7
+{
+
+namespace vfs
+{
+
+bool mount(const char * directory, const char * at = "");
+bool mount_archive(const char * filename, const char * at = "");
+
+// data isn't copied, it has to stay put until it is unmounted
+void mount_memory(const char * name, const void * data, size_t size, unsigned int type = ARCHIVE_RAW);
+
+// Any data handed out from archives or memory mounts is gone after this
+void unmount_all();
+
+// Where a path resolves to. Files in archives or memory come back as data
+// and size (good while mounted), files on disk as the path to open.
+struct location
+{
+    std::string             disk_path;
+    const unsigned char *   data;
+    size_t                  size;
+    unsigned int            type;       // ARCHIVE_TYPE, ARCHIVE_RAW on disk
+};
+
+bool locate(const char * path, location& where);
+
+// The path with the separators this platform wants, for the few places
+// that still have to go to the disk themselves (writing, mostly)
+std::string native_path(const char * path);
+
+// A file's whole contents, mapped from the disk or pointing straight into
+// an archive or memory mount
+class file
+{
+public:
+    file();
+    ~file();
+
+    bool open(const char * path);
+    void close();
+
+    bool                    is_open() const     { return base != NULL; }
+    const unsigned char *   data() const        { return base; }
+    size_t                  size() const        { return length; }
+    unsigned int            type() const        { return kind; }
+
+private:
+    file(const file&);
+    file& operator=(const file&);
+
+    mapped_file             mapping;
+    const unsigned char *   base;
+    size_t                  length;
+    unsigned int            kind;
+};
+
+// Lets a parser that wants a std::istream read a file in place:
+//
+//     sb7::vfs::membuf buf(f.data(), f.size());
+//     std::istream in(&buf);
+class membuf : public std::streambuf
+{
+public:
+    membuf(const unsigned char * data, size_t size)
+    {
+        char * p = (char *)data;
+        setg(p, p, p + size);
+    }
+};
+
+struct stats
+{
+    unsigned int            opens;          // file::open() calls
+    unsigned int            failed;         // ... that found nothing
+    unsigned int            cache_hits;     // Paths resolved without a search
+    unsigned int            searches;       // Paths that had to be searched for
+    unsigned long long      bytes;          // Opened, mapped or in place
+    double                  open_time;      // Seconds spent in file::open()
+};
+
+void get_stats(stats& s);
+void reset_stats();
+
+}
+
+}
+
+#endif /* __SB7VFS_H__ */
@@ -1,6 +1,11 @@
 #ifndef __SHADER_H__
 #define __SHADER_H__
 
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 namespace sb7
 {
 
@@ -23,6 +28,39 @@ GLuint from_string(const char * source,
                    bool check_errors = false);
 #endif
 
+// GLSL with #include "file" (next to the file including it) or
+// #include <file> (from the top of the vfs) expanded in place, with #line
+// directives so errors still point into the right file: source string 0 is
+// the file itself and the files it includes are numbered after it in the
+// order they are found. Each file is included at most once (as if it had
+// #pragma once) and conditionals aren't looked at. load() and the asset
+// loader expand anything that has an #include in it.
+//
+// Expansions are cached, and each one is only reused while every file it
+// was made from still hashes the same.
+struct dependency
+{
+    std::string     path;
+    uint64_t        hash;           // Of the file's contents when it was read
+    int             parent;         // The file that included it, -1 for the file itself
+};
+
+bool preprocess(const char * filename,
+                std::string& out,
+                std::vector<dependency> * dependencies = NULL);
+
+// Same, for a file that has already been read
+bool preprocess(const char * source,
+                size_t length,
+                const char * filename,
+                std::string& out,
+                std::vector<dependency> * dependencies = NULL);
+
+bool has_includes(const char * source, size_t length);
+
+// True if any of the files has changed (or gone) since they were read
+bool dependencies_changed(const std::vector<dependency>& dependencies);
+
 }
 
 namespace program
@@ -37,6 +75,95 @@ GLuint link_from_shaders(const GLuint * shaders,
                          bool check_errors = false);
 #endif
 
+// link_from_shaders in two halves, so that nothing waits on the driver while
+// it compiles and links. start_link compiles and links without looking at
+// the result (or takes the program from the binary cache). With
+// GL_KHR_parallel_shader_compile the driver does that on its own threads
+// and is_ready says when it's done; without, is_ready is always true and
+// finish_link is where the wait happens. finish_link checks the result,
+// reports errors and returns 0 on failure just like link_from_shaders.
+// Start every program before finishing any of them so the work overlaps.
+//
+// A separable program (GL_PROGRAM_SEPARABLE) is usually one stage on its
+// own, to be put together with others in a program pipeline (see
+// glUseProgramStages) instead of being linked with them.
+GLuint start_link(const GLuint * shaders,
+                  int shader_count,
+                  bool delete_shaders,
+                  bool separable = false);
+
+bool is_ready(GLuint program);
+
+GLuint finish_link(GLuint program,
+#ifdef _DEBUG
+                   bool check_errors = true);
+#else
+                   bool check_errors = false);
+#endif
+
+// Starts a whole set of programs at once and hands each one over when it's
+// first wanted:
+//
+//     sb7::program::batch programs;
+//     unsigned int sky = programs.add("sc_vs.glsl", "sc_fs.glsl");
+//     unsigned int scene = programs.add("vs.glsl", "fs.glsl");
+//     ...
+//     if (programs.ready(sky))
+//         sky_program = programs.get(sky);
+//
+// get() finishes the program (waiting if it has to) and hands it over, it is
+// the caller's to delete from then on. Programs that were never taken are
+// deleted along with the batch.
+class batch
+{
+public:
+    batch();
+    ~batch();
+
+    // 0 from get() if either file can't be read
+    unsigned int add(const char * vs_filename, const char * fs_filename);
+    unsigned int add(const GLuint * shaders, int shader_count, bool delete_shaders = true);
+
+    unsigned int    count() const               { return (unsigned int)programs.size(); }
+    bool            ready(unsigned int i) const { return taken[i] || is_ready(programs[i]); }
+    bool            ready() const;
+
+    GLuint get(unsigned int i,
+#ifdef _DEBUG
+               bool check_errors = true);
+#else
+               bool check_errors = false);
+#endif
+
+private:
+    batch(const batch&);
+    batch& operator=(const batch&);
+
+    std::vector<GLuint>     programs;
+    std::vector<bool>       taken;
+};
+
+// Keeps linked programs on disk as driver binaries, so the next run can skip
+// compiling them. While a cache directory is set, shader::load and
+// shader::from_string only hand their source to GL and link_from_shaders
+// (start_link, really) looks for a binary under a hash of the sources and
+// the driver's vendor, renderer and version. The shaders are only compiled
+// when there isn't one or the driver turns it down, so compile errors are
+// reported from there. Needs a current context; does nothing if the driver
+// has no binary formats. NULL turns the cache off again.
+void set_binary_cache(const char * directory);
+
+struct binary_cache_stats
+{
+    unsigned int    hits;           // Programs loaded from a binary
+    unsigned int    misses;         // ... that had no binary yet
+    unsigned int    rejected;       // ... whose binary the driver wouldn't take
+    unsigned int    stored;         // Binaries written
+    unsigned int    compiles;       // Shaders compiled, cache or not
+};
+
+void get_binary_cache_stats(binary_cache_stats& s);
+
 }
 
 }
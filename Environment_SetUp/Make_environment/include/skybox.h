@@ -11,6 +11,9 @@
 #include <vector>
 #include <string>
 #include <vmath.h>
+#include <sb7texcodec.h>
+#include <sb7mipmap.h>
+#include <sb7streamingtexture.h>
 
 //fill soon to be vertex list to represent a cube
 //centered on (0,0,0)
@@ -37,5 +40,25 @@ void loadCubeTextures(std::string directory, GLuint texture_ID);
 //helps load textures and specific texture mapping
 void loadCubeSide(GLint texture_ID, GLenum side, std::string file);
 
+//read a bitmap side into RGBA pixels (delete[] them when done), NULL if it couldn't be read
+unsigned char * readCubeSide(std::string file, unsigned int &width, unsigned int &height);
+
+//same as above, but the bitmap file is already in memory (size bytes at data), NULL if it isn't a whole bitmap
+unsigned char * decodeCubeSide(const unsigned char *data, size_t size, unsigned int &width, unsigned int &height);
+
+//Compress the six sides in directory into a single cube map KTX file, with a full mip chain
+//mipFilter -> filter used to make the smaller levels
+//psnr -> average quality of the compressed faces in dB
+bool bakeCubeTextures(std::string directory, std::string ktxFile, sb7::texcodec::format format, sb7::texcodec::quality quality,
+                      sb7::mipmap::filter mipFilter, double &psnr);
+
+//Load a baked cube map KTX file, replaces texture_ID with the loaded texture
+bool loadBakedCubeTextures(std::string ktxFile, GLuint &texture_ID);
+
+//Start streaming a baked cube map KTX file, only the small mips are there right away
+//stream owns the texture from then on, texture_ID is replaced with it
+//Call stream.update() every frame to bring in the rest
+bool streamBakedCubeTextures(std::string ktxFile, sb7::streaming_texture &stream, GLuint &texture_ID);
+
 //convert char to unsigned int
 unsigned int charToUInt(char * loc);
\ No newline at end of file
@@ -0,0 +1,4 @@
+// Shared by every vertex shader that goes through the camera
+
+uniform mat4 perspective; //Perspective transform
+uniform mat4 toCamera; //world to Camera transform
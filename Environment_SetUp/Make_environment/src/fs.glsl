@@ -1,10 +1,24 @@
 #version 450 core                                                 
 
 in vec4 vs_color;                                                                  
+#ifdef LIT
+in vec3 vs_world;
+#endif
+#ifndef DEPTH_ONLY
 out vec4 color;                                                   
+#endif
                                                                   
 void main(void)                                                   
 {                     
+#if defined(DEPTH_ONLY)
+    //Nothing to shade, only the depth gets written (for a depth pre-pass)
+#elif defined(LIT)
+    //Flat shading, the face normal comes from how the world position changes across the triangle
+    vec3 normal = normalize(cross(dFdx(vs_world), dFdy(vs_world)));
+    float diffuse = max(dot(normal, normalize(vec3(0.4, 1.0, 0.6))), 0.0);
+    color = vec4(vs_color.rgb * (0.3 + 0.7 * diffuse) * 2.0, 1.0);
+#else
     color = vec4(vec3(gl_FragCoord.z), 1.0); //This will shade things based on the z 'depth'
     //color = vs_color;                             
+#endif
 }                                                                 
\ No newline at end of file
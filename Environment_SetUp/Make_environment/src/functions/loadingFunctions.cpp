@@ -1,5 +1,7 @@
 
 #include <loadingFunctions.h>
+#include <sb7vfs.h>
+#include <algorithm>
 //Object Loading Information
 //Referenced from https://en.wikibooks.org/wiki/OpenGL_Programming/Modern_OpenGL_Tutorial_Load_OBJ
 // and http://www.opengl-tutorial.org/beginners-tutorials/tutorial-7-model-loading/ 
@@ -17,16 +19,69 @@
 // number - Total number of points in vertices (should be vertices.length())
 void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number)
 {
-    //File to load in
-    std::ifstream in(filename, std::ios::in);
+    //Same load, group info just gets thrown away
+    std::vector<SB6M_SUB_OBJECT_DECL> groups;
+    std::vector<std::string> groupNames;
+    std::vector<SB6M_CLUSTER_DECL> groupBounds;
+    load_obj(filename, vertices, uvs, normals, number, groups, groupNames, groupBounds);
+}
+
+// Same as above, but also keeps track of 'o <name>' and 'g <name>' lines
+// groups - draw range of each group (first vertex, vertex count), just like sb7::object's sub-objects
+// groupNames - name from the o/g line that started each group ("default" for faces before any o/g line)
+// groupBounds - bounding sphere and normal cone of each group (object space) for culling / LOD picking
+// Every group is one contiguous run in the output, even if its name shows up more than once in the file
+void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number,
+              std::vector<SB6M_SUB_OBJECT_DECL> &groups, std::vector<std::string> &groupNames, std::vector<SB6M_CLUSTER_DECL> &groupBounds)
+{
+    //File to load in, from wherever the vfs finds it (a mounted directory, archive, ...)
+    sb7::vfs::file file;
 
     //Check to make sure file opened
-    if (!in) {
+    if (!file.open(filename)) {
         char buf[50];
         sprintf(buf, "OBJ file not found!");
         MessageBoxA(NULL, buf, "Error in loading obj file", MB_OK);
     }
 
+    //Packed by sb7pack the triangles are already there (already clustered too, the groups still hold)
+    sb7::packed_mesh packed;
+    if (file.type() == sb7::ARCHIVE_MESH && sb7::parse_packed_mesh(file.data(), file.size(), packed)) {
+        const vmath::vec4 *packedVerts = (const vmath::vec4 *)packed.positions;
+        const vmath::vec2 *packedUVs = (const vmath::vec2 *)packed.uvs;
+        const vmath::vec4 *packedNorms = (const vmath::vec4 *)packed.normals;
+
+        vertices.assign(packedVerts, packedVerts + packed.vertex_count);
+        if (packedUVs) {
+            uvs.assign(packedUVs, packedUVs + packed.vertex_count);
+        } else {
+            uvs.assign(packed.vertex_count, vmath::vec2(0.0f, 0.0f)); //Packed without them, keep the lists lined up
+        }
+        if (packedNorms) {
+            normals.assign(packedNorms, packedNorms + packed.vertex_count);
+        } else {
+            normals.assign(packed.vertex_count, vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+        }
+        number = packed.vertex_count / 3;
+
+        groups.swap(packed.groups);
+        groupNames.swap(packed.group_names);
+        groupBounds.swap(packed.group_bounds);
+        return;
+    }
+
+    //Otherwise it is obj text, parsed right where it is mapped
+    sb7::vfs::membuf buf(file.data(), file.size());
+    std::istream in(&buf);
+
+    parse_obj(in, vertices, uvs, normals, number, groups, groupNames, groupBounds);
+}
+
+// Same as above, but the obj text comes from a stream that is already open
+// (an std::istringstream over a file that was read in somewhere else, say)
+void parse_obj(std::istream &in, std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals, GLuint &number,
+               std::vector<SB6M_SUB_OBJECT_DECL> &groups, std::vector<std::string> &groupNames, std::vector<SB6M_CLUSTER_DECL> &groupBounds)
+{
     //Temp vectors to hold data
     //These will need to be indexed into the output vectors based on face info
     std::vector<vmath::vec4> tempVert; // from vertices lines 'v <x> <y> <z>'
@@ -34,6 +89,11 @@ void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vec
     std::vector<GLuint> tempFace; // from face line 'f <v1>/<t1>/<n1> <v2>/<t2>/<n2> <v3>/<t3>/<n3>', should be indexes
     std::vector<vmath::vec2> tempUVs; // from texture line 'vt <x> <y>'
     std::vector<vmath::vec4> tempNorm; // from a normal line 'vn <x> <y> <z>' //Should this be a vec3 or vec4?
+    std::vector<GLuint> tempFaceGroup; // group each face belongs to, one entry per face
+
+    groupNames.clear();
+    GLuint curGroup = 0;          // group new faces go into
+    bool haveGroup = false;       // no o/g line seen yet
 
     std::string line;       // Complete line pulled from file    
     std::string sub = "";   // Substring working space
@@ -57,8 +117,33 @@ void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vec
             //Push vec4 onto verticies vector
             tempVert.push_back(tVec);
             
+        } else if (line.substr(0,2) == "o " || line.substr(0,2) == "g ") {
+            //Process object / group line, every face after this belongs to it
+            sub = line.substr(2);
+            if (!sub.empty() && sub[sub.size()-1] == '\r') {
+                sub.erase(sub.size()-1); //Windows line endings
+            }
+
+            //Reuse the group if the name was seen before so it stays one range
+            curGroup = 0;
+            while (curGroup < groupNames.size() && groupNames[curGroup] != sub) {
+                curGroup++;
+            }
+            if (curGroup == groupNames.size()) {
+                groupNames.push_back(sub);
+            }
+            haveGroup = true;
+
         } else if (line.substr(0,2) == "f ") {
             //Process face line 
+            if (!haveGroup) {
+                //Faces before any o/g line
+                groupNames.push_back("default");
+                curGroup = groupNames.size() - 1;
+                haveGroup = true;
+            }
+            tempFaceGroup.push_back(curGroup);
+
             // Faces line f 14/25/9 60/19/9 56/97/9 : f <vertex1>/<texture1>/<normal1> <vertex2>/<texture2>/<normal2> <vertex3>/<texture3>/<normal3>
             sub = line.substr(2); //Current sub string of line
             //Expect 3 number sets, loop three times
@@ -112,8 +197,25 @@ void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vec
     vertices.clear();
     uvs.clear();
     normals.clear();
+    groups.clear();
+    groupBounds.clear();
     number = 0;
 
+    //Sort faces by group (keeping file order inside a group) so each group is one run
+    // groupStart[g] is where group g's faces begin, faceOrder lists face numbers in output order
+    std::vector<GLuint> groupStart(groupNames.size() + 1, 0);
+    for (GLuint f = 0; f < tempFaceGroup.size(); f++) {
+        groupStart[tempFaceGroup[f] + 1]++;
+    }
+    for (GLuint g = 0; g < groupNames.size(); g++) {
+        groupStart[g + 1] += groupStart[g];
+    }
+    std::vector<GLuint> faceOrder(tempFaceGroup.size());
+    std::vector<GLuint> groupFill(groupStart.begin(), groupStart.end() - 1);
+    for (GLuint f = 0; f < tempFaceGroup.size(); f++) {
+        faceOrder[groupFill[tempFaceGroup[f]]++] = f;
+    }
+
     //At this point out temp vectors are full of data
     // tempVert, tempUVs and tempNorm are indexed (starting at 0) in file order
     // tempFace correlates everything together in sets of 9 values (three triplets)
@@ -122,7 +224,8 @@ void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vec
     //                   0    1    2    3    4    5    6    7    8
     // Faces striping: <v1>/<t1>/<n1> <v2>/<t2>/<n2> <v3>/<t3>/<n3>
     //Because the data in tempFace is striped buy sets of three triplets, step forward by 9 each time
-    for(int i = 0; i < tempFace.size(); i += 9 ){
+    for(int f = 0; f < faceOrder.size(); f++ ){
+        int i = faceOrder[f] * 9; //Start of this face in tempFace
         //Pull data into vertices
         //                                   VVV Index offset pattern
         //                          VVV Holds vertex index to pull from tempVery (offset from starting at 1 to 0)    
@@ -143,7 +246,90 @@ void load_obj(const char* filename, std::vector<vmath::vec4> &vertices, std::vec
 
         number++; //Sanity Check to make sure things line up
     }
-    
+
+    //Every group is now a contiguous run of 3 vertices per face
+    std::vector<GLuint> indices(vertices.size());
+    for (GLuint i = 0; i < indices.size(); i++) {
+        indices[i] = i;
+    }
+    std::vector<std::string> usedNames;
+    for (GLuint g = 0; g < groupNames.size(); g++) {
+        SB6M_SUB_OBJECT_DECL range;
+        range.first = groupStart[g] * 3;
+        range.count = (groupStart[g + 1] - groupStart[g]) * 3;
+        if (range.count == 0) {
+            continue; //o line straight followed by a g line, nothing to draw
+        }
+        groups.push_back(range);
+        usedNames.push_back(groupNames[g]);
+
+        //Bounds of just this group's triangles
+        groupBounds.push_back(sb7::cluster::compute_bounds(&vertices[0][0], sizeof(vertices[0]), indices.data() + range.first, range.count));
+    }
+    groupNames.swap(usedNames);
+}
+
+// Cluster an already loaded obj for culling
+// load_obj hands back a triangle soup, so the 'index' of every vertex is just its position in the list
+// sb7::cluster hands back a new triangle order, which gets applied to all three lists
+// so each cluster ends up as a contiguous run that glDrawArrays / glMultiDrawArrays can use directly
+void cluster_obj(std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals,
+                 std::vector<SB6M_SUB_OBJECT_DECL> &clusters, std::vector<SB6M_CLUSTER_DECL> &bounds)
+{
+    //Whole object is one big group
+    std::vector<SB6M_SUB_OBJECT_DECL> groups(1);
+    groups[0].first = 0;
+    groups[0].count = vertices.size();
+    cluster_obj(vertices, uvs, normals, groups, clusters, bounds);
+}
+
+// Same thing, but clusters never cross a group boundary
+// Triangles only move around inside their own group, so the group ranges from load_obj stay valid
+void cluster_obj(std::vector<vmath::vec4> &vertices, std::vector<vmath::vec2> &uvs, std::vector<vmath::vec4> &normals,
+                 const std::vector<SB6M_SUB_OBJECT_DECL> &groups,
+                 std::vector<SB6M_SUB_OBJECT_DECL> &clusters, std::vector<SB6M_CLUSTER_DECL> &bounds)
+{
+    clusters.clear();
+    bounds.clear();
+    if(vertices.empty()){
+        return; //Nothing loaded, nothing to cluster
+    }
+
+    //Identity index list for the triangle soup
+    std::vector<GLuint> indices(vertices.size());
+    for(GLuint i = 0; i < indices.size(); i++){
+        indices[i] = i;
+    }
+
+    std::vector<GLuint> order(indices); //Reordered index list, untouched outside of groups
+    std::vector<GLuint> groupOrder; //Reordered index list of one group
+    std::vector<SB6M_SUB_OBJECT_DECL> groupClusters;
+    std::vector<SB6M_CLUSTER_DECL> groupBounds;
+    for(GLuint g = 0; g < groups.size(); g++){
+        sb7::cluster::build(&vertices[0][0], sizeof(vertices[0]), indices.data() + groups[g].first, groups[g].count, groupOrder, groupClusters, groupBounds);
+
+        //build counts from the start of what it was handed, move the ranges back to the whole list
+        std::copy(groupOrder.begin(), groupOrder.end(), order.begin() + groups[g].first);
+        for(GLuint c = 0; c < groupClusters.size(); c++){
+            groupClusters[c].first += groups[g].first;
+            clusters.push_back(groupClusters[c]);
+            bounds.push_back(groupBounds[c]);
+        }
+    }
+
+    //Shuffle every attribute into cluster order
+    std::vector<vmath::vec4> tVert(order.size());
+    std::vector<vmath::vec2> tUVs(order.size());
+    std::vector<vmath::vec4> tNorm(order.size());
+    for(GLuint i = 0; i < order.size(); i++){
+        tVert[i] = vertices[order[i]];
+        tUVs[i] = uvs[order[i]];
+        tNorm[i] = normals[order[i]];
+    }
+
+    vertices.swap(tVert);
+    uvs.swap(tUVs);
+    normals.swap(tNorm);
 }
 
 //File parsing helper
@@ -9,6 +9,9 @@
 *                     https://antongerdelan.net/opengl/cubemaps.html                 
 */
 #include <skybox.h>
+#include <sb7ktx.h>
+#include <sb7vfs.h>
+#include <cstring>
 #include <fstream>
 
 void createCube(std::vector<vmath::vec4> &vertices){
@@ -59,14 +62,45 @@ void loadCubeTextures(std::string directory, GLuint texture_ID){
     glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );   
 }
 
-void loadCubeSide(GLint texture_ID, GLenum side, std::string file){
-    //If you are curious why so many unsigned chars: https://stackoverflow.com/questions/75191/what-is-an-unsigned-char
-    // Bind the next call to this CUBE_MAP
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
+unsigned char * readCubeSide(std::string file, unsigned int &width, unsigned int &height){
+    //Mapped (or found in a packed archive) by the vfs, nothing gets read into a copy first
+    sb7::vfs::file tFile;
 
+    //Attempt to open the file
+    if(!tFile.open(file.c_str())){
+        //Check to see if file is open
+        char buf[50];
+        sprintf(buf, "One of the texture files was found!");
+        MessageBoxA(NULL, buf, "Error in loading texture file", MB_OK);
+        return NULL;
+    }  
+
+    //sb7pack already turned the bitmap into RGBA pixels, they just need copying out
+    if(tFile.type() == sb7::ARCHIVE_TEXTURE){
+        sb7::ktx::file::header h;
+        std::vector<const unsigned char *> images;
+        std::vector<unsigned int> imageSizes;
+        unsigned int target;
+
+        if(!sb7::ktx::file::parse(tFile.data(), tFile.size(), h, target, images, imageSizes) || target != GL_TEXTURE_2D ||
+           h.gltype != GL_UNSIGNED_BYTE || h.glformat != GL_RGBA || imageSizes[0] < h.pixelwidth * h.pixelheight * 4){
+            return NULL;
+        }
+
+        width = h.pixelwidth;
+        height = h.pixelheight;
+        unsigned char *pixels = new unsigned char[width * height * 4];
+        memcpy(pixels, images[0], width * height * 4);
+        return pixels;
+    }
+
+    //Otherwise it is the bitmap itself, decodeCubeSide does the rest
+    return decodeCubeSide(tFile.data(), tFile.size(), width, height);
+}
+
+unsigned char * decodeCubeSide(const unsigned char *data, size_t size, unsigned int &width, unsigned int &height){
+    //If you are curious why so many unsigned chars: https://stackoverflow.com/questions/75191/what-is-an-unsigned-char
     //Set up some function variables
-    //Input file stream
-    std::ifstream tFile;
     //Memory location of where we will put the texture data
     unsigned char *texture_data; 
     unsigned int tDataSize = 0;
@@ -80,65 +114,182 @@ void loadCubeSide(GLint texture_ID, GLenum side, std::string file){
     char bmpFileHeader[14]; // We need this to grab the last four bytes (data offset)
     char bmpDIBHeader[12]; //We only need to grab the first few lines of this
     unsigned int tStartOfData; //Location of start of pixel data (likely 54 bytes)
-    unsigned int tHeight; //Size of the texture data
-    unsigned int tWidth;  //Size of the texture data 
     // Based on how the file format works this is going to need to be a power of two (likely) or there will be padding involved
 
-    //Attempt to open the file
-    tFile.open(file,std::ifstream::in | std::ifstream::binary);
-    if(!tFile){
-        //Check to see if file is open
-        char buf[50];
-        sprintf(buf, "One of the texture files was found!");
-        MessageBoxA(NULL, buf, "Error in loading texture file", MB_OK);
-        return;
-    }  
+    //Too short to even hold the headers
+    if(size < 26){
+        return NULL;
+    }
 
-    //Read in the BitMap file header, this will be used to isolate the data offset (where the pixels start)
-    tFile.read(bmpFileHeader,14); //Read in 14 bytes
-    
-    //Seek forward 14 bytes from the beginning (should already be there, just to be safe)
-    tFile.seekg(14,std::ios_base::beg); 
+    //Copy out the BitMap file header, this will be used to isolate the data offset (where the pixels start)
+    memcpy(bmpFileHeader, data, 14); //First 14 bytes
 
-    //Read just enough from the infoHeader to get the width and height info
-    tFile.read(bmpDIBHeader, 12); 
+    //Just enough from the infoHeader (starts 14 bytes in) to get the width and height info
+    memcpy(bmpDIBHeader, data + 14, 12);
 
     //Extract relevant info from headers
-    tWidth = charToUInt(&bmpDIBHeader[4]);//second thing (4 bytes in)
-    tHeight = charToUInt(&bmpDIBHeader[8]);//third thing (4 more bytes in)    
+    width = charToUInt(&bmpDIBHeader[4]);//second thing (4 bytes in)
+    height = charToUInt(&bmpDIBHeader[8]);//third thing (4 more bytes in)    
     tStartOfData = charToUInt(&bmpFileHeader[10]); //0xA offset from start (10 bytes in)
 
+    //Make sure all the pixels are actually there (3 bytes a pixel in the file)
+    if(tStartOfData > size || (size - tStartOfData) / 3 < (unsigned long long)width * height){
+        return NULL;
+    }
+
     //Calculate the needed OUTPUT size of the data (width x height x 4) 4 because rgb+alpha
-    tDataSize = tWidth * tHeight * 4;
+    tDataSize = width * height * 4;
     //allocate memory for data
     texture_data = new unsigned char [tDataSize];
 
-    //Zero out array, just in case
-    for(int i = 0; i < tDataSize; i++){
-        texture_data[i] = 0;
-    }
-
-    //Move file pointer to the correct location based on header size
-    tFile.seekg(tStartOfData,std::ios_base::beg);
+    //Pixels start here based on header size
+    const unsigned char *colors = data + tStartOfData;
  
     // At this point we can read every pixel of the image
     int i = 0;
     int j = 0; //Index variables
-    char colors[3]; //Temp hold location for color data
-    for (; i < tWidth * tHeight; i++) { //Loop over all 'pixels'            
-            // We load an RGB value from the file
-            tFile.read(colors,3);
-
+    for (; i < width * height; i++) { //Loop over all 'pixels'            
             // And store it
             texture_data[j+0] = colors[2]; //Red component
             texture_data[j+1] = colors[1]; //Green componet
             texture_data[j+2] = colors[0]; //Blue component
             texture_data[j+3] = 255; //Add alpha element
             j += 4; // Go to the next position
+            colors += 3; // Next RGB value in the file
+    }
+
+    return texture_data;
+}
+
+// Compress the six sides into one KTX cube map so later runs can skip the bitmaps
+// KTX wants the faces in +X, -X, +Y, -Y, +Z, -Z order, matched up with the sides loadCubeTextures uses
+// Every face gets a full mip chain made here, so nothing has to generate mips at startup
+// psnr - average quality of the compressed faces against the bitmaps, in dB (higher is better, ~40 is hard to tell apart)
+bool bakeCubeTextures(std::string directory, std::string ktxFile, sb7::texcodec::format format, sb7::texcodec::quality quality,
+                      sb7::mipmap::filter mipFilter, double &psnr){
+    const char * sides[6] = { "sc_right.bmp", "sc_left.bmp", "sc_down.bmp", "sc_up.bmp", "sc_front.bmp", "sc_back.bmp" };
+
+    unsigned char * pixels[6] = { NULL, NULL, NULL, NULL, NULL, NULL }; //Level 0 of each face
+    unsigned int width = 0;
+    unsigned int height = 0;
+    bool ok = true;
+    psnr = 0.0;
+
+    for(int i = 0; i < 6 && ok; i++){
+        unsigned int tWidth, tHeight;
+        pixels[i] = readCubeSide(directory+".\\"+sides[i], tWidth, tHeight);
+        //Cube faces all have to be there and be the same size
+        ok = pixels[i] != NULL && (i == 0 || (tWidth == width && tHeight == height));
+        width = tWidth;
+        height = tHeight;
     }
 
-    // Closes the file stream
-    tFile.close();
+    if(!ok){
+        for(int i = 0; i < 6; i++){
+            delete[] pixels[i];
+        }
+        return false;
+    }
+
+    //Filter all the faces down at once (in linear light, the bitmaps are sRGB)
+    std::vector<std::vector<unsigned char> > chains[6];
+    sb7::mipmap::generate(mipFilter, pixels, 6, width, height, chains);
+    for(int i = 0; i < 6; i++){
+        delete[] pixels[i];
+    }
+
+    unsigned int levels = sb7::mipmap::level_count(width, height);
+    std::vector<std::vector<unsigned char> > blocks(levels * 6); //Compressed images, level by level, 6 faces each
+    std::vector<const void *> images(levels * 6);                 //Image pointers handed to the ktx writer
+    std::vector<unsigned int> imageSizes(levels * 6);
+
+    for(unsigned int level = 0; level < levels; level++){
+        unsigned int lWidth, lHeight;
+        sb7::mipmap::level_size(level, width, height, lWidth, lHeight);
+
+        for(int i = 0; i < 6; i++){
+            std::vector<unsigned char> &b = blocks[level * 6 + i];
+
+            //Compress, then decompress again to see how close it got
+            b.resize(sb7::texcodec::compressed_size(format, lWidth, lHeight));
+            sb7::texcodec::compress(format, quality, chains[i][level].data(), lWidth, lHeight, 0, b.data());
+
+            if(level == 0){
+                //Quality is reported for the full size faces only
+                std::vector<unsigned char> check(lWidth * lHeight * 4);
+                sb7::texcodec::decompress(format, b.data(), lWidth, lHeight, check.data());
+                psnr += sb7::texcodec::psnr(chains[i][0].data(), check.data(), lWidth, lHeight, format == sb7::texcodec::FORMAT_BC1 ? 3 : 4) / 6.0;
+            }
+
+            images[level * 6 + i] = b.data();
+            imageSizes[level * 6 + i] = b.size();
+        }
+    }
+
+    //Compressed textures have no type or format, only an internal format
+    sb7::ktx::file::header h;
+    memset(&h, 0, sizeof(h));
+    h.gltypesize = 1;
+    h.glinternalformat = sb7::texcodec::gl_internal_format(format);
+    h.glbaseinternalformat = sb7::texcodec::gl_base_format(format);
+    h.pixelwidth = width;
+    h.pixelheight = height;
+    h.faces = 6;
+    h.miplevels = levels;
+
+    return sb7::ktx::file::write(sb7::vfs::native_path(ktxFile.c_str()).c_str(), h, images.data(), imageSizes.data()); //Written to the disk, not through the vfs
+}
+
+// Load a baked cube map, texture_ID is replaced with the new texture if it worked
+bool loadBakedCubeTextures(std::string ktxFile, GLuint &texture_ID){
+    GLuint tex = sb7::ktx::file::load(ktxFile.c_str());
+    if(tex == 0){
+        return false; //Not baked yet (or broken), caller falls back to the bitmaps
+    }
+
+    glDeleteTextures(1, &texture_ID);
+    texture_ID = tex;
+
+    // Same parameters loadCubeTextures sets up, except the baked file has mips to use
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    return true;
+}
+
+// Stream a baked cube map, the first frames draw with the blurry small mips while the big ones come in
+bool streamBakedCubeTextures(std::string ktxFile, sb7::streaming_texture &stream, GLuint &texture_ID){
+    if(stream.open(ktxFile.c_str()) == 0){
+        return false; //Not baked yet (or broken), caller falls back
+    }
+
+    glDeleteTextures(1, &texture_ID);
+    texture_ID = stream.texture();
+
+    // Same parameters as loadBakedCubeTextures, the stream looks after the base level and LOD itself
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    return true;
+}
+
+void loadCubeSide(GLint texture_ID, GLenum side, std::string file){
+    // Bind the next call to this CUBE_MAP
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
+
+    //Read the bitmap into RGBA pixels
+    unsigned int tWidth;  //Size of the texture data
+    unsigned int tHeight; //Size of the texture data
+    unsigned char *texture_data = readCubeSide(file, tWidth, tHeight);
+    if(!texture_data){
+        return; //Already complained about it
+    }
 
     // Load the image data into a buffer to send to the GPU
 	glTexImage2D( side, // Which side are you loading in (should be an enum)
@@ -14,6 +14,11 @@
 
 #include <loadingFunctions.h>
 #include <skybox.h>
+#include <sb7assetpipeline.h>
+#include <sb7assetloader.h>
+#include <sb7resources.h>
+#include <sb7shadervariants.h>
+#include <sb7reflection.h>
 
 //Needed for file loading (also vector)
 #include <string>
@@ -24,6 +29,10 @@
 #include <cassert>
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
+//Features the object shader can be built with (see vs.glsl and fs.glsl), every set of them is its own program
+enum object_feature { OBJECT_DEPTH_ONLY = 1 << 0, OBJECT_LIT = 1 << 1 };
+static const char * const object_features[] = { "DEPTH_ONLY", "LIT" };
+
 class test_app : public sb7::application{
 
     public:
@@ -52,73 +61,27 @@ class test_app : public sb7::application{
 
         //Also notice this could be automated / streamlined with a list of objects to load
 
-        //Load two objects
-        load_obj(".\\bin\\media\\PizzaPlate.obj", objects[0].verticies, objects[0].uv, objects[0].normals, objects[0].vertNum);
-        load_obj(".\\bin\\media\\SteveBlank.obj", objects[1].verticies, objects[1].uv, objects[1].normals, objects[1].vertNum);
-        load_obj(".\\bin\\media\\Planet.obj", objects[2].verticies, objects[2].uv, objects[2].normals, objects[2].vertNum);
-
-        ////////////////////////////////
-        //Set up Object Scene Shaders //
-        ////////////////////////////////
-        GLuint shaders[2];
-
-        //Load scene rendering based shaders
-        //These need to be co-located with main.cpp in src
-        shaders[0] = sb7::shader::load(".\\src\\vs.glsl", GL_VERTEX_SHADER);
-        compiler_error_check(shaders[0]);
-        shaders[1] = sb7::shader::load(".\\src\\fs.glsl", GL_FRAGMENT_SHADER);
-        compiler_error_check(shaders[1]);
-        //Put together scene rendering program from the two loaded shaders
-        rendering_program = sb7::program::link_from_shaders(shaders, 2, true);
-        GL_CHECK_ERRORS
-
-        /////////////////////////////////
-        // Transfer Object Into OpenGL //
-        /////////////////////////////////
+        //Everything loads through the asset pipeline: one thread reads the files, the decode threads
+        //parse them and this thread uploads them from render (see the top of render), all three at the same time
+        //loadScene and loadSkycube are coroutines, they start their loads and come back here at their first co_await
+        //Render skips an object until it is uploaded, and the skycube until it is ready
+        //Every file is looked up through the vfs: the working directory, and over it the packed media file if there is one
+        //(sb7pack bin\media.sb7a bin\media plus the src\*.glsl shaders), then everything comes out of that one mapping instead
+        sb7::vfs::mount(".");
+        sb7::vfs::mount_archive(".\\bin\\media.sb7a");
+        //Meshes, textures and programs go through the resource manager, so nothing is loaded twice
+        //Anything nobody holds on to any more is kept until the scene needs more GPU memory than this
+        resources.set_budget(256 * 1024 * 1024);
+        //Linked programs are kept in bin\shadercache, after the first run no shader gets compiled at startup
+        sb7::program::set_binary_cache(".\\bin\\shadercache");
+        pipeline.start();
+        loadScene();
+        loadSkycube();
 
         //Set up vao
-        glUseProgram(rendering_program); //TODO:: This might not be necessary (because of the above link_from_shaders)
         glCreateVertexArrays(1,&vertex_array_object);
         glBindVertexArray(vertex_array_object);
 
-        for(int i = 0; i < objects.size(); i++){
-            //For each object in objects, set up openGL buffers
-            glGenBuffers(1,&objects[i].vertices_buffer_ID); //Create the buffer id for this object
-            glBindBuffer( GL_ARRAY_BUFFER, objects[i].vertices_buffer_ID);
-            glBufferData( GL_ARRAY_BUFFER,
-                objects[i].verticies.size() * sizeof(objects[i].verticies[0]), //Size of element * number of elements
-                objects[i].verticies.data(),                                   //Actual data
-                GL_STATIC_DRAW);                                               //Set to static draw (read only)  
-           
-            //If we needed to load the UVs or Normals, this would be where.
-        }
-        
-        GL_CHECK_ERRORS
-        ////////////////////////////////////
-        // Grab IDs for rendering program //
-        ////////////////////////////////////
-        transform_ID = glGetUniformLocation(rendering_program,"transform");
-        perspec_ID = glGetUniformLocation(rendering_program,"perspective");
-        toCam_ID = glGetUniformLocation(rendering_program,"toCamera");
-        vertex_ID = glGetAttribLocation(rendering_program,"obj_vertex");
-
-        ///////////////////////////
-        //Set up Skycube shaders //
-        ///////////////////////////
-        // Placeholders for loaded shaders
-        GLuint sc_shaders[2];
-
-        //Load Skycube based shaders
-        //These need to be co-located with main.cpp in src
-        sc_shaders[0] = sb7::shader::load(".\\src\\sc_vs.glsl", GL_VERTEX_SHADER);
-        compiler_error_check(sc_shaders[0]);
-        sc_shaders[1] = sb7::shader::load(".\\src\\sc_fs.glsl", GL_FRAGMENT_SHADER);
-        compiler_error_check(sc_shaders[1]);
-
-        //Put together Sky cube program from the two loaded shaders
-        sc_program = sb7::program::link_from_shaders(sc_shaders, 2, true);
-        GL_CHECK_ERRORS
-
         /////////////////////
         //Load Skycube info//
         /////////////////////
@@ -140,18 +103,6 @@ class test_app : public sb7::application{
         glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 0, NULL); //Linking the buffer filled above to a vertex attribute
         GL_CHECK_ERRORS
 
-        //Set up texture information
-        glActiveTexture(GL_TEXTURE0);     //Set following data to GL_TEXTURE0
-        glGenTextures(1,&sc_map_texture); //Grab texture ID
-        //Call a file loading function to load in textures for skybox
-        loadCubeTextures(".\\bin\\media\\Skycube\\",sc_map_texture);
-        GL_CHECK_ERRORS
-
-        //Get uniform handles for perspective and camera matrices
-        sc_Perspective = glGetUniformLocation(sc_program,"perspective");
-        sc_Camera= glGetUniformLocation(sc_program,"toCamera");
-        GL_CHECK_ERRORS
-
         /////////////////////
         // Camera Creation //
         /////////////////////
@@ -166,12 +117,6 @@ class test_app : public sb7::application{
         calcProjection(camera); //Calculate the projection matrix used by this camera
         calcView(camera); //Calculate the View matrix for camera
 
-        //Link locations to Uniforms
-        glUseProgram(sc_program);
-        glUniformMatrix4fv(sc_Perspective,1,GL_FALSE,camera.proj_Matrix);
-        glUniformMatrix4fv(sc_Camera,1,GL_FALSE,camera.view_mat_no_translation);
-        GL_CHECK_ERRORS
-
         // General openGL settings
         //src:: https://github.com/capnramses/antons_opengl_tutorials_book/tree/master/21_cube_mapping
         glEnable( GL_DEPTH_TEST );          // enable depth-testing
@@ -185,17 +130,61 @@ class test_app : public sb7::application{
         GL_CHECK_ERRORS
     }
 
+    void stop_loading(){
+        //Decoders stage meshes and skycube faces in the upload ring, they have to be done before it goes away
+        //Loads that haven't finished by now are just dropped, the ring gives back what they had reserved
+        pipeline.stop();
+    }
+
     void shutdown(){
         //Clean up Buffers
         glDeleteVertexArrays(1, &sc_vertex_array_object);
-        glDeleteTextures(1,&sc_map_texture);
-        glDeleteProgram(sc_program);
+        if(sc_stream.texture() == sc_map_texture){
+            sc_stream.close(); //The stream owns the streamed skycube texture
+        }
+
+        //Everything else belongs to the resource manager, let go of it while there is still a context
+        for(int i = 0; i < objects.size(); i++){
+            objects[i].mesh.reset();
+        }
+        object_shaders.clear();
+        sc_program_handle.reset();
+        sc_cubemap.reset();
+        resources.purge();
     }
 
     void render(double curTime){
 
         glViewport( 0, 0, info.windowWidth, info.windowHeight ); //Set Viewport information
 
+        //Upload whatever the asset pipeline has finished decoding, a few ms worth a frame
+        //Once everything is in, print when each asset was read, decoded and uploaded
+        if(!assets_done && pipeline.process(0.004) == 0 && sc_ready){
+            assets_done = true;
+            pipeline.print_timeline(stderr);
+
+            //And how the vfs did (the pipeline only asks it where files are, opens are the loaders that map them)
+            sb7::vfs::stats vs;
+            sb7::vfs::get_stats(vs);
+            fprintf(stderr, "vfs: %u opens (%u failed), %u lookups cached, %u searched, %llu bytes, %.2f ms opening\n",
+                    vs.opens, vs.failed, vs.cache_hits, vs.searches, vs.bytes, vs.open_time * 1000.0);
+
+            //And what the resource manager is holding on to
+            sb7::resource_manager::stats rs;
+            resources.get_stats(rs);
+            fprintf(stderr, "resources: %u (%u unused), %.2f of %.2f MB, %u loads shared by path, %u by contents, %u evicted\n",
+                    rs.resources, rs.unreferenced, rs.bytes / 1048576.0, rs.budget / 1048576.0, rs.path_hits, rs.content_hits, rs.evictions);
+
+            //And whether the programs came from the binary cache (a warm start compiles nothing)
+            sb7::program::binary_cache_stats ps;
+            sb7::program::get_binary_cache_stats(ps);
+            fprintf(stderr, "program cache: %u hits, %u misses, %u rejected, %u stored, %u shaders compiled\n",
+                    ps.hits, ps.misses, ps.rejected, ps.stored, ps.compiles);
+        }
+
+        //Ages everything for least recently used, and frees what nobody uses if over budget
+        resources.update();
+
         //if Auto rotate flag is set, update the position of the camera
         if(autoRotate){
             camera.position = vmath::vec3(static_cast<float>(cos(curTime/10.0) * 5.0),
@@ -235,18 +224,64 @@ class test_app : public sb7::application{
         objects[2].obj2world = vmath::translate(0.5f, 0.5f, 1.0f) * //get planet in 'right side up'
                                 vmath::scale(0.1f);
 
+        //Frustum of the camera in world space, used to cull clusters
+        sb7::cluster::frustum view_frustum;
+        sb7::cluster::extract_frustum(camera.proj_Matrix * camera.view_mat, view_frustum);
+
+        //Pick the variant of the object shader to draw with, what is lit is decided here so the shader never branches on it
+        if(rendering_pipeline != 0){
+            unsigned int features = litObjects ? OBJECT_LIT : 0;
+            GLuint object_pipeline = object_shaders.get(features); //Built the first time it is used
+            if(object_pipeline != 0 && object_pipeline != rendering_pipeline){
+                useObjectVariant(features);
+            }
+        }
+
+        //Cull on the job workers, each object collects the draw ranges of every cluster that could be seen
+        //Objects that are still loading belong to the decode threads, so they are left alone
+        std::vector<char> resident(objects.size());
         for(int i = 0; i < objects.size(); i++ ){
-            //render loop, go through each object and render it!
-            glUseProgram(rendering_program); //activate the render program
+            resident[i] = objects[i].ready && rendering_pipeline != 0;
+        }
+        jobs.parallel_for(0, objects.size(), 1, [&](unsigned int first, unsigned int last){
+            for(unsigned int i = first; i < last; i++){
+                objects[i].visible_firsts.clear();
+                objects[i].visible_counts.clear();
+                if(!resident[i]){
+                    continue;
+                }
+                //Bounds are stored in object space, move them into world space with this frames transform
+                for(int c = 0; c < objects[i].clusters.size(); c++){
+                    SB6M_CLUSTER_DECL world_bounds = sb7::cluster::transform(objects[i].cluster_bounds[c], objects[i].obj2world);
+                    if(sb7::cluster::is_visible(world_bounds, view_frustum, camera.position)){
+                        objects[i].visible_firsts.push_back(objects[i].clusters[c].first);
+                        objects[i].visible_counts.push_back(objects[i].clusters[c].count);
+                    }
+                }
+            }
+        });
+
+        //Every object is drawn with the same pipeline and camera, so those are set once for all of them
+        if(rendering_pipeline != 0){
+            bindPipeline(rendering_pipeline); //activate the render pipeline
             glBindVertexArray(vertex_array_object); //Select base vao
+            glProgramUniformMatrix4fv(object_vs_program, perspec_ID, 1,GL_FALSE, camera.proj_Matrix); //Load camera projection
+            glProgramUniformMatrix4fv(object_vs_program, toCam_ID, 1,GL_FALSE, camera.view_mat); //Load in view matrix for camera
+        }
 
-            //Copy over all the transforms
-            glUniformMatrix4fv(transform_ID, 1,GL_FALSE, objects[i].obj2world); //Load in transform for this object
-            //TODO::These might only need to be loaded once (for all objects)
-            glUniformMatrix4fv(perspec_ID, 1,GL_FALSE, camera.proj_Matrix); //Load camera projection
-            glUniformMatrix4fv(toCam_ID, 1,GL_FALSE, camera.view_mat); //Load in view matrix for camera
+        for(int i = 0; i < objects.size(); i++ ){
+            if(objects[i].visible_firsts.empty()){
+                continue; //Still loading, or nothing to see here
+            }
+
+            //render loop, go through each object and render it!
+            //Copy over the transform, uniforms are set on the vertex stage's program (the pipeline has no uniforms of its own)
+            glProgramUniformMatrix4fv(object_vs_program, transform_ID, 1,GL_FALSE, objects[i].obj2world); //Load in transform for this object
 
             //link to object buffer
+            if(vertex_ID < 0){
+                continue; //The shader doesn't use obj_vertex, nothing to draw with
+            }
             glEnableVertexAttribArray(vertex_ID); //Recall the vertex ID
             glBindBuffer(GL_ARRAY_BUFFER,objects[i].vertices_buffer_ID);//Link object buffer to vertex_ID
             glVertexAttribPointer( //Index into the buffer
@@ -257,19 +292,121 @@ class test_app : public sb7::application{
                     0,         //No stride (steps between indexes)
                     0);       //initial offset
 
-            glDrawArrays( GL_TRIANGLES, 0, objects[i].verticies.size());
+            //One call for all visible clusters of this object
+            glMultiDrawArrays( GL_TRIANGLES, objects[i].visible_firsts.data(), objects[i].visible_counts.data(), objects[i].visible_firsts.size());
         }
 
         runtime_error_check(4);
     }
 
+    //Loads the objects and the scene program, everything is started before the first co_await so it all overlaps
+    //Runs on this thread up to the first co_await, after that on whichever thread finished what it was waiting on
+    sb7::task<void> loadScene(){
+        const char * object_files[3] = { ".\\bin\\media\\PizzaPlate.obj", ".\\bin\\media\\SteveBlank.obj", ".\\bin\\media\\Planet.obj" };
+        sb7::resource_manager::mesh_handle meshes[3];
+        for(int i = 0; i < objects.size(); i++){
+            meshes[i] = resources.load_mesh(object_files[i]); //Parsed and clustered on a decode thread, buffer filled on this one
+        }
+
+        ////////////////////////////////
+        //Set up Object Scene Shaders //
+        ////////////////////////////////
+        //Load scene rendering based shaders, one source for every variant of them (see object_features)
+        //These need to be co-located with main.cpp in src
+        //Each stage is built separately and put together in a pipeline, so a feature only the fragment shader uses costs no vertex shader compiles
+        if(!object_shaders.init(".\\src\\vs.glsl", ".\\src\\fs.glsl", object_features, 2, true)){
+            MessageBoxA(NULL, "Object shaders not found!", "Error in loading shaders", MB_OK); //Every variant is 0 then, so render skips the objects
+        }
+        object_shaders.prepare(0); //Start the plain variant compiling now, the others wait until they are first drawn with
+        while(!object_shaders.ready(0)){
+            co_await sb7::resume_on_main(jobs); //Look in once a frame, the objects carry on loading meanwhile
+        }
+        useObjectVariant(0); //Render starts drawing objects once this is set
+        GL_CHECK_ERRORS
+
+        //Hand each object over to render as it comes in
+        for(int i = 0; i < objects.size(); i++){
+            co_await meshes[i].loaded();
+
+            if(!meshes[i]){
+                MessageBoxA(NULL, "OBJ file not found!", "Error in loading obj file", MB_OK);
+                continue;
+            }
+
+            //The object keeps the handle, so the mesh stays loaded while it is drawn
+            obj_t &obj = objects[i];
+            const sb7::resource_manager::mesh &m = *meshes[i].get();
+            obj.vertices_buffer_ID = m.buffer;
+            obj.vertNum = m.vertex_count;
+            obj.groups = m.groups;
+            obj.group_names = m.group_names;
+            obj.group_bounds = m.group_bounds;
+            obj.clusters = m.clusters;
+            obj.cluster_bounds = m.cluster_bounds;
+            obj.mesh = meshes[i];
+            obj.ready = true;
+        }
+    }
+
+    //Loads the skycube program and texture, the first run also bakes the texture on a worker
+    //Until both are in the skycube is skipped and the scene draws over the clear colour
+    sb7::task<void> loadSkycube(){
+        ///////////////////////////
+        //Set up Skycube shaders //
+        ///////////////////////////
+        //Start the shaders now, they don't depend on the texture
+        //These need to be co-located with main.cpp in src
+        sc_program_handle = resources.load_program(".\\src\\sc_vs.glsl", ".\\src\\sc_fs.glsl");
+
+        //Set up texture information
+        //Use the compressed bake of the skycube if there is one, otherwise bake it from the bitmaps first (first run)
+        //The bake is streamed in, so startup doesn't wait on the full size faces
+        if(!streamBakedCubeTextures(".\\bin\\media\\Skycube\\skycube.ktx", sc_stream, sc_map_texture)){
+            co_await assets.on_worker(); //Baking is all CPU, keep it off this thread
+            double psnr = 0.0;
+            bool baked = bakeCubeTextures(".\\bin\\media\\Skycube\\", ".\\bin\\media\\Skycube\\skycube.ktx",
+                                          sb7::texcodec::FORMAT_BC1, sb7::texcodec::QUALITY_HIGH, sb7::mipmap::FILTER_KAISER, psnr);
+            co_await assets.on_gl_thread();
+            sc_bake_psnr = psnr;
+
+            if(!baked || !streamBakedCubeTextures(".\\bin\\media\\Skycube\\skycube.ktx", sc_stream, sc_map_texture)){
+                //Couldn't bake, use the uncompressed bitmaps like before
+                sc_cubemap = resources.load_cubemap(".\\bin\\media\\Skycube\\");
+                co_await sc_cubemap.loaded();
+                sc_map_texture = sc_cubemap ? sc_cubemap->name : 0;
+            }
+        }
+
+        co_await sc_program_handle.loaded();
+        sc_program = sc_program_handle ? sc_program_handle->name : 0;
+        GL_CHECK_ERRORS
+
+        //Get uniform handles for perspective and camera matrices, the resource manager reflected the program when it linked
+        if(sc_program_handle){
+            sc_Perspective = sc_program_handle->reflection.uniform_location("perspective");
+            sc_Camera = sc_program_handle->reflection.uniform_location("toCamera");
+        }
+
+        //Link locations to Uniforms
+        bindProgram(sc_program);
+        glUniformMatrix4fv(sc_Perspective,1,GL_FALSE,camera.proj_Matrix);
+        glUniformMatrix4fv(sc_Camera,1,GL_FALSE,camera.view_mat_no_translation);
+        GL_CHECK_ERRORS
+        sc_ready = true;
+    }
+
     void drawSkyCube(double curTime){
+        if(!sc_ready){
+            return; //Still loading
+        }
 
         glDepthMask( GL_FALSE ); //Used to force skybox 'into' the back, making sure everything is rendered over it
-        glUseProgram( sc_program ); //Select the skycube program
+        bindProgram( sc_program ); //Select the skycube program
         glUniformMatrix4fv( sc_Perspective, 1, GL_FALSE, camera.proj_Matrix); //Update the projection matrix (if needed)
         glUniformMatrix4fv( sc_Camera, 1, GL_FALSE, camera.view_mat_no_translation); //Update the projection matrix (if needed)
         glActiveTexture( GL_TEXTURE0 ); //Make sure we are using the CUBE_MAP texture we already set up
+        size_t sc_budget = sc_stream_budget;
+        sc_stream.update(sc_budget); //Bring in more of the skycube if it is still streaming (does nothing once it is all there)
         glBindTexture( GL_TEXTURE_CUBE_MAP, sc_map_texture ); //Link to the texture
         glBindVertexArray( sc_vertex_array_object ); // Set up the vertex array
         glDrawArrays( GL_TRIANGLES, 0, skycube_vertices.size() ); //Start drawing triangles
@@ -293,6 +430,8 @@ class test_app : public sb7::application{
                 // A -x cameraPos  S -y cameraPos  D -z cameraPos
                 // Z - Reset to default X Diagnostic Printout
                 // C - toggle auto rotate flag
+                // L - toggle lit objects
+                // R - reload the object shaders if vs.glsl, fs.glsl or anything they include has changed
                 // T +x cameraFocus  Y +y cameraFocus  U +z cameraFocus
                 // G -x cameraFocus  H -y cameraFocus  J -z cameraFocus
                 case 'D':
@@ -334,6 +473,15 @@ class test_app : public sb7::application{
                 case 'C':
                     autoRotate = !autoRotate;
                     break;
+                case 'L':
+                    litObjects = !litObjects;
+                    break;
+                case 'R':
+                    if(object_shaders.refresh()){ //Every variant is gone, the one being drawn with too
+                        bound_pipeline = 0; //Deleting the bound pipeline unbound it
+                        useObjectVariant(0); //Pipeline 0 if it didn't compile, nothing is drawn until it is fixed and reloaded
+                    }
+                    break;
                 case 'Z': //Reset
                     camera.position = vmath::vec3(0.0f, 0.0f, 5.0f); //Starting camera at position (0,0,5)
                     camera.focus = vmath::vec3(0.0f, 0.0f, 0.0f); //Camera is looking in the +y direction
@@ -354,11 +502,68 @@ class test_app : public sb7::application{
                                        camera.view_mat_no_translation[3][0],camera.view_mat_no_translation[3][1],camera.view_mat_no_translation[3][2],camera.view_mat_no_translation[3][3]);
                     MessageBoxA(NULL, buf2, "Diagnostic Printout", MB_OK);
                     break;
+                case 'B': //Job system benchmark and how busy the workers have been
+                    {
+                        std::vector<sb7::job_system::worker_stats> stats;
+                        jobs.get_stats(stats, true);
+                        sb7::job_system::benchmark_result bench = jobs.benchmark();
+
+                        std::string text;
+                        char line[160];
+                        sprintf(line, "Workers: %u\nEmpty job: %.0f ns\nDependency hand-off: %.0f ns\nparallel_for speedup: %.2fx\n\n",
+                                bench.workers, bench.ns_per_job, bench.ns_per_dependency, bench.parallel_for_speedup);
+                        text += line;
+                        for(int w = 0; w < stats.size(); w++){
+                            sprintf(line, "Worker %d: %.0f%% busy, %llu jobs (%llu stolen)\n",
+                                    w, stats[w].utilization * 100.0, stats[w].jobs, stats[w].steals);
+                            text += line;
+                        }
+                        MessageBoxA(NULL, text.c_str(), "Job System", MB_OK);
+                    }
+                    break;
+                case 'K': //Skycube bake info
+                    char buf3[100];
+                    sprintf(buf3, "Skycube baked this run: %s\nCompressed PSNR: %.2f dB", sc_bake_psnr > 0.0 ? "yes" : "no", sc_bake_psnr);
+                    MessageBoxA(NULL, buf3, "Diagnostic Printout", MB_OK);
+                    break;
             }
         }
 
     }
 
+    //Switches the objects over to a variant of the object shader
+    void useObjectVariant(unsigned int features){
+        ////////////////////////////////////
+        // Grab IDs for rendering program //
+        ////////////////////////////////////
+        //Names are hashed when this compiles, the lookups are into the table built when the program linked
+        //Everything looked up here belongs to the vertex stage, it is its own program inside the pipeline
+        const sb7::program_reflection& vs_info = object_shaders.reflection(features, GL_VERTEX_SHADER);
+        transform_ID = vs_info.uniform_location("transform");
+        perspec_ID = vs_info.uniform_location("perspective");
+        toCam_ID = vs_info.uniform_location("toCamera");
+        vertex_ID = vs_info.attribute_location("obj_vertex");
+        object_vs_program = vs_info.program();
+        rendering_pipeline = object_shaders.get(features);
+    }
+
+    //Binding state cache, GL is only told when what draws next changes
+    //A bound program wins over a bound pipeline, so binding a pipeline unbinds the program
+    void bindProgram(GLuint program){
+        if(program != bound_program){
+            glUseProgram(program);
+            bound_program = program;
+        }
+    }
+
+    void bindPipeline(GLuint program_pipeline){
+        bindProgram(0);
+        if(program_pipeline != bound_pipeline){
+            glBindProgramPipeline(program_pipeline);
+            bound_pipeline = program_pipeline;
+        }
+    }
+
     void runtime_error_check(GLuint tracker = 0)
     {
         GLenum err = glGetError();
@@ -370,54 +575,44 @@ class test_app : public sb7::application{
         }
     }
 
-    void compiler_error_check(GLuint shader)
-    {
-        GLint isCompiled = 0;
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
-        if (isCompiled == GL_FALSE)
-        {
-            GLint maxLength = 0;
-            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
-
-            // The maxLength includes the NULL character
-            std::vector<GLchar> errorLog(maxLength);
-            glGetShaderInfoLog(shader, maxLength, &maxLength, &errorLog[0]);
-
-            if(maxLength == 0){
-                char buf[50];
-                sprintf(buf, "Possibly shaders not found!", maxLength);
-                MessageBoxA(NULL, buf, "Error in shader compilation", MB_OK);
-            } else {
-                // Provide the infolog in whatever manor you deem best.
-                MessageBoxA(NULL, &errorLog[0], "Error in shader compilation", MB_OK);
-            }
-
-            // Exit with failure.
-            glDeleteShader(shader); // Don't leak the shader.
-        }
-    }
-
     private:
         //Scene Rendering Information
-        GLuint rendering_program; //Program reference for scene generation
+        GLuint rendering_pipeline = 0; //Pipeline for scene generation, 0 until loadScene has built it
+        GLuint object_vs_program = 0; //Vertex stage of rendering_pipeline, the object uniforms are set on it
+        sb7::shader_variants object_shaders; //Every variant of the object shader, rendering_pipeline is one of them
+        GLuint bound_program = 0; //What bindProgram/bindPipeline last bound
+        GLuint bound_pipeline = 0;
+        bool litObjects = false; //Draw objects with the OBJECT_LIT variant
         GLuint vertex_array_object;
         
-        //Uniform attributes for Scene Render
-        GLuint transform_ID; //Dynamic transform of object
-        GLuint perspec_ID;   //Perspective transform
-        GLuint toCam_ID;     //World to Camera transform
-        GLuint vertex_ID;    //This will be mapped to different objects as we load them
+        //Uniform attributes for Scene Render, -1 if the program doesn't use them
+        GLint transform_ID = -1; //Dynamic transform of object
+        GLint perspec_ID = -1;   //Perspective transform
+        GLint toCam_ID = -1;     //World to Camera transform
+        GLint vertex_ID = -1;    //This will be mapped to different objects as we load them
 
         //Structure to hold all the object info
         struct obj_t{
-            //Data for object loaded from file
-            std::vector<vmath::vec4> verticies;
-            std::vector<vmath::vec4> normals;
-            std::vector<vmath::vec2> uv;
-            GLuint vertNum; //This should be the same as vertivies.size()
+            //Data for object loaded from file (the verticies themselves only live in the buffer)
+            GLuint vertNum = 0; //Number of verticies in the buffer
+
+            //o/g groups from the file (runs of verticies), their names and bounds in object space
+            std::vector<SB6M_SUB_OBJECT_DECL> groups;
+            std::vector<std::string> group_names;
+            std::vector<SB6M_CLUSTER_DECL> group_bounds;
+
+            //Clusters (runs of verticies) and their culling bounds in object space
+            std::vector<SB6M_SUB_OBJECT_DECL> clusters;
+            std::vector<SB6M_CLUSTER_DECL> cluster_bounds;
+
+            //Draw ranges of the clusters that passed culling this frame
+            std::vector<GLint> visible_firsts;
+            std::vector<GLsizei> visible_counts;
 
             //Handle from OpenGL set up
-            GLuint vertices_buffer_ID;        
+            GLuint vertices_buffer_ID = 0;
+            sb7::resource_manager::mesh_handle mesh; //Holds on to the mesh, the buffer belongs to the resource manager
+            bool ready = false; //Set once loadScene has the object, it is drawn after that
 
             //Object to World transforms
             vmath::mat4 obj2world;
@@ -426,17 +621,29 @@ class test_app : public sb7::application{
         //Hold all of our objects
         std::vector<obj_t> objects;
 
+        //Reads, decodes and uploads everything at startup, assets is the coroutine front end over it
+        sb7::asset_pipeline pipeline;
+        sb7::asset_loader assets{pipeline, jobs, &uploads}; //Meshes and skycube faces are staged in the application's upload ring on the decode threads
+        sb7::resource_manager resources{assets}; //Owns every mesh, texture and program loaded through it
+        bool assets_done = false; //Set once everything is uploaded and the timeline printed
+
 
 
         //Data for Skycube
-        GLuint sc_program; //Program refernce
+        GLuint sc_program = 0; //Program refernce
+        sb7::resource_manager::program_handle sc_program_handle; //Keeps sc_program loaded
 
         GLuint sc_vertex_array_object;
-        GLuint sc_map_texture;
+        GLuint sc_map_texture = 0;
+        sb7::resource_manager::texture_handle sc_cubemap; //Only used if the bake can't be streamed, then sc_map_texture is its texture
+        bool sc_ready = false; //Set once loadSkycube has the skycube program and texture
+        double sc_bake_psnr = 0.0; //Quality of the compressed skycube, only set on the run that baked it
+        sb7::streaming_texture sc_stream; //Streams the baked skycube in over the first frames
+        size_t sc_stream_budget = 256 * 1024; //Bytes of skycube uploaded per frame while streaming
 
         //TODO:: Rename these better names
-        GLuint sc_Camera;
-        GLuint sc_Perspective;
+        GLint sc_Camera = -1;
+        GLint sc_Perspective = -1;
 
         std::vector<vmath::vec4> skycube_vertices; //List of skycube vertexes
 
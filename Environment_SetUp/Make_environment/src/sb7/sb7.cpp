@@ -63,4 +63,146 @@ void APIENTRY sb7::application::debug_callback(GLenum source,
                                                GLvoid* userParam)
 {
     reinterpret_cast<application *>(userParam)->onDebugMessage(source, type, id, severity, length, message);
-}
\ No newline at end of file
+}
+
+void sb7::application::start_loader()
+{
+    // The loader's context only ever renders nowhere, so its window stays hidden
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    loader_window = glfwCreateWindow(1, 1, info.title, NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+
+    if (!loader_window)
+    {
+        fprintf(stderr, "No shared context for the loader, loading on the main thread\n");
+        return;
+    }
+
+    loader_running = true;
+    loader = std::thread(loader_main, this);
+}
+
+void sb7::application::stop_loader()
+{
+    if (!loader_window)
+        return;
+
+    {
+        std::lock_guard<std::mutex> l(loader_lock);
+
+        // Anything not started yet isn't worth starting now
+        loader_running = false;
+        loader_busy -= (unsigned int)loader_queue.size();
+        loader_queue.clear();
+    }
+
+    loader_wake.notify_all();
+    loader.join();
+
+    process_loads(true);
+
+    glfwDestroyWindow(loader_window);
+    loader_window = NULL;
+}
+
+void sb7::application::loader_main(application * self)
+{
+    glfwMakeContextCurrent(self->loader_window);
+
+    for (;;)
+    {
+        load_job job;
+
+        {
+            std::unique_lock<std::mutex> l(self->loader_lock);
+
+            while (self->loader_running && self->loader_queue.empty())
+                self->loader_wake.wait(l);
+
+            if (!self->loader_running)
+                break;
+
+            job = self->loader_queue.front();
+            self->loader_queue.pop_front();
+        }
+
+        job.work();
+
+        // The flush gets the fence to the GPU, so the main thread's wait on
+        // it can finish
+        job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+
+        std::lock_guard<std::mutex> l(self->loader_lock);
+        self->loader_fenced.push_back(job);
+        self->loader_busy--;
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+void sb7::application::load(const std::function<void()>& work, const std::function<void()>& done)
+{
+    if (!loader_window)
+    {
+        if (work)
+            work();
+        if (done)
+            done();
+        return;
+    }
+
+    load_job job;
+    job.work = work ? work : std::function<void()>([]{});
+    job.done = done;
+    job.fence = 0;
+
+    {
+        std::lock_guard<std::mutex> l(loader_lock);
+        loader_queue.push_back(job);
+        loader_busy++;
+    }
+
+    loader_wake.notify_one();
+}
+
+unsigned int sb7::application::loads_pending()
+{
+    std::lock_guard<std::mutex> l(loader_lock);
+
+    return loader_busy + (unsigned int)loader_fenced.size();
+}
+
+void sb7::application::process_loads(bool wait)
+{
+    for (;;)
+    {
+        load_job job;
+
+        {
+            std::lock_guard<std::mutex> l(loader_lock);
+
+            if (loader_fenced.empty())
+                return;
+
+            job = loader_fenced.front();
+        }
+
+        // Fences from one context signal in order, so stop at the first
+        // one still pending
+        GLenum status = glClientWaitSync(job.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? ~(GLuint64)0 : 0);
+
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return;
+
+        glDeleteSync(job.fence);
+
+        {
+            std::lock_guard<std::mutex> l(loader_lock);
+            loader_fenced.pop_front();
+        }
+
+        if (job.done)
+            job.done();
+    }
+}
@@ -0,0 +1,486 @@
+/*
+ * Packed asset archive
+ *
+ * The table of contents is an open addressed hash table with linear
+ * probing, at most half full, so a lookup is one hash and a compare or two.
+ * Everything is checked once in open() so find() can trust the mapping.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <sb7archive.h>
+#include <sb7cluster.h>
+
+#include <GL/glcorearb.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+
+namespace sb7
+{
+
+enum
+{
+    BLOB_ALIGNMENT = 4096
+};
+
+archive::archive()
+    : header(NULL),
+      buckets(NULL),
+      entries(NULL),
+      names(NULL)
+{
+
+}
+
+archive::~archive()
+{
+    close();
+}
+
+bool archive::open(const char * filename)
+{
+    const SB7A_HEADER * h;
+    uint64_t toc_size;
+    unsigned int i;
+
+    close();
+
+    if (!file.open(filename))
+        return false;
+
+    h = (const SB7A_HEADER *)file.data();
+
+    if (file.size() < sizeof(SB7A_HEADER) || h->magic != SB7A_MAGIC || h->version != SB7A_VERSION)
+        goto fail;
+
+    // Always at least one empty slot, or a miss would never stop probing
+    if (h->bucket_count == 0 || (h->bucket_count & (h->bucket_count - 1)) != 0 || h->bucket_count <= h->entry_count)
+        goto fail;
+
+    toc_size = sizeof(SB7A_HEADER) + (uint64_t)h->bucket_count * sizeof(uint32_t) +
+               (uint64_t)h->entry_count * sizeof(SB7A_ENTRY) + h->names_size;
+
+    if (toc_size > file.size() || h->names_size == 0)
+        goto fail;
+
+    buckets = (const uint32_t *)(h + 1);
+    entries = (const SB7A_ENTRY *)(buckets + h->bucket_count);
+    names = (const char *)(entries + h->entry_count);
+
+    if (names[h->names_size - 1] != 0)
+        goto fail;
+
+    for (i = 0; i < h->bucket_count; i++)
+    {
+        if (buckets[i] > h->entry_count)
+            goto fail;
+    }
+
+    for (i = 0; i < h->entry_count; i++)
+    {
+        const SB7A_ENTRY& e = entries[i];
+
+        // The blob and the zero byte after it, which load_shader relies on
+        if (e.name_offset >= h->names_size || e.offset < toc_size ||
+            e.offset >= file.size() || e.size >= file.size() - e.offset ||
+            file.data()[e.offset + e.size] != 0)
+            goto fail;
+    }
+
+    header = h;
+
+    return true;
+
+fail:
+    buckets = NULL;
+    entries = NULL;
+    names = NULL;
+    file.close();
+
+    return false;
+}
+
+void archive::close()
+{
+    header = NULL;
+    buckets = NULL;
+    entries = NULL;
+    names = NULL;
+    file.close();
+}
+
+const SB7A_ENTRY * archive::find(const char * name) const
+{
+    if (!header || !name)
+        return NULL;
+
+    std::string key = normalize(name);
+    uint64_t h = hash(key);
+    uint32_t mask = header->bucket_count - 1;
+    uint32_t slot = (uint32_t)h & mask;
+
+    while (buckets[slot] != 0)
+    {
+        const SB7A_ENTRY& e = entries[buckets[slot] - 1];
+
+        if (e.hash == h && key == names + e.name_offset)
+            return &e;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+bool archive::find(const char * name, const unsigned char *& data, size_t& size, unsigned int * type) const
+{
+    const SB7A_ENTRY * e = find(name);
+
+    if (!e)
+        return false;
+
+    data = file.data() + e->offset;
+    size = (size_t)e->size;
+    if (type)
+        *type = e->type;
+
+    return true;
+}
+
+std::string archive::normalize(const char * name)
+{
+    std::string out;
+    const char * p = name;
+
+    while (*p)
+    {
+        const char * start;
+        size_t length;
+
+        while (*p == '/' || *p == '\\')
+            p++;
+
+        start = p;
+        while (*p && *p != '/' && *p != '\\')
+            p++;
+
+        length = p - start;
+        if (length == 0 || (length == 1 && start[0] == '.'))
+            continue;
+
+        if (!out.empty())
+            out += '/';
+        out.append(start, length);
+    }
+
+    return out;
+}
+
+// 64 bit FNV-1a
+uint64_t archive::hash(const std::string& normalized)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < normalized.size(); i++)
+    {
+        h ^= (unsigned char)normalized[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+archive_writer::archive_writer()
+{
+
+}
+
+void archive_writer::add(const char * name, ARCHIVE_TYPE type, const void * data, size_t size)
+{
+    std::vector<unsigned char> copy((const unsigned char *)data, (const unsigned char *)data + size);
+
+    add(name, type, copy);
+}
+
+void archive_writer::add(const char * name, ARCHIVE_TYPE type, std::vector<unsigned char>& data)
+{
+    std::string key = archive::normalize(name);
+    size_t i;
+
+    for (i = 0; i < blobs.size(); i++)
+    {
+        if (blobs[i].name == key)
+            break;
+    }
+
+    if (i == blobs.size())
+        blobs.push_back(blob());
+
+    blobs[i].name = key;
+    blobs[i].type = type;
+    blobs[i].data.swap(data);
+    data.clear();
+}
+
+bool archive_writer::save(const char * filename) const
+{
+    static const unsigned char zeros[BLOB_ALIGNMENT] = { 0 };
+
+    SB7A_HEADER header;
+    std::vector<uint32_t> buckets;
+    std::vector<SB7A_ENTRY> entries(blobs.size());
+    std::string names;
+    uint64_t offset;
+    size_t i;
+    FILE * fp;
+    bool ok = true;
+
+    header.magic = SB7A_MAGIC;
+    header.version = SB7A_VERSION;
+    header.entry_count = (uint32_t)blobs.size();
+    header.bucket_count = 16;
+    header.alignment = BLOB_ALIGNMENT;
+    header.reserved = 0;
+
+    while (header.bucket_count < header.entry_count * 2)
+        header.bucket_count *= 2;
+
+    buckets.assign(header.bucket_count, 0);
+
+    for (i = 0; i < blobs.size(); i++)
+    {
+        SB7A_ENTRY& e = entries[i];
+        uint32_t slot;
+
+        e.hash = archive::hash(blobs[i].name);
+        e.size = blobs[i].data.size();
+        e.name_offset = (uint32_t)names.size();
+        e.type = blobs[i].type;
+
+        names += blobs[i].name;
+        names += '\0';
+
+        slot = (uint32_t)e.hash & (header.bucket_count - 1);
+        while (buckets[slot] != 0)
+            slot = (slot + 1) & (header.bucket_count - 1);
+        buckets[slot] = (uint32_t)i + 1;
+    }
+
+    if (names.empty())
+        names += '\0';
+
+    header.names_size = (uint32_t)names.size();
+
+    // Blobs start on the first boundary after the table of contents, and
+    // each ends with at least one zero byte before the next boundary
+    offset = sizeof(header) + buckets.size() * sizeof(uint32_t) + entries.size() * sizeof(SB7A_ENTRY) + names.size();
+
+    for (i = 0; i < entries.size(); i++)
+    {
+        offset = (offset + BLOB_ALIGNMENT - 1) & ~(uint64_t)(BLOB_ALIGNMENT - 1);
+        entries[i].offset = offset;
+        offset += entries[i].size + 1;
+    }
+
+    fp = fopen(filename, "wb");
+
+    if (!fp)
+        return false;
+
+    ok &= fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok &= fwrite(&buckets[0], sizeof(uint32_t), buckets.size(), fp) == buckets.size();
+    if (!entries.empty())
+        ok &= fwrite(&entries[0], sizeof(SB7A_ENTRY), entries.size(), fp) == entries.size();
+    ok &= fwrite(names.data(), 1, names.size(), fp) == names.size();
+
+    offset = sizeof(header) + buckets.size() * sizeof(uint32_t) + entries.size() * sizeof(SB7A_ENTRY) + names.size();
+
+    for (i = 0; ok && i < entries.size(); i++)
+    {
+        size_t pad = (size_t)(entries[i].offset - offset);
+        size_t size = blobs[i].data.size();
+
+        ok &= fwrite(zeros, 1, pad, fp) == pad;
+        if (size)
+            ok &= fwrite(&blobs[i].data[0], 1, size, fp) == size;
+        ok &= fwrite(zeros, 1, 1, fp) == 1;
+
+        offset = entries[i].offset + size + 1;
+    }
+
+    ok &= fclose(fp) == 0;
+
+    return ok;
+}
+
+// The smallest a chunk of each type read here can be and still hold its fields
+static size_t min_chunk_size(unsigned int chunk_type)
+{
+    switch (chunk_type)
+    {
+        case SB6M_CHUNK_TYPE_DATA:              return sizeof(SB6M_DATA_CHUNK);
+        case SB6M_CHUNK_TYPE_VERTEX_DATA:       return sizeof(SB6M_CHUNK_VERTEX_DATA);
+        case SB6M_CHUNK_TYPE_VERTEX_ATTRIBS:    return offsetof(SB6M_VERTEX_ATTRIB_CHUNK, attrib_data);
+        case SB6M_CHUNK_TYPE_SUB_OBJECT_LIST:   return offsetof(SB6M_CHUNK_SUB_OBJECT_LIST, sub_object);
+        case SB6M_CHUNK_TYPE_CLUSTER_LIST:      return offsetof(SB6M_CHUNK_CLUSTER_LIST, cluster);
+        default:                                return sizeof(SB6M_CHUNK_HEADER);
+    }
+}
+
+bool parse_packed_mesh(const unsigned char * data, size_t size, packed_mesh& m)
+{
+    const SB6M_HEADER * header = (const SB6M_HEADER *)data;
+    const unsigned char * ptr = data;
+    const unsigned char * end = data + size;
+    const SB6M_DATA_CHUNK * data_chunk = NULL;
+    const SB6M_CHUNK_VERTEX_DATA * vertex_chunk = NULL;
+    const SB6M_VERTEX_ATTRIB_CHUNK * attrib_chunk = NULL;
+    const SB6M_CHUNK_SUB_OBJECT_LIST * sub_object_chunk = NULL;
+    const SB6M_CHUNK_CLUSTER_LIST * cluster_chunk = NULL;
+    const SB6M_CHUNK_COMMENT * comment_chunk = NULL;
+    const unsigned char * payload;
+    unsigned int i;
+
+    m.positions = m.uvs = m.normals = NULL;
+    m.vertex_count = 0;
+    m.clusters.clear();
+    m.cluster_bounds.clear();
+    m.groups.clear();
+    m.group_names.clear();
+    m.group_bounds.clear();
+
+    if (size < sizeof(SB6M_HEADER) || header->magic != SB6M_MAGIC || header->size > size)
+        return false;
+
+    ptr += header->size;
+
+    for (i = 0; i < header->num_chunks; i++)
+    {
+        const SB6M_CHUNK_HEADER * chunk = (const SB6M_CHUNK_HEADER *)ptr;
+
+        if (end - ptr < (ptrdiff_t)sizeof(SB6M_CHUNK_HEADER) || chunk->size < sizeof(SB6M_CHUNK_HEADER) || chunk->size > (size_t)(end - ptr))
+            break;
+
+        // Otherwise the fields read below (and the count arithmetic) would
+        // run past the end of the chunk
+        if (chunk->size < min_chunk_size(chunk->chunk_type))
+            return false;
+
+        ptr += chunk->size;
+        switch (chunk->chunk_type)
+        {
+            case SB6M_CHUNK_TYPE_DATA:              data_chunk = (const SB6M_DATA_CHUNK *)chunk; break;
+            case SB6M_CHUNK_TYPE_VERTEX_DATA:       vertex_chunk = (const SB6M_CHUNK_VERTEX_DATA *)chunk; break;
+            case SB6M_CHUNK_TYPE_VERTEX_ATTRIBS:    attrib_chunk = (const SB6M_VERTEX_ATTRIB_CHUNK *)chunk; break;
+            case SB6M_CHUNK_TYPE_SUB_OBJECT_LIST:   sub_object_chunk = (const SB6M_CHUNK_SUB_OBJECT_LIST *)chunk; break;
+            case SB6M_CHUNK_TYPE_CLUSTER_LIST:      cluster_chunk = (const SB6M_CHUNK_CLUSTER_LIST *)chunk; break;
+            case SB6M_CHUNK_TYPE_COMMENT:           comment_chunk = (const SB6M_CHUNK_COMMENT *)chunk; break;
+            default:                                break;
+        }
+    }
+
+    if (!data_chunk || !vertex_chunk || !attrib_chunk || data_chunk->encoding != SB6M_DATA_ENCODING_RAW ||
+        data_chunk->data_offset > (size_t)(end - (const unsigned char *)data_chunk) ||
+        data_chunk->data_length > (size_t)(end - (const unsigned char *)data_chunk) - data_chunk->data_offset)
+        return false;
+
+    payload = (const unsigned char *)data_chunk + data_chunk->data_offset;
+    m.vertex_count = vertex_chunk->total_vertices;
+
+    // Never trust the count further than the chunk actually reaches
+    unsigned int attrib_count = std::min(attrib_chunk->attrib_count, (unsigned int)((attrib_chunk->header.size -
+                                         offsetof(SB6M_VERTEX_ATTRIB_CHUNK, attrib_data)) / sizeof(SB6M_VERTEX_ATTRIB_DECL)));
+
+    for (i = 0; i < attrib_count; i++)
+    {
+        const SB6M_VERTEX_ATTRIB_DECL& a = attrib_chunk->attrib_data[i];
+        const float ** array = NULL;
+        unsigned int components = 4;
+
+        if (strncmp(a.name, "position", sizeof(a.name)) == 0)
+            array = &m.positions;
+        else if (strncmp(a.name, "texcoord", sizeof(a.name)) == 0)
+            array = &m.uvs, components = 2;
+        else if (strncmp(a.name, "normal", sizeof(a.name)) == 0)
+            array = &m.normals;
+
+        // Only tightly packed float arrays can be used in place
+        if (!array || a.size != components || a.type != GL_FLOAT ||
+            (a.stride != 0 && a.stride != components * sizeof(float)) ||
+            a.data_offset > data_chunk->data_length ||
+            (uint64_t)m.vertex_count * components * sizeof(float) > data_chunk->data_length - a.data_offset)
+            continue;
+
+        *array = (const float *)(payload + a.data_offset);
+    }
+
+    if (!m.positions)
+    {
+        m.uvs = m.normals = NULL;
+        return false;
+    }
+
+    if (sub_object_chunk && cluster_chunk)
+    {
+        size_t count = (sub_object_chunk->header.size - offsetof(SB6M_CHUNK_SUB_OBJECT_LIST, sub_object)) / sizeof(SB6M_SUB_OBJECT_DECL);
+        size_t bounds = (cluster_chunk->header.size - offsetof(SB6M_CHUNK_CLUSTER_LIST, cluster)) / sizeof(SB6M_CLUSTER_DECL);
+
+        count = std::min(count, (size_t)sub_object_chunk->count);
+        bounds = std::min(bounds, (size_t)cluster_chunk->count);
+
+        // Every cluster is drawn as a range of vertices, so one that reaches
+        // past the last vertex makes the whole list unusable
+        for (i = 0; i < count; i++)
+        {
+            const SB6M_SUB_OBJECT_DECL& c = sub_object_chunk->sub_object[i];
+
+            if (c.first > m.vertex_count || c.count > m.vertex_count - c.first)
+                break;
+        }
+
+        // Cluster bounds only make sense if they line up with the sub-objects
+        if (bounds == count && i == count)
+        {
+            m.clusters.assign(sub_object_chunk->sub_object, sub_object_chunk->sub_object + count);
+            m.cluster_bounds.assign(cluster_chunk->cluster, cluster_chunk->cluster + count);
+        }
+    }
+
+    if (comment_chunk)
+    {
+        const char * text = comment_chunk->comment;
+        std::istringstream in(std::string(text, strnlen(text, comment_chunk->header.size - sizeof(SB6M_CHUNK_HEADER))));
+        std::vector<unsigned int> indices(m.vertex_count);
+        std::string line;
+
+        std::iota(indices.begin(), indices.end(), 0u);
+
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            SB6M_SUB_OBJECT_DECL range;
+            std::string tag, name;
+
+            if (!(fields >> tag >> range.first >> range.count) || tag != "g" ||
+                range.first > m.vertex_count || range.count > m.vertex_count - range.first)
+                continue;
+
+            fields >> std::ws;
+            std::getline(fields, name);
+
+            m.groups.push_back(range);
+            m.group_names.push_back(name);
+            m.group_bounds.push_back(cluster::compute_bounds(m.positions, 4 * sizeof(float), &indices[range.first], range.count));
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,420 @@
+/*
+ * Asset loader
+ *
+ * read() puts one asset into the pipeline whose decode stage resumes the
+ * coroutine and whose upload stage resumes it again if it asked to be, so a
+ * loader is a single coroutine that walks through the pipeline's stages.
+ * Packed assets go through the same stages, the read stage just has nothing
+ * to do for them.
+ */
+
+#include <sb7assetloader.h>
+#include <sb7ktx.h>
+#include <shader.h>
+
+#include <loadingFunctions.h>
+#include <skybox.h>
+
+#include <cstring>
+#include <sstream>
+
+namespace sb7
+{
+
+struct asset_loader::file_state
+{
+    file_state() : mapped(nullptr), mapped_size(0), type(ARCHIVE_RAW), uploader(nullptr), jobs(nullptr) {}
+
+    std::vector<unsigned char>      bytes;
+    const unsigned char *           mapped;     // Into the archive, if packed
+    size_t                          mapped_size;
+    unsigned int                    type;
+    std::coroutine_handle<>         reader;
+    std::atomic<void *>             uploader;   // Coroutine waiting on the upload stage, or gone_by()
+    job_system *                    jobs;
+
+    // Marks the upload stage as over with nobody waiting on it
+    static void * gone_by()
+    {
+        static char marker;
+        return &marker;
+    }
+};
+
+asset_loader::asset_loader(asset_pipeline& pipeline, job_system& jobs, upload_queue * uploads)
+    : pipeline(pipeline),
+      jobs(jobs),
+      uploads(uploads),
+      gl_thread(std::this_thread::get_id())
+{
+
+}
+
+bool asset_loader::stage(const void * data, size_t size, upload_queue::region& r)
+{
+    r.data = nullptr;
+
+    // Not waiting keeps the decode threads free, the GL thread only makes
+    // room once a frame
+    if (!uploads || size == 0 || !uploads->reserve(size, r, false))
+    {
+        r.data = nullptr;
+        return false;
+    }
+
+    memcpy(r.data, data, size);
+
+    return true;
+}
+
+std::vector<unsigned char>& asset_loader::file::bytes()
+{
+    return state->bytes;
+}
+
+const unsigned char * asset_loader::file::data() const
+{
+    return state->mapped ? state->mapped : state->bytes.data();
+}
+
+size_t asset_loader::file::size() const
+{
+    return state->mapped ? state->mapped_size : state->bytes.size();
+}
+
+bool asset_loader::file::packed() const
+{
+    return state->mapped != nullptr;
+}
+
+unsigned int asset_loader::file::type() const
+{
+    return state->type;
+}
+
+bool asset_loader::file::upload_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    void * expected = nullptr;
+
+    if (state->uploader.compare_exchange_strong(expected, h.address()))
+        return true;
+
+    // Missed it, the next run_main_jobs() is the next time on the GL thread
+    state->jobs->run_on_main([h]{ h.resume(); });
+
+    return true;
+}
+
+asset_loader::read_awaiter asset_loader::read(const std::string& path)
+{
+    read_awaiter r;
+
+    r.loader = this;
+    r.path = path;
+    r.state = std::make_shared<file_state>();
+    r.state->jobs = &jobs;
+
+    return r;
+}
+
+void asset_loader::read_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    std::shared_ptr<file_state> s = state;
+
+    s->reader = h;
+
+    // Packed assets skip the read, the decode stage gets them straight away.
+    // Anything the vfs can't find goes in with nothing to read, and comes
+    // back empty.
+    vfs::location where;
+
+    if (vfs::locate(path.c_str(), where) && where.data)
+    {
+        s->mapped = where.data;
+        s->mapped_size = where.size;
+        s->type = where.type;
+    }
+
+    loader->pipeline.add(path.c_str(), where.disk_path.c_str(),
+        [s](std::vector<unsigned char>& data)
+        {
+            s->bytes.swap(data);
+            s->reader.resume();
+        },
+        [s]
+        {
+            void * w = s->uploader.exchange(file_state::gone_by());
+
+            if (w)
+                std::coroutine_handle<>::from_address(w).resume();
+        });
+}
+
+asset_loader::file asset_loader::read_awaiter::await_resume()
+{
+    file f;
+
+    f.state = state;
+
+    return f;
+}
+
+task<asset_loader::mesh> asset_loader::load_mesh(std::string path)
+{
+    std::vector<vmath::vec4> vertices, normals;
+    std::vector<vmath::vec2> uvs;
+    const unsigned char * upload_data;
+    size_t upload_size;
+    mesh m;
+
+    m.buffer = 0;
+    m.vertex_count = 0;
+
+    file f = co_await read(path);
+
+    if (f.size() == 0)
+        co_return m;
+
+    if (f.type() == ARCHIVE_MESH)
+    {
+        packed_mesh packed;
+
+        // Already clustered, the positions go up straight from the mapping
+        if (!parse_packed_mesh(f.data(), f.size(), packed))
+            co_return m;
+
+        m.vertex_count = packed.vertex_count / 3;
+        m.groups.swap(packed.groups);
+        m.group_names.swap(packed.group_names);
+        m.group_bounds.swap(packed.group_bounds);
+        m.clusters.swap(packed.clusters);
+        m.cluster_bounds.swap(packed.cluster_bounds);
+
+        upload_data = (const unsigned char *)packed.positions;
+        upload_size = (size_t)packed.vertex_count * sizeof(vmath::vec4);
+    }
+    else
+    {
+        {
+            std::istringstream in(std::string(f.data(), f.data() + f.size()));
+
+            f.bytes().clear();
+            f.bytes().shrink_to_fit();
+
+            parse_obj(in, vertices, uvs, normals, m.vertex_count, m.groups, m.group_names, m.group_bounds);
+        }
+
+        cluster_obj(vertices, uvs, normals, m.groups, m.clusters, m.cluster_bounds);
+
+        upload_data = (const unsigned char *)vertices.data();
+        upload_size = vertices.size() * sizeof(vertices[0]);
+    }
+
+    upload_queue::region staged;
+    bool queued = stage(upload_data, upload_size, staged);
+
+    co_await f.upload();
+
+    glGenBuffers(1, &m.buffer);
+
+    if (!queued)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, m.buffer);
+        glBufferData(GL_ARRAY_BUFFER, upload_size, upload_data, GL_STATIC_DRAW);
+        co_return m;
+    }
+
+    upload_queue::asset a = uploads->begin();
+
+    uploads->buffer_data(a, staged, m.buffer, GL_STATIC_DRAW);
+    uploads->finish(a);
+
+    // The buffer has no storage until the copy is issued
+    while (!uploads->is_resident(a))
+        co_await resume_on_main(jobs);
+
+    co_return m;
+}
+
+task<asset_loader::face> asset_loader::load_cube_face(std::string path)
+{
+    face result;
+
+    result.data = nullptr;
+    result.width = 0;
+    result.height = 0;
+    result.staged.data = nullptr;
+
+    file f = co_await read(path);
+
+    if (f.type() == ARCHIVE_TEXTURE)
+    {
+        ktx::file::header h;
+        std::vector<const unsigned char *> images;
+        std::vector<unsigned int> image_sizes;
+        unsigned int target;
+
+        // sb7pack writes bitmaps as plain RGBA, which is all that's taken here
+        if (ktx::file::parse(f.data(), f.size(), h, target, images, image_sizes) &&
+            target == GL_TEXTURE_2D && h.gltype == GL_UNSIGNED_BYTE && h.glformat == GL_RGBA &&
+            image_sizes[0] >= h.pixelwidth * h.pixelheight * 4)
+        {
+            result.data = images[0];
+            result.width = h.pixelwidth;
+            result.height = h.pixelheight;
+        }
+    }
+    else if (f.size() != 0)
+    {
+        result.pixels.reset(decodeCubeSide(f.data(), f.size(), result.width, result.height));
+        result.data = result.pixels.get();
+    }
+
+    if (result.data)
+        stage(result.data, (size_t)result.width * result.height * 4, result.staged);
+
+    co_return result;
+}
+
+static const struct
+{
+    GLenum          side;
+    const char *    name;
+} cube_sides[6] =
+{
+    { GL_TEXTURE_CUBE_MAP_POSITIVE_Z, ".\\sc_front.bmp" },
+    { GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, ".\\sc_back.bmp" },
+    { GL_TEXTURE_CUBE_MAP_POSITIVE_Y, ".\\sc_down.bmp" },
+    { GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, ".\\sc_up.bmp" },
+    { GL_TEXTURE_CUBE_MAP_POSITIVE_X, ".\\sc_right.bmp" },
+    { GL_TEXTURE_CUBE_MAP_NEGATIVE_X, ".\\sc_left.bmp" }
+};
+
+const char * asset_loader::cube_face(unsigned int i)
+{
+    return cube_sides[i].name;
+}
+
+task<GLuint> asset_loader::load_cubemap(std::string directory)
+{
+    task<face> pending[6];
+    face faces[6];
+    GLuint texture = 0;
+    bool any = false;
+    int i;
+
+    // All six go into the pipeline before waiting on any of them
+    for (i = 0; i < 6; i++)
+        pending[i] = load_cube_face(directory + cube_sides[i].name);
+
+    for (i = 0; i < 6; i++)
+    {
+        faces[i] = co_await pending[i];
+        any = any || faces[i].data;
+    }
+
+    if (!any)
+        co_return 0;
+
+    co_await on_gl_thread();
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+
+    bool staged = false;
+
+    for (i = 0; i < 6; i++)
+        staged = staged || faces[i].staged.data;
+
+    upload_queue::asset a = staged ? uploads->begin() : 0;
+
+    // Staged faces only get their storage here, the queue fills it in
+    for (i = 0; i < 6; i++)
+    {
+        if (!faces[i].data)
+            continue;
+
+        glTexImage2D(cube_sides[i].side, 0, GL_RGBA, faces[i].width, faces[i].height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, faces[i].staged.data ? NULL : faces[i].data);
+
+        if (faces[i].staged.data)
+            uploads->tex_sub_image(a, faces[i].staged, texture, cube_sides[i].side, 0,
+                                   0, 0, 0, faces[i].width, faces[i].height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (staged)
+    {
+        uploads->finish(a);
+
+        while (!uploads->is_resident(a))
+            co_await resume_on_main(jobs);
+    }
+
+    co_return texture;
+}
+
+task<GLuint> asset_loader::load_shader(std::string path, GLenum type)
+{
+    file f = co_await read(path);
+
+    std::string expanded;
+
+    if (f.size() == 0)
+        co_return 0;
+
+    // Includes are read here, on the decode thread
+    if (shader::has_includes((const char *)f.data(), f.size()))
+    {
+        if (!shader::preprocess((const char *)f.data(), f.size(), path.c_str(), expanded))
+            co_return 0;
+    }
+    // The source wants a terminator, and the decode thread has nothing
+    // else to do for a shader. Packed blobs always have one after them.
+    else if (!f.packed())
+    {
+        f.bytes().push_back(0);
+    }
+
+    co_await f.upload();
+
+    // Not checked here, so the driver can carry on compiling while the
+    // program waits for its other stages
+    co_return shader::from_string(expanded.empty() ? (const char *)f.data() : expanded.c_str(), type, false);
+}
+
+task<GLuint> asset_loader::load_program(std::string vs_path, std::string fs_path)
+{
+    task<GLuint> vs = load_shader(vs_path, GL_VERTEX_SHADER);
+    task<GLuint> fs = load_shader(fs_path, GL_FRAGMENT_SHADER);
+    GLuint shaders[2];
+
+    shaders[0] = co_await vs;
+    shaders[1] = co_await fs;
+
+    // Whichever shader finished last did so on the GL thread, but make sure
+    co_await on_gl_thread();
+
+    if (!shaders[0] || !shaders[1])
+    {
+        glDeleteShader(shaders[0]);
+        glDeleteShader(shaders[1]);
+        co_return 0;
+    }
+
+    GLuint result = program::start_link(shaders, 2, true);
+
+    // Look in once a frame until the driver's threads are done with it,
+    // other programs compile and link meanwhile
+    while (!program::is_ready(result))
+        co_await resume_on_main(jobs);
+
+    co_return program::finish_link(result, true);
+}
+
+}
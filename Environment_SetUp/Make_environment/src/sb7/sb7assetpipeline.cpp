@@ -0,0 +1,357 @@
+/*
+ * Asset pipeline
+ *
+ * One thread reads, handing the file reader everything queued so far at
+ * once so it can keep the device busy, and decoding gets the rest of the
+ * cores. Stage times are stamped under the records lock so the timeline can
+ * be read at any time.
+ */
+
+#include <sb7assetpipeline.h>
+
+#include <algorithm>
+
+namespace sb7
+{
+
+asset_pipeline::asset_pipeline()
+    : uploaded(0),
+      to_read((size_t)-1),
+      stopping(false),
+      t0(std::chrono::steady_clock::now())
+{
+
+}
+
+asset_pipeline::~asset_pipeline()
+{
+    stop();
+}
+
+void asset_pipeline::start(unsigned int count, unsigned int depth)
+{
+    unsigned int i;
+
+    stop();
+
+    if (count == 0)
+    {
+        // Leave a thread for the reader and one for the GL thread
+        count = std::thread::hardware_concurrency();
+        count = count > 2 ? count - 2 : 1;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(records_lock);
+        records.clear();
+        uploaded = 0;
+    }
+
+    to_read.reopen((size_t)-1);
+    to_decode.reopen(depth);
+    to_upload.reopen(depth);
+
+    stopping = false;
+    t0 = std::chrono::steady_clock::now();
+
+    io.init();
+
+    reader = std::thread(read_main, this);
+    for (i = 0; i < count; i++)
+        decoders.push_back(std::thread(decode_main, this));
+}
+
+void asset_pipeline::stop()
+{
+    size_t i;
+
+    if (!reader.joinable())
+        return;
+
+    stopping = true;
+    to_read.close();
+    to_decode.close();
+    to_upload.close();
+
+    reader.join();
+    for (i = 0; i < decoders.size(); i++)
+        decoders[i].join();
+
+    decoders.clear();
+    io.shutdown();
+}
+
+double asset_pipeline::now() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void asset_pipeline::stamp(double& at)
+{
+    double t = now();
+
+    std::lock_guard<std::mutex> l(records_lock);
+    at = t;
+}
+
+void asset_pipeline::add(const char * name, const char * path,
+                         const decode_proc& decode, const upload_proc& upload)
+{
+    record * r;
+
+    {
+        std::lock_guard<std::mutex> l(records_lock);
+
+        records.push_back(record());
+        r = &records.back();
+
+        r->name = name ? name : (path ? path : "");
+        r->path = path ? path : "";
+        r->decode = decode;
+        r->upload = upload;
+
+        r->times.name = r->name;
+        r->times.bytes = 0;
+        r->times.read_start = r->times.read_end = -1.0;
+        r->times.decode_start = r->times.decode_end = -1.0;
+        r->times.upload_start = r->times.upload_end = -1.0;
+    }
+
+    to_read.push(r);
+}
+
+void asset_pipeline::read_main(asset_pipeline * self)
+{
+    std::vector<record *> reading;
+    std::vector<std::string> paths;
+    record * r;
+
+    while (!self->stopping && self->to_read.pop(r))
+    {
+        size_t k;
+
+        // Whatever else is queued by now goes in the same batch
+        reading.assign(1, r);
+        while (self->to_read.try_pop(r))
+            reading.push_back(r);
+
+        paths.clear();
+        for (k = 0; k < reading.size(); k++)
+        {
+            self->stamp(reading[k]->times.read_start);
+
+            if (!reading[k]->path.empty())
+            {
+                reading[paths.size()] = reading[k];
+                paths.push_back(reading[k]->path);
+                continue;
+            }
+
+            // Nothing to read
+            item i;
+
+            i.asset = reading[k];
+            self->stamp(i.asset->times.read_end);
+
+            if (!self->to_decode.push(i))
+                return;
+        }
+
+        reading.resize(paths.size());
+
+        self->io.read_batch(paths, [self, &reading](unsigned int index, const unsigned char * data, size_t size, bool ok)
+        {
+            item i;
+
+            i.asset = reading[index];
+            if (ok)
+                i.data.assign(data, data + size);
+
+            self->stamp(i.asset->times.read_end);
+
+            {
+                std::lock_guard<std::mutex> l(self->records_lock);
+                i.asset->times.bytes = i.data.size();
+            }
+
+            // Waits here while the decoders are behind. Once stopped the
+            // rest of the batch is read and dropped.
+            self->to_decode.push(i);
+        });
+    }
+}
+
+void asset_pipeline::decode_main(asset_pipeline * self)
+{
+    item i;
+
+    while (!self->stopping && self->to_decode.pop(i))
+    {
+        record * r = i.asset;
+
+        self->stamp(r->times.decode_start);
+        if (r->decode)
+            r->decode(i.data);
+        self->stamp(r->times.decode_end);
+
+        // Decoded bytes have been kept by now if they were wanted
+        i.data.clear();
+        i.data.shrink_to_fit();
+
+        // Waits here while the GL thread is behind
+        if (!self->to_upload.push(i))
+            break;
+    }
+}
+
+void asset_pipeline::run_upload(item& i)
+{
+    record * r = i.asset;
+
+    stamp(r->times.upload_start);
+    if (r->upload)
+        r->upload();
+    stamp(r->times.upload_end);
+
+    uploaded++;
+}
+
+unsigned int asset_pipeline::process(double budget)
+{
+    double start = now();
+    item i;
+
+    while (to_upload.try_pop(i))
+    {
+        run_upload(i);
+
+        if (budget > 0.0 && now() - start >= budget)
+            break;
+    }
+
+    std::lock_guard<std::mutex> l(records_lock);
+    return (unsigned int)records.size() - uploaded;
+}
+
+void asset_pipeline::finish()
+{
+    item i;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> l(records_lock);
+            if (uploaded == records.size())
+                break;
+        }
+
+        if (!to_upload.pop(i))
+            break;
+
+        run_upload(i);
+    }
+}
+
+void asset_pipeline::get_timeline(std::vector<timeline_entry>& timeline)
+{
+    size_t i;
+
+    std::lock_guard<std::mutex> l(records_lock);
+
+    timeline.resize(records.size());
+    for (i = 0; i < records.size(); i++)
+        timeline[i] = records[i].times;
+}
+
+void asset_pipeline::print_timeline(FILE * out)
+{
+    std::vector<timeline_entry> timeline;
+    double busy[3] = { 0.0, 0.0, 0.0 };
+    double first = -1.0, last = -1.0;
+    size_t i;
+
+    get_timeline(timeline);
+
+    fprintf(out, "%-24s %10s %17s %17s %17s\n", "asset", "bytes", "read (ms)", "decode (ms)", "upload (ms)");
+
+    for (i = 0; i < timeline.size(); i++)
+    {
+        const timeline_entry& e = timeline[i];
+
+        fprintf(out, "%-24s %10u %8.2f-%8.2f %8.2f-%8.2f %8.2f-%8.2f\n",
+                e.name.c_str(), (unsigned int)e.bytes,
+                e.read_start * 1000.0, e.read_end * 1000.0,
+                e.decode_start * 1000.0, e.decode_end * 1000.0,
+                e.upload_start * 1000.0, e.upload_end * 1000.0);
+
+        if (e.read_start < 0.0 || e.upload_end < 0.0)
+            continue;
+
+        busy[0] += e.read_end - e.read_start;
+        busy[1] += e.decode_end - e.decode_start;
+        busy[2] += e.upload_end - e.upload_start;
+
+        if (first < 0.0 || e.read_start < first)
+            first = e.read_start;
+        last = std::max(last, e.upload_end);
+    }
+
+    fprintf(out, "busy: read %.2f ms, decode %.2f ms, upload %.2f ms (sum %.2f ms)\n",
+            busy[0] * 1000.0, busy[1] * 1000.0, busy[2] * 1000.0,
+            (busy[0] + busy[1] + busy[2]) * 1000.0);
+    if (first >= 0.0)
+        fprintf(out, "wall: %.2f ms, reads through %s\n", (last - first) * 1000.0, io.backend_name());
+}
+
+bool asset_pipeline::write_trace(const char * filename)
+{
+    static const char * const stage_names[3] = { "read", "decode", "upload" };
+
+    std::vector<timeline_entry> timeline;
+    bool comma = false;
+    FILE * f;
+    size_t i;
+    int s;
+
+    get_timeline(timeline);
+
+    f = fopen(filename, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+
+    for (i = 0; i < timeline.size(); i++)
+    {
+        const timeline_entry& e = timeline[i];
+        const double starts[3] = { e.read_start, e.decode_start, e.upload_start };
+        const double ends[3] = { e.read_end, e.decode_end, e.upload_end };
+        std::string name;
+        size_t c;
+
+        // Names are file names, only quotes and backslashes need escaping
+        for (c = 0; c < e.name.size(); c++)
+        {
+            if (e.name[c] == '"' || e.name[c] == '\\')
+                name += '\\';
+            name += e.name[c];
+        }
+
+        for (s = 0; s < 3; s++)
+        {
+            if (starts[s] < 0.0 || ends[s] < 0.0)
+                continue;
+
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}",
+                    comma ? ",\n" : "", name.c_str(), stage_names[s], s,
+                    starts[s] * 1e6, (ends[s] - starts[s]) * 1e6);
+            comma = true;
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) == 0;
+}
+
+}
@@ -0,0 +1,331 @@
+/*
+ * Mesh cluster utility
+ *
+ * Triangles are ordered along a Morton (Z-order) curve through their
+ * centroids and the sorted list is cut into evenly sized runs. Neighbouring
+ * triangles on a Z-order curve are neighbours in space, which keeps the
+ * bounding spheres tight, and on mostly smooth surfaces it also keeps the
+ * normals of a cluster close together so the normal cone stays narrow.
+ */
+
+#include <sb7cluster.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+namespace sb7
+{
+
+namespace cluster
+{
+
+static inline vmath::vec3 fetch(const float * positions, unsigned int stride, unsigned int index)
+{
+    const float * p = (const float *)((const char *)positions + (size_t)stride * index);
+
+    return vmath::vec3(p[0], p[1], p[2]);
+}
+
+// Component-wise box growth, done by hand since vmath's vector max
+// instantiates the scalar overload with the wrong template argument
+static inline void grow(vmath::vec3& lo, vmath::vec3& hi, const vmath::vec3& p)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (p[i] < lo[i]) lo[i] = p[i];
+        if (p[i] > hi[i]) hi[i] = p[i];
+    }
+}
+
+// Spread the low 10 bits of v so there are two zero bits between each
+static inline unsigned int part1by2(unsigned int v)
+{
+    v &= 0x000003FF;
+    v = (v ^ (v << 16)) & 0xFF0000FF;
+    v = (v ^ (v <<  8)) & 0x0300F00F;
+    v = (v ^ (v <<  4)) & 0x030C30C3;
+    v = (v ^ (v <<  2)) & 0x09249249;
+
+    return v;
+}
+
+struct sort_entry
+{
+    unsigned int    key;
+    unsigned int    triangle;
+
+    bool operator<(const sort_entry& that) const
+    {
+        return key < that.key || (key == that.key && triangle < that.triangle);
+    }
+};
+
+void build(const float * positions,
+           unsigned int position_stride,
+           const unsigned int * indices,
+           unsigned int index_count,
+           std::vector<unsigned int>& out_indices,
+           std::vector<SB6M_SUB_OBJECT_DECL>& sub_objects,
+           std::vector<SB6M_CLUSTER_DECL>& clusters,
+           unsigned int max_triangles)
+{
+    unsigned int triangle_count = index_count / 3;
+    unsigned int i;
+
+    out_indices.clear();
+    sub_objects.clear();
+    clusters.clear();
+
+    if (triangle_count == 0)
+        return;
+
+    if (max_triangles == 0)
+        max_triangles = MAX_TRIANGLES;
+
+    // Centroids and their bounding box, used to quantize for the Morton key
+    std::vector<vmath::vec3> centroids(triangle_count);
+    vmath::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+
+    for (i = 0; i < triangle_count; i++)
+    {
+        vmath::vec3 c = (fetch(positions, position_stride, indices[i * 3 + 0]) +
+                         fetch(positions, position_stride, indices[i * 3 + 1]) +
+                         fetch(positions, position_stride, indices[i * 3 + 2])) * (1.0f / 3.0f);
+        centroids[i] = c;
+        grow(lo, hi, c);
+    }
+
+    float extent = vmath::max(hi[0] - lo[0], vmath::max(hi[1] - lo[1], hi[2] - lo[2]));
+    float quantize = extent > 0.0f ? 1023.0f / extent : 0.0f;
+
+    std::vector<sort_entry> order(triangle_count);
+
+    for (i = 0; i < triangle_count; i++)
+    {
+        unsigned int x = (unsigned int)((centroids[i][0] - lo[0]) * quantize + 0.5f);
+        unsigned int y = (unsigned int)((centroids[i][1] - lo[1]) * quantize + 0.5f);
+        unsigned int z = (unsigned int)((centroids[i][2] - lo[2]) * quantize + 0.5f);
+
+        order[i].key = part1by2(x) | (part1by2(y) << 1) | (part1by2(z) << 2);
+        order[i].triangle = i;
+    }
+
+    std::sort(order.begin(), order.end());
+
+    out_indices.resize(triangle_count * 3);
+
+    for (i = 0; i < triangle_count; i++)
+    {
+        out_indices[i * 3 + 0] = indices[order[i].triangle * 3 + 0];
+        out_indices[i * 3 + 1] = indices[order[i].triangle * 3 + 1];
+        out_indices[i * 3 + 2] = indices[order[i].triangle * 3 + 2];
+    }
+
+    // Cut into evenly sized runs rather than N full clusters plus a runt
+    unsigned int cluster_count = (triangle_count + max_triangles - 1) / max_triangles;
+    unsigned int first_triangle = 0;
+
+    sub_objects.reserve(cluster_count);
+    clusters.reserve(cluster_count);
+
+    for (i = 0; i < cluster_count; i++)
+    {
+        unsigned int last_triangle = (unsigned int)(((unsigned long long)triangle_count * (i + 1)) / cluster_count);
+        SB6M_SUB_OBJECT_DECL decl;
+
+        decl.first = first_triangle * 3;
+        decl.count = (last_triangle - first_triangle) * 3;
+
+        sub_objects.push_back(decl);
+        clusters.push_back(compute_bounds(positions, position_stride, &out_indices[decl.first], decl.count));
+
+        first_triangle = last_triangle;
+    }
+}
+
+SB6M_CLUSTER_DECL compute_bounds(const float * positions,
+                                 unsigned int position_stride,
+                                 const unsigned int * indices,
+                                 unsigned int index_count)
+{
+    SB6M_CLUSTER_DECL result;
+    vmath::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    vmath::vec3 axis(0.0f);
+    unsigned int i;
+
+    memset(&result, 0, sizeof(result));
+
+    if (index_count < 3)
+    {
+        result.cone_cutoff = 1.0f;
+        return result;
+    }
+
+    for (i = 0; i < index_count; i++)
+    {
+        grow(lo, hi, fetch(positions, position_stride, indices[i]));
+    }
+
+    // Sphere around the box center, grown to hold every vertex
+    vmath::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+
+    for (i = 0; i < index_count; i++)
+    {
+        radius = vmath::max(radius, vmath::distance(fetch(positions, position_stride, indices[i]), center));
+    }
+
+    // Cone axis is the average facing direction, the half angle covers the
+    // normal furthest away from it
+    std::vector<vmath::vec3> normals;
+    normals.reserve(index_count / 3);
+
+    for (i = 0; i + 2 < index_count; i += 3)
+    {
+        vmath::vec3 a = fetch(positions, position_stride, indices[i + 0]);
+        vmath::vec3 b = fetch(positions, position_stride, indices[i + 1]);
+        vmath::vec3 c = fetch(positions, position_stride, indices[i + 2]);
+        vmath::vec3 n = vmath::cross(b - a, c - a);
+        float len = vmath::length(n);
+
+        if (len <= FLT_EPSILON)
+            continue;   // Degenerate, faces nowhere
+
+        n /= len;
+        normals.push_back(n);
+        axis += n;
+    }
+
+    float axis_length = vmath::length(axis);
+    float cutoff = 1.0f;
+
+    if (!normals.empty() && axis_length > FLT_EPSILON)
+    {
+        axis /= axis_length;
+
+        float min_dp = 1.0f;
+        for (i = 0; i < normals.size(); i++)
+        {
+            min_dp = vmath::min(min_dp, vmath::dot(axis, normals[i]));
+        }
+
+        // Normals spread over more than a hemisphere can't be rejected together
+        if (min_dp > 0.0f)
+        {
+            cutoff = sqrtf(1.0f - min_dp * min_dp);
+        }
+    }
+    else
+    {
+        axis = vmath::vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    result.center[0] = center[0];
+    result.center[1] = center[1];
+    result.center[2] = center[2];
+    result.radius = radius;
+    result.cone_axis[0] = axis[0];
+    result.cone_axis[1] = axis[1];
+    result.cone_axis[2] = axis[2];
+    result.cone_cutoff = cutoff;
+
+    return result;
+}
+
+void extract_frustum(const vmath::mat4& mvp, frustum& f)
+{
+    // Matrices are column major, so row r is (m[0][r], m[1][r], m[2][r], m[3][r])
+    vmath::vec4 row[4];
+    int r;
+
+    for (r = 0; r < 4; r++)
+    {
+        row[r] = vmath::vec4(mvp[0][r], mvp[1][r], mvp[2][r], mvp[3][r]);
+    }
+
+    f.planes[0] = row[3] + row[0];      // Left
+    f.planes[1] = row[3] - row[0];      // Right
+    f.planes[2] = row[3] + row[1];      // Bottom
+    f.planes[3] = row[3] - row[1];      // Top
+    f.planes[4] = row[3] + row[2];      // Near
+    f.planes[5] = row[3] - row[2];      // Far
+
+    for (r = 0; r < 6; r++)
+    {
+        float len = vmath::length(vmath::vec3(f.planes[r][0], f.planes[r][1], f.planes[r][2]));
+
+        if (len > 0.0f)
+        {
+            f.planes[r] /= len;
+        }
+    }
+}
+
+SB6M_CLUSTER_DECL transform(const SB6M_CLUSTER_DECL& c, const vmath::mat4& m)
+{
+    SB6M_CLUSTER_DECL result = c;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        result.center[i] = m[0][i] * c.center[0] + m[1][i] * c.center[1] + m[2][i] * c.center[2] + m[3][i];
+    }
+
+    // Non-uniform scale would skew the cone, so only the largest axis scale
+    // is honoured (the sphere stays conservative, the cone does not)
+    float scale = vmath::max(vmath::length(vmath::vec3(m[0][0], m[0][1], m[0][2])),
+                  vmath::max(vmath::length(vmath::vec3(m[1][0], m[1][1], m[1][2])),
+                             vmath::length(vmath::vec3(m[2][0], m[2][1], m[2][2]))));
+    result.radius = c.radius * scale;
+
+    vmath::vec3 axis;
+    for (i = 0; i < 3; i++)
+    {
+        axis[i] = m[0][i] * c.cone_axis[0] + m[1][i] * c.cone_axis[1] + m[2][i] * c.cone_axis[2];
+    }
+
+    float len = vmath::length(axis);
+    if (len > 0.0f)
+    {
+        axis /= len;
+    }
+
+    result.cone_axis[0] = axis[0];
+    result.cone_axis[1] = axis[1];
+    result.cone_axis[2] = axis[2];
+
+    return result;
+}
+
+bool is_visible(const SB6M_CLUSTER_DECL& c, const frustum& f, const vmath::vec3& eye)
+{
+    vmath::vec3 center(c.center[0], c.center[1], c.center[2]);
+    int i;
+
+    for (i = 0; i < 6; i++)
+    {
+        const vmath::vec4& p = f.planes[i];
+
+        if (p[0] * center[0] + p[1] * center[1] + p[2] * center[2] + p[3] < -c.radius)
+            return false;
+    }
+
+    // A cone cutoff of 1 can never pass the test below, skip the math
+    if (c.cone_cutoff >= 1.0f)
+        return true;
+
+    // Every triangle faces away if every point of the sphere is seen at more
+    // than 90 degrees from every normal in the cone. Bounding the view
+    // direction over the sphere conservatively gives:
+    //   dot(d, axis) - r > cutoff * (|d| + r)
+    vmath::vec3 d = center - eye;
+    vmath::vec3 axis(c.cone_axis[0], c.cone_axis[1], c.cone_axis[2]);
+
+    return vmath::dot(d, axis) - c.radius <= c.cone_cutoff * (vmath::length(d) + c.radius);
+}
+
+}
+
+}
@@ -0,0 +1,674 @@
+/*
+ * Batched file reader
+ *
+ * Files are packed into the staging buffer 4 KiB apart in waves: as many
+ * as fit go in one wave, and every read of the wave is kept in flight until
+ * the whole wave is in. Reads are split into chunks so a large file still
+ * spreads over the device queue. Short reads and EAGAIN are resubmitted.
+ */
+
+#include <sb7filereader.h>
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SB7_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef SB7_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace sb7
+{
+
+enum
+{
+    FILE_ALIGNMENT = 4096,              // Where each file starts in staging
+    THREAD_COUNT = 4                    // Fallback readers
+};
+
+static const size_t CHUNK_SIZE = 512 * 1024;   // Largest single read
+
+file_reader::file_reader()
+    : mode(BACKEND_NONE),
+      ring_fd(-1),
+      sq_ring(NULL),
+      cq_ring(NULL),
+      sq_ring_size(0),
+      cq_ring_size(0),
+      sqes(NULL),
+      sqes_size(0),
+      sq_entries(0),
+      sq_head(NULL),
+      sq_tail(NULL),
+      sq_mask(NULL),
+      sq_array(NULL),
+      cq_head(NULL),
+      cq_tail(NULL),
+      cq_mask(NULL),
+      cqes(NULL),
+      registered(false),
+      staging(NULL),
+      staging_size(0),
+      running(false)
+{
+
+}
+
+file_reader::~file_reader()
+{
+    shutdown();
+}
+
+bool file_reader::init(size_t staging_bytes, unsigned int depth, bool force_threads)
+{
+    shutdown();
+
+    staging_size = (staging_bytes + FILE_ALIGNMENT - 1) & ~(size_t)(FILE_ALIGNMENT - 1);
+
+    if (!force_threads && init_uring(depth))
+    {
+        mode = BACKEND_IO_URING;
+        return true;
+    }
+
+    init_threads();
+
+    return true;
+}
+
+void file_reader::init_threads()
+{
+    unsigned int i;
+
+    running = true;
+    for (i = 0; i < THREAD_COUNT; i++)
+        workers.push_back(std::thread(worker_main, this));
+
+    mode = BACKEND_THREADS;
+}
+
+void file_reader::shutdown()
+{
+    size_t i;
+
+    if (mode == BACKEND_IO_URING)
+        shutdown_uring();
+
+    if (!workers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            running = false;
+        }
+        wake.notify_all();
+
+        for (i = 0; i < workers.size(); i++)
+            workers[i].join();
+
+        workers.clear();
+    }
+
+    mode = BACKEND_NONE;
+}
+
+const char * file_reader::backend_name() const
+{
+    switch (mode)
+    {
+        case BACKEND_IO_URING:
+            return registered ? "io_uring (registered buffers)" : "io_uring";
+        case BACKEND_THREADS:
+            return "threads";
+        default:
+            return "none";
+    }
+}
+
+unsigned int file_reader::read_batch(const std::vector<std::string>& paths, const done_proc& done)
+{
+    if (paths.empty())
+        return 0;
+
+#ifdef SB7_HAVE_IO_URING
+    if (mode == BACKEND_IO_URING)
+        return read_batch_uring(paths, done);
+#endif
+
+    if (mode == BACKEND_THREADS)
+        return read_batch_threads(paths, done);
+
+    return 0;
+}
+
+#ifdef SB7_HAVE_IO_URING
+
+bool file_reader::init_uring(unsigned int depth)
+{
+    io_uring_params p;
+    iovec iov;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+
+    fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (fd < 0)
+        return false;
+
+    ring_fd = fd;
+    sq_entries = p.sq_entries;
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    // Newer kernels map both rings in one go
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (cq_ring_size > sq_ring_size)
+            sq_ring_size = cq_ring_size;
+        cq_ring_size = sq_ring_size;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        sq_ring = NULL;
+        goto fail;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq_ring = sq_ring;
+    }
+    else
+    {
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            cq_ring = NULL;
+            goto fail;
+        }
+    }
+
+    sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        sqes = NULL;
+        goto fail;
+    }
+
+    sq_head = (unsigned int *)((char *)sq_ring + p.sq_off.head);
+    sq_tail = (unsigned int *)((char *)sq_ring + p.sq_off.tail);
+    sq_mask = (unsigned int *)((char *)sq_ring + p.sq_off.ring_mask);
+    sq_array = (unsigned int *)((char *)sq_ring + p.sq_off.array);
+    cq_head = (unsigned int *)((char *)cq_ring + p.cq_off.head);
+    cq_tail = (unsigned int *)((char *)cq_ring + p.cq_off.tail);
+    cq_mask = (unsigned int *)((char *)cq_ring + p.cq_off.ring_mask);
+    cqes = (char *)cq_ring + p.cq_off.cqes;
+
+    staging = (unsigned char *)mmap(NULL, staging_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((void *)staging == MAP_FAILED)
+    {
+        staging = NULL;
+        goto fail;
+    }
+
+    // Registering pins the staging pages so reads skip mapping them every
+    // time. It can fail against RLIMIT_MEMLOCK, plain reads still work then.
+    iov.iov_base = staging;
+    iov.iov_len = staging_size;
+    registered = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    return true;
+
+fail:
+    shutdown_uring();
+
+    return false;
+}
+
+void file_reader::shutdown_uring()
+{
+    if (registered)
+        syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    registered = false;
+
+    if (staging)
+        munmap(staging, staging_size);
+    if (sqes)
+        munmap(sqes, sqes_size);
+    if (cq_ring && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring)
+        munmap(sq_ring, sq_ring_size);
+    if (ring_fd >= 0)
+        close(ring_fd);
+
+    staging = NULL;
+    sqes = NULL;
+    cq_ring = NULL;
+    sq_ring = NULL;
+    ring_fd = -1;
+}
+
+unsigned int file_reader::read_batch_uring(const std::vector<std::string>& paths, const done_proc& done)
+{
+    struct file_state
+    {
+        int                         fd;
+        size_t                      size;
+        size_t                      submitted;      // Bytes asked for so far
+        size_t                      completed;      // Bytes that have arrived
+        unsigned int                in_flight;
+        unsigned char *             dest;
+        std::vector<unsigned char>  own;            // Files too big for staging
+        bool                        failed;
+    };
+
+    struct read_op
+    {
+        unsigned int                file;
+        size_t                      offset;
+        size_t                      length;
+    };
+
+    std::vector<file_state> files(paths.size());
+    std::vector<read_op> ops;
+    std::vector<unsigned int> free_ops;
+    std::deque<unsigned int> retry;
+    std::vector<unsigned int> wave;
+    unsigned int next_file = 0;
+    unsigned int read_ok = 0;
+    unsigned int i;
+
+    // Opening is still one call per file, but it only touches metadata
+    for (i = 0; i < paths.size(); i++)
+    {
+        file_state& f = files[i];
+        struct stat st;
+
+        f.fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+        f.size = 0;
+        f.submitted = 0;
+        f.completed = 0;
+        f.in_flight = 0;
+        f.dest = NULL;
+        f.failed = f.fd < 0 || fstat(f.fd, &st) != 0;
+
+        if (!f.failed)
+            f.size = (size_t)st.st_size;
+    }
+
+    while (next_file < files.size())
+    {
+        size_t used = 0;
+        unsigned int submit_cursor = 0;
+        unsigned int wave_left;
+        unsigned int in_flight = 0;
+
+        // Pack as many files into staging as fit
+        wave.clear();
+        while (next_file < files.size())
+        {
+            file_state& f = files[next_file];
+
+            if (f.failed || f.size == 0)
+            {
+                if (f.fd >= 0)
+                    close(f.fd);
+                f.fd = -1;
+                done(next_file, staging, 0, !f.failed);
+                read_ok += !f.failed;
+                next_file++;
+                continue;
+            }
+
+            if (f.size > staging_size)
+            {
+                // Gets a wave of its own
+                if (!wave.empty())
+                    break;
+
+                f.own.resize(f.size);
+                f.dest = &f.own[0];
+                wave.push_back(next_file++);
+                break;
+            }
+
+            if (used + f.size > staging_size)
+                break;
+
+            f.dest = staging + used;
+            used += (f.size + FILE_ALIGNMENT - 1) & ~(size_t)(FILE_ALIGNMENT - 1);
+            wave.push_back(next_file++);
+        }
+
+        wave_left = (unsigned int)wave.size();
+
+        while (wave_left)
+        {
+            unsigned int tail = *sq_tail;
+            unsigned int head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            unsigned int to_submit = 0;
+            int result;
+
+            // Keep the device queue full: retries first, then new chunks.
+            // in_flight never passes sq_entries, so the CQ can't overflow.
+            while (in_flight < sq_entries && tail - head < sq_entries)
+            {
+                unsigned int op_index;
+                io_uring_sqe * sqe;
+
+                if (!retry.empty())
+                {
+                    op_index = retry.front();
+                    retry.pop_front();
+
+                    // The file may have failed (and been closed) meanwhile
+                    if (files[ops[op_index].file].failed || files[ops[op_index].file].fd < 0)
+                    {
+                        free_ops.push_back(op_index);
+                        continue;
+                    }
+                }
+                else
+                {
+                    while (submit_cursor < wave.size() &&
+                           (files[wave[submit_cursor]].failed ||
+                            files[wave[submit_cursor]].submitted == files[wave[submit_cursor]].size))
+                        submit_cursor++;
+
+                    if (submit_cursor == wave.size())
+                        break;
+
+                    file_state& f = files[wave[submit_cursor]];
+                    read_op op;
+
+                    op.file = wave[submit_cursor];
+                    op.offset = f.submitted;
+                    op.length = f.size - f.submitted < CHUNK_SIZE ? f.size - f.submitted : CHUNK_SIZE;
+                    f.submitted += op.length;
+
+                    if (free_ops.empty())
+                    {
+                        op_index = (unsigned int)ops.size();
+                        ops.push_back(op);
+                    }
+                    else
+                    {
+                        op_index = free_ops.back();
+                        free_ops.pop_back();
+                        ops[op_index] = op;
+                    }
+                }
+
+                const read_op& op = ops[op_index];
+                file_state& f = files[op.file];
+
+                sqe = (io_uring_sqe *)sqes + (tail & *sq_mask);
+                memset(sqe, 0, sizeof(*sqe));
+
+                // Fixed reads only work inside the registered staging
+                sqe->opcode = (registered && f.own.empty()) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+                sqe->fd = f.fd;
+                sqe->addr = (unsigned long long)(f.dest + op.offset);
+                sqe->len = (unsigned int)op.length;
+                sqe->off = op.offset;
+                sqe->buf_index = 0;
+                sqe->user_data = op_index;
+
+                sq_array[tail & *sq_mask] = tail & *sq_mask;
+                tail++;
+
+                f.in_flight++;
+                in_flight++;
+                to_submit++;
+            }
+
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+            result = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, in_flight ? 1 : 0,
+                                  IORING_ENTER_GETEVENTS, NULL, 0);
+            if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                // The ring is unusable. Whatever it hasn't finished (a file
+                // in this wave that is still open, or any file after it) is
+                // read again by the threads, which take over from here.
+                std::vector<std::string> rest;
+                std::vector<unsigned int> rest_index;
+
+                for (i = 0; i < wave.size(); i++)
+                {
+                    file_state& f = files[wave[i]];
+
+                    if (f.fd < 0)
+                        continue;
+
+                    close(f.fd);
+                    f.fd = -1;
+                    rest.push_back(paths[wave[i]]);
+                    rest_index.push_back(wave[i]);
+                }
+                for (; next_file < files.size(); next_file++)
+                {
+                    if (files[next_file].fd >= 0)
+                        close(files[next_file].fd);
+                    files[next_file].fd = -1;
+                    rest.push_back(paths[next_file]);
+                    rest_index.push_back(next_file);
+                }
+
+                // The threads read into buffers of their own, not staging
+                shutdown_uring();
+                init_threads();
+
+                return read_ok + read_batch_threads(rest,
+                    [&](unsigned int index, const unsigned char * data, size_t size, bool ok)
+                    {
+                        done(rest_index[index], data, size, ok);
+                    });
+            }
+
+            // Reap everything that has completed
+            head = *cq_head;
+            while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe * cqe = (const io_uring_cqe *)cqes + (head & *cq_mask);
+                unsigned int op_index = (unsigned int)cqe->user_data;
+                int res = cqe->res;
+                read_op& op = ops[op_index];
+                file_state& f = files[op.file];
+                bool again = false;
+
+                head++;
+                in_flight--;
+                f.in_flight--;
+
+                if (res == -EAGAIN || res == -EINTR)
+                {
+                    again = true;
+                }
+                else if (res <= 0)
+                {
+                    // An error, or the file got shorter since fstat
+                    f.failed = true;
+                }
+                else
+                {
+                    f.completed += (size_t)res;
+
+                    if ((size_t)res < op.length)
+                    {
+                        op.offset += (size_t)res;
+                        op.length -= (size_t)res;
+                        again = true;
+                    }
+                }
+
+                // Nothing more is asked of a file that has failed
+                again = again && !f.failed;
+
+                if (again)
+                    retry.push_back(op_index);
+                else
+                    free_ops.push_back(op_index);
+
+                if (f.in_flight == 0 && !again && (f.failed || f.completed == f.size))
+                {
+                    close(f.fd);
+                    f.fd = -1;
+
+                    if (f.failed)
+                        done(op.file, NULL, 0, false);
+                    else
+                        done(op.file, f.dest, f.size, true);
+
+                    read_ok += !f.failed;
+                    f.own.clear();
+                    f.own.shrink_to_fit();
+                    wave_left--;
+                }
+            }
+
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    return read_ok;
+}
+
+#else
+
+bool file_reader::init_uring(unsigned int depth)
+{
+    return false;
+}
+
+void file_reader::shutdown_uring()
+{
+
+}
+
+unsigned int file_reader::read_batch_uring(const std::vector<std::string>& paths, const done_proc& done)
+{
+    return 0;
+}
+
+#endif
+
+static bool read_whole_file(const std::string& path, std::vector<unsigned char>& data)
+{
+    FILE * f;
+    long size;
+    bool ok = false;
+
+    f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+
+    if (fseek(f, 0, SEEK_END) != 0)
+        goto done;
+
+    size = ftell(f);
+    if (size < 0 || fseek(f, 0, SEEK_SET) != 0)
+        goto done;
+
+    data.resize((size_t)size);
+    ok = size == 0 || fread(&data[0], 1, (size_t)size, f) == (size_t)size;
+
+done:
+    fclose(f);
+
+    return ok;
+}
+
+void file_reader::worker_main(file_reader * self)
+{
+    for (;;)
+    {
+        job * j;
+
+        {
+            std::unique_lock<std::mutex> l(self->lock);
+
+            while (self->todo.empty() && self->running)
+                self->wake.wait(l);
+
+            if (self->todo.empty())
+                break;
+
+            j = self->todo.front();
+            self->todo.pop_front();
+        }
+
+        j->ok = read_whole_file(*j->path, j->data);
+
+        {
+            std::lock_guard<std::mutex> l(self->lock);
+            self->done_jobs.push_back(j);
+        }
+        self->finished.notify_one();
+    }
+}
+
+unsigned int file_reader::read_batch_threads(const std::vector<std::string>& paths, const done_proc& done)
+{
+    unsigned int left = (unsigned int)paths.size();
+    unsigned int read_ok = 0;
+    unsigned int i;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        for (i = 0; i < paths.size(); i++)
+        {
+            job * j = new job;
+
+            j->path = &paths[i];
+            j->index = i;
+            j->ok = false;
+            todo.push_back(j);
+        }
+    }
+    wake.notify_all();
+
+    while (left)
+    {
+        job * j;
+
+        {
+            std::unique_lock<std::mutex> l(lock);
+
+            while (done_jobs.empty())
+                finished.wait(l);
+
+            j = done_jobs.front();
+            done_jobs.pop_front();
+        }
+
+        if (j->ok)
+            done(j->index, j->data.empty() ? NULL : &j->data[0], j->data.size(), true);
+        else
+            done(j->index, NULL, 0, false);
+
+        read_ok += j->ok;
+        left--;
+        delete j;
+    }
+
+    return read_ok;
+}
+
+}
@@ -0,0 +1,493 @@
+/*
+ * Job system
+ *
+ * Each deque has its own lock; jobs are coarse enough (a load, a batch of
+ * clusters, a chunk of a loop) that the lock is never the bottleneck, and
+ * it keeps stealing simple. Idle workers sleep on a condition variable
+ * until something is queued.
+ */
+
+#include <sb7jobs.h>
+
+#include <chrono>
+
+namespace sb7
+{
+
+struct job_entry
+{
+    std::function<void()>   fn;
+    job_counter *           done;
+    bool                    main;
+};
+
+// Which worker of which pool the current thread is, if any
+static thread_local job_system * current_pool = NULL;
+static thread_local int current_worker = -1;
+
+static unsigned long long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+job_system::job_system()
+    : next_worker(0),
+      queued(0),
+      running(false),
+      stats_start_ns(0)
+{
+
+}
+
+job_system::~job_system()
+{
+    stop();
+}
+
+void job_system::start(unsigned int count)
+{
+    unsigned int i;
+
+    stop();
+
+    if (count == 0)
+    {
+        count = std::thread::hardware_concurrency();
+        count = count > 1 ? count - 1 : 1;
+    }
+
+    main_thread = std::this_thread::get_id();
+    running = true;
+    stats_start_ns = now_ns();
+
+    for (i = 0; i < count; i++)
+    {
+        worker * w = new worker;
+        w->run = 0;
+        w->steals = 0;
+        w->busy_ns = 0;
+        workers.push_back(w);
+    }
+
+    // Only start threads once every deque exists, they steal from all of them
+    for (i = 0; i < count; i++)
+        workers[i]->thread = std::thread(worker_main, this, (int)i);
+}
+
+void job_system::stop()
+{
+    unsigned int i;
+
+    if (workers.empty())
+        return;
+
+    // Workers only leave once their deques are empty
+    {
+        std::lock_guard<std::mutex> l(sleep_lock);
+        running = false;
+    }
+    wake.notify_all();
+
+    // Everyone steals from everyone, so no deque goes until all are done
+    for (i = 0; i < workers.size(); i++)
+        workers[i]->thread.join();
+
+    for (i = 0; i < workers.size(); i++)
+        delete workers[i];
+
+    workers.clear();
+
+    // Main thread jobs nobody got round to
+    run_main_jobs();
+}
+
+void job_system::run(const std::function<void()>& fn, job_counter * done, job_counter * after)
+{
+    job * j = new job;
+
+    j->fn = fn;
+    j->done = done;
+    j->main = false;
+
+    if (done)
+        done->count++;
+
+    if (after)
+    {
+        std::lock_guard<std::mutex> l(after->lock);
+
+        // Checked under the lock, which finish() takes once the count hits zero
+        if (after->count != 0)
+        {
+            after->waiting.push_back(j);
+            return;
+        }
+    }
+
+    submit(j);
+}
+
+void job_system::run_on_main(const std::function<void()>& fn, job_counter * done, job_counter * after)
+{
+    job * j = new job;
+
+    j->fn = fn;
+    j->done = done;
+    j->main = true;
+
+    if (done)
+        done->count++;
+
+    if (after)
+    {
+        std::lock_guard<std::mutex> l(after->lock);
+
+        if (after->count != 0)
+        {
+            after->waiting.push_back(j);
+            return;
+        }
+    }
+
+    submit(j);
+}
+
+void job_system::submit(job * j)
+{
+    if (j->main)
+    {
+        std::lock_guard<std::mutex> l(main_lock);
+        main_jobs.push_back(j);
+        return;
+    }
+
+    enqueue(j);
+}
+
+void job_system::enqueue(job * j)
+{
+    worker * w;
+
+    // No workers (not started, or stopped): whoever waits runs it
+    if (workers.empty())
+    {
+        std::lock_guard<std::mutex> l(main_lock);
+        main_jobs.push_back(j);
+        return;
+    }
+
+    // Workers keep what they make, everyone else deals jobs out in turn
+    if (current_pool == this && current_worker >= 0)
+        w = workers[current_worker];
+    else
+        w = workers[next_worker++ % workers.size()];
+
+    {
+        std::lock_guard<std::mutex> l(w->lock);
+        w->jobs.push_back(j);
+    }
+
+    {
+        std::lock_guard<std::mutex> l(sleep_lock);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void job_system::finish(job * j)
+{
+    job_counter * c = j->done;
+
+    std::vector<job *> released;
+    size_t i;
+
+    delete j;
+
+    if (!c)
+        return;
+
+    // The count only drops under the lock, so a job being held back can't
+    // miss it reaching zero. c may be gone as soon as the lock is released.
+    {
+        std::lock_guard<std::mutex> l(c->lock);
+
+        if (--c->count == 0)
+            released.swap(c->waiting);
+    }
+
+    for (i = 0; i < released.size(); i++)
+        submit(released[i]);
+}
+
+job_system::job * job_system::find_job(int self, bool& stolen)
+{
+    size_t count = workers.size();
+    size_t i;
+    job * j = NULL;
+
+    stolen = false;
+
+    // Newest of our own first
+    if (self >= 0)
+    {
+        worker * w = workers[self];
+        std::lock_guard<std::mutex> l(w->lock);
+
+        if (!w->jobs.empty())
+        {
+            j = w->jobs.back();
+            w->jobs.pop_back();
+        }
+    }
+
+    // Then the oldest of someone else's, starting past ourselves so
+    // thieves spread out
+    for (i = 1; j == NULL && i <= count; i++)
+    {
+        worker * w = workers[(self + i) % count];
+        std::lock_guard<std::mutex> l(w->lock);
+
+        if (!w->jobs.empty())
+        {
+            j = w->jobs.front();
+            w->jobs.pop_front();
+            stolen = self >= 0;
+        }
+    }
+
+    if (j)
+        queued--;
+
+    return j;
+}
+
+bool job_system::run_one(int self)
+{
+    bool stolen;
+    job * j = find_job(self, stolen);
+
+    if (!j)
+        return false;
+
+    if (self >= 0)
+    {
+        worker * w = workers[self];
+        unsigned long long start = now_ns();
+
+        j->fn();
+
+        w->busy_ns += now_ns() - start;
+        w->run++;
+        if (stolen)
+            w->steals++;
+    }
+    else
+    {
+        j->fn();
+    }
+
+    finish(j);
+
+    return true;
+}
+
+void job_system::worker_main(job_system * self, int index)
+{
+    current_pool = self;
+    current_worker = index;
+
+    for (;;)
+    {
+        if (self->run_one(index))
+            continue;
+
+        std::unique_lock<std::mutex> l(self->sleep_lock);
+
+        if (self->queued == 0)
+        {
+            if (!self->running)
+                break;
+
+            self->wake.wait(l);
+        }
+    }
+
+    current_pool = NULL;
+    current_worker = -1;
+}
+
+unsigned int job_system::run_main_jobs()
+{
+    std::deque<job *> work;
+    unsigned int ran = 0;
+
+    {
+        std::lock_guard<std::mutex> l(main_lock);
+        work.swap(main_jobs);
+    }
+
+    while (!work.empty())
+    {
+        job * j = work.front();
+        work.pop_front();
+
+        j->fn();
+        finish(j);
+        ran++;
+    }
+
+    return ran;
+}
+
+void job_system::wait(job_counter& c)
+{
+    int self = (current_pool == this) ? current_worker : -1;
+    bool is_main = std::this_thread::get_id() == main_thread;
+
+    while (c.count != 0)
+    {
+        // Help out rather than block; the main thread also owes the main
+        // thread jobs (and, with no workers, all of them)
+        if (run_one(self))
+            continue;
+        if ((is_main || workers.empty()) && run_main_jobs())
+            continue;
+
+        std::this_thread::yield();
+    }
+
+    // Let the job that finished c let go of its lock before c is destroyed
+    std::lock_guard<std::mutex> l(c.lock);
+}
+
+void job_system::parallel_for(unsigned int begin,
+                              unsigned int end,
+                              unsigned int grain,
+                              const std::function<void(unsigned int, unsigned int)>& fn)
+{
+    job_counter c;
+    unsigned int first;
+
+    if (end <= begin)
+        return;
+
+    // About four chunks per thread balances well without flooding the deques
+    if (grain == 0)
+    {
+        unsigned int chunks = ((unsigned int)workers.size() + 1) * 4;
+        grain = (end - begin + chunks - 1) / chunks;
+        if (grain == 0)
+            grain = 1;
+    }
+
+    for (first = begin; first < end; first += grain)
+    {
+        unsigned int last = end - first > grain ? first + grain : end;
+
+        run([&fn, first, last]{ fn(first, last); }, &c);
+    }
+
+    wait(c);
+}
+
+void job_system::get_stats(std::vector<worker_stats>& stats, bool reset)
+{
+    unsigned long long now = now_ns();
+    double elapsed = (now - stats_start_ns) * 1e-9;
+    size_t i;
+
+    stats.resize(workers.size());
+
+    for (i = 0; i < workers.size(); i++)
+    {
+        worker * w = workers[i];
+
+        stats[i].jobs = w->run;
+        stats[i].steals = w->steals;
+        stats[i].busy_seconds = w->busy_ns * 1e-9;
+        stats[i].utilization = elapsed > 0.0 ? stats[i].busy_seconds / elapsed : 0.0;
+
+        if (reset)
+        {
+            w->run = 0;
+            w->steals = 0;
+            w->busy_ns = 0;
+        }
+    }
+
+    if (reset)
+        stats_start_ns = now;
+}
+
+// Enough arithmetic to be worth spreading out, without touching memory
+static float benchmark_work(unsigned int i)
+{
+    float x = (float)i;
+    int k;
+
+    for (k = 0; k < 256; k++)
+        x = x * 0.999f + 1.0f;
+
+    return x;
+}
+
+job_system::benchmark_result job_system::benchmark(unsigned int jobs)
+{
+    benchmark_result result;
+    unsigned long long start;
+    unsigned int i;
+
+    result.workers = (unsigned int)workers.size();
+
+    // Empty jobs: pure scheduling overhead
+    {
+        job_counter c;
+
+        start = now_ns();
+        for (i = 0; i < jobs; i++)
+            run([]{}, &c);
+        wait(c);
+
+        result.ns_per_job = (double)(now_ns() - start) / jobs;
+    }
+
+    // A chain where each job waits on the last: hand-off latency
+    {
+        unsigned int links = jobs / 10 ? jobs / 10 : 1;
+        std::vector<job_counter> chain(links);
+
+        start = now_ns();
+        for (i = 0; i < links; i++)
+            run([]{}, &chain[i], i ? &chain[i - 1] : NULL);
+        wait(chain[links - 1]);
+
+        result.ns_per_dependency = (double)(now_ns() - start) / links;
+    }
+
+    // The same loop serially and through parallel_for
+    {
+        std::vector<float> out(jobs);
+        unsigned long long serial;
+
+        start = now_ns();
+        for (i = 0; i < jobs; i++)
+            out[i] = benchmark_work(i);
+        serial = now_ns() - start;
+
+        start = now_ns();
+        parallel_for(0, jobs, 0, [&out](unsigned int first, unsigned int last)
+        {
+            unsigned int k;
+
+            for (k = first; k < last; k++)
+                out[k] = benchmark_work(k);
+        });
+
+        result.parallel_for_speedup = (double)serial / (double)(now_ns() - start);
+    }
+
+    return result;
+}
+
+}
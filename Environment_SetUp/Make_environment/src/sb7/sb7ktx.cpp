@@ -22,14 +22,20 @@
  */
 
 #include "sb7ktx.h"
+#include "sb7vfs.h"
 
 #ifdef _MSC_VER
 #define _CRT_SECURE_NO_WARNINGS 1
 #endif /* _MSC_VER */
 
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 // #include <sb7.h>
 
@@ -81,57 +87,272 @@ static const unsigned short swap16(const unsigned short u16)
     return b.u16;
 }
 
-static unsigned int calculate_stride(const header& h, unsigned int width, unsigned int pad = 4)
+// Number of levels in a full mip chain
+static unsigned int calculate_mip_levels(const header& h)
 {
-    unsigned int channels = 0;
+    unsigned int size = h.pixelwidth;
+    unsigned int levels = 1;
 
-    switch (h.glbaseinternalformat)
+    if (h.pixelheight > size)
+        size = h.pixelheight;
+    if (h.pixeldepth > size)
+        size = h.pixeldepth;
+
+    while (size >>= 1)
+        levels++;
+
+    return levels;
+}
+
+static void swap_image(unsigned char * data, unsigned int size, unsigned int type_size)
+{
+    unsigned int i;
+
+    if (type_size == 2)
     {
-        case GL_RED:    channels = 1;
-            break;
-        case GL_RG:     channels = 2;
-            break;
+        unsigned short * p = (unsigned short *)data;
+        for (i = 0; i < size / 2; i++)
+            p[i] = swap16(p[i]);
+    }
+    else if (type_size == 4)
+    {
+        unsigned int * p = (unsigned int *)data;
+        for (i = 0; i < size / 4; i++)
+            p[i] = swap32(p[i]);
+    }
+}
+
+// Bytes per component (or per pixel for packed types), zero if unknown
+static unsigned int calculate_type_size(GLenum type, bool& packed)
+{
+    packed = false;
+
+    switch (type)
+    {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT:
+            return 2;
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+        case GL_FLOAT:
+            return 4;
+        case GL_UNSIGNED_BYTE_3_3_2:
+        case GL_UNSIGNED_BYTE_2_3_3_REV:
+            packed = true;
+            return 1;
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_5_6_5_REV:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+        case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+            packed = true;
+            return 2;
+        case GL_UNSIGNED_INT_8_8_8_8:
+        case GL_UNSIGNED_INT_8_8_8_8_REV:
+        case GL_UNSIGNED_INT_10_10_10_2:
+        case GL_UNSIGNED_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_10F_11F_11F_REV:
+        case GL_UNSIGNED_INT_5_9_9_9_REV:
+        case GL_UNSIGNED_INT_24_8:
+            packed = true;
+            return 4;
+        case GL_FLOAT_32_UNSIGNED_INT_24_8_REV:
+            packed = true;
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static unsigned int calculate_channels(GLenum format)
+{
+    switch (format)
+    {
+        case GL_RED:
+        case GL_RED_INTEGER:
+        case GL_DEPTH_COMPONENT:
+        case GL_STENCIL_INDEX:
+            return 1;
+        case GL_RG:
+        case GL_RG_INTEGER:
+        case GL_DEPTH_STENCIL:
+            return 2;
+        case GL_RGB:
         case GL_BGR:
-        case GL_RGB:    channels = 3;
-            break;
+        case GL_RGB_INTEGER:
+        case GL_BGR_INTEGER:
+            return 3;
+        case GL_RGBA:
         case GL_BGRA:
-        case GL_RGBA:   channels = 4;
-            break;
+        case GL_RGBA_INTEGER:
+        case GL_BGRA_INTEGER:
+            return 4;
+        default:
+            return 0;
     }
+}
+
+// Smallest imageSize an uncompressed level can have: one image (a cube
+// map face, or the whole level) with its rows padded to four bytes. Zero
+// when the file is compressed or its format or type isn't known here.
+static uint64_t calculate_image_size(const header& h, GLenum target, unsigned int level)
+{
+    uint64_t width = h.pixelwidth >> level;
+    uint64_t height = h.pixelheight >> level;
+    uint64_t depth = h.pixeldepth >> level;
+    uint64_t layers = (uint64_t)h.arrayelements * (target == GL_TEXTURE_CUBE_MAP_ARRAY ? 6 : 1);
+    unsigned int pixel_size;
+    bool packed;
+
+    if (h.gltype == GL_NONE)
+        return 0;
+
+    pixel_size = calculate_type_size(h.gltype, packed);
+    if (!packed)
+        pixel_size *= calculate_channels(h.glformat);
 
-    unsigned int stride = h.gltypesize * channels * width;
+    if (!width)
+        width = 1;
+    if (!height)
+        height = 1;
+    if (!depth)
+        depth = 1;
 
-    stride = (stride + (pad - 1)) & ~(pad - 1);
+    uint64_t row = (width * pixel_size + 3) & ~(uint64_t)3;
 
-    return stride;
+    switch (target)
+    {
+        case GL_TEXTURE_1D:             return row;
+        case GL_TEXTURE_1D_ARRAY:       return row * layers;
+        case GL_TEXTURE_3D:             return row * height * depth;
+        case GL_TEXTURE_2D_ARRAY:
+        case GL_TEXTURE_CUBE_MAP_ARRAY: return row * height * layers;
+        default:                        return row * height;
+    }
 }
 
-static unsigned int calculate_face_size(const header& h)
+// Uploads one image (a whole level, or one face of a non-array cube map).
+// layers is the array size (times six for cube map arrays), or zero.
+static void upload_image(GLenum target, GLenum face, const header& h, unsigned int level,
+                         unsigned int width, unsigned int height, unsigned int depth, unsigned int layers,
+                         const unsigned char * data, unsigned int image_size)
 {
-    unsigned int stride = calculate_stride(h, h.pixelwidth);
+    bool compressed = (h.gltype == GL_NONE);
+
+    switch (target)
+    {
+        case GL_TEXTURE_1D:
+            if (compressed)
+                glCompressedTexSubImage1D(target, level, 0, width, h.glinternalformat, image_size, data);
+            else
+                glTexSubImage1D(target, level, 0, width, h.glformat, h.gltype, data);
+            break;
+        case GL_TEXTURE_1D_ARRAY:
+            if (compressed)
+                glCompressedTexSubImage2D(target, level, 0, 0, width, layers, h.glinternalformat, image_size, data);
+            else
+                glTexSubImage2D(target, level, 0, 0, width, layers, h.glformat, h.gltype, data);
+            break;
+        case GL_TEXTURE_2D:
+        case GL_TEXTURE_CUBE_MAP:
+            if (compressed)
+                glCompressedTexSubImage2D(face, level, 0, 0, width, height, h.glinternalformat, image_size, data);
+            else
+                glTexSubImage2D(face, level, 0, 0, width, height, h.glformat, h.gltype, data);
+            break;
+        case GL_TEXTURE_3D:
+            if (compressed)
+                glCompressedTexSubImage3D(target, level, 0, 0, 0, width, height, depth, h.glinternalformat, image_size, data);
+            else
+                glTexSubImage3D(target, level, 0, 0, 0, width, height, depth, h.glformat, h.gltype, data);
+            break;
+        case GL_TEXTURE_2D_ARRAY:
+        case GL_TEXTURE_CUBE_MAP_ARRAY:
+            if (compressed)
+                glCompressedTexSubImage3D(target, level, 0, 0, 0, width, height, layers, h.glinternalformat, image_size, data);
+            else
+                glTexSubImage3D(target, level, 0, 0, 0, width, height, layers, h.glformat, h.gltype, data);
+            break;
+    }
+}
 
-    return stride * h.pixelheight;
+// Guess target (texture type). Files written to the spec store one face
+// for anything that isn't a cube map, older files stored zero.
+static GLenum guess_target(const header& h)
+{
+    if (h.pixelheight == 0)
+    {
+        if (h.arrayelements == 0)
+        {
+            return GL_TEXTURE_1D;
+        }
+        else
+        {
+            return GL_TEXTURE_1D_ARRAY;
+        }
+    }
+    else if (h.pixeldepth == 0)
+    {
+        if (h.arrayelements == 0)
+        {
+            if (h.faces != 6)
+            {
+                return GL_TEXTURE_2D;
+            }
+            else
+            {
+                return GL_TEXTURE_CUBE_MAP;
+            }
+        }
+        else
+        {
+            if (h.faces != 6)
+            {
+                return GL_TEXTURE_2D_ARRAY;
+            }
+            else
+            {
+                return GL_TEXTURE_CUBE_MAP_ARRAY;
+            }
+        }
+    }
+    else
+    {
+        return GL_TEXTURE_3D;
+    }
 }
 
 extern
 unsigned int load(const char * filename, unsigned int tex)
 {
-    FILE * fp;
+    vfs::file file;
     GLuint temp = 0;
     GLuint retval = 0;
     header h;
-    size_t data_start, data_end;
-    unsigned char * data;
+    const unsigned char * ptr;
+    const unsigned char * end;
+    unsigned char * swapped = NULL;
     GLenum target = GL_NONE;
-
-    fp = fopen(filename, "rb");
-
-    if (!fp)
+    unsigned int levels;
+    unsigned int level;
+    unsigned int layers;
+    GLint unpack_alignment;
+    bool swap = false;
+
+    // Level data is uploaded straight out of the mapping
+    if (!file.open(filename))
         return 0;
 
-    if (fread(&h, sizeof(h), 1, fp) != 1)
+    if (file.size() < sizeof(h))
         goto fail_read;
 
+    memcpy(&h, file.data(), sizeof(h));
+
     if (memcmp(h.identifier, identifier, sizeof(identifier)) != 0)
         goto fail_header;
 
@@ -142,6 +363,7 @@ unsigned int load(const char * filename, unsigned int tex)
     else if (h.endianness == 0x01020304)
     {
         // Swap needed
+        swap = true;
         h.endianness            = swap32(h.endianness);
         h.gltype                = swap32(h.gltype);
         h.gltypesize            = swap32(h.gltypesize);
@@ -161,47 +383,7 @@ unsigned int load(const char * filename, unsigned int tex)
         goto fail_header;
     }
 
-    // Guess target (texture type)
-    if (h.pixelheight == 0)
-    {
-        if (h.arrayelements == 0)
-        {
-            target = GL_TEXTURE_1D;
-        }
-        else
-        {
-            target = GL_TEXTURE_1D_ARRAY;
-        }
-    }
-    else if (h.pixeldepth == 0)
-    {
-        if (h.arrayelements == 0)
-        {
-            if (h.faces == 0)
-            {
-                target = GL_TEXTURE_2D;
-            }
-            else
-            {
-                target = GL_TEXTURE_CUBE_MAP;
-            }
-        }
-        else
-        {
-            if (h.faces == 0)
-            {
-                target = GL_TEXTURE_2D_ARRAY;
-            }
-            else
-            {
-                target = GL_TEXTURE_CUBE_MAP_ARRAY;
-            }
-        }
-    }
-    else
-    {
-        target = GL_TEXTURE_3D;
-    }
+    target = guess_target(h);
 
     // Check for insanity...
     if (target == GL_NONE ||                                    // Couldn't figure out target
@@ -211,114 +393,375 @@ unsigned int load(const char * filename, unsigned int tex)
         goto fail_header;
     }
 
-    temp = tex;
-    if (tex == 0)
-    {
-        glGenTextures(1, &tex);
-    }
+    if (h.keypairbytes > file.size() - sizeof(h))
+        goto fail_header;
 
-    glBindTexture(target, tex);
+    ptr = file.data() + sizeof(h) + h.keypairbytes;
+    end = file.data() + file.size();
 
-    data_start = ftell(fp) + h.keypairbytes;
-    fseek(fp, 0, SEEK_END);
-    data_end = ftell(fp);
-    fseek(fp, data_start, SEEK_SET);
+    // Zero levels means "generate them", so storage is still the full chain
+    levels = h.miplevels ? h.miplevels : calculate_mip_levels(h);
 
-    data = new unsigned char [data_end - data_start];
-    memset(data, 0, data_end - data_start);
+    if (levels > calculate_mip_levels(h))
+        goto fail_header;
 
-    fread(data, 1, data_end - data_start, fp);
+    layers = h.arrayelements;
+    if (target == GL_TEXTURE_CUBE_MAP_ARRAY)
+        layers *= 6;
 
-    if (h.miplevels == 0)
+    temp = tex;
+    if (tex == 0)
     {
-        h.miplevels = 1;
+        glGenTextures(1, &tex);
     }
 
+    glBindTexture(target, tex);
+
     switch (target)
     {
         case GL_TEXTURE_1D:
-            glTexStorage1D(GL_TEXTURE_1D, h.miplevels, h.glinternalformat, h.pixelwidth);
-            glTexSubImage1D(GL_TEXTURE_1D, 0, 0, h.pixelwidth, h.glformat, h.glinternalformat, data);
+            glTexStorage1D(target, levels, h.glinternalformat, h.pixelwidth);
+            break;
+        case GL_TEXTURE_1D_ARRAY:
+            glTexStorage2D(target, levels, h.glinternalformat, h.pixelwidth, layers);
             break;
         case GL_TEXTURE_2D:
-            // glTexImage2D(GL_TEXTURE_2D, 0, h.glinternalformat, h.pixelwidth, h.pixelheight, 0, h.glformat, h.gltype, data);
-            if (h.gltype == GL_NONE)
-            {
-                glCompressedTexImage2D(GL_TEXTURE_2D, 0, h.glinternalformat, h.pixelwidth, h.pixelheight, 0, 420 * 380 / 2, data);
-            }
-            else
-            {
-                glTexStorage2D(GL_TEXTURE_2D, h.miplevels, h.glinternalformat, h.pixelwidth, h.pixelheight);
-                {
-                    unsigned char * ptr = data;
-                    unsigned int height = h.pixelheight;
-                    unsigned int width = h.pixelwidth;
-                    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-                    for (unsigned int i = 0; i < h.miplevels; i++)
-                    {
-                        glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, width, height, h.glformat, h.gltype, ptr);
-                        ptr += height * calculate_stride(h, width, 1);
-                        height >>= 1;
-                        width >>= 1;
-                        if (!height)
-                            height = 1;
-                        if (!width)
-                            width = 1;
-                    }
-                }
-            }
+        case GL_TEXTURE_CUBE_MAP:
+            glTexStorage2D(target, levels, h.glinternalformat, h.pixelwidth, h.pixelheight);
             break;
         case GL_TEXTURE_3D:
-            glTexStorage3D(GL_TEXTURE_3D, h.miplevels, h.glinternalformat, h.pixelwidth, h.pixelheight, h.pixeldepth);
-            glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, h.pixelwidth, h.pixelheight, h.pixeldepth, h.glformat, h.gltype, data);
-            break;
-        case GL_TEXTURE_1D_ARRAY:
-            glTexStorage2D(GL_TEXTURE_1D_ARRAY, h.miplevels, h.glinternalformat, h.pixelwidth, h.arrayelements);
-            glTexSubImage2D(GL_TEXTURE_1D_ARRAY, 0, 0, 0, h.pixelwidth, h.arrayelements, h.glformat, h.gltype, data);
+            glTexStorage3D(target, levels, h.glinternalformat, h.pixelwidth, h.pixelheight, h.pixeldepth);
             break;
         case GL_TEXTURE_2D_ARRAY:
-            glTexStorage3D(GL_TEXTURE_2D_ARRAY, h.miplevels, h.glinternalformat, h.pixelwidth, h.pixelheight, h.arrayelements);
-            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, h.pixelwidth, h.pixelheight, h.arrayelements, h.glformat, h.gltype, data);
-            break;
-        case GL_TEXTURE_CUBE_MAP:
-            glTexStorage2D(GL_TEXTURE_CUBE_MAP, h.miplevels, h.glinternalformat, h.pixelwidth, h.pixelheight);
-            // glTexSubImage3D(GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, h.pixelwidth, h.pixelheight, h.faces, h.glformat, h.gltype, data);
-            {
-                unsigned int face_size = calculate_face_size(h);
-                for (unsigned int i = 0; i < h.faces; i++)
-                {
-                    glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, h.pixelwidth, h.pixelheight, h.glformat, h.gltype, data + face_size * i);
-                }
-            }
-            break;
         case GL_TEXTURE_CUBE_MAP_ARRAY:
-            glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, h.miplevels, h.glinternalformat, h.pixelwidth, h.pixelheight, h.arrayelements);
-            glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, 0, 0, 0, h.pixelwidth, h.pixelheight, h.faces * h.arrayelements, h.glformat, h.gltype, data);
+            glTexStorage3D(target, levels, h.glinternalformat, h.pixelwidth, h.pixelheight, layers);
             break;
         default:                                               // Should never happen
             goto fail_target;
     }
 
-    if (h.miplevels == 1)
+    // KTX rows are always padded to four bytes
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // Each level is a 32-bit imageSize followed by its images, padded to four
+    // bytes. For non-array cube maps imageSize covers one face and each face
+    // is padded on its own; otherwise it covers the whole level.
+    for (level = 0; level < (h.miplevels ? h.miplevels : 1); level++)
+    {
+        unsigned int width = h.pixelwidth >> level;
+        unsigned int height = h.pixelheight >> level;
+        unsigned int depth = h.pixeldepth >> level;
+        unsigned int image_size;
+        unsigned int images = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+        unsigned int padded_size;
+        unsigned int i;
+
+        if (!width)
+            width = 1;
+        if (!height)
+            height = 1;
+        if (!depth)
+            depth = 1;
+
+        if (end - ptr < 4)
+            goto fail_data;
+
+        memcpy(&image_size, ptr, sizeof(image_size));
+        if (swap)
+            image_size = swap32(image_size);
+        ptr += 4;
+
+        padded_size = (image_size + 3) & ~3u;
+
+        // glTexSubImage reads the whole image whatever imageSize says
+        if ((size_t)(end - ptr) < (size_t)padded_size * (images - 1) + image_size ||
+            image_size < calculate_image_size(h, target, level))
+            goto fail_data;
+
+        for (i = 0; i < images; i++)
+        {
+            const unsigned char * image = ptr;
+
+            // Multi-byte texel types need swapping, which can't be done in
+            // the read-only mapping
+            if (swap && h.gltypesize > 1)
+            {
+                delete [] swapped;
+                swapped = new unsigned char [image_size];
+                memcpy(swapped, ptr, image_size);
+                swap_image(swapped, image_size, h.gltypesize);
+                image = swapped;
+            }
+
+            upload_image(target,
+                         target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : target,
+                         h, level, width, height, depth, layers, image, image_size);
+
+            ptr += padded_size;
+        }
+    }
+
+    // Only build mips at runtime when the file didn't ship any
+    if (h.miplevels == 0)
     {
         glGenerateMipmap(target);
     }
 
     retval = tex;
 
+fail_data:
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+    delete [] swapped;
+
 fail_target:
-    delete [] data;
+    // Don't leak a texture nobody will ever hear about
+    if (retval == 0 && temp == 0)
+        glDeleteTextures(1, &tex);
 
 fail_header:;
 fail_read:;
-    fclose(fp);
 
     return retval;
 }
 
+extern
+bool parse(const void * data, size_t size, header& h, unsigned int& target,
+           std::vector<const unsigned char *>& images, std::vector<unsigned int>& image_sizes)
+{
+    const unsigned char * ptr = (const unsigned char *)data;
+    const unsigned char * end = ptr + size;
+    unsigned int level;
+
+    images.clear();
+    image_sizes.clear();
+
+    if (size < sizeof(h))
+        return false;
+
+    memcpy(&h, data, sizeof(h));
+
+    // Images are handed out in place, so they can't be byte swapped
+    if (memcmp(h.identifier, identifier, sizeof(identifier)) != 0 ||
+        h.endianness != 0x04030201)
+        return false;
+
+    target = guess_target(h);
+
+    if (h.pixelwidth == 0 ||
+        (h.pixelheight == 0 && h.pixeldepth != 0) ||
+        h.miplevels > calculate_mip_levels(h) ||
+        h.keypairbytes > size - sizeof(h))
+        return false;
+
+    ptr += sizeof(h) + h.keypairbytes;
+
+    // Same layout load() walks
+    for (level = 0; level < (h.miplevels ? h.miplevels : 1); level++)
+    {
+        unsigned int faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+        unsigned int image_size;
+        unsigned int padded_size;
+        unsigned int i;
+
+        if (end - ptr < 4)
+            return false;
+
+        memcpy(&image_size, ptr, sizeof(image_size));
+        ptr += 4;
+
+        padded_size = (image_size + 3) & ~3u;
+
+        if ((size_t)(end - ptr) < (size_t)padded_size * (faces - 1) + image_size ||
+            image_size < calculate_image_size(h, target, level))
+            return false;
+
+        for (i = 0; i < faces; i++)
+        {
+            images.push_back(ptr);
+            image_sizes.push_back(image_size);
+            ptr += padded_size;
+        }
+    }
+
+    return true;
+}
+
+extern
+bool write(std::vector<unsigned char>& out, const header& h, const void * const * images, const unsigned int * image_sizes)
+{
+    header fixed = h;
+    unsigned int levels = h.miplevels ? h.miplevels : 1;
+    unsigned int faces = (h.faces == 6 && h.arrayelements == 0) ? 6 : 1;
+    unsigned int level;
+    unsigned int i;
+
+    memcpy(fixed.identifier, identifier, sizeof(identifier));
+    fixed.endianness = 0x04030201;
+    fixed.keypairbytes = 0;
+
+    out.assign((const unsigned char *)&fixed, (const unsigned char *)&fixed + sizeof(fixed));
+
+    for (level = 0; level < levels; level++)
+    {
+        // imageSize is per face for non-array cube maps, same as load()
+        unsigned int size = image_sizes[level * faces];
+
+        out.insert(out.end(), (const unsigned char *)&size, (const unsigned char *)&size + sizeof(size));
+
+        for (i = 0; i < faces; i++)
+        {
+            const unsigned char * image = (const unsigned char *)images[level * faces + i];
+
+            out.insert(out.end(), image, image + size);
+            out.resize((out.size() + 3) & ~(size_t)3, 0);
+        }
+    }
+
+    return true;
+}
+
+extern
+bool write(const char * filename, const header& h, const void * const * images, const unsigned int * image_sizes)
+{
+    std::vector<unsigned char> out;
+    FILE * fp;
+    bool ok;
+
+    write(out, h, images, image_sizes);
+
+    fp = fopen(filename, "wb");
+
+    if (!fp)
+        return false;
+
+    ok = fwrite(&out[0], 1, out.size(), fp) == out.size();
+    ok &= fclose(fp) == 0;
+
+    return ok;
+}
+
+static GLenum calculate_base_format(GLenum format)
+{
+    switch (format)
+    {
+        case GL_RED_INTEGER:    return GL_RED;
+        case GL_RG_INTEGER:     return GL_RG;
+        case GL_BGR:
+        case GL_BGR_INTEGER:
+        case GL_RGB_INTEGER:    return GL_RGB;
+        case GL_BGRA:
+        case GL_BGRA_INTEGER:
+        case GL_RGBA_INTEGER:   return GL_RGBA;
+        default:                return format;
+    }
+}
+
+// A save in flight. Level data is read back into one pixel pack buffer,
+// laid out exactly as the KTX body minus the imageSize words.
+struct pending_save
+{
+    std::string                 filename;
+    header                      h;
+    std::vector<unsigned int>   image_size;     // Per level, unpadded
+    unsigned int                images;         // Images per level (6 for non-array cube maps)
+    GLuint                      buffer;
+    GLsync                      fence;
+    const unsigned char *       data;           // Mapped pack buffer while writing
+    std::thread                 worker;
+    std::atomic<bool>           done;
+    bool                        ok;
+};
+
+static std::vector<pending_save *> pending_saves;
+
+static void report(const char * filename, const char * message)
+{
+    char buffer[1024];
+
+    snprintf(buffer, sizeof(buffer), "%s: %s", filename, message);
+#ifdef _WIN32
+    OutputDebugStringA(buffer);
+    OutputDebugStringA("\n");
+#else
+    fprintf(stderr, "%s\n", buffer);
+#endif
+}
+
+static void write_file(pending_save * job)
+{
+    FILE * fp = fopen(job->filename.c_str(), "wb");
+    const unsigned char * ptr = job->data;
+    static const unsigned char padding[4] = { 0, 0, 0, 0 };
+    unsigned int level;
+    unsigned int i;
+    bool ok = (fp != NULL);
+
+    if (ok)
+    {
+        ok &= fwrite(&job->h, sizeof(job->h), 1, fp) == 1;
+
+        for (level = 0; ok && level < job->image_size.size(); level++)
+        {
+            unsigned int size = job->image_size[level];
+            unsigned int pad = ((size + 3) & ~3u) - size;
+
+            ok &= fwrite(&size, sizeof(size), 1, fp) == 1;
+
+            for (i = 0; ok && i < job->images; i++)
+            {
+                ok &= fwrite(ptr, 1, size, fp) == size;
+                ok &= fwrite(padding, 1, pad, fp) == pad;
+                ptr += size + pad;
+            }
+        }
+
+        ok &= fclose(fp) == 0;
+    }
+
+    job->ok = ok;
+    job->done = true;
+}
+
+extern
 bool save(const char * filename, unsigned int target, unsigned int tex)
 {
     header h;
+    GLenum query_target = target;
+    GLint compressed = 0;
+    GLint internal_format = 0;
+    GLint format = GL_NONE;
+    GLint type = GL_NONE;
+    GLint immutable = 0;
+    GLint levels = 0;
+    GLint width, height, depth;
+    GLint pack_alignment;
+    unsigned int pixel_size = 0;
+    unsigned int images = 1;
+    unsigned int total = 0;
+    unsigned int offset = 0;
+    std::vector<unsigned int> image_size;
+    bool packed = false;
+    int level;
+    unsigned int i;
+
+    switch (target)
+    {
+        case GL_TEXTURE_1D:
+        case GL_TEXTURE_1D_ARRAY:
+        case GL_TEXTURE_2D:
+        case GL_TEXTURE_2D_ARRAY:
+        case GL_TEXTURE_3D:
+        case GL_TEXTURE_CUBE_MAP_ARRAY:
+            break;
+        case GL_TEXTURE_CUBE_MAP:
+            // Level parameters live on the faces
+            query_target = GL_TEXTURE_CUBE_MAP_POSITIVE_X;
+            images = 6;
+            break;
+        default:
+            return false;
+    }
 
     memset(&h, 0, sizeof(h));
     memcpy(h.identifier, identifier, sizeof(identifier));
@@ -326,13 +769,211 @@ bool save(const char * filename, unsigned int target, unsigned int tex)
 
     glBindTexture(target, tex);
 
-    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_WIDTH, (GLint *)&h.pixelwidth);
-    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, (GLint *)&h.pixelheight);
-    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_DEPTH, (GLint *)&h.pixeldepth);
+    glGetTexLevelParameteriv(query_target, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(query_target, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(query_target, 0, GL_TEXTURE_DEPTH, &depth);
+    glGetTexLevelParameteriv(query_target, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    glGetTexLevelParameteriv(query_target, 0, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+
+    if (width == 0)
+        return false;
+
+    // Immutable textures know their level count, otherwise count the
+    // levels that actually have storage
+    glGetTexParameteriv(target, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+    if (immutable)
+    {
+        glGetTexParameteriv(target, GL_TEXTURE_IMMUTABLE_LEVELS, &levels);
+    }
+    else
+    {
+        GLint w = width;
+        while (w != 0)
+        {
+            glGetTexLevelParameteriv(query_target, ++levels, GL_TEXTURE_WIDTH, &w);
+        }
+    }
+
+    // Let the driver pick the format and type it returns without conversion
+    glGetInternalformativ(target, internal_format, GL_TEXTURE_IMAGE_FORMAT, 1, &format);
+    glGetInternalformativ(target, internal_format, GL_TEXTURE_IMAGE_TYPE, 1, &type);
+
+    if (compressed)
+    {
+        h.gltype = 0;
+        h.gltypesize = 1;
+        h.glformat = 0;
+    }
+    else
+    {
+        unsigned int type_size = calculate_type_size(type, packed);
+
+        pixel_size = packed ? type_size : type_size * calculate_channels(format);
+        if (pixel_size == 0)
+            return false;
+
+        h.gltype = type;
+        h.gltypesize = type_size;
+        h.glformat = format;
+    }
+
+    h.glinternalformat = internal_format;
+    h.glbaseinternalformat = calculate_base_format(format);
+    h.pixelwidth = width;
+    h.faces = (target == GL_TEXTURE_CUBE_MAP || target == GL_TEXTURE_CUBE_MAP_ARRAY) ? 6 : 1;
+    h.miplevels = levels;
+
+    switch (target)
+    {
+        case GL_TEXTURE_1D_ARRAY:
+            h.arrayelements = height;
+            break;
+        case GL_TEXTURE_2D:
+        case GL_TEXTURE_CUBE_MAP:
+            h.pixelheight = height;
+            break;
+        case GL_TEXTURE_2D_ARRAY:
+            h.pixelheight = height;
+            h.arrayelements = depth;
+            break;
+        case GL_TEXTURE_CUBE_MAP_ARRAY:
+            h.pixelheight = height;
+            h.arrayelements = depth / 6;
+            break;
+        case GL_TEXTURE_3D:
+            h.pixelheight = height;
+            h.pixeldepth = depth;
+            break;
+    }
+
+    // Size every level up front so the whole readback fits in one buffer.
+    // Array layers report their count as height or depth at every level.
+    for (level = 0; level < levels; level++)
+    {
+        GLint size = 0;
+
+        if (compressed)
+        {
+            glGetTexLevelParameteriv(query_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+        }
+        else
+        {
+            glGetTexLevelParameteriv(query_target, level, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(query_target, level, GL_TEXTURE_HEIGHT, &height);
+            glGetTexLevelParameteriv(query_target, level, GL_TEXTURE_DEPTH, &depth);
+
+            // Rows are padded to four bytes, both by KTX and GL_PACK_ALIGNMENT
+            size = ((width * pixel_size + 3) & ~3u) * height * depth;
+        }
+
+        image_size.push_back(size);
+        total += ((size + 3) & ~3u) * images;
+    }
+
+    pending_save * job = new pending_save;
+
+    job->filename = filename;
+    job->h = h;
+    job->image_size = image_size;
+    job->images = images;
+    job->data = NULL;
+    job->done = false;
+    job->ok = false;
+
+    glGenBuffers(1, &job->buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, job->buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, total, NULL, GL_STREAM_READ);
+
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // With a pack buffer bound these only queue copies, nothing waits here
+    for (level = 0; level < levels; level++)
+    {
+        for (i = 0; i < images; i++)
+        {
+            GLenum image_target = (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : target;
+
+            if (compressed)
+                glGetCompressedTexImage(image_target, level, (void *)(uintptr_t)offset);
+            else
+                glGetTexImage(image_target, level, format, type, (void *)(uintptr_t)offset);
+
+            offset += (image_size[level] + 3) & ~3u;
+        }
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    pending_saves.push_back(job);
 
     return true;
 }
 
+extern
+unsigned int process_saves(bool wait)
+{
+    size_t i = 0;
+
+    while (i < pending_saves.size())
+    {
+        pending_save * job = pending_saves[i];
+
+        if (job->fence != NULL)
+        {
+            GLenum status = glClientWaitSync(job->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                i++;
+                continue;
+            }
+
+            glDeleteSync(job->fence);
+            job->fence = NULL;
+
+            // The copy has landed, so mapping doesn't stall. The worker
+            // reads straight out of the mapping.
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, job->buffer);
+            job->data = (const unsigned char *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            if (status == GL_WAIT_FAILED || job->data == NULL)
+                job->done = true;
+            else
+                job->worker = std::thread(write_file, job);
+        }
+
+        if (!job->done && !wait)
+        {
+            i++;
+            continue;
+        }
+
+        if (job->worker.joinable())
+            job->worker.join();
+
+        // Mapping and buffer belong to this context, release them here
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, job->buffer);
+        if (job->data != NULL)
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteBuffers(1, &job->buffer);
+
+        // Nobody waits on a save, so this is the only place a failure shows
+        if (!job->ok)
+            report(job->filename.c_str(), "couldn't save texture");
+
+        delete job;
+        pending_saves.erase(pending_saves.begin() + i);
+    }
+
+    return (unsigned int)pending_saves.size();
+}
+
 }
 
 }
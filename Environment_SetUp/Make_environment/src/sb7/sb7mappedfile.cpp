@@ -0,0 +1,132 @@
+/*
+ * Read-only memory mapped file
+ */
+
+#include <sb7mappedfile.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace sb7
+{
+
+mapped_file::mapped_file()
+    : base(NULL),
+      length(0),
+#ifdef _WIN32
+      file(INVALID_HANDLE_VALUE),
+      mapping(NULL)
+#else
+      fd(-1)
+#endif
+{
+
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const char * filename)
+{
+    LARGE_INTEGER file_size;
+
+    close();
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        goto fail;
+
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+        goto fail;
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+        goto fail;
+
+    base = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL)
+        goto fail;
+
+    length = (size_t)file_size.QuadPart;
+
+    return true;
+
+fail:
+    close();
+    return false;
+}
+
+void mapped_file::close()
+{
+    if (base != NULL)
+        UnmapViewOfFile(base);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    base = NULL;
+    length = 0;
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool mapped_file::open(const char * filename)
+{
+    struct stat st;
+    void * p;
+
+    close();
+
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        goto fail;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+        goto fail;
+
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        goto fail;
+
+    // Loaders walk files front to back exactly once
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    base = (const unsigned char *)p;
+    length = (size_t)st.st_size;
+
+    return true;
+
+fail:
+    close();
+    return false;
+}
+
+void mapped_file::close()
+{
+    if (base != NULL)
+        munmap((void *)base, length);
+    if (fd >= 0)
+        ::close(fd);
+
+    base = NULL;
+    length = 0;
+    fd = -1;
+}
+
+#endif
+
+}
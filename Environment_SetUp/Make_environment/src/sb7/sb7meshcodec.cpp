@@ -0,0 +1,846 @@
+/*
+ * Mesh stream codec
+ *
+ * Vertex stream layout, per block of up to BLOCK_VERTICES vertices and per
+ * byte lane within the vertex:
+ *
+ *   [group modes, 2 bits per group of 16 bytes, 4 groups per byte]
+ *   [group payloads]
+ *
+ * Group modes: 0 = all zero, 1 = 2 bits per value, 2 = 4 bits per value,
+ * 3 = 8 bits per value. In modes 1 and 2 the largest code (3 or 15) means
+ * "look in the escape bytes", which follow the packed bits of that group.
+ *
+ * Index stream layout:
+ *
+ *   [one code byte per triangle][varint payload]
+ *
+ * Code byte high nibble 0-14 names an entry of the edge FIFO, the low nibble
+ * says where the third vertex comes from (0 = next unseen vertex, 1-14 =
+ * vertex FIFO entry, 15 = varint). High nibble 15 means no shared edge; the
+ * low three bits then flag which corners are "next unseen vertex", the
+ * others are varints. Varints are zigzagged deltas to the last varint.
+ */
+
+#include <sb7meshcodec.h>
+
+#include <algorithm>
+#include <cstring>
+
+// SSE2 is part of every x86-64 target, use it for the wide parts of the
+// vertex decoder there and fall back to plain loops everywhere else
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SB7_MESHCODEC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace sb7
+{
+
+namespace meshcodec
+{
+
+enum
+{
+    BLOCK_VERTICES  = 256,
+    GROUP_SIZE      = 16,
+    FIFO_SIZE       = 16
+};
+
+static inline unsigned char zigzag8(unsigned char v)
+{
+    return (unsigned char)((v << 1) ^ ((signed char)v >> 7));
+}
+
+static inline unsigned char unzigzag8(unsigned char v)
+{
+    return (unsigned char)((v >> 1) ^ -(v & 1));
+}
+
+static inline unsigned int zigzag32(int v)
+{
+    return ((unsigned int)v << 1) ^ (unsigned int)(v >> 31);
+}
+
+static inline int unzigzag32(unsigned int v)
+{
+    return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+static void write_varint(std::vector<unsigned char>& out, unsigned int v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+static inline bool read_varint(const unsigned char *& p, const unsigned char * end, unsigned int& v)
+{
+    unsigned int shift = 0;
+
+    v = 0;
+    while (p < end && shift < 35)
+    {
+        unsigned char b = *p++;
+        v |= (unsigned int)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+        shift += 7;
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Vertices
+////////////////////////////////////////////////////////////////////////////
+
+static void encode_group(std::vector<unsigned char>& out, const unsigned char * z, unsigned int& mode)
+{
+    unsigned int i;
+    unsigned int escapes2 = 0, escapes4 = 0;
+    bool zero = true;
+
+    for (i = 0; i < GROUP_SIZE; i++)
+    {
+        zero &= (z[i] == 0);
+        escapes2 += (z[i] >= 3);
+        escapes4 += (z[i] >= 15);
+    }
+
+    if (zero)
+    {
+        mode = 0;
+        return;
+    }
+
+    unsigned int size2 = GROUP_SIZE / 4 + escapes2;
+    unsigned int size4 = GROUP_SIZE / 2 + escapes4;
+
+    if (size2 <= size4 && size2 < GROUP_SIZE)
+    {
+        mode = 1;
+        unsigned char packed[GROUP_SIZE / 4] = { 0 };
+        for (i = 0; i < GROUP_SIZE; i++)
+        {
+            packed[i / 4] |= (unsigned char)(std::min<unsigned int>(z[i], 3) << ((i % 4) * 2));
+        }
+        out.insert(out.end(), packed, packed + GROUP_SIZE / 4);
+        for (i = 0; i < GROUP_SIZE; i++)
+        {
+            if (z[i] >= 3)
+                out.push_back(z[i]);
+        }
+    }
+    else if (size4 < GROUP_SIZE)
+    {
+        mode = 2;
+        unsigned char packed[GROUP_SIZE / 2] = { 0 };
+        for (i = 0; i < GROUP_SIZE; i++)
+        {
+            packed[i / 2] |= (unsigned char)(std::min<unsigned int>(z[i], 15) << ((i % 2) * 4));
+        }
+        out.insert(out.end(), packed, packed + GROUP_SIZE / 2);
+        for (i = 0; i < GROUP_SIZE; i++)
+        {
+            if (z[i] >= 15)
+                out.push_back(z[i]);
+        }
+    }
+    else
+    {
+        mode = 3;
+        out.insert(out.end(), z, z + GROUP_SIZE);
+    }
+}
+
+void encode_vertices(std::vector<unsigned char>& out,
+                     const void * vertices,
+                     size_t count,
+                     size_t element_size)
+{
+    const unsigned char * src = (const unsigned char *)vertices;
+    std::vector<unsigned char> last(element_size, 0);
+    unsigned char z[BLOCK_VERTICES];
+    size_t block, k, i;
+
+    for (block = 0; block < count; block += BLOCK_VERTICES)
+    {
+        size_t n = std::min<size_t>(BLOCK_VERTICES, count - block);
+        size_t groups = (n + GROUP_SIZE - 1) / GROUP_SIZE;
+
+        for (k = 0; k < element_size; k++)
+        {
+            unsigned char prev = last[k];
+
+            memset(z, 0, sizeof(z));
+            for (i = 0; i < n; i++)
+            {
+                unsigned char v = src[(block + i) * element_size + k];
+                z[i] = zigzag8((unsigned char)(v - prev));
+                prev = v;
+            }
+            last[k] = prev;
+
+            // Reserve the mode bytes, payloads follow them
+            size_t header = out.size();
+            out.resize(out.size() + (groups + 3) / 4, 0);
+
+            for (i = 0; i < groups; i++)
+            {
+                unsigned int mode;
+                encode_group(out, z + i * GROUP_SIZE, mode);
+                out[header + i / 4] |= (unsigned char)(mode << ((i % 4) * 2));
+            }
+        }
+    }
+}
+
+// Group unpacking goes through tables: one packed byte expands to four
+// 2-bit or two 4-bit values with a single load
+struct unpack_tables
+{
+    unsigned char   bits2[256][4];
+    unsigned char   bits4[256][2];
+
+    unpack_tables()
+    {
+        for (unsigned int b = 0; b < 256; b++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+                bits2[b][j] = (b >> (j * 2)) & 3;
+            for (unsigned int j = 0; j < 2; j++)
+                bits4[b][j] = (b >> (j * 4)) & 15;
+        }
+    }
+};
+
+static const unpack_tables& get_unpack_tables()
+{
+    static const unpack_tables tables;
+
+    return tables;
+}
+
+// Unpacks one group of 2 or 4 bit values, returning the payload size or 0
+// if the input runs out
+template <unsigned int bits>
+static inline size_t decode_group(unsigned char * g, const unsigned char * p, const unsigned char * end, const unpack_tables& t)
+{
+    const unsigned int per_byte = 8 / bits;
+    const unsigned int packed = GROUP_SIZE / per_byte;
+    const unsigned char escape = (unsigned char)((1 << bits) - 1);
+    unsigned int j;
+
+    if ((size_t)(end - p) < packed)
+        return 0;
+
+    // A field is an escape when all of its bits are set
+    unsigned long long word = 0;
+    memcpy(&word, p, packed);
+
+    unsigned long long all_set = word;
+    for (j = 1; j < bits; j++)
+        all_set &= word >> j;
+    all_set &= bits == 2 ? 0x5555555555555555ULL : 0x1111111111111111ULL;
+
+    for (j = 0; j < packed; j++)
+    {
+        memcpy(g + j * per_byte, bits == 2 ? t.bits2[p[j]] : t.bits4[p[j]], per_byte);
+    }
+
+    const unsigned char * e = p + packed;
+
+    // Escapes are rare, keep them off the common path
+    if (all_set)
+    {
+        for (j = 0; j < GROUP_SIZE; j++)
+        {
+            if (g[j] == escape)
+            {
+                if (e == end)
+                    return 0;
+                g[j] = *e++;
+            }
+        }
+    }
+
+    return e - p;
+}
+
+#ifdef SB7_MESHCODEC_SSE2
+
+// 16 lanes of 16 vertices -> 16 vertices of 16 lanes
+static inline void transpose_16x16(const unsigned char * src, size_t src_stride,
+                                   unsigned char * dst, size_t dst_stride)
+{
+    __m128i r[16], t[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        r[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+
+    for (i = 0; i < 8; i++)
+    {
+        t[i * 2 + 0] = _mm_unpacklo_epi8(r[i * 2], r[i * 2 + 1]);
+        t[i * 2 + 1] = _mm_unpackhi_epi8(r[i * 2], r[i * 2 + 1]);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        r[i * 4 + 0] = _mm_unpacklo_epi16(t[i * 4 + 0], t[i * 4 + 2]);
+        r[i * 4 + 1] = _mm_unpackhi_epi16(t[i * 4 + 0], t[i * 4 + 2]);
+        r[i * 4 + 2] = _mm_unpacklo_epi16(t[i * 4 + 1], t[i * 4 + 3]);
+        r[i * 4 + 3] = _mm_unpackhi_epi16(t[i * 4 + 1], t[i * 4 + 3]);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            t[i * 8 + j * 2 + 0] = _mm_unpacklo_epi32(r[i * 8 + j], r[i * 8 + j + 4]);
+            t[i * 8 + j * 2 + 1] = _mm_unpackhi_epi32(r[i * 8 + j], r[i * 8 + j + 4]);
+        }
+    }
+    for (i = 0; i < 8; i++)
+    {
+        r[i * 2 + 0] = _mm_unpacklo_epi64(t[i], t[i + 8]);
+        r[i * 2 + 1] = _mm_unpackhi_epi64(t[i], t[i + 8]);
+    }
+
+    for (i = 0; i < 16; i++)
+        _mm_storeu_si128((__m128i *)(dst + i * dst_stride), r[i]);
+}
+
+#endif /* SB7_MESHCODEC_SSE2 */
+
+// Turns a row of zigzagged deltas back into values, returns the last value
+static inline unsigned char undo_deltas(unsigned char * row, size_t padded, unsigned char carry)
+{
+    size_t i = 0;
+
+#ifdef SB7_MESHCODEC_SSE2
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i low7 = _mm_set1_epi8(0x7F);
+
+    for (; i < padded; i += 16)
+    {
+        __m128i z = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i sign = _mm_cmpeq_epi8(_mm_and_si128(z, one), one);
+        __m128i d = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(z, 1), low7), sign);
+
+        // Running sum across the 16 bytes in four shift-and-add steps
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+        d = _mm_add_epi8(d, _mm_set1_epi8((char)carry));
+
+        _mm_storeu_si128((__m128i *)(row + i), d);
+        carry = (unsigned char)(_mm_extract_epi16(d, 7) >> 8);
+    }
+#endif
+
+    for (; i < padded; i++)
+    {
+        carry = (unsigned char)(carry + unzigzag8(row[i]));
+        row[i] = carry;
+    }
+
+    return carry;
+}
+
+bool decode_vertices(void * vertices,
+                     size_t count,
+                     size_t element_size,
+                     const unsigned char * in,
+                     size_t in_size)
+{
+    const unpack_tables& tables = get_unpack_tables();
+    unsigned char * dst = (unsigned char *)vertices;
+    const unsigned char * p = in;
+    const unsigned char * end = in + in_size;
+    std::vector<unsigned char> last(element_size, 0);
+    std::vector<unsigned char> lanes(element_size * BLOCK_VERTICES);
+    size_t block, k, i;
+
+    for (block = 0; block < count; block += BLOCK_VERTICES)
+    {
+        size_t n = std::min<size_t>(BLOCK_VERTICES, count - block);
+        size_t groups = (n + GROUP_SIZE - 1) / GROUP_SIZE;
+
+        // Unpack every byte lane of the block into its own row...
+        for (k = 0; k < element_size; k++)
+        {
+            const unsigned char * modes = p;
+            unsigned char * z = &lanes[k * BLOCK_VERTICES];
+
+            if ((size_t)(end - p) < (groups + 3) / 4)
+                return false;
+            p += (groups + 3) / 4;
+
+            for (i = 0; i < groups; i++)
+            {
+                unsigned char * g = z + i * GROUP_SIZE;
+                size_t used = 0;
+
+                switch ((modes[i / 4] >> ((i % 4) * 2)) & 3)
+                {
+                    case 0:
+                        memset(g, 0, GROUP_SIZE);
+                        break;
+                    case 1:
+                        if (!(used = decode_group<2>(g, p, end, tables)))
+                            return false;
+                        break;
+                    case 2:
+                        if (!(used = decode_group<4>(g, p, end, tables)))
+                            return false;
+                        break;
+                    case 3:
+                        if ((size_t)(end - p) < GROUP_SIZE)
+                            return false;
+                        memcpy(g, p, GROUP_SIZE);
+                        used = GROUP_SIZE;
+                        break;
+                }
+
+                p += used;
+            }
+
+            // Padding past n holds zero deltas, so the last padded value is
+            // also the value of vertex n - 1
+            last[k] = undo_deltas(z, groups * GROUP_SIZE, last[k]);
+        }
+
+        // ...then interleave the rows back into vertices, front to back,
+        // which matters when the output is mapped GL memory
+        unsigned char * out = dst + block * element_size;
+        i = 0;
+
+#ifdef SB7_MESHCODEC_SSE2
+        if (element_size % 16 == 0)
+        {
+            for (; i + 16 <= n; i += 16)
+            {
+                for (k = 0; k < element_size; k += 16)
+                {
+                    transpose_16x16(&lanes[k * BLOCK_VERTICES + i], BLOCK_VERTICES,
+                                    out + i * element_size + k, element_size);
+                }
+            }
+        }
+#endif
+
+        for (; i < n; i++)
+        {
+            for (k = 0; k < element_size; k++)
+            {
+                out[i * element_size + k] = lanes[k * BLOCK_VERTICES + i];
+            }
+        }
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Indices
+////////////////////////////////////////////////////////////////////////////
+
+struct index_state
+{
+    unsigned int    edge[FIFO_SIZE][2];
+    unsigned int    vertex[FIFO_SIZE];
+    unsigned int    edge_offset;
+    unsigned int    vertex_offset;
+    unsigned int    next;
+    unsigned int    last;
+
+    index_state()
+        : edge_offset(0),
+          vertex_offset(0),
+          next(0),
+          last(0)
+    {
+        // Entries that were never written must not match anything real
+        memset(edge, 0xFF, sizeof(edge));
+        memset(vertex, 0xFF, sizeof(vertex));
+    }
+
+    void push_edge(unsigned int a, unsigned int b)
+    {
+        edge[edge_offset & (FIFO_SIZE - 1)][0] = a;
+        edge[edge_offset & (FIFO_SIZE - 1)][1] = b;
+        edge_offset++;
+    }
+
+    void push_vertex(unsigned int v)
+    {
+        vertex[vertex_offset & (FIFO_SIZE - 1)] = v;
+        vertex_offset++;
+    }
+
+    // i = 0 is the most recent entry
+    const unsigned int * get_edge(unsigned int i) const
+    {
+        return edge[(edge_offset - 1 - i) & (FIFO_SIZE - 1)];
+    }
+
+    unsigned int get_vertex(unsigned int i) const
+    {
+        return vertex[(vertex_offset - 1 - i) & (FIFO_SIZE - 1)];
+    }
+};
+
+void encode_indices(std::vector<unsigned char>& out,
+                    const unsigned int * indices,
+                    size_t index_count)
+{
+    size_t triangle_count = index_count / 3;
+    size_t codes = out.size();
+    std::vector<unsigned char> payload;
+    index_state s;
+    size_t t;
+
+    out.resize(codes + triangle_count);
+
+    for (t = 0; t < triangle_count; t++)
+    {
+        const unsigned int * tri = indices + t * 3;
+        int found_edge = -1;
+        unsigned int a = 0, b = 0, c = 0;
+        unsigned int i, r;
+
+        // Adjacent triangles walk a shared edge in opposite directions, so a
+        // stored edge (x, y) matches a rotation of this triangle starting (y, x)
+        for (i = 0; i < FIFO_SIZE - 1 && found_edge < 0; i++)
+        {
+            const unsigned int * e = s.get_edge(i);
+
+            for (r = 0; r < 3; r++)
+            {
+                if (tri[r] == e[1] && tri[(r + 1) % 3] == e[0])
+                {
+                    a = tri[r];
+                    b = tri[(r + 1) % 3];
+                    c = tri[(r + 2) % 3];
+                    found_edge = (int)i;
+                    break;
+                }
+            }
+        }
+
+        if (found_edge >= 0)
+        {
+            unsigned int fc = 15;
+
+            if (c == s.next)
+            {
+                fc = 0;
+                s.next++;
+                s.push_vertex(c);
+            }
+            else
+            {
+                for (i = 0; i < FIFO_SIZE - 2; i++)
+                {
+                    if (s.get_vertex(i) == c)
+                    {
+                        fc = i + 1;
+                        break;
+                    }
+                }
+
+                if (fc == 15)
+                {
+                    write_varint(payload, zigzag32((int)(c - s.last)));
+                    s.last = c;
+                    s.push_vertex(c);
+                }
+            }
+
+            out[codes + t] = (unsigned char)((found_edge << 4) | fc);
+            s.push_edge(b, c);
+            s.push_edge(c, a);
+        }
+        else
+        {
+            unsigned int flags = 0;
+
+            a = tri[0];
+            b = tri[1];
+            c = tri[2];
+
+            const unsigned int v[3] = { a, b, c };
+            for (i = 0; i < 3; i++)
+            {
+                if (v[i] == s.next)
+                {
+                    flags |= 1 << i;
+                    s.next++;
+                }
+                else
+                {
+                    write_varint(payload, zigzag32((int)(v[i] - s.last)));
+                    s.last = v[i];
+                }
+                s.push_vertex(v[i]);
+            }
+
+            out[codes + t] = (unsigned char)(0xF0 | flags);
+            s.push_edge(a, b);
+            s.push_edge(b, c);
+            s.push_edge(c, a);
+        }
+    }
+
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+template <typename T>
+static bool decode_indices_typed(T * dst,
+                                 size_t triangle_count,
+                                 const unsigned char * in,
+                                 size_t in_size)
+{
+    const unsigned char * codes = in;
+    const unsigned char * p = in + triangle_count;
+    const unsigned char * end = in + in_size;
+    index_state s;
+    size_t t;
+
+    if (in_size < triangle_count)
+        return false;
+
+    for (t = 0; t < triangle_count; t++)
+    {
+        unsigned int code = codes[t];
+        unsigned int a, b, c;
+
+        if ((code >> 4) != 15)
+        {
+            const unsigned int * e = s.get_edge(code >> 4);
+            unsigned int fc = code & 15;
+
+            a = e[1];
+            b = e[0];
+
+            if (fc == 0)
+            {
+                c = s.next++;
+                s.push_vertex(c);
+            }
+            else if (fc < 15)
+            {
+                c = s.get_vertex(fc - 1);
+            }
+            else
+            {
+                unsigned int v;
+                if (!read_varint(p, end, v))
+                    return false;
+                c = s.last + unzigzag32(v);
+                s.last = c;
+                s.push_vertex(c);
+            }
+
+            s.push_edge(b, c);
+            s.push_edge(c, a);
+        }
+        else
+        {
+            unsigned int tri[3];
+            unsigned int i;
+
+            for (i = 0; i < 3; i++)
+            {
+                if (code & (1 << i))
+                {
+                    tri[i] = s.next++;
+                }
+                else
+                {
+                    unsigned int v;
+                    if (!read_varint(p, end, v))
+                        return false;
+                    tri[i] = s.last + unzigzag32(v);
+                    s.last = tri[i];
+                }
+                s.push_vertex(tri[i]);
+            }
+
+            a = tri[0];
+            b = tri[1];
+            c = tri[2];
+
+            s.push_edge(a, b);
+            s.push_edge(b, c);
+            s.push_edge(c, a);
+        }
+
+        dst[t * 3 + 0] = (T)a;
+        dst[t * 3 + 1] = (T)b;
+        dst[t * 3 + 2] = (T)c;
+    }
+
+    return true;
+}
+
+bool decode_indices(void * indices,
+                    size_t index_count,
+                    size_t index_size,
+                    const unsigned char * in,
+                    size_t in_size)
+{
+    size_t triangle_count = index_count / 3;
+
+    switch (index_size)
+    {
+        case 1:
+            return decode_indices_typed((unsigned char *)indices, triangle_count, in, in_size);
+        case 2:
+            return decode_indices_typed((unsigned short *)indices, triangle_count, in, in_size);
+        case 4:
+            return decode_indices_typed((unsigned int *)indices, triangle_count, in, in_size);
+        default:
+            return false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Whole data chunks
+////////////////////////////////////////////////////////////////////////////
+
+static unsigned int read_index(const unsigned char * p, size_t size)
+{
+    switch (size)
+    {
+        case 1:     return p[0];
+        case 2:     { unsigned short v; memcpy(&v, p, 2); return v; }
+        default:    { unsigned int v; memcpy(&v, p, 4); return v; }
+    }
+}
+
+void encode_data(std::vector<unsigned char>& out,
+                 const void * raw,
+                 const std::vector<SB6M_PACKED_STREAM_DECL>& streams)
+{
+    const unsigned char * src = (const unsigned char *)raw;
+    size_t base = out.size();
+    size_t header_size = sizeof(unsigned int) + streams.size() * sizeof(SB6M_PACKED_STREAM_DECL);
+    std::vector<SB6M_PACKED_STREAM_DECL> decls(streams);
+    size_t i;
+
+    out.resize(base + header_size, 0);
+
+    for (i = 0; i < decls.size(); i++)
+    {
+        SB6M_PACKED_STREAM_DECL& d = decls[i];
+
+        // Keep every payload 4 byte aligned
+        while ((out.size() - base) & 3)
+            out.push_back(0);
+
+        d.encoded_offset = (unsigned int)(out.size() - base);
+
+        if (d.type == SB6M_PACKED_STREAM_INDEX)
+        {
+            std::vector<unsigned int> indices(d.element_count);
+            for (size_t j = 0; j < d.element_count; j++)
+            {
+                indices[j] = read_index(src + d.offset + j * d.element_size, d.element_size);
+            }
+            encode_indices(out, indices.data(), indices.size());
+        }
+        else
+        {
+            encode_vertices(out, src + d.offset, d.element_count, d.element_size);
+        }
+
+        d.encoded_length = (unsigned int)(out.size() - base - d.encoded_offset);
+    }
+
+    unsigned int count = (unsigned int)decls.size();
+    memcpy(&out[base], &count, sizeof(count));
+    if (!decls.empty())
+    {
+        memcpy(&out[base + sizeof(unsigned int)], &decls[0], decls.size() * sizeof(SB6M_PACKED_STREAM_DECL));
+    }
+}
+
+struct range
+{
+    size_t  begin;
+    size_t  end;
+
+    bool operator<(const range& that) const { return begin < that.begin; }
+};
+
+bool decode_data(void * dst,
+                 size_t dst_size,
+                 const void * packed,
+                 size_t packed_size)
+{
+    const unsigned char * base = (const unsigned char *)packed;
+    unsigned char * out = (unsigned char *)dst;
+    unsigned int count;
+    unsigned int i;
+
+    if (packed_size < sizeof(unsigned int))
+        return false;
+
+    memcpy(&count, base, sizeof(count));
+
+    if ((packed_size - sizeof(unsigned int)) / sizeof(SB6M_PACKED_STREAM_DECL) < count)
+        return false;
+
+    const SB6M_PACKED_STREAM_DECL * decls = (const SB6M_PACKED_STREAM_DECL *)(base + sizeof(unsigned int));
+    std::vector<range> covered;
+
+    for (i = 0; i < count; i++)
+    {
+        const SB6M_PACKED_STREAM_DECL& d = decls[i];
+        size_t length = (size_t)d.element_size * d.element_count;
+
+        if (d.offset > dst_size || length > dst_size - d.offset)
+            return false;
+        if (d.encoded_offset > packed_size || d.encoded_length > packed_size - d.encoded_offset)
+            return false;
+
+        bool ok;
+        if (d.type == SB6M_PACKED_STREAM_INDEX)
+        {
+            ok = decode_indices(out + d.offset, d.element_count, d.element_size, base + d.encoded_offset, d.encoded_length);
+        }
+        else
+        {
+            ok = decode_vertices(out + d.offset, d.element_count, d.element_size, base + d.encoded_offset, d.encoded_length);
+        }
+
+        if (!ok)
+            return false;
+
+        range r = { d.offset, d.offset + length };
+        covered.push_back(r);
+    }
+
+    // Zero only the gaps, the destination is usually write-combined memory
+    std::sort(covered.begin(), covered.end());
+    size_t cursor = 0;
+    for (i = 0; i < covered.size(); i++)
+    {
+        if (covered[i].begin > cursor)
+            memset(out + cursor, 0, covered[i].begin - cursor);
+        cursor = std::max(cursor, covered[i].end);
+    }
+    if (cursor < dst_size)
+        memset(out + cursor, 0, dst_size - cursor);
+
+    return true;
+}
+
+}
+
+}
@@ -0,0 +1,410 @@
+/*
+ * CPU mip chain generation
+ *
+ * Both filters are separable. For every destination column (and row) a
+ * short list of source taps is built once per level: the box filter weighs
+ * each source pixel by how much of it the destination pixel covers, the
+ * Kaiser filter samples sinc(t) * kaiser(t / 3) with t in destination
+ * pixels. Each destination row is made by filtering the source rows it
+ * needs vertically into a scratch row, then that row horizontally.
+ * Addressing clamps at the edges.
+ */
+
+#include <sb7mipmap.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SB7_MIPMAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace sb7
+{
+
+namespace mipmap
+{
+
+enum
+{
+    KAISER_RADIUS = 3,          // In destination pixels
+    LINEAR_LUT_SIZE = 8192
+};
+
+static const float kaiser_alpha = 4.0f;
+
+unsigned int level_count(unsigned int width, unsigned int height)
+{
+    unsigned int size = width > height ? width : height;
+    unsigned int levels = 1;
+
+    while (size >>= 1)
+        levels++;
+
+    return levels;
+}
+
+void level_size(unsigned int level,
+                unsigned int width,
+                unsigned int height,
+                unsigned int& level_width,
+                unsigned int& level_height)
+{
+    level_width = width >> level;
+    level_height = height >> level;
+
+    if (level_width == 0)
+        level_width = 1;
+    if (level_height == 0)
+        level_height = 1;
+}
+
+static float srgb_to_linear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Conversion tables, built once
+struct tables
+{
+    float           to_linear[256];
+    unsigned char   to_srgb[LINEAR_LUT_SIZE];
+
+    tables()
+    {
+        int i;
+
+        for (i = 0; i < 256; i++)
+            to_linear[i] = srgb_to_linear(i / 255.0f);
+
+        for (i = 0; i < LINEAR_LUT_SIZE; i++)
+            to_srgb[i] = (unsigned char)(linear_to_srgb(i / (float)(LINEAR_LUT_SIZE - 1)) * 255.0f + 0.5f);
+    }
+};
+
+static const tables& get_tables()
+{
+    static const tables t;
+
+    return t;
+}
+
+// Zeroth order modified Bessel function of the first kind
+static float bessel_i0(float x)
+{
+    float sum = 1.0f;
+    float term = 1.0f;
+    int k;
+
+    for (k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+
+        if (term < sum * 1e-8f)
+            break;
+    }
+
+    return sum;
+}
+
+static float kaiser_sinc(float t)
+{
+    float x = t / (float)KAISER_RADIUS;
+
+    if (fabsf(x) >= 1.0f)
+        return 0.0f;
+
+    float window = bessel_i0(kaiser_alpha * sqrtf(1.0f - x * x)) / bessel_i0(kaiser_alpha);
+    float sinc = t == 0.0f ? 1.0f : sinf(3.14159265f * t) / (3.14159265f * t);
+
+    return sinc * window;
+}
+
+// Taps for every destination pixel along one axis, stride taps per pixel
+struct taps
+{
+    std::vector<int>    first;
+    std::vector<float>  weight;
+    int                 stride;
+};
+
+static void build_taps(filter f, unsigned int src, unsigned int dst, taps& t)
+{
+    float scale = (float)src / (float)dst;
+    float radius = (f == FILTER_BOX) ? scale * 0.5f : (float)KAISER_RADIUS * scale;
+    unsigned int x;
+    int i;
+
+    t.stride = (int)ceilf(radius * 2.0f) + 1;
+    t.first.resize(dst);
+    t.weight.assign((size_t)dst * t.stride, 0.0f);
+
+    for (x = 0; x < dst; x++)
+    {
+        float center = (x + 0.5f) * scale;
+        int first = (int)floorf(center - radius);
+        float total = 0.0f;
+        float * w = &t.weight[(size_t)x * t.stride];
+
+        t.first[x] = first;
+
+        for (i = 0; i < t.stride; i++)
+        {
+            float lo = (float)(first + i);
+
+            if (f == FILTER_BOX)
+            {
+                // Overlap of source pixel [lo, lo + 1) with the footprint
+                float a = lo > center - radius ? lo : center - radius;
+                float b = lo + 1.0f < center + radius ? lo + 1.0f : center + radius;
+                w[i] = b > a ? b - a : 0.0f;
+            }
+            else
+            {
+                w[i] = kaiser_sinc((lo + 0.5f - center) / scale);
+            }
+
+            total += w[i];
+        }
+
+        for (i = 0; i < t.stride; i++)
+            w[i] /= total;
+    }
+}
+
+static inline int clamp_index(int i, int size)
+{
+    return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+// dst += w * src over count RGBA pixels
+static inline void accumulate(float * dst, const float * src, float w, unsigned int count)
+{
+    unsigned int i;
+
+#ifdef SB7_MIPMAP_SSE2
+    __m128 vw = _mm_set1_ps(w);
+
+    for (i = 0; i < count; i++)
+    {
+        __m128 d = _mm_loadu_ps(dst + i * 4);
+        d = _mm_add_ps(d, _mm_mul_ps(vw, _mm_loadu_ps(src + i * 4)));
+        _mm_storeu_ps(dst + i * 4, d);
+    }
+#else
+    for (i = 0; i < count * 4; i++)
+        dst[i] += w * src[i];
+#endif
+}
+
+static inline void quantize(const float * src, unsigned char * dst, unsigned int count, bool srgb)
+{
+    const tables& t = get_tables();
+    unsigned int i;
+    int c;
+
+    for (i = 0; i < count; i++)
+    {
+        for (c = 0; c < 4; c++)
+        {
+            float v = src[i * 4 + c];
+            v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+
+            if (srgb && c < 3)
+                dst[i * 4 + c] = t.to_srgb[(int)(v * (LINEAR_LUT_SIZE - 1) + 0.5f)];
+            else
+                dst[i * 4 + c] = (unsigned char)(v * 255.0f + 0.5f);
+        }
+    }
+}
+
+// One level of one image, destination rows [first_row, last_row)
+static void downsample_rows(const float * src, unsigned int src_w, unsigned int src_h,
+                            float * dst, unsigned int dst_w,
+                            const taps& tx, const taps& ty,
+                            unsigned int first_row, unsigned int last_row,
+                            unsigned char * out, bool srgb)
+{
+    std::vector<float> row((size_t)src_w * 4);
+    unsigned int x, y;
+    int k;
+
+    for (y = first_row; y < last_row; y++)
+    {
+        const float * wy = &ty.weight[(size_t)y * ty.stride];
+        float * d = dst + (size_t)y * dst_w * 4;
+
+        // Vertical pass into the scratch row
+        memset(&row[0], 0, row.size() * sizeof(float));
+        for (k = 0; k < ty.stride; k++)
+        {
+            if (wy[k] != 0.0f)
+            {
+                int sy = clamp_index(ty.first[y] + k, (int)src_h);
+                accumulate(&row[0], src + (size_t)sy * src_w * 4, wy[k], src_w);
+            }
+        }
+
+        // Horizontal pass into the destination
+        memset(d, 0, (size_t)dst_w * 4 * sizeof(float));
+        for (x = 0; x < dst_w; x++)
+        {
+            const float * wx = &tx.weight[(size_t)x * tx.stride];
+
+            for (k = 0; k < tx.stride; k++)
+            {
+                if (wx[k] != 0.0f)
+                {
+                    int sx = clamp_index(tx.first[x] + k, (int)src_w);
+                    accumulate(d + x * 4, &row[(size_t)sx * 4], wx[k], 1);
+                }
+            }
+        }
+
+        quantize(d, out + (size_t)y * dst_w * 4, dst_w, srgb);
+    }
+}
+
+// One level's worth of bands, shared by every worker
+struct level_job
+{
+    std::atomic<unsigned int> *                 next_task;
+    unsigned int                                tasks;
+    unsigned int                                bands;
+    unsigned int                                band;
+    std::vector<float> *                        current;
+    std::vector<float> *                        next;
+    std::vector<std::vector<unsigned char> > *  chains;
+    unsigned int                                level;
+    unsigned int                                src_w, src_h;
+    unsigned int                                dst_w, dst_h;
+    const taps *                                tx;
+    const taps *                                ty;
+    bool                                        srgb;
+};
+
+static void run_level(level_job * job)
+{
+    unsigned int task;
+
+    while ((task = (*job->next_task)++) < job->tasks)
+    {
+        unsigned int image = task / job->bands;
+        unsigned int first = (task % job->bands) * job->band;
+        unsigned int last = first + job->band < job->dst_h ? first + job->band : job->dst_h;
+
+        downsample_rows(&job->current[image][0], job->src_w, job->src_h,
+                        &job->next[image][0], job->dst_w, *job->tx, *job->ty,
+                        first, last, &job->chains[image][job->level][0], job->srgb);
+    }
+}
+
+void generate(filter f,
+              const unsigned char * const * images,
+              unsigned int count,
+              unsigned int width,
+              unsigned int height,
+              std::vector<std::vector<unsigned char> > * chains,
+              bool srgb,
+              unsigned int threads)
+{
+    const tables& t = get_tables();
+    unsigned int levels = level_count(width, height);
+    unsigned int level;
+    unsigned int i, p;
+
+    if (width == 0 || height == 0 || count == 0)
+        return;
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    // Every image is filtered in float from here on
+    std::vector<std::vector<float> > current(count);
+    std::vector<std::vector<float> > next(count);
+
+    for (i = 0; i < count; i++)
+    {
+        size_t pixels = (size_t)width * height;
+
+        chains[i].assign(levels, std::vector<unsigned char>());
+        chains[i][0].assign(images[i], images[i] + pixels * 4);
+        current[i].resize(pixels * 4);
+
+        for (p = 0; p < pixels * 4; p++)
+        {
+            current[i][p] = (srgb && (p & 3) != 3) ? t.to_linear[images[i][p]] : images[i][p] / 255.0f;
+        }
+    }
+
+    for (level = 1; level < levels; level++)
+    {
+        unsigned int src_w, src_h, dst_w, dst_h;
+        taps tx, ty;
+
+        level_size(level - 1, width, height, src_w, src_h);
+        level_size(level, width, height, dst_w, dst_h);
+
+        build_taps(f, src_w, dst_w, tx);
+        build_taps(f, src_h, dst_h, ty);
+
+        for (i = 0; i < count; i++)
+        {
+            next[i].resize((size_t)dst_w * dst_h * 4);
+            chains[i][level].resize((size_t)dst_w * dst_h * 4);
+        }
+
+        // Bands of rows of every image go to whichever worker is free
+        unsigned int band = (dst_h + threads - 1) / threads;
+        if (band < 4)
+            band = 4;
+        unsigned int bands = (dst_h + band - 1) / band;
+        unsigned int tasks = bands * count;
+        std::atomic<unsigned int> next_task(0);
+
+        level_job job;
+        job.next_task = &next_task;
+        job.tasks = tasks;
+        job.bands = bands;
+        job.band = band;
+        job.current = &current[0];
+        job.next = &next[0];
+        job.chains = chains;
+        job.level = level;
+        job.src_w = src_w;
+        job.src_h = src_h;
+        job.dst_w = dst_w;
+        job.dst_h = dst_h;
+        job.tx = &tx;
+        job.ty = &ty;
+        job.srgb = srgb;
+
+        unsigned int spawn = threads < tasks ? threads : tasks;
+        std::vector<std::thread> pool;
+
+        for (i = 1; i < spawn; i++)
+            pool.push_back(std::thread(run_level, &job));
+
+        run_level(&job);
+
+        for (i = 0; i < pool.size(); i++)
+            pool[i].join();
+
+        current.swap(next);
+    }
+}
+
+}
+
+}
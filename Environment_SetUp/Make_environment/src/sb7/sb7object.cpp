@@ -25,16 +25,22 @@
 
 #include "GL/gl3w.h"
 #include <object.h>
+#include <sb7meshcodec.h>
+#include <sb7vfs.h>
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
 namespace sb7
 {
 
 object::object()
     : data_buffer(0),
+      vao(0),
       index_type(0),
-      vao(0)
+      index_offset(0),
+      indirect_buffer(0)
 {
 
 }
@@ -44,53 +50,113 @@ object::~object()
 
 }
 
+static unsigned int index_size(GLenum type)
+{
+    switch (type)
+    {
+        case GL_UNSIGNED_BYTE:      return sizeof(GLubyte);
+        case GL_UNSIGNED_SHORT:     return sizeof(GLushort);
+        case GL_UNSIGNED_INT:       return sizeof(GLuint);
+        default:                    return 0;
+    }
+}
+
+// Whether [offset, offset + length) fits in size bytes
+static bool in_range(uint64_t offset, uint64_t length, uint64_t size)
+{
+    return offset <= size && length <= size - offset;
+}
+
+// The smallest a chunk of each known type can be and still hold its fields
+static size_t min_chunk_size(unsigned int chunk_type)
+{
+    switch (chunk_type)
+    {
+        case SB6M_CHUNK_TYPE_VERTEX_ATTRIBS:    return offsetof(SB6M_VERTEX_ATTRIB_CHUNK, attrib_data);
+        case SB6M_CHUNK_TYPE_VERTEX_DATA:       return sizeof(SB6M_CHUNK_VERTEX_DATA);
+        case SB6M_CHUNK_TYPE_INDEX_DATA:        return sizeof(SB6M_CHUNK_INDEX_DATA);
+        case SB6M_CHUNK_TYPE_SUB_OBJECT_LIST:   return offsetof(SB6M_CHUNK_SUB_OBJECT_LIST, sub_object);
+        case SB6M_CHUNK_TYPE_DATA:              return sizeof(SB6M_DATA_CHUNK);
+        case SB6M_CHUNK_TYPE_CLUSTER_LIST:      return offsetof(SB6M_CHUNK_CLUSTER_LIST, cluster);
+        default:                                return sizeof(SB6M_CHUNK_HEADER);
+    }
+}
+
+static void report(const char * filename, const char * message)
+{
+    char buffer[1024];
+
+    snprintf(buffer, sizeof(buffer), "%s: %s", filename, message);
+#ifdef _WIN32
+    OutputDebugStringA(buffer);
+    OutputDebugStringA("\n");
+#else
+    fprintf(stderr, "%s\n", buffer);
+#endif
+}
+
 void object::load(const char * filename)
 {
-    FILE * infile = fopen(filename, "rb");
-    size_t filesize;
-    char * data;
+    vfs::file file;
 
     this->free();
 
-    fseek(infile, 0, SEEK_END);
-    filesize = ftell(infile);
-    fseek(infile, 0, SEEK_SET);
+    // The file is mapped read-only (or already in an archive's mapping) and
+    // uploaded from there directly
+    if (!file.open(filename))
+        return;
 
-    data = new char[filesize];
+    const unsigned char * data = file.data();
+    const unsigned char * ptr = data;
+    const unsigned char * end = data + file.size();
+    const SB6M_HEADER * header = (const SB6M_HEADER *)ptr;
 
-    fread(data, filesize, 1, infile);
+    if (file.size() < sizeof(SB6M_HEADER) || header->magic != SB6M_MAGIC || header->size > file.size())
+        return;
 
-    char * ptr = data;
-    SB6M_HEADER * header = (SB6M_HEADER *)ptr;
     ptr += header->size;
 
-    SB6M_VERTEX_ATTRIB_CHUNK * vertex_attrib_chunk = NULL;
-    SB6M_CHUNK_VERTEX_DATA * vertex_data_chunk = NULL;
-    SB6M_CHUNK_INDEX_DATA * index_data_chunk = NULL;
-    SB6M_CHUNK_SUB_OBJECT_LIST * sub_object_chunk = NULL;
-    SB6M_DATA_CHUNK * data_chunk = NULL;
+    const SB6M_VERTEX_ATTRIB_CHUNK * vertex_attrib_chunk = NULL;
+    const SB6M_CHUNK_VERTEX_DATA * vertex_data_chunk = NULL;
+    const SB6M_CHUNK_INDEX_DATA * index_data_chunk = NULL;
+    const SB6M_CHUNK_SUB_OBJECT_LIST * sub_object_chunk = NULL;
+    const SB6M_DATA_CHUNK * data_chunk = NULL;
+    const SB6M_CHUNK_CLUSTER_LIST * cluster_chunk = NULL;
 
     unsigned int i;
     for (i = 0; i < header->num_chunks; i++)
     {
-        SB6M_CHUNK_HEADER * chunk = (SB6M_CHUNK_HEADER *)ptr;
+        const SB6M_CHUNK_HEADER * chunk = (const SB6M_CHUNK_HEADER *)ptr;
+
+        if (end - ptr < (ptrdiff_t)sizeof(SB6M_CHUNK_HEADER) || chunk->size < sizeof(SB6M_CHUNK_HEADER) || chunk->size > (size_t)(end - ptr))
+            break;  // Truncated file, use whatever was found so far
+
+        if (chunk->size < min_chunk_size(chunk->chunk_type))
+        {
+            report(filename, "chunk too small for its type");
+            return;
+        }
+
         ptr += chunk->size;
         switch (chunk->chunk_type)
         {
             case SB6M_CHUNK_TYPE_VERTEX_ATTRIBS:
-                vertex_attrib_chunk = (SB6M_VERTEX_ATTRIB_CHUNK *)chunk;
+                vertex_attrib_chunk = (const SB6M_VERTEX_ATTRIB_CHUNK *)chunk;
                 break;
             case SB6M_CHUNK_TYPE_VERTEX_DATA:
-                vertex_data_chunk = (SB6M_CHUNK_VERTEX_DATA *)chunk;
+                vertex_data_chunk = (const SB6M_CHUNK_VERTEX_DATA *)chunk;
                 break;
             case SB6M_CHUNK_TYPE_INDEX_DATA:
-                index_data_chunk = (SB6M_CHUNK_INDEX_DATA *)chunk;
+                index_data_chunk = (const SB6M_CHUNK_INDEX_DATA *)chunk;
                 break;
             case SB6M_CHUNK_TYPE_SUB_OBJECT_LIST:
-                sub_object_chunk = (SB6M_CHUNK_SUB_OBJECT_LIST *)chunk;
+                sub_object_chunk = (const SB6M_CHUNK_SUB_OBJECT_LIST *)chunk;
                 break;
             case SB6M_CHUNK_TYPE_DATA:
-                data_chunk = (SB6M_DATA_CHUNK *)chunk;
+                data_chunk = (const SB6M_DATA_CHUNK *)chunk;
+                break;
+            case SB6M_CHUNK_TYPE_CLUSTER_LIST:
+                cluster_chunk = (const SB6M_CHUNK_CLUSTER_LIST *)chunk;
                 break;
             default:
                 break; // goto failed;
@@ -99,6 +165,49 @@ void object::load(const char * filename)
 
 // failed:
 
+    // Everything the file points at has to be inside it before any of it is
+    // uploaded. Data chunk offsets are from the chunk, index offsets are
+    // into the data chunk's contents when there is one and otherwise, like
+    // vertex data offsets, from the start of the file.
+    uint64_t index_bytes = 0;
+
+    if (index_data_chunk != NULL)
+    {
+        index_bytes = (uint64_t)index_data_chunk->index_count * index_size(index_data_chunk->index_type);
+
+        if (index_size(index_data_chunk->index_type) == 0)
+        {
+            report(filename, "unknown index type");
+            return;
+        }
+    }
+
+    if (data_chunk != NULL)
+    {
+        size_t available = end - (const unsigned char *)data_chunk;
+
+        if (data_chunk->data_offset > available ||
+            (data_chunk->encoding != SB6M_DATA_ENCODING_PACKED && data_chunk->data_length > available - data_chunk->data_offset) ||
+            (index_data_chunk != NULL && !in_range(index_data_chunk->index_data_offset, index_bytes, data_chunk->data_length)))
+        {
+            report(filename, "vertex or index data runs past the end of the file");
+            return;
+        }
+    }
+    else if ((vertex_data_chunk != NULL && !in_range(vertex_data_chunk->data_offset, vertex_data_chunk->data_size, file.size())) ||
+             (index_data_chunk != NULL && !in_range(index_data_chunk->index_data_offset, index_bytes, file.size())))
+    {
+        report(filename, "vertex or index data runs past the end of the file");
+        return;
+    }
+
+    if (vertex_attrib_chunk != NULL &&
+        vertex_attrib_chunk->attrib_count > (vertex_attrib_chunk->header.size - offsetof(SB6M_VERTEX_ATTRIB_CHUNK, attrib_data)) / sizeof(SB6M_VERTEX_ATTRIB_DECL))
+    {
+        report(filename, "vertex attribute list runs past the end of its chunk");
+        return;
+    }
+
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
@@ -106,23 +215,52 @@ void object::load(const char * filename)
     {
         glGenBuffers(1, &data_buffer);
         glBindBuffer(GL_ARRAY_BUFFER, data_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data_chunk->data_length, (unsigned char*)data_chunk + data_chunk->data_offset, GL_STATIC_DRAW);
+
+        const unsigned char * payload = (const unsigned char *)data_chunk + data_chunk->data_offset;
+        size_t payload_size = end - payload;
+
+        if (data_chunk->encoding == SB6M_DATA_ENCODING_PACKED)
+        {
+            // Decode straight into the buffer's storage, no staging copy
+            glBufferData(GL_ARRAY_BUFFER, data_chunk->data_length, NULL, GL_STATIC_DRAW);
+            void * dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, data_chunk->data_length, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+            bool decoded = dst != NULL && meshcodec::decode_data(dst, data_chunk->data_length, payload, payload_size);
+
+            if (dst != NULL)
+            {
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+
+            if (!decoded)
+            {
+                report(filename, "can't decode packed data");
+                glBindVertexArray(0);
+                this->free();
+                return;
+            }
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, data_chunk->data_length, payload, GL_STATIC_DRAW);
+        }
+
+        if (index_data_chunk != NULL)
+        {
+            // Index offset is already relative to the data chunk's contents
+            index_offset = index_data_chunk->index_data_offset;
+        }
     }
     else
     {
-        unsigned int data_size = 0;
-        unsigned int size_used = 0;
+        size_t data_size = (size_t)index_bytes;
+        size_t size_used = 0;
 
         if (vertex_data_chunk != NULL)
         {
             data_size += vertex_data_chunk->data_size;
         }
 
-        if (index_data_chunk != NULL)
-        {
-            data_size += index_data_chunk->index_count * (index_data_chunk->index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLubyte));
-        }
-
         glGenBuffers(1, &data_buffer);
         glBindBuffer(GL_ARRAY_BUFFER, data_buffer);
         glBufferData(GL_ARRAY_BUFFER, data_size, NULL, GL_STATIC_DRAW);
@@ -130,62 +268,83 @@ void object::load(const char * filename)
         if (vertex_data_chunk != NULL)
         {
             glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_data_chunk->data_size, data + vertex_data_chunk->data_offset);
-            size_used += vertex_data_chunk->data_offset;
+            size_used += vertex_data_chunk->data_size;
         }
 
         if (index_data_chunk != NULL)
         {
-            glBufferSubData(GL_ARRAY_BUFFER, size_used, index_data_chunk->index_count * (index_data_chunk->index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLubyte)), data + index_data_chunk->index_data_offset);
+            // Indices land right after the vertices, wherever they were in the file
+            glBufferSubData(GL_ARRAY_BUFFER, size_used, (size_t)index_bytes, data + index_data_chunk->index_data_offset);
+            index_offset = (GLuint)size_used;
         }
     }
 
-    for (i = 0; i < vertex_attrib_chunk->attrib_count; i++)
+    if (vertex_attrib_chunk != NULL)
     {
-        SB6M_VERTEX_ATTRIB_DECL &attrib_decl = vertex_attrib_chunk->attrib_data[i];
-        glVertexAttribPointer(i,
-                              attrib_decl.size,
-                              attrib_decl.type,
-                              attrib_decl.flags & SB6M_VERTEX_ATTRIB_FLAG_NORMALIZED ? GL_TRUE : GL_FALSE,
-                              attrib_decl.stride,
-                              (GLvoid *)(uintptr_t)attrib_decl.data_offset);
-        glEnableVertexAttribArray(i);
+        for (i = 0; i < vertex_attrib_chunk->attrib_count; i++)
+        {
+            const SB6M_VERTEX_ATTRIB_DECL &attrib_decl = vertex_attrib_chunk->attrib_data[i];
+            if (attrib_decl.flags & SB6M_VERTEX_ATTRIB_FLAG_INTEGER)
+            {
+                glVertexAttribIPointer(i,
+                                       attrib_decl.size,
+                                       attrib_decl.type,
+                                       attrib_decl.stride,
+                                       (GLvoid *)(uintptr_t)attrib_decl.data_offset);
+            }
+            else
+            {
+                glVertexAttribPointer(i,
+                                      attrib_decl.size,
+                                      attrib_decl.type,
+                                      attrib_decl.flags & SB6M_VERTEX_ATTRIB_FLAG_NORMALIZED ? GL_TRUE : GL_FALSE,
+                                      attrib_decl.stride,
+                                      (GLvoid *)(uintptr_t)attrib_decl.data_offset);
+            }
+            glEnableVertexAttribArray(i);
+        }
     }
 
     if (index_data_chunk != NULL)
     {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data_buffer);
         index_type = index_data_chunk->index_type;
-        index_offset = index_data_chunk->index_data_offset;
     }
     else
     {
         index_type = GL_NONE;
+        index_offset = 0;
     }
 
     if (sub_object_chunk != NULL)
     {
-        if (sub_object_chunk->count > MAX_SUB_OBJECTS)
-        {
-            sub_object_chunk->count = MAX_SUB_OBJECTS;
-        }
+        // Never trust the count further than the chunk actually reaches
+        size_t max_count = (sub_object_chunk->header.size - offsetof(SB6M_CHUNK_SUB_OBJECT_LIST, sub_object)) / sizeof(SB6M_SUB_OBJECT_DECL);
+        unsigned int count = sub_object_chunk->count;
 
-        for (i = 0; i < sub_object_chunk->count; i++)
+        if (count > max_count)
         {
-            sub_object[i] = sub_object_chunk->sub_object[i];
+            count = (unsigned int)max_count;
         }
 
-        num_sub_objects = sub_object_chunk->count;
+        sub_object.assign(sub_object_chunk->sub_object, sub_object_chunk->sub_object + count);
     }
     else
     {
-        sub_object[0].first = 0;
-        sub_object[0].count = index_type != GL_NONE ? index_data_chunk->index_count : vertex_data_chunk->total_vertices;
-        num_sub_objects = 1;
-    }
+        SB6M_SUB_OBJECT_DECL whole;
 
-    delete[] data;
+        whole.first = 0;
+        whole.count = index_type != GL_NONE ? index_data_chunk->index_count :
+                      vertex_data_chunk != NULL ? vertex_data_chunk->total_vertices : 0;
+        sub_object.assign(1, whole);
+    }
 
-    fclose(infile);
+    // Cluster bounds only make sense if they line up with the sub-objects
+    if (cluster_chunk != NULL && sub_object_chunk != NULL && cluster_chunk->count >= sub_object.size() &&
+        (cluster_chunk->header.size - offsetof(SB6M_CHUNK_CLUSTER_LIST, cluster)) / sizeof(SB6M_CLUSTER_DECL) >= sub_object.size())
+    {
+        cluster.assign(cluster_chunk->cluster, cluster_chunk->cluster + sub_object.size());
+    }
 
     glBindVertexArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -195,9 +354,13 @@ void object::free()
 {
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &data_buffer);
+    glDeleteBuffers(1, &indirect_buffer);
 
     vao = 0;
     data_buffer = 0;
+    indirect_buffer = 0;
+    sub_object.clear();
+    cluster.clear();
 }
 
 void object::render_sub_object(unsigned int object_index, unsigned int instance_count, unsigned int base_instance)
@@ -206,10 +369,11 @@ void object::render_sub_object(unsigned int object_index, unsigned int instance_
 
     if (index_type != GL_NONE)
     {
+        // Sub-object ranges count indices, the draw wants a byte offset
         glDrawElementsInstancedBaseInstance(GL_TRIANGLES,
                                             sub_object[object_index].count,
                                             index_type,
-                                            (void*)sub_object[object_index].first,
+                                            (void*)(uintptr_t)(index_offset + sub_object[object_index].first * index_size(index_type)),
                                             instance_count,
                                             base_instance);
     }
@@ -223,4 +387,155 @@ void object::render_sub_object(unsigned int object_index, unsigned int instance_
     }
 }
 
+void object::render_all(const unsigned int * object_indices,
+                        unsigned int object_count,
+                        unsigned int instance_count,
+                        unsigned int base_instance)
+{
+    unsigned int i;
+    unsigned int isize = index_size(index_type);
+
+    if (object_indices == NULL)
+    {
+        object_count = (unsigned int)sub_object.size();
+    }
+
+    if (object_count == 0)
+        return;
+
+    glBindVertexArray(vao);
+
+    if (instance_count == 1 && base_instance == 0)
+    {
+        draw_count.resize(object_count);
+
+        if (index_type != GL_NONE)
+        {
+            draw_offset.resize(object_count);
+
+            for (i = 0; i < object_count; i++)
+            {
+                const SB6M_SUB_OBJECT_DECL& so = sub_object[object_indices ? object_indices[i] : i];
+                draw_count[i] = so.count;
+                draw_offset[i] = (const void *)(uintptr_t)(index_offset + so.first * isize);
+            }
+
+            glMultiDrawElements(GL_TRIANGLES, &draw_count[0], index_type, &draw_offset[0], object_count);
+        }
+        else
+        {
+            draw_first.resize(object_count);
+
+            for (i = 0; i < object_count; i++)
+            {
+                const SB6M_SUB_OBJECT_DECL& so = sub_object[object_indices ? object_indices[i] : i];
+                draw_first[i] = so.first;
+                draw_count[i] = so.count;
+            }
+
+            glMultiDrawArrays(GL_TRIANGLES, &draw_first[0], &draw_count[0], object_count);
+        }
+
+        return;
+    }
+
+    // Indirect commands address indices in elements, not bytes
+    if (index_type != GL_NONE && index_offset % isize != 0)
+    {
+        for (i = 0; i < object_count; i++)
+        {
+            render_sub_object(object_indices ? object_indices[i] : i, instance_count, base_instance);
+        }
+
+        return;
+    }
+
+    if (index_type != GL_NONE)
+    {
+        // DrawElementsIndirectCommand: count, instanceCount, firstIndex, baseVertex, baseInstance
+        draw_commands.resize(object_count * 5);
+
+        for (i = 0; i < object_count; i++)
+        {
+            const SB6M_SUB_OBJECT_DECL& so = sub_object[object_indices ? object_indices[i] : i];
+            GLuint * cmd = &draw_commands[i * 5];
+            cmd[0] = so.count;
+            cmd[1] = instance_count;
+            cmd[2] = index_offset / isize + so.first;
+            cmd[3] = 0;
+            cmd[4] = base_instance;
+        }
+    }
+    else
+    {
+        // DrawArraysIndirectCommand: count, instanceCount, first, baseInstance
+        draw_commands.resize(object_count * 4);
+
+        for (i = 0; i < object_count; i++)
+        {
+            const SB6M_SUB_OBJECT_DECL& so = sub_object[object_indices ? object_indices[i] : i];
+            GLuint * cmd = &draw_commands[i * 4];
+            cmd[0] = so.count;
+            cmd[1] = instance_count;
+            cmd[2] = so.first;
+            cmd[3] = base_instance;
+        }
+    }
+
+    if (indirect_buffer == 0)
+    {
+        glGenBuffers(1, &indirect_buffer);
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+    // Orphan the old contents so the driver never waits on last frame's draw
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, draw_commands.size() * sizeof(GLuint), &draw_commands[0], GL_STREAM_DRAW);
+
+    if (index_type != GL_NONE)
+    {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, NULL, object_count, 0);
+    }
+    else
+    {
+        glMultiDrawArraysIndirect(GL_TRIANGLES, NULL, object_count, 0);
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+unsigned int object::render_visible(const vmath::mat4& mvp,
+                                   const vmath::vec3& eye,
+                                   unsigned int instance_count,
+                                   unsigned int base_instance)
+{
+    unsigned int i;
+
+    if (!has_clusters())
+    {
+        render_all(NULL, 0, instance_count, base_instance);
+
+        return (unsigned int)sub_object.size();
+    }
+
+    cluster::frustum f;
+    cluster::extract_frustum(mvp, f);
+
+    visible.clear();
+
+    for (i = 0; i < sub_object.size(); i++)
+    {
+        if (cluster::is_visible(cluster[i], f, eye))
+        {
+            visible.push_back(i);
+        }
+    }
+
+    if (!visible.empty())
+    {
+        render_all(&visible[0], (unsigned int)visible.size(), instance_count, base_instance);
+    }
+
+    return (unsigned int)visible.size();
+}
+
 }
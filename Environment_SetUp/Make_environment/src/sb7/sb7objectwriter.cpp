@@ -0,0 +1,298 @@
+/*
+ * SB6M writer
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <sb7objectwriter.h>
+#include <sb7meshcodec.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+namespace sb7
+{
+
+static void append(std::vector<unsigned char>& out, const void * data, size_t size)
+{
+    const unsigned char * p = (const unsigned char *)data;
+
+    out.insert(out.end(), p, p + size);
+}
+
+static void align4(std::vector<unsigned char>& out)
+{
+    while (out.size() & 3)
+        out.push_back(0);
+}
+
+// Chunk sizes are patched once the payload is known
+static size_t begin_chunk(std::vector<unsigned char>& out, SB6M_CHUNK_TYPE type)
+{
+    SB6M_CHUNK_HEADER header;
+
+    header.chunk_type = type;
+    header.size = 0;
+
+    size_t start = out.size();
+    append(out, &header, sizeof(header));
+
+    return start;
+}
+
+static void end_chunk(std::vector<unsigned char>& out, size_t start)
+{
+    align4(out);
+
+    unsigned int size = (unsigned int)(out.size() - start);
+    memcpy(&out[start + offsetof(SB6M_CHUNK_HEADER, size)], &size, sizeof(size));
+}
+
+object_writer::object_writer()
+    : vertex_count(0),
+      stride(0),
+      index_type(GL_NONE),
+      index_count(0),
+      encoding(SB6M_DATA_ENCODING_RAW)
+{
+
+}
+
+void object_writer::set_vertex_data(const void * data, unsigned int size, unsigned int total_vertices)
+{
+    vertex_data.assign((const unsigned char *)data, (const unsigned char *)data + size);
+    vertex_count = total_vertices;
+}
+
+void object_writer::add_attrib(const char * name,
+                               unsigned int size,
+                               GLenum type,
+                               unsigned int stride,
+                               unsigned int flags,
+                               unsigned int data_offset)
+{
+    SB6M_VERTEX_ATTRIB_DECL decl;
+
+    memset(&decl, 0, sizeof(decl));
+    strncpy(decl.name, name, sizeof(decl.name) - 1);
+    decl.size = size;
+    decl.type = type;
+    decl.stride = stride;
+    decl.flags = flags;
+    decl.data_offset = data_offset;
+
+    attribs.push_back(decl);
+}
+
+void object_writer::set_index_data(GLenum type, const unsigned int * indices, unsigned int count)
+{
+    unsigned int i;
+
+    index_type = type;
+    index_count = count;
+    index_data.clear();
+
+    for (i = 0; i < count; i++)
+    {
+        switch (type)
+        {
+            case GL_UNSIGNED_BYTE:
+            {
+                GLubyte v = (GLubyte)indices[i];
+                append(index_data, &v, sizeof(v));
+                break;
+            }
+            case GL_UNSIGNED_SHORT:
+            {
+                GLushort v = (GLushort)indices[i];
+                append(index_data, &v, sizeof(v));
+                break;
+            }
+            default:
+                append(index_data, &indices[i], sizeof(GLuint));
+                break;
+        }
+    }
+}
+
+void object_writer::add_sub_object(unsigned int first, unsigned int count)
+{
+    SB6M_SUB_OBJECT_DECL decl;
+
+    decl.first = first;
+    decl.count = count;
+
+    sub_objects.push_back(decl);
+}
+
+void object_writer::set_sub_objects(const std::vector<SB6M_SUB_OBJECT_DECL>& list)
+{
+    sub_objects = list;
+}
+
+void object_writer::set_clusters(const std::vector<SB6M_CLUSTER_DECL>& list)
+{
+    clusters = list;
+}
+
+void object_writer::set_comment(const char * text)
+{
+    comment = text ? text : "";
+}
+
+void object_writer::write(std::vector<unsigned char>& out) const
+{
+    SB6M_HEADER header;
+    size_t chunk;
+    unsigned int num_chunks = 0;
+    unsigned int index_data_offset = 0;
+
+    // Decoded layout of the DATA chunk: vertices, then indices
+    std::vector<unsigned char> raw(vertex_data);
+    if (!index_data.empty())
+    {
+        align4(raw);
+        index_data_offset = (unsigned int)raw.size();
+        append(raw, &index_data[0], index_data.size());
+    }
+
+    size_t header_start = out.size();
+    memset(&header, 0, sizeof(header));
+    header.magic = SB6M_MAGIC;
+    header.size = sizeof(header);
+    append(out, &header, sizeof(header));
+
+    // Vertex attributes
+    chunk = begin_chunk(out, SB6M_CHUNK_TYPE_VERTEX_ATTRIBS);
+    {
+        unsigned int count = (unsigned int)attribs.size();
+        append(out, &count, sizeof(count));
+        if (count)
+            append(out, &attribs[0], count * sizeof(SB6M_VERTEX_ATTRIB_DECL));
+    }
+    end_chunk(out, chunk);
+    num_chunks++;
+
+    // Vertex data description, the bytes themselves live in the DATA chunk
+    chunk = begin_chunk(out, SB6M_CHUNK_TYPE_VERTEX_DATA);
+    {
+        unsigned int v[3] = { (unsigned int)vertex_data.size(), 0, vertex_count };
+        append(out, v, sizeof(v));
+    }
+    end_chunk(out, chunk);
+    num_chunks++;
+
+    if (!index_data.empty())
+    {
+        chunk = begin_chunk(out, SB6M_CHUNK_TYPE_INDEX_DATA);
+        {
+            unsigned int v[3] = { index_type, index_count, index_data_offset };
+            append(out, v, sizeof(v));
+        }
+        end_chunk(out, chunk);
+        num_chunks++;
+    }
+
+    if (!sub_objects.empty())
+    {
+        chunk = begin_chunk(out, SB6M_CHUNK_TYPE_SUB_OBJECT_LIST);
+        {
+            unsigned int count = (unsigned int)sub_objects.size();
+            append(out, &count, sizeof(count));
+            append(out, &sub_objects[0], count * sizeof(SB6M_SUB_OBJECT_DECL));
+        }
+        end_chunk(out, chunk);
+        num_chunks++;
+    }
+
+    if (!clusters.empty())
+    {
+        chunk = begin_chunk(out, SB6M_CHUNK_TYPE_CLUSTER_LIST);
+        {
+            unsigned int count = (unsigned int)clusters.size();
+            append(out, &count, sizeof(count));
+            append(out, &clusters[0], count * sizeof(SB6M_CLUSTER_DECL));
+        }
+        end_chunk(out, chunk);
+        num_chunks++;
+    }
+
+    if (!comment.empty())
+    {
+        chunk = begin_chunk(out, SB6M_CHUNK_TYPE_COMMENT);
+        append(out, comment.c_str(), comment.size() + 1);
+        end_chunk(out, chunk);
+        num_chunks++;
+    }
+
+    // The data itself goes last so everything above is read before it
+    chunk = begin_chunk(out, SB6M_CHUNK_TYPE_DATA);
+    {
+        unsigned int v[3] = { (unsigned int)encoding,
+                              (unsigned int)sizeof(SB6M_DATA_CHUNK),
+                              (unsigned int)raw.size() };
+        append(out, v, sizeof(v));
+
+        if (encoding == SB6M_DATA_ENCODING_PACKED)
+        {
+            std::vector<SB6M_PACKED_STREAM_DECL> streams;
+            SB6M_PACKED_STREAM_DECL decl;
+
+            memset(&decl, 0, sizeof(decl));
+
+            if (!vertex_data.empty())
+            {
+                unsigned int element_size = stride ? stride : 4;
+                if (vertex_data.size() % element_size)
+                    element_size = 1;
+
+                decl.type = SB6M_PACKED_STREAM_VERTEX;
+                decl.offset = 0;
+                decl.element_size = element_size;
+                decl.element_count = (unsigned int)(vertex_data.size() / element_size);
+                streams.push_back(decl);
+            }
+
+            if (!index_data.empty())
+            {
+                decl.type = SB6M_PACKED_STREAM_INDEX;
+                decl.offset = index_data_offset;
+                decl.element_size = (unsigned int)(index_data.size() / index_count);
+                decl.element_count = index_count;
+                streams.push_back(decl);
+            }
+
+            meshcodec::encode_data(out, raw.empty() ? NULL : &raw[0], streams);
+        }
+        else if (!raw.empty())
+        {
+            append(out, &raw[0], raw.size());
+        }
+    }
+    end_chunk(out, chunk);
+    num_chunks++;
+
+    memcpy(&out[header_start + offsetof(SB6M_HEADER, num_chunks)], &num_chunks, sizeof(num_chunks));
+}
+
+bool object_writer::save(const char * filename) const
+{
+    std::vector<unsigned char> out;
+    FILE * fp;
+    bool ok;
+
+    write(out);
+
+    fp = fopen(filename, "wb");
+
+    if (!fp)
+        return false;
+
+    ok = fwrite(&out[0], 1, out.size(), fp) == out.size();
+    ok &= fclose(fp) == 0;
+
+    return ok;
+}
+
+}
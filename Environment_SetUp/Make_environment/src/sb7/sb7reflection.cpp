@@ -0,0 +1,217 @@
+/*
+ * Program reflection
+ *
+ * One table holds every kind of resource, each slot tagged with its kind,
+ * and is kept at most half full so a probe rarely goes past the first slot.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <sb7reflection.h>
+
+#include <cstdio>
+#include <string>
+
+namespace sb7
+{
+
+program_reflection::program_reflection()
+    : name(0)
+{
+
+}
+
+void program_reflection::clear()
+{
+    name = 0;
+    uniform_list.clear();
+    attribute_list.clear();
+    block_list.clear();
+    table.clear();
+}
+
+// Arrays are reported as "name[0]", they're looked up as "name"
+static std::string resource_string(GLuint program, GLenum interface, GLuint index, GLint length)
+{
+    std::string s(length > 0 ? (size_t)length : 1, '\0');
+
+    glGetProgramResourceName(program, interface, index, (GLsizei)s.size(), NULL, &s[0]);
+    s.resize(strlen(s.c_str()));
+
+    if (s.size() > 3 && s.compare(s.size() - 3, 3, "[0]") == 0)
+        s.resize(s.size() - 3);
+
+    return s;
+}
+
+int program_reflection::find(unsigned int kind, uint32_t hash) const
+{
+    size_t mask = table.size() - 1;
+    size_t i;
+
+    if (table.empty())
+        return -1;
+
+    for (i = hash & mask; table[i].kind != SLOT_EMPTY; i = (i + 1) & mask)
+    {
+        if (table[i].hash == hash && table[i].kind == kind)
+            return (int)table[i].index;
+    }
+
+    return -1;
+}
+
+void program_reflection::insert(unsigned int kind, uint32_t hash, unsigned int index)
+{
+    size_t mask = table.size() - 1;
+    size_t i;
+
+    for (i = hash & mask; table[i].kind != SLOT_EMPTY; i = (i + 1) & mask)
+        ;
+
+    table[i].hash = hash;
+    table[i].kind = kind;
+    table[i].index = index;
+}
+
+bool program_reflection::reflect(GLuint program)
+{
+    static const GLenum uniform_props[] = { GL_NAME_LENGTH, GL_TYPE, GL_ARRAY_SIZE, GL_LOCATION,
+                                            GL_BLOCK_INDEX, GL_OFFSET, GL_ARRAY_STRIDE, GL_MATRIX_STRIDE };
+    static const GLenum attribute_props[] = { GL_NAME_LENGTH, GL_TYPE, GL_ARRAY_SIZE, GL_LOCATION };
+    static const GLenum block_props[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+
+    std::vector<std::string> names;
+    std::vector<unsigned int> kinds;
+    GLint status = 0;
+    GLint uniform_count = 0;
+    GLint attribute_count = 0;
+    GLint block_count = 0;
+    GLint values[8];
+    GLint i;
+    size_t size;
+    size_t n;
+
+    clear();
+
+    if (!program)
+        return false;
+
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+    if (!status)
+        return false;
+
+    glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniform_count);
+    glGetProgramInterfaceiv(program, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &attribute_count);
+    glGetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &block_count);
+
+    for (i = 0; i < uniform_count; i++)
+    {
+        uniform u;
+
+        glGetProgramResourceiv(program, GL_UNIFORM, i, 8, uniform_props, 8, NULL, values);
+        names.push_back(resource_string(program, GL_UNIFORM, i, values[0]));
+        kinds.push_back(SLOT_UNIFORM);
+
+        u.hash = name_hash(names.back().c_str(), names.back().size());
+        u.type = (GLenum)values[1];
+        u.array_size = values[2];
+        u.location = values[3];
+        u.block = values[4];
+        u.offset = values[5];
+        u.array_stride = values[6];
+        u.matrix_stride = values[7];
+
+        uniform_list.push_back(u);
+    }
+
+    for (i = 0; i < attribute_count; i++)
+    {
+        attribute a;
+
+        glGetProgramResourceiv(program, GL_PROGRAM_INPUT, i, 4, attribute_props, 4, NULL, values);
+        names.push_back(resource_string(program, GL_PROGRAM_INPUT, i, values[0]));
+        kinds.push_back(SLOT_ATTRIBUTE);
+
+        a.hash = name_hash(names.back().c_str(), names.back().size());
+        a.type = (GLenum)values[1];
+        a.array_size = values[2];
+        a.location = values[3];
+
+        attribute_list.push_back(a);
+    }
+
+    for (i = 0; i < block_count; i++)
+    {
+        block b;
+
+        glGetProgramResourceiv(program, GL_UNIFORM_BLOCK, i, 3, block_props, 3, NULL, values);
+        names.push_back(resource_string(program, GL_UNIFORM_BLOCK, i, values[0]));
+        kinds.push_back(SLOT_BLOCK);
+
+        b.hash = name_hash(names.back().c_str(), names.back().size());
+        b.index = (GLuint)i;
+        b.binding = values[1];
+        b.data_size = values[2];
+
+        block_list.push_back(b);
+    }
+
+    for (size = 8; size < names.size() * 2; size *= 2)
+        ;
+
+    table.assign(size, slot());
+
+    for (n = 0; n < names.size(); n++)
+    {
+        unsigned int kind = kinds[n];
+        unsigned int index = (unsigned int)(kind == SLOT_UNIFORM ? n :
+                                            kind == SLOT_ATTRIBUTE ? n - uniform_count :
+                                            n - uniform_count - attribute_count);
+        uint32_t hash = name_hash(names[n].c_str(), names[n].size());
+
+        // Every name in a program is different, so any match is a collision
+        if (find(kind, hash) >= 0)
+        {
+            char buffer[1024];
+
+            snprintf(buffer, sizeof(buffer), "program %u: \"%s\" has the same hash as another name, rename one of them",
+                     program, names[n].c_str());
+#ifdef _WIN32
+            OutputDebugStringA(buffer);
+            OutputDebugStringA("\n");
+#else
+            fprintf(stderr, "%s\n", buffer);
+#endif
+            clear();
+            return false;
+        }
+
+        insert(kind, hash, index);
+    }
+
+    name = program;
+
+    return true;
+}
+
+const program_reflection::uniform * program_reflection::find_uniform(resource_name n) const
+{
+    int i = find(SLOT_UNIFORM, n.hash);
+    return i < 0 ? NULL : &uniform_list[i];
+}
+
+const program_reflection::attribute * program_reflection::find_attribute(resource_name n) const
+{
+    int i = find(SLOT_ATTRIBUTE, n.hash);
+    return i < 0 ? NULL : &attribute_list[i];
+}
+
+const program_reflection::block * program_reflection::find_block(resource_name n) const
+{
+    int i = find(SLOT_BLOCK, n.hash);
+    return i < 0 ? NULL : &block_list[i];
+}
+
+}
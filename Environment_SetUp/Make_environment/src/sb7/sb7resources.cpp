@@ -0,0 +1,530 @@
+/*
+ * Resource manager
+ *
+ * Each resource is loaded by one coroutine. It hashes the files on a
+ * worker first, and only if nothing with the same contents is loaded does
+ * it go on to load them through the asset loader. That maps the files
+ * twice, but the second time they are still in the page cache.
+ *
+ * Eviction looks through every record for the oldest one, which costs
+ * nothing next to the handful of resources a scene has.
+ */
+
+#include <sb7resources.h>
+#include <sb7ktx.h>
+#include <sb7vfs.h>
+#include <shader.h>
+
+#include <cstring>
+
+namespace sb7
+{
+
+enum
+{
+    LOAD_MESH,
+    LOAD_CUBEMAP,
+    LOAD_KTX,
+    LOAD_PROGRAM
+};
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// MurmurHash3 style over every file the resource is loaded from. Never 0,
+// which is kept for "couldn't hash it".
+static uint64_t hash_files(unsigned int how, const std::vector<std::string>& paths)
+{
+    std::vector<std::string> files;
+    uint64_t h = 0x9e3779b97f4a7c15ull * (how + 1);
+    size_t i;
+
+    if (how == LOAD_CUBEMAP)
+    {
+        for (i = 0; i < 6; i++)
+            files.push_back(paths[0] + asset_loader::cube_face((unsigned int)i));
+    }
+    else
+    {
+        files = paths;
+    }
+
+    for (i = 0; i < files.size(); i++)
+    {
+        vfs::file f;
+
+        if (!f.open(files[i].c_str()))
+            return 0;
+
+        const unsigned char * p = f.data();
+        size_t n = f.size();
+        uint64_t w;
+
+        h ^= n;
+
+        for (; n >= 8; p += 8, n -= 8)
+        {
+            memcpy(&w, p, 8);
+            w *= 0x87c37b91114253d5ull;
+            w = rotl64(w, 31);
+            w *= 0x4cf5ad432745937full;
+            h ^= w;
+            h = rotl64(h, 27) * 5 + 0x52dce729;
+        }
+
+        for (w = 0; n > 0; n--)
+            w = (w << 8) | p[n - 1];
+
+        h ^= rotl64(w * 0x87c37b91114253d5ull, 31) * 0x4cf5ad432745937full;
+
+        // The same shader can include different files from another directory
+        std::vector<shader::dependency> includes;
+        std::string expanded;
+
+        if (how == LOAD_PROGRAM && shader::has_includes((const char *)f.data(), f.size()))
+        {
+            if (!shader::preprocess((const char *)f.data(), f.size(), files[i].c_str(), expanded, &includes))
+                return 0;
+
+            for (size_t j = 1; j < includes.size(); j++)
+                h = rotl64(h ^ (includes[j].hash * 0x87c37b91114253d5ull), 27) * 5 + 0x52dce729;
+        }
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h ? h : 1;
+}
+
+// Every level of every face, from what GL says the texture holds
+static size_t texture_bytes(GLuint name, GLenum target)
+{
+    GLenum face = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    size_t faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    size_t bytes = 0;
+    GLint level;
+
+    glBindTexture(target, name);
+
+    for (level = 0; level < 32; level++)
+    {
+        GLint width = 0, height = 0, depth = 0, compressed = 0;
+
+        glGetTexLevelParameteriv(face, level, GL_TEXTURE_WIDTH, &width);
+
+        if (width == 0)
+            break;
+
+        glGetTexLevelParameteriv(face, level, GL_TEXTURE_HEIGHT, &height);
+        glGetTexLevelParameteriv(face, level, GL_TEXTURE_DEPTH, &depth);
+        glGetTexLevelParameteriv(face, level, GL_TEXTURE_COMPRESSED, &compressed);
+
+        if (compressed)
+        {
+            GLint size = 0;
+
+            glGetTexLevelParameteriv(face, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            bytes += (size_t)size * faces;
+        }
+        else
+        {
+            static const GLenum channels[] =
+            {
+                GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE,
+                GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE, GL_TEXTURE_STENCIL_SIZE
+            };
+            size_t bits = 0;
+            int c;
+
+            for (c = 0; c < 6; c++)
+            {
+                GLint size = 0;
+
+                glGetTexLevelParameteriv(face, level, channels[c], &size);
+                bits += size;
+            }
+
+            bytes += (size_t)width * height * (depth ? depth : 1) * bits / 8 * faces;
+        }
+    }
+
+    return bytes;
+}
+
+resource_manager::resource_manager(asset_loader& assets)
+    : assets(assets),
+      limit(0),
+      total(0),
+      frame(0)
+{
+    memset(&counters, 0, sizeof(counters));
+}
+
+resource_manager::~resource_manager()
+{
+    std::unordered_map<std::string, std::unique_ptr<record> >::iterator it;
+
+    for (it = records.begin(); it != records.end(); ++it)
+    {
+        record * r = it->second.get();
+
+        if (r->shared || r->state != READY)
+            continue;
+
+        glDeleteBuffers(1, &r->mesh_data.buffer);
+        glDeleteTextures(1, &r->texture_data.name);
+        glDeleteProgram(r->program_data.name);
+    }
+}
+
+resource_manager::mesh_handle resource_manager::load_mesh(const std::string& path)
+{
+    return mesh_handle(find_or_load(LOAD_MESH, std::vector<std::string>(1, path)));
+}
+
+resource_manager::texture_handle resource_manager::load_cubemap(const std::string& directory)
+{
+    return texture_handle(find_or_load(LOAD_CUBEMAP, std::vector<std::string>(1, directory)));
+}
+
+resource_manager::texture_handle resource_manager::load_texture(const std::string& path)
+{
+    return texture_handle(find_or_load(LOAD_KTX, std::vector<std::string>(1, path)));
+}
+
+resource_manager::program_handle resource_manager::load_program(const std::string& vs_path, const std::string& fs_path)
+{
+    std::vector<std::string> paths;
+
+    paths.push_back(vs_path);
+    paths.push_back(fs_path);
+
+    return program_handle(find_or_load(LOAD_PROGRAM, paths));
+}
+
+resource_manager::record * resource_manager::find_or_load(unsigned int how, const std::vector<std::string>& paths)
+{
+    std::string key(1, (char)('0' + how));
+    size_t i;
+
+    for (i = 0; i < paths.size(); i++)
+    {
+        key += '|';
+        key += archive::normalize(paths[i].c_str());
+    }
+
+    std::unordered_map<std::string, std::unique_ptr<record> >::iterator it = records.find(key);
+
+    if (it != records.end())
+    {
+        counters.path_hits++;
+        return it->second.get();
+    }
+
+    record * r = new record;
+
+    r->owner = this;
+    r->how = how;
+    r->state = LOADING;
+    r->key = key;
+    r->content = 0;
+    r->refs = 0;
+    r->bytes = 0;
+    r->last_used = frame;
+    r->shared = nullptr;
+    r->mesh_data.buffer = 0;
+    r->mesh_data.vertex_count = 0;
+    r->texture_data.name = 0;
+    r->texture_data.target = GL_NONE;
+    r->program_data.name = 0;
+
+    records[key].reset(r);
+
+    // Runs to its first co_await and carries on by itself
+    load(r, paths);
+
+    return r;
+}
+
+task<void> resource_manager::load(record * r, std::vector<std::string> paths)
+{
+    co_await assets.on_worker();
+
+    uint64_t content = hash_files(r->how, paths);
+
+    co_await assets.on_gl_thread();
+
+    if (content)
+    {
+        std::unordered_map<uint64_t, record *>::iterator it = by_content.find(content);
+
+        if (it != by_content.end())
+        {
+            share(r, it->second);
+            co_return;
+        }
+
+        r->content = content;
+        by_content[content] = r;
+    }
+
+    mesh m;
+    texture t;
+    program p;
+
+    t.name = 0;
+    t.target = GL_NONE;
+    p.name = 0;
+
+    switch (r->how)
+    {
+        case LOAD_MESH:
+            m = co_await assets.load_mesh(paths[0]);
+            break;
+        case LOAD_CUBEMAP:
+            t.name = co_await assets.load_cubemap(paths[0]);
+            t.target = GL_TEXTURE_CUBE_MAP;
+            break;
+        case LOAD_KTX:
+            t.name = ktx::file::load(paths[0].c_str());
+            if (t.name)
+            {
+                GLint target = GL_NONE;
+                glGetTextureParameteriv(t.name, GL_TEXTURE_TARGET, &target);
+                t.target = (GLenum)target;
+            }
+            break;
+        case LOAD_PROGRAM:
+            p.name = co_await assets.load_program(paths[0], paths[1]);
+            break;
+    }
+
+    // A file that couldn't be read finishes on a decode thread
+    co_await assets.on_gl_thread();
+
+    if (r->how == LOAD_MESH)
+        r->mesh_data = std::move(m);
+
+    r->texture_data = t;
+    r->program_data = p;
+
+    if (r->how == LOAD_PROGRAM)
+        r->program_data.reflection.reflect(p.name);
+
+    finish(r, r->mesh_data.buffer || t.name || p.name);
+}
+
+void resource_manager::share(record * r, record * target)
+{
+    r->shared = target;
+    r->state = READY;
+    r->last_used = frame;
+    target->refs++;
+    counters.content_hits++;
+
+    if (target->state != LOADING)
+    {
+        wake(r);
+        return;
+    }
+
+    target->waiters.insert(target->waiters.end(), r->waiters.begin(), r->waiters.end());
+    r->waiters.clear();
+}
+
+void resource_manager::finish(record * r, bool ok)
+{
+    r->state = ok ? READY : FAILED;
+    r->last_used = frame;
+
+    if (ok)
+    {
+        switch (r->how)
+        {
+            case LOAD_MESH:
+            {
+                GLint size = 0;
+                glBindBuffer(GL_ARRAY_BUFFER, r->mesh_data.buffer);
+                glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+                r->bytes = (size_t)size;
+                break;
+            }
+            case LOAD_CUBEMAP:
+            case LOAD_KTX:
+                r->bytes = texture_bytes(r->texture_data.name, r->texture_data.target);
+                break;
+            case LOAD_PROGRAM:
+            {
+                GLint length = 0;
+                glGetProgramiv(r->program_data.name, GL_PROGRAM_BINARY_LENGTH, &length);
+                r->bytes = (size_t)length;
+                break;
+            }
+        }
+
+        total += r->bytes;
+    }
+    else if (r->content)
+    {
+        // Nothing else should share a failure
+        by_content.erase(r->content);
+        r->content = 0;
+    }
+
+    // Nobody may have wanted it by the time it loaded, in which case
+    // nobody is waiting on it either
+    if (r->refs == 0 && r->state == FAILED)
+    {
+        destroy(r);
+        return;
+    }
+
+    wake(r);
+    evict();
+}
+
+void resource_manager::wake(record * r)
+{
+    std::vector<std::coroutine_handle<> > waiting;
+    size_t i;
+
+    // Whoever is resumed may start or drop loads, so r isn't touched after
+    waiting.swap(r->waiters);
+
+    for (i = 0; i < waiting.size(); i++)
+        waiting[i].resume();
+}
+
+void resource_manager::release(record * r)
+{
+    if (--r->refs != 0)
+        return;
+
+    r->last_used = frame;
+
+    if (r->state == FAILED)
+        destroy(r);
+    else if (r->state == READY)
+        evict();
+}
+
+void resource_manager::set_budget(size_t bytes)
+{
+    limit = bytes;
+    evict();
+}
+
+void resource_manager::update()
+{
+    frame++;
+    evict();
+}
+
+void resource_manager::evict()
+{
+    if (limit == 0)
+        return;
+
+    while (total > limit)
+    {
+        std::unordered_map<std::string, std::unique_ptr<record> >::iterator it;
+        record * oldest = nullptr;
+
+        for (it = records.begin(); it != records.end(); ++it)
+        {
+            record * r = it->second.get();
+
+            if (r->refs == 0 && r->state != LOADING && (!oldest || r->last_used < oldest->last_used))
+                oldest = r;
+        }
+
+        if (!oldest)
+            break;
+
+        destroy(oldest);
+        counters.evictions++;
+    }
+}
+
+void resource_manager::purge()
+{
+    bool found = true;
+
+    // Dropping a record that shares another can free that one too, so
+    // start over after each
+    while (found)
+    {
+        std::unordered_map<std::string, std::unique_ptr<record> >::iterator it;
+
+        found = false;
+
+        for (it = records.begin(); it != records.end(); ++it)
+        {
+            if (it->second->refs == 0 && it->second->state != LOADING)
+            {
+                destroy(it->second.get());
+                found = true;
+                break;
+            }
+        }
+    }
+}
+
+void resource_manager::destroy(record * r)
+{
+    if (r->content)
+    {
+        std::unordered_map<uint64_t, record *>::iterator it = by_content.find(r->content);
+
+        if (it != by_content.end() && it->second == r)
+            by_content.erase(it);
+    }
+
+    if (r->shared)
+    {
+        record * target = r->shared;
+
+        if (--target->refs == 0)
+        {
+            target->last_used = frame;
+
+            if (target->state == FAILED)
+                destroy(target);
+        }
+    }
+    else if (r->state == READY)
+    {
+        glDeleteBuffers(1, &r->mesh_data.buffer);
+        glDeleteTextures(1, &r->texture_data.name);
+        glDeleteProgram(r->program_data.name);
+        total -= r->bytes;
+    }
+
+    records.erase(r->key);
+}
+
+void resource_manager::get_stats(stats& s) const
+{
+    std::unordered_map<std::string, std::unique_ptr<record> >::const_iterator it;
+
+    s = counters;
+    s.resources = (unsigned int)records.size();
+    s.loading = 0;
+    s.unreferenced = 0;
+    s.bytes = total;
+    s.budget = limit;
+
+    for (it = records.begin(); it != records.end(); ++it)
+    {
+        s.loading += it->second->state == LOADING;
+        s.unreferenced += it->second->refs == 0;
+    }
+}
+
+}
@@ -24,80 +24,200 @@
 #define _CRT_SECURE_NO_WARNINGS 1
 
 #include "GL/gl3w.h"
+#include <sb7ext.h>
+#include <sb7vfs.h>
+#include <shader.h>
 
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace sb7
 {
 
-namespace shader
-{
+#define SB7P_MAGIC      0x50374253u     // "SB7P"
+#define SB7P_VERSION    1
 
-extern
-GLuint load(const char * filename, GLenum shader_type, bool check_errors)
+// GL_KHR_parallel_shader_compile (and the ARB one, same values)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR            0x91B1
+#endif
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Ahead of the driver's binary in a cache file
+struct SB7P_HEADER
 {
-    GLuint result = 0;
-    FILE * fp;
-    size_t filesize;
-    char * data;
+    uint32_t            magic;
+    uint32_t            version;
+    uint64_t            key;            // The file is named after it too
+    uint32_t            format;         // From glGetProgramBinary
+    uint32_t            length;
+};
+
+// A link that start_link() issued and finish_link() hasn't looked at yet
+struct pending_link
+{
+    uint64_t                                    key;        // Binary cache key, 0 if the cache is off
+    std::vector<GLuint>                         shaders;
+    std::vector<std::string>                    filenames;  // Where known, for errors
+    bool                                        delete_shaders;
+};
 
-    fp = fopen(filename, "rb");
+struct program_state
+{
+    std::string                                 directory;  // Binary cache, native, ends in a separator, empty if off
+    std::unordered_map<GLuint, std::string>     deferred;   // Shaders not compiled yet, and their files
+    std::unordered_map<GLuint, pending_link>    pending;    // By program
+    program::binary_cache_stats                 counters;
+    bool                                        probed;     // For parallel compiles
+    bool                                        parallel;
+};
+
+static program_state& get_program_state()
+{
+    static program_state s;
+    return s;
+}
 
-    if (!fp)
-        return 0;
+// Asks the driver for as many compiler threads as it likes, the first time
+// anything is compiled
+static void probe_parallel_compile()
+{
+    program_state& s = get_program_state();
 
-    fseek(fp, 0, SEEK_END);
-    filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    if (s.probed)
+        return;
 
-    data = new char [filesize + 1];
+    s.probed = true;
 
-    if (!data)
-        goto fail_data_alloc;
+    if (!sb6IsExtensionSupported("GL_KHR_parallel_shader_compile") &&
+        !sb6IsExtensionSupported("GL_ARB_parallel_shader_compile"))
+        return;
 
-    fread(data, 1, filesize, fp);
-    data[filesize] = 0;
-    fclose(fp);
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC threads;
 
-    result = glCreateShader(shader_type);
+    threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)gl3wGetProcAddress("glMaxShaderCompilerThreadsKHR");
 
-    if (!result)
-        goto fail_shader_alloc;
+    if (!threads)
+        threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)gl3wGetProcAddress("glMaxShaderCompilerThreadsARB");
 
-    glShaderSource(result, 1, &data, NULL);
+    if (threads)
+        threads(0xFFFFFFFF);
 
-    delete [] data;
+    s.parallel = true;
+}
 
-    glCompileShader(result);
+// Prints the shader's log if it didn't compile
+static bool check_compile(GLuint sh, const char * filename)
+{
+    GLint status = 0;
+    glGetShaderiv(sh, GL_COMPILE_STATUS, &status);
 
-    if (check_errors)
+    if (!status)
     {
-        GLint status = 0;
-        glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-
-        if (!status)
-        {
-            char buffer[4096];
-            glGetShaderInfoLog(result, 4096, NULL, buffer);
+        char buffer[4096];
+        glGetShaderInfoLog(sh, 4096, NULL, buffer);
 #ifdef _WIN32
+        if (filename && filename[0])
+        {
             OutputDebugStringA(filename);
             OutputDebugStringA(":");
-            OutputDebugStringA(buffer);
-            OutputDebugStringA("\n");
+        }
+        OutputDebugStringA(buffer);
+        OutputDebugStringA("\n");
 #else
+        if (filename && filename[0])
             fprintf(stderr, "%s: %s\n", filename, buffer);
+        else
+            fprintf(stderr, "%s\n", buffer);
 #endif
-            goto fail_compile_shader;
-        }
+        return false;
+    }
+
+    return true;
+}
+
+// Without check_errors nothing waits on the compiler
+static bool compile(GLuint sh, const char * filename, bool check_errors)
+{
+    probe_parallel_compile();
+
+    get_program_state().counters.compiles++;
+
+    glCompileShader(sh);
+
+    return !check_errors || check_compile(sh, filename);
+}
+
+// With the cache on, compiling waits for link_from_shaders
+static bool defer(GLuint sh, const char * filename)
+{
+    program_state& c = get_program_state();
+
+    if (c.directory.empty())
+    {
+        c.deferred.erase(sh);
+        return false;
+    }
+
+    c.deferred[sh] = filename ? filename : "";
+
+    return true;
+}
+
+namespace shader
+{
+
+extern
+GLuint load(const char * filename, GLenum shader_type, bool check_errors)
+{
+    GLuint result = 0;
+    vfs::file file;
+    std::string expanded;
+    const GLchar * source;
+    GLint length;
+
+    // Compiled straight from the mapping, the length saves needing a terminator
+    if (!file.open(filename))
+        return 0;
+
+    source = (const GLchar *)file.data();
+    length = (GLint)file.size();
+
+    if (has_includes(source, length))
+    {
+        if (!preprocess(source, length, filename, expanded))
+            return 0;
+
+        source = expanded.data();
+        length = (GLint)expanded.size();
     }
 
+    result = glCreateShader(shader_type);
+
+    if (!result)
+        goto fail_shader_alloc;
+
+    glShaderSource(result, 1, &source, &length);
+
+    if (defer(result, filename))
+        return result;
+
+    if (!compile(result, filename, check_errors))
+        goto fail_compile_shader;
+
     return result;
 
 fail_compile_shader:
     glDeleteShader(result);
+    result = 0;
 
 fail_shader_alloc:;
-fail_data_alloc:
     return result;
 }
 
@@ -112,26 +232,11 @@ GLuint from_string(const char * source,
     const char * strings[] = { source };
     glShaderSource(sh, 1, strings, nullptr);
 
-    glCompileShader(sh);
+    if (defer(sh, NULL))
+        return sh;
 
-    if (check_errors)
-    {
-        GLint status = 0;
-        glGetShaderiv(sh, GL_COMPILE_STATUS, &status);
-
-        if (!status)
-        {
-            char buffer[4096];
-            glGetShaderInfoLog(sh, 4096, NULL, buffer);
-#ifdef _WIN32
-            OutputDebugStringA(buffer);
-            OutputDebugStringA("\n");
-#else
-            fprintf(stderr, "%s\n", buffer);
-#endif
-            goto fail_compile_shader;
-        }
-    }
+    if (!compile(sh, NULL, check_errors))
+        goto fail_compile_shader;
 
     return sh;
 
@@ -146,16 +251,271 @@ fail_compile_shader:
 namespace program
 {
 
-GLuint link_from_shaders(const GLuint * shaders,
-                         int shader_count,
-                         bool delete_shaders,
-                         bool check_errors)
+static uint64_t fnv1a(uint64_t h, const void * data, size_t size)
 {
+    const unsigned char * p = (const unsigned char *)data;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+// The driver, then each shader's stage and source, as GL has them
+static uint64_t program_key(const GLuint * shaders, int shader_count, bool separable)
+{
+    static const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    uint64_t h = 0xcbf29ce484222325ull;
+    std::vector<GLchar> source;
     int i;
 
+    for (i = 0; i < 3; i++)
+    {
+        const char * s = (const char *)glGetString(strings[i]);
+
+        if (s)
+            h = fnv1a(h, s, strlen(s));
+        h = fnv1a(h, "", 1);
+    }
+
+    for (i = 0; i < shader_count; i++)
+    {
+        GLint type = 0, length = 0;
+
+        glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+        glGetShaderiv(shaders[i], GL_SHADER_SOURCE_LENGTH, &length);
+
+        source.resize(length > 0 ? length : 1);
+        source[0] = 0;
+        glGetShaderSource(shaders[i], (GLsizei)source.size(), NULL, &source[0]);
+
+        h = fnv1a(h, &type, sizeof(type));
+        h = fnv1a(h, &source[0], source.size());
+    }
+
+    // The same shaders linked on their own are a different program
+    if (separable)
+        h = fnv1a(h, "separable", 9);
+
+    return h ? h : 1;
+}
+
+static std::string binary_path(uint64_t key)
+{
+    char name[32];
+
+    sprintf(name, "%016llx.bin", (unsigned long long)key);
+
+    return get_program_state().directory + name;
+}
+
+// 0 if there is no binary for key, or the driver won't take it
+static GLuint load_binary(uint64_t key, bool separable)
+{
+    program_state& c = get_program_state();
+    std::string path = binary_path(key);
+    std::vector<unsigned char> data;
+    SB7P_HEADER h;
     GLuint program;
+    GLint status = 0;
+    FILE * f;
+
+    f = fopen(path.c_str(), "rb");
+
+    if (!f)
+        goto fail_missing;
+
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != SB7P_MAGIC ||
+        h.version != SB7P_VERSION || h.key != key || h.length == 0)
+        goto fail_read;
+
+    data.resize(h.length);
+
+    if (fread(&data[0], 1, h.length, f) != h.length)
+        goto fail_read;
+
+    fclose(f);
 
     program = glCreateProgram();
+    if (separable)
+        glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glProgramBinary(program, h.format, &data[0], (GLsizei)h.length);
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+    if (!status)
+    {
+        // Usually a driver update, the fresh link replaces it
+        glDeleteProgram(program);
+        remove(path.c_str());
+        c.counters.rejected++;
+        return 0;
+    }
+
+    c.counters.hits++;
+
+    return program;
+
+fail_read:
+    fclose(f);
+    remove(path.c_str());
+
+fail_missing:
+    c.counters.misses++;
+
+    return 0;
+}
+
+static void store_binary(GLuint program, uint64_t key)
+{
+    program_state& c = get_program_state();
+    std::string path = binary_path(key);
+    std::string temp = path + ".tmp";
+    std::vector<unsigned char> data;
+    SB7P_HEADER h;
+    GLint status = 0, length = 0;
+    GLenum format = 0;
+    std::error_code ec;
+    FILE * f;
+    bool ok;
+
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (!status || length <= 0)
+        return;
+
+    data.resize(length);
+    glGetProgramBinary(program, length, &length, &format, &data[0]);
+
+    h.magic = SB7P_MAGIC;
+    h.version = SB7P_VERSION;
+    h.key = key;
+    h.format = format;
+    h.length = (uint32_t)length;
+
+    // Written to the side and renamed, so a run that dies halfway never
+    // leaves a broken binary behind
+    f = fopen(temp.c_str(), "wb");
+
+    if (!f)
+        return;
+
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(&data[0], 1, h.length, f) == h.length;
+    ok = fclose(f) == 0 && ok;
+
+    if (ok)
+        std::filesystem::rename(temp, path, ec);
+
+    if (!ok || ec)
+    {
+        remove(temp.c_str());
+        return;
+    }
+
+    c.counters.stored++;
+}
+
+void set_binary_cache(const char * directory)
+{
+    program_state& c = get_program_state();
+    GLint formats = 0;
+    std::error_code ec;
+
+    c.directory.clear();
+
+    if (!directory || !directory[0])
+        return;
+
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    if (formats <= 0)
+        return;
+
+    std::string native = vfs::native_path(directory);
+
+    std::filesystem::create_directories(native, ec);
+
+    if (!std::filesystem::is_directory(native, ec))
+        return;
+
+#ifdef _WIN32
+    if (native.back() != '\\')
+        native += '\\';
+#else
+    if (native.back() != '/')
+        native += '/';
+#endif
+
+    c.directory = native;
+}
+
+void get_binary_cache_stats(binary_cache_stats& s)
+{
+    s = get_program_state().counters;
+}
+
+GLuint start_link(const GLuint * shaders,
+                  int shader_count,
+                  bool delete_shaders,
+                  bool separable)
+{
+    program_state& s = get_program_state();
+    pending_link p;
+    uint64_t key = 0;
+    GLuint program;
+    int i;
+
+    if (!s.directory.empty())
+    {
+        key = program_key(shaders, shader_count, separable);
+        program = load_binary(key, separable);
+
+        if (program)
+        {
+            if (delete_shaders)
+            {
+                for (i = 0; i < shader_count; i++)
+                {
+                    s.deferred.erase(shaders[i]);
+                    glDeleteShader(shaders[i]);
+                }
+            }
+
+            return program;
+        }
+    }
+
+    p.key = key;
+    p.delete_shaders = delete_shaders;
+
+    // Whatever was left for here gets compiled now, alongside the rest
+    for (i = 0; i < shader_count; i++)
+    {
+        std::unordered_map<GLuint, std::string>::iterator it = s.deferred.find(shaders[i]);
+
+        p.shaders.push_back(shaders[i]);
+        p.filenames.push_back(std::string());
+
+        if (it == s.deferred.end())
+            continue;
+
+        p.filenames.back() = it->second;
+        s.deferred.erase(it);
+
+        compile(shaders[i], p.filenames.back().c_str(), false);
+    }
+
+    program = glCreateProgram();
+
+    if (key)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    if (separable)
+        glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
 
     for (i = 0; i < shader_count; i++)
     {
@@ -164,35 +524,146 @@ GLuint link_from_shaders(const GLuint * shaders,
 
     glLinkProgram(program);
 
-    if (check_errors)
+    s.pending[program] = p;
+
+    return program;
+}
+
+bool is_ready(GLuint program)
+{
+    program_state& s = get_program_state();
+    GLint done = 0;
+
+    if (!s.parallel || s.pending.find(program) == s.pending.end())
+        return true;
+
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+
+    return done != 0;
+}
+
+GLuint finish_link(GLuint program, bool check_errors)
+{
+    program_state& s = get_program_state();
+    std::unordered_map<GLuint, pending_link>::iterator it = s.pending.find(program);
+    GLint status = 0;
+    size_t i;
+
+    if (it == s.pending.end())
+        return program;
+
+    pending_link p = it->second;
+
+    s.pending.erase(it);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+    if (check_errors && !status)
     {
-        GLint status;
-        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        char buffer[4096];
 
-        if (!status)
-        {
-            char buffer[4096];
-            glGetProgramInfoLog(program, 4096, NULL, buffer);
+        for (i = 0; i < p.shaders.size(); i++)
+            check_compile(p.shaders[i], p.filenames[i].c_str());
+
+        glGetProgramInfoLog(program, 4096, NULL, buffer);
 #ifdef _WIN32
-            OutputDebugStringA(buffer);
-            OutputDebugStringA("\n");
+        OutputDebugStringA(buffer);
+        OutputDebugStringA("\n");
+#else
+        fprintf(stderr, "%s\n", buffer);
 #endif
-            glDeleteProgram(program);
-            return 0;
-        }
+        glDeleteProgram(program);
+        program = 0;
+    }
+    else if (status && p.key)
+    {
+        store_binary(program, p.key);
     }
 
-    if (delete_shaders)
+    if (p.delete_shaders)
     {
-        for (i = 0; i < shader_count; i++)
-        {
-            glDeleteShader(shaders[i]);
-        }
+        for (i = 0; i < p.shaders.size(); i++)
+            glDeleteShader(p.shaders[i]);
     }
 
     return program;
 }
 
+GLuint link_from_shaders(const GLuint * shaders,
+                         int shader_count,
+                         bool delete_shaders,
+                         bool check_errors)
+{
+    return finish_link(start_link(shaders, shader_count, delete_shaders), check_errors);
+}
+
+batch::batch()
+{
+
+}
+
+batch::~batch()
+{
+    size_t i;
+
+    for (i = 0; i < programs.size(); i++)
+    {
+        if (!taken[i])
+            glDeleteProgram(finish_link(programs[i], false));
+    }
+}
+
+unsigned int batch::add(const char * vs_filename, const char * fs_filename)
+{
+    GLuint shaders[2];
+
+    shaders[0] = shader::load(vs_filename, GL_VERTEX_SHADER, false);
+    shaders[1] = shader::load(fs_filename, GL_FRAGMENT_SHADER, false);
+
+    if (!shaders[0] || !shaders[1])
+    {
+        glDeleteShader(shaders[0]);
+        glDeleteShader(shaders[1]);
+        programs.push_back(0);
+        taken.push_back(false);
+        return (unsigned int)programs.size() - 1;
+    }
+
+    return add(shaders, 2, true);
+}
+
+unsigned int batch::add(const GLuint * shaders, int shader_count, bool delete_shaders)
+{
+    programs.push_back(start_link(shaders, shader_count, delete_shaders));
+    taken.push_back(false);
+
+    return (unsigned int)programs.size() - 1;
+}
+
+bool batch::ready() const
+{
+    size_t i;
+
+    for (i = 0; i < programs.size(); i++)
+    {
+        if (!taken[i] && !is_ready(programs[i]))
+            return false;
+    }
+
+    return true;
+}
+
+GLuint batch::get(unsigned int i, bool check_errors)
+{
+    if (!taken[i])
+    {
+        programs[i] = finish_link(programs[i], check_errors);
+        taken[i] = true;
+    }
+
+    return programs[i];
+}
+
 }
 
 }
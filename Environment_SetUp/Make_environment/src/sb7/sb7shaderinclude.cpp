@@ -0,0 +1,337 @@
+/*
+ * GLSL #include
+ *
+ * Expansions are cached by normalized path along with every file that went
+ * into them. A cached one is checked by hashing those files again, which
+ * is one mapping and one pass over each: much less than expanding, and it
+ * means an edited include is picked up without anyone having to say so.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include "GL/gl3w.h"
+#include <sb7archive.h>
+#include <sb7vfs.h>
+#include <shader.h>
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace sb7
+{
+
+namespace shader
+{
+
+struct expansion
+{
+    std::string                 text;
+    std::vector<dependency>     dependencies;
+};
+
+struct include_state
+{
+    std::mutex                                      lock;
+    std::unordered_map<std::string, expansion>      cache;      // By normalized path
+};
+
+static include_state& get_include_state()
+{
+    static include_state s;
+    return s;
+}
+
+static uint64_t hash_source(const char * source, size_t length)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        h ^= (unsigned char)source[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+static void report(const char * filename, unsigned int line, const char * message, const std::string& name)
+{
+    char buffer[1024];
+
+    snprintf(buffer, sizeof(buffer), "%s(%u): %s \"%s\"", filename, line, message, name.c_str());
+#ifdef _WIN32
+    OutputDebugStringA(buffer);
+    OutputDebugStringA("\n");
+#else
+    fprintf(stderr, "%s\n", buffer);
+#endif
+}
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Finds an #include on the line [p, end), and the name in it. The line
+// isn't one if it starts inside a block comment.
+static bool parse_include(const char * p, const char * end, std::string& name, bool& from_root)
+{
+    while (p < end && is_blank(*p))
+        p++;
+
+    if (p == end || *p++ != '#')
+        return false;
+
+    while (p < end && is_blank(*p))
+        p++;
+
+    if (end - p < 7 || strncmp(p, "include", 7) != 0)
+        return false;
+
+    p += 7;
+
+    while (p < end && is_blank(*p))
+        p++;
+
+    if (p == end || (*p != '"' && *p != '<'))
+        return false;
+
+    char close = *p == '"' ? '"' : '>';
+    const char * start = ++p;
+
+    while (p < end && *p != close)
+        p++;
+
+    if (p == end || p == start)
+        return false;
+
+    name.assign(start, p);
+    from_root = close == '>';
+
+    return true;
+}
+
+// Whether a block comment is still open at the end of the line
+static bool in_comment_after(const char * p, const char * end, bool in_comment)
+{
+    for (; p < end; p++)
+    {
+        if (in_comment)
+        {
+            if (p[0] == '*' && p + 1 < end && p[1] == '/')
+            {
+                in_comment = false;
+                p++;
+            }
+        }
+        else if (p[0] == '/' && p + 1 < end)
+        {
+            if (p[1] == '/')
+                break;
+
+            if (p[1] == '*')
+            {
+                in_comment = true;
+                p++;
+            }
+        }
+    }
+
+    return in_comment;
+}
+
+bool has_includes(const char * source, size_t length)
+{
+    const char * end = source + length;
+    const char * p;
+
+    for (p = source; (p = (const char *)memchr(p, '#', end - p)) != NULL; p++)
+    {
+        const char * q = p + 1;
+
+        while (q < end && is_blank(*q))
+            q++;
+
+        if (end - q >= 7 && strncmp(q, "include", 7) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Appends the file at dependencies[index] to out, its includes expanded
+static bool expand(const char * source, size_t length, int index,
+                   std::vector<dependency>& dependencies, std::string& out)
+{
+    const std::string path = dependencies[index].path;
+    const char * end = source + length;
+    const char * line = source;
+    bool in_comment = false;
+    unsigned int number = 1;
+    char buffer[64];
+
+    while (line < end)
+    {
+        const char * eol = (const char *)memchr(line, '\n', end - line);
+        const char * next = eol ? eol + 1 : end;
+        std::string name;
+        bool from_root;
+
+        if (!eol)
+            eol = end;
+
+        if (in_comment || !parse_include(line, eol, name, from_root))
+        {
+            in_comment = in_comment_after(line, eol, in_comment);
+            out.append(line, next);
+            line = next;
+            number++;
+            continue;
+        }
+
+        // Relative to the file doing the including, unless it's <name>
+        if (!from_root)
+        {
+            size_t slash = path.rfind('/');
+
+            if (slash != std::string::npos)
+                name = path.substr(0, slash + 1) + name;
+        }
+
+        name = archive::normalize(name.c_str());
+
+        size_t i;
+
+        for (i = 0; i < dependencies.size() && dependencies[i].path != name; i++)
+            ;
+
+        // Already in, so the line just goes
+        if (i < dependencies.size())
+        {
+            out += '\n';
+            line = next;
+            number++;
+            continue;
+        }
+
+        vfs::file f;
+
+        if (!f.open(name.c_str()))
+        {
+            report(path.c_str(), number, "can't open include file", name);
+            return false;
+        }
+
+        dependency d;
+
+        d.path = name;
+        d.hash = hash_source((const char *)f.data(), f.size());
+        d.parent = index;
+
+        dependencies.push_back(d);
+
+        snprintf(buffer, sizeof(buffer), "#line 1 %u\n", (unsigned int)i);
+        out += buffer;
+
+        if (!expand((const char *)f.data(), f.size(), (int)i, dependencies, out))
+            return false;
+
+        if (!out.empty() && out.back() != '\n')
+            out += '\n';
+
+        line = next;
+        number++;
+
+        snprintf(buffer, sizeof(buffer), "#line %u %d\n", number, index);
+        out += buffer;
+    }
+
+    return true;
+}
+
+bool preprocess(const char * source,
+                size_t length,
+                const char * filename,
+                std::string& out,
+                std::vector<dependency> * dependencies)
+{
+    include_state& s = get_include_state();
+    std::string key = archive::normalize(filename ? filename : "");
+    uint64_t hash = hash_source(source, length);
+    expansion e;
+
+    {
+        std::lock_guard<std::mutex> l(s.lock);
+
+        std::unordered_map<std::string, expansion>::const_iterator it = s.cache.find(key);
+
+        if (it != s.cache.end())
+            e = it->second;
+    }
+
+    // Rehashing the includes is done without the lock, so other threads
+    // can expand meanwhile
+    if (e.dependencies.empty() || e.dependencies[0].hash != hash ||
+        dependencies_changed(std::vector<dependency>(e.dependencies.begin() + 1, e.dependencies.end())))
+    {
+        dependency d;
+
+        d.path = key;
+        d.hash = hash;
+        d.parent = -1;
+
+        e.text.clear();
+        e.dependencies.assign(1, d);
+
+        if (!expand(source, length, 0, e.dependencies, e.text))
+            return false;
+
+        std::lock_guard<std::mutex> l(s.lock);
+
+        s.cache[key] = e;
+    }
+
+    out.swap(e.text);
+
+    if (dependencies)
+        dependencies->swap(e.dependencies);
+
+    return true;
+}
+
+bool preprocess(const char * filename,
+                std::string& out,
+                std::vector<dependency> * dependencies)
+{
+    vfs::file f;
+
+    if (!f.open(filename))
+        return false;
+
+    return preprocess((const char *)f.data(), f.size(), filename, out, dependencies);
+}
+
+bool dependencies_changed(const std::vector<dependency>& dependencies)
+{
+    size_t i;
+
+    for (i = 0; i < dependencies.size(); i++)
+    {
+        vfs::file f;
+
+        if (!f.open(dependencies[i].path.c_str()))
+            return true;
+
+        if (hash_source((const char *)f.data(), f.size()) != dependencies[i].hash)
+            return true;
+    }
+
+    return false;
+}
+
+}
+
+}
@@ -0,0 +1,293 @@
+/*
+ * Shader variants
+ *
+ * The table is indexed by the feature bits themselves, so get() on a built
+ * variant is one load and one compare.
+ */
+
+#include <sb7shadervariants.h>
+#include <shader.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+namespace sb7
+{
+
+shader_variants::shader_variants()
+    : mask(0),
+      separable(false)
+{
+    memset(programs, 0, sizeof(programs));
+    memset(state, NOT_BUILT, sizeof(state));
+    memset(stage_masks, 0, sizeof(stage_masks));
+    memset(stage_programs, 0, sizeof(stage_programs));
+    memset(stage_state, NOT_BUILT, sizeof(stage_state));
+}
+
+shader_variants::~shader_variants()
+{
+    clear();
+}
+
+bool shader_variants::init(const char * vs_filename, const char * fs_filename,
+                           const char * const * feature_names, unsigned int feature_count,
+                           bool separable)
+{
+    clear();
+
+    if (feature_count > MAX_FEATURES)
+        feature_count = MAX_FEATURES;
+
+    names.assign(feature_names, feature_names + feature_count);
+    mask = (1u << feature_count) - 1;
+    vs_path = vs_filename;
+    fs_path = fs_filename;
+    this->separable = separable;
+
+    return read_sources();
+}
+
+// Whether name appears in the source as a whole identifier
+static bool mentions(const std::string& source, const std::string& name)
+{
+    size_t at;
+
+    for (at = source.find(name); at != std::string::npos; at = source.find(name, at + 1))
+    {
+        size_t end = at + name.size();
+
+        if ((at == 0 || !(isalnum((unsigned char)source[at - 1]) || source[at - 1] == '_')) &&
+            (end == source.size() || !(isalnum((unsigned char)source[end]) || source[end] == '_')))
+            return true;
+    }
+
+    return false;
+}
+
+bool shader_variants::read_sources()
+{
+    unsigned int i;
+
+    if (shader::preprocess(vs_path.c_str(), vs_source, &vs_dependencies) &&
+        shader::preprocess(fs_path.c_str(), fs_source, &fs_dependencies))
+    {
+        // A stage only needs a program for the features it looks at
+        stage_masks[0] = stage_masks[1] = 0;
+
+        for (i = 0; i < names.size(); i++)
+        {
+            stage_masks[0] |= mentions(vs_source, names[i]) ? 1u << i : 0;
+            stage_masks[1] |= mentions(fs_source, names[i]) ? 1u << i : 0;
+        }
+
+        return true;
+    }
+
+    vs_source.clear();
+    fs_source.clear();
+    vs_dependencies.clear();
+    fs_dependencies.clear();
+
+    return false;
+}
+
+bool shader_variants::refresh()
+{
+    // Never read is as good as changed, it might be there now
+    if (!vs_source.empty() &&
+        !shader::dependencies_changed(vs_dependencies) &&
+        !shader::dependencies_changed(fs_dependencies))
+        return false;
+
+    clear();
+    read_sources();
+
+    return true;
+}
+
+void shader_variants::clear()
+{
+    unsigned int i;
+    unsigned int s;
+
+    for (i = 0; i < (1u << MAX_FEATURES); i++)
+    {
+        if (state[i] == STARTED)
+            programs[i] = program::finish_link(programs[i], false);
+
+        if (programs[i] && separable)
+            glDeleteProgramPipelines(1, &programs[i]);
+        else if (programs[i])
+            glDeleteProgram(programs[i]);
+
+        programs[i] = 0;
+        state[i] = NOT_BUILT;
+        reflections[i].clear();
+
+        for (s = 0; s < 2; s++)
+        {
+            if (stage_state[s][i] == STARTED)
+                stage_programs[s][i] = program::finish_link(stage_programs[s][i], false);
+
+            if (stage_programs[s][i])
+                glDeleteProgram(stage_programs[s][i]);
+
+            stage_programs[s][i] = 0;
+            stage_state[s][i] = NOT_BUILT;
+            stage_reflections[s][i].clear();
+        }
+    }
+}
+
+std::string shader_variants::source(GLenum shader_type, unsigned int features) const
+{
+    const std::string& text = shader_type == GL_VERTEX_SHADER ? vs_source : fs_source;
+    std::string defines;
+    size_t at = 0;
+    unsigned int line = 1;
+    unsigned int i;
+    char buffer[32];
+
+    features &= mask;
+
+    for (i = 0; i < names.size(); i++)
+    {
+        if (features & (1u << i))
+            defines += "#define " + names[i] + " 1\n";
+    }
+
+    if (defines.empty())
+        return text;
+
+    // #version has to come first, the defines go straight after it
+    size_t version = text.find("#version");
+
+    if (version != std::string::npos)
+    {
+        at = text.find('\n', version);
+        at = at == std::string::npos ? text.size() : at + 1;
+    }
+
+    for (i = 0; i < at; i++)
+        line += text[i] == '\n';
+
+    // Errors still point at the right line of the file
+    sprintf(buffer, "#line %u\n", line);
+    defines += buffer;
+
+    if (at != 0 && text[at - 1] != '\n')
+        defines.insert(0, "\n");
+
+    return text.substr(0, at) + defines + text.substr(at);
+}
+
+void shader_variants::prepare(unsigned int features)
+{
+    GLuint shaders[2];
+
+    features &= mask;
+
+    if (state[features] != NOT_BUILT || vs_source.empty() || fs_source.empty())
+        return;
+
+    if (separable)
+    {
+        prepare_stage(0, features & stage_masks[0]);
+        prepare_stage(1, features & stage_masks[1]);
+        state[features] = STARTED;
+        return;
+    }
+
+    shaders[0] = shader::from_string(source(GL_VERTEX_SHADER, features).c_str(), GL_VERTEX_SHADER, false);
+    shaders[1] = shader::from_string(source(GL_FRAGMENT_SHADER, features).c_str(), GL_FRAGMENT_SHADER, false);
+
+    programs[features] = program::start_link(shaders, 2, true);
+    state[features] = STARTED;
+}
+
+bool shader_variants::ready(unsigned int features) const
+{
+    unsigned int s;
+
+    features &= mask;
+
+    // Without sources nothing is ever started, and get() gives 0 at once
+    if (vs_source.empty() || fs_source.empty())
+        return true;
+
+    if (state[features] != STARTED || !separable)
+        return state[features] == BUILT || (state[features] == STARTED && program::is_ready(programs[features]));
+
+    for (s = 0; s < 2; s++)
+    {
+        unsigned int f = features & stage_masks[s];
+
+        if (stage_state[s][f] == STARTED && !program::is_ready(stage_programs[s][f]))
+            return false;
+    }
+
+    return true;
+}
+
+// Stage programs are shared by every variant that only differs in features
+// the stage doesn't mention
+void shader_variants::prepare_stage(unsigned int stage, unsigned int features)
+{
+    GLenum type = stage == 0 ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER;
+    GLuint shader;
+
+    if (stage_state[stage][features] != NOT_BUILT)
+        return;
+
+    shader = shader::from_string(source(type, features).c_str(), type, false);
+
+    stage_programs[stage][features] = program::start_link(&shader, 1, true, true);
+    stage_state[stage][features] = STARTED;
+}
+
+void shader_variants::finish_stage(unsigned int stage, unsigned int features)
+{
+    if (stage_state[stage][features] != STARTED)
+        return;
+
+    stage_programs[stage][features] = program::finish_link(stage_programs[stage][features], true);
+    stage_state[stage][features] = BUILT;
+    stage_reflections[stage][features].reflect(stage_programs[stage][features]);
+}
+
+GLuint shader_variants::build(unsigned int features)
+{
+    prepare(features);
+
+    if (state[features] == STARTED && separable)
+    {
+        unsigned int vs = features & stage_masks[0];
+        unsigned int fs = features & stage_masks[1];
+
+        finish_stage(0, vs);
+        finish_stage(1, fs);
+
+        if (stage_programs[0][vs] && stage_programs[1][fs])
+        {
+            glCreateProgramPipelines(1, &programs[features]);
+            glUseProgramStages(programs[features], GL_VERTEX_SHADER_BIT, stage_programs[0][vs]);
+            glUseProgramStages(programs[features], GL_FRAGMENT_SHADER_BIT, stage_programs[1][fs]);
+        }
+    }
+    else if (state[features] == STARTED)
+    {
+        programs[features] = program::finish_link(programs[features], true);
+    }
+
+    // Failures are kept too, so a broken variant is only reported once
+    state[features] = BUILT;
+
+    if (!separable)
+        reflections[features].reflect(programs[features]);
+
+    return programs[features];
+}
+
+}
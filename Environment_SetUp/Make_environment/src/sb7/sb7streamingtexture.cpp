@@ -0,0 +1,280 @@
+/*
+ * Streaming texture
+ *
+ * Levels are streamed coarse to fine. The loader copies each level out of
+ * the mapping (so the page faults happen on its thread, not in the middle
+ * of a frame) and publishes it by lowering loaded_level; update() uploads
+ * published levels in slices of whole rows, or whole block rows for
+ * compressed formats, until the budget runs out.
+ */
+
+#include <sb7streamingtexture.h>
+
+#include <cstring>
+
+#include "GL/gl3w.h"
+
+namespace sb7
+{
+
+// How much of a level fades in per update once it is resident
+static const float fade_step = 0.25f;
+
+static unsigned int level_extent(unsigned int size, unsigned int level)
+{
+    size >>= level;
+
+    return size ? size : 1;
+}
+
+// How many slices update() splits one face of a level into. Compressed
+// images can only be split on block rows.
+static unsigned int level_slices(const ktx::file::header& h, unsigned int level)
+{
+    unsigned int slice_rows = (h.gltype == GL_NONE) ? 4 : 1;
+
+    return (level_extent(h.pixelheight, level) + slice_rows - 1) / slice_rows;
+}
+
+// Uploads rows [y, y + rows) of one face of one level
+static void upload_rows(const ktx::file::header& h, GLenum face, unsigned int level,
+                        unsigned int y, unsigned int rows,
+                        const unsigned char * data, unsigned int size)
+{
+    unsigned int width = level_extent(h.pixelwidth, level);
+
+    if (h.gltype == GL_NONE)
+        glCompressedTexSubImage2D(face, level, 0, y, width, rows, h.glinternalformat, size, data);
+    else
+        glTexSubImage2D(face, level, 0, y, width, rows, h.glformat, h.gltype, data);
+}
+
+streaming_texture::streaming_texture()
+    : tex(0),
+      tex_target(GL_NONE),
+      levels(0),
+      faces(0),
+      loaded_level(0),
+      stop(false),
+      base_level(0),
+      min_lod(0.0f),
+      upload_face(0),
+      upload_row(0)
+{
+    memset(&h, 0, sizeof(h));
+}
+
+streaming_texture::~streaming_texture()
+{
+    close();
+}
+
+unsigned int streaming_texture::open(const char * filename, unsigned int tail_size)
+{
+    GLint unpack_alignment;
+    unsigned int level;
+    unsigned int i;
+
+    close();
+
+    if (!file.open(filename))
+        return 0;
+
+    // Only complete, ready to sample chains can be streamed
+    if (!ktx::file::parse(file.data(), file.size(), h, tex_target, images, image_sizes) ||
+        (tex_target != GL_TEXTURE_2D && tex_target != GL_TEXTURE_CUBE_MAP) ||
+        h.miplevels == 0)
+    {
+        goto fail;
+    }
+
+    levels = h.miplevels;
+    faces = (tex_target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+
+    // The tail is every level no bigger than tail_size, and at least the last
+    base_level = levels - 1;
+    while (base_level > 0 &&
+           level_extent(h.pixelwidth, base_level - 1) <= tail_size &&
+           level_extent(h.pixelheight, base_level - 1) <= tail_size)
+    {
+        base_level--;
+    }
+
+    // Streamed faces are uploaded a slice at a time, so each one has to
+    // split into whole, non-empty slices
+    for (level = 0; level < base_level; level++)
+    {
+        unsigned int slices = level_slices(h, level);
+
+        for (i = 0; i < faces; i++)
+        {
+            unsigned int size = image_sizes[level * faces + i];
+
+            if (size == 0 || size % slices != 0)
+                goto fail;
+        }
+    }
+
+    glGenTextures(1, &tex);
+    glBindTexture(tex_target, tex);
+    glTexStorage2D(tex_target, levels, h.glinternalformat, h.pixelwidth, h.pixelheight);
+
+    glTexParameteri(tex_target, GL_TEXTURE_BASE_LEVEL, base_level);
+    glTexParameteri(tex_target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameterf(tex_target, GL_TEXTURE_MIN_LOD, 0.0f);
+
+    // KTX rows are always padded to four bytes
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    for (level = base_level; level < levels; level++)
+    {
+        for (i = 0; i < faces; i++)
+        {
+            unsigned int image = level * faces + i;
+
+            upload_rows(h, faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : tex_target, level,
+                        0, level_extent(h.pixelheight, level), images[image], image_sizes[image]);
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+    staging.resize(levels * faces);
+    loaded_level = base_level;
+    stop = false;
+    min_lod = 0.0f;
+    upload_face = 0;
+    upload_row = 0;
+
+    if (base_level > 0)
+        loader = std::thread(load_levels, this);
+
+    return tex;
+
+fail:
+    close();
+
+    return 0;
+}
+
+void streaming_texture::close()
+{
+    stop = true;
+
+    if (loader.joinable())
+        loader.join();
+
+    if (tex)
+    {
+        glDeleteTextures(1, &tex);
+        tex = 0;
+    }
+
+    staging.clear();
+    images.clear();
+    image_sizes.clear();
+    file.close();
+
+    tex_target = GL_NONE;
+    levels = 0;
+    faces = 0;
+    base_level = 0;
+    min_lod = 0.0f;
+}
+
+void streaming_texture::load_levels(streaming_texture * self)
+{
+    unsigned int level = self->loaded_level;
+    unsigned int i;
+
+    while (level-- > 0 && !self->stop)
+    {
+        for (i = 0; i < self->faces; i++)
+        {
+            unsigned int image = level * self->faces + i;
+
+            self->staging[image].assign(self->images[image], self->images[image] + self->image_sizes[image]);
+        }
+
+        self->loaded_level = level;
+    }
+}
+
+bool streaming_texture::update(size_t& budget)
+{
+    GLint unpack_alignment = 0;
+    bool bound = false;
+
+    if (tex == 0)
+        return false;
+
+    if (min_lod > 0.0f)
+    {
+        min_lod = min_lod > fade_step ? min_lod - fade_step : 0.0f;
+
+        glBindTexture(tex_target, tex);
+        glTexParameterf(tex_target, GL_TEXTURE_MIN_LOD, min_lod);
+    }
+
+    while (base_level > 0 && budget > 0 && loaded_level < base_level)
+    {
+        unsigned int level = base_level - 1;
+        unsigned int height = level_extent(h.pixelheight, level);
+        std::vector<unsigned char>& image = staging[level * faces + upload_face];
+
+        unsigned int slice_rows = (h.gltype == GL_NONE) ? 4 : 1;
+        unsigned int slices = level_slices(h, level);
+        size_t slice_size = image.size() / slices;
+        size_t count = slice_size ? budget / slice_size : slices;
+        unsigned int first = upload_row / slice_rows;
+
+        if (count == 0)
+            count = 1;
+        if (count > slices - first)
+            count = slices - first;
+
+        unsigned int rows = (unsigned int)count * slice_rows;
+        if (upload_row + rows > height)
+            rows = height - upload_row;
+
+        if (!bound)
+        {
+            glBindTexture(tex_target, tex);
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            bound = true;
+        }
+
+        upload_rows(h, faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + upload_face : tex_target, level,
+                    upload_row, rows, &image[first * slice_size], (unsigned int)(count * slice_size));
+
+        budget -= budget < count * slice_size ? budget : count * slice_size;
+        upload_row += rows;
+
+        if (upload_row < height)
+            continue;
+
+        // Face done, the copy isn't needed any more
+        std::vector<unsigned char>().swap(image);
+        upload_row = 0;
+
+        if (++upload_face < faces)
+            continue;
+
+        // Level done: let the sampler at it, starting from where it was
+        upload_face = 0;
+        base_level = level;
+        min_lod += 1.0f;
+
+        glTexParameteri(tex_target, GL_TEXTURE_BASE_LEVEL, base_level);
+        glTexParameterf(tex_target, GL_TEXTURE_MIN_LOD, min_lod);
+    }
+
+    if (bound)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+    return is_resident();
+}
+
+}
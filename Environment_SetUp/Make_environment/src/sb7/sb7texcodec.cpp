@@ -0,0 +1,706 @@
+/*
+ * Texture block codec
+ *
+ * BC1 color blocks: two RGB565 endpoints c0 > c1 followed by 2-bit indices
+ * into { c0, c1, (2 c0 + c1) / 3, (c0 + 2 c1) / 3 }. BC3 adds an alpha
+ * block in front: two 8-bit endpoints and 3-bit indices, eight interpolated
+ * values when a0 > a1, otherwise six plus 0 and 255.
+ *
+ * The color encoder picks an axis through the block (bounding box diagonal
+ * or principal axis), takes the extreme projections as endpoints, pulls
+ * them in by 1/16 of the range to balance the quantization error and then
+ * does an exhaustive nearest palette entry search per pixel. High quality
+ * re-solves the endpoints for the chosen indices by least squares and
+ * keeps the result if the block error went down.
+ */
+
+#include <sb7texcodec.h>
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SB7_TEXCODEC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace sb7
+{
+
+namespace texcodec
+{
+
+unsigned int gl_internal_format(format f)
+{
+    return f == FORMAT_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+unsigned int gl_base_format(format f)
+{
+    return f == FORMAT_BC1 ? 0x1907 /* GL_RGB */ : 0x1908 /* GL_RGBA */;
+}
+
+size_t block_size(format f)
+{
+    return f == FORMAT_BC1 ? 8 : 16;
+}
+
+size_t compressed_size(format f, unsigned int width, unsigned int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_size(f);
+}
+
+static inline int clamp255(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static unsigned short pack565(int r, int g, int b)
+{
+    // Round to nearest representable value
+    r = (clamp255(r) * 31 + 127) / 255;
+    g = (clamp255(g) * 63 + 127) / 255;
+    b = (clamp255(b) * 31 + 127) / 255;
+
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(unsigned short c, int rgb[3])
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+static void color_palette(unsigned short c0, unsigned short c1, bool four_color, int palette[4][3])
+{
+    int i;
+
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+
+    for (i = 0; i < 3; i++)
+    {
+        if (four_color)
+        {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+        }
+        else
+        {
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+        }
+    }
+}
+
+// Picks the nearest palette entry for each of the 16 pixels, returns the
+// total squared RGB error
+static unsigned int find_color_indices(const unsigned char px[64], const int palette[4][3], unsigned char indices[16])
+{
+#ifdef SB7_TEXCODEC_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    __m128i pal[4];
+    __m128i total = zero;
+    int i, k;
+
+    for (k = 0; k < 4; k++)
+    {
+        pal[k] = _mm_setr_epi16((short)palette[k][0], (short)palette[k][1], (short)palette[k][2], 0,
+                                (short)palette[k][0], (short)palette[k][1], (short)palette[k][2], 0);
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(px + i * 16)), rgb_mask);
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i best = _mm_set1_epi32(0x7FFFFFFF);
+        __m128i best_index = zero;
+
+        for (k = 0; k < 4; k++)
+        {
+            __m128i dl = _mm_sub_epi16(lo, pal[k]);
+            __m128i dh = _mm_sub_epi16(hi, pal[k]);
+
+            // (r^2 + g^2, b^2) per pixel, then fold the pairs together
+            __m128 sl = _mm_castsi128_ps(_mm_madd_epi16(dl, dl));
+            __m128 sh = _mm_castsi128_ps(_mm_madd_epi16(dh, dh));
+            __m128i d = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(3, 1, 3, 1))));
+
+            __m128i closer = _mm_cmplt_epi32(d, best);
+            best = _mm_or_si128(_mm_and_si128(closer, d), _mm_andnot_si128(closer, best));
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, best_index));
+        }
+
+        total = _mm_add_epi32(total, best);
+
+        unsigned int idx[4];
+        _mm_storeu_si128((__m128i *)idx, best_index);
+        indices[i * 4 + 0] = (unsigned char)idx[0];
+        indices[i * 4 + 1] = (unsigned char)idx[1];
+        indices[i * 4 + 2] = (unsigned char)idx[2];
+        indices[i * 4 + 3] = (unsigned char)idx[3];
+    }
+
+    unsigned int sums[4];
+    _mm_storeu_si128((__m128i *)sums, total);
+
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    unsigned int total = 0;
+    int i, k;
+
+    for (i = 0; i < 16; i++)
+    {
+        unsigned int best = 0xFFFFFFFF;
+
+        for (k = 0; k < 4; k++)
+        {
+            int dr = px[i * 4 + 0] - palette[k][0];
+            int dg = px[i * 4 + 1] - palette[k][1];
+            int db = px[i * 4 + 2] - palette[k][2];
+            unsigned int d = dr * dr + dg * dg + db * db;
+
+            if (d < best)
+            {
+                best = d;
+                indices[i] = (unsigned char)k;
+            }
+        }
+
+        total += best;
+    }
+
+    return total;
+#endif
+}
+
+// Endpoints (as 8-bit colors) to a finished block. Returns the block error.
+static unsigned int fit_color_block(const unsigned char px[64], const float e0[3], const float e1[3],
+                                    unsigned short& c0, unsigned short& c1, unsigned char indices[16])
+{
+    int palette[4][3];
+
+    c0 = pack565((int)(e0[0] + 0.5f), (int)(e0[1] + 0.5f), (int)(e0[2] + 0.5f));
+    c1 = pack565((int)(e1[0] + 0.5f), (int)(e1[1] + 0.5f), (int)(e1[2] + 0.5f));
+
+    // Four color mode needs c0 > c1, swapping flips index bit 0
+    if (c0 < c1)
+    {
+        unsigned short t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+
+    color_palette(c0, c1, true, palette);
+
+    if (c0 == c1)
+    {
+        // Every entry decodes to (nearly) the same color, use entry 0 only
+        memset(indices, 0, 16);
+        unsigned int err = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int dr = px[i * 4 + 0] - palette[0][0];
+            int dg = px[i * 4 + 1] - palette[0][1];
+            int db = px[i * 4 + 2] - palette[0][2];
+            err += dr * dr + dg * dg + db * db;
+        }
+        return err;
+    }
+
+    return find_color_indices(px, palette, indices);
+}
+
+// Least squares endpoints for a fixed set of indices. Returns false if the
+// system is degenerate (every pixel on one index).
+static bool refine_endpoints(const unsigned char px[64], const unsigned char indices[16], float e0[3], float e1[3])
+{
+    static const float weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[3] = { 0.0f, 0.0f, 0.0f };
+    float bx[3] = { 0.0f, 0.0f, 0.0f };
+    int i, c;
+
+    for (i = 0; i < 16; i++)
+    {
+        float a = weight[indices[i]];
+        float b = 1.0f - a;
+
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+
+        for (c = 0; c < 3; c++)
+        {
+            ax[c] += a * px[i * 4 + c];
+            bx[c] += b * px[i * 4 + c];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+
+    if (fabsf(det) < 1e-6f)
+        return false;
+
+    for (c = 0; c < 3; c++)
+    {
+        e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+        e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+        e0[c] = e0[c] < 0.0f ? 0.0f : (e0[c] > 255.0f ? 255.0f : e0[c]);
+        e1[c] = e1[c] < 0.0f ? 0.0f : (e1[c] > 255.0f ? 255.0f : e1[c]);
+    }
+
+    return true;
+}
+
+static void encode_color_block(const unsigned char px[64], quality q, unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    float lo[3] = { 255.0f, 255.0f, 255.0f };
+    float hi[3] = { 0.0f, 0.0f, 0.0f };
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    float e0[3], e1[3];
+    unsigned short c0, c1;
+    unsigned char indices[16];
+    unsigned int err;
+    int i, c;
+
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            float v = px[i * 4 + c];
+            mean[c] += v;
+            if (v < lo[c]) lo[c] = v;
+            if (v > hi[c]) hi[c] = v;
+        }
+    }
+
+    for (c = 0; c < 3; c++)
+        mean[c] *= 1.0f / 16.0f;
+
+    for (i = 0; i < 16; i++)
+    {
+        float r = px[i * 4 + 0] - mean[0];
+        float g = px[i * 4 + 1] - mean[1];
+        float b = px[i * 4 + 2] - mean[2];
+
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    if (q == QUALITY_FAST)
+    {
+        // Bounding box, with the diagonal picked from the covariance signs
+        // relative to green (the channel with the most bits)
+        for (c = 0; c < 3; c++)
+        {
+            e0[c] = hi[c];
+            e1[c] = lo[c];
+        }
+
+        if (cov[1] < 0.0f) { e0[0] = lo[0]; e1[0] = hi[0]; }
+        if (cov[4] < 0.0f) { e0[2] = lo[2]; e1[2] = hi[2]; }
+    }
+    else
+    {
+        // Principal axis by power iteration, starting from the box diagonal
+        float axis[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+        float pmin = 1e30f, pmax = -1e30f;
+        int imin = 0, imax = 0;
+
+        if (cov[1] < 0.0f) axis[0] = -axis[0];
+        if (cov[4] < 0.0f) axis[2] = -axis[2];
+
+        for (i = 0; i < 4; i++)
+        {
+            float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            float m = fabsf(x) > fabsf(y) ? fabsf(x) : fabsf(y);
+
+            if (fabsf(z) > m)
+                m = fabsf(z);
+
+            if (m < 1e-6f)
+                break;
+
+            axis[0] = x / m;
+            axis[1] = y / m;
+            axis[2] = z / m;
+        }
+
+        for (i = 0; i < 16; i++)
+        {
+            float p = px[i * 4 + 0] * axis[0] + px[i * 4 + 1] * axis[1] + px[i * 4 + 2] * axis[2];
+
+            if (p < pmin) { pmin = p; imin = i; }
+            if (p > pmax) { pmax = p; imax = i; }
+        }
+
+        for (c = 0; c < 3; c++)
+        {
+            e0[c] = px[imax * 4 + c];
+            e1[c] = px[imin * 4 + c];
+        }
+    }
+
+    // Pull the endpoints in by 1/16 of the range
+    for (c = 0; c < 3; c++)
+    {
+        float inset = (e0[c] - e1[c]) / 16.0f;
+        e0[c] -= inset;
+        e1[c] += inset;
+    }
+
+    err = fit_color_block(px, e0, e1, c0, c1, indices);
+
+    if (q == QUALITY_HIGH)
+    {
+        for (i = 0; i < 2 && err != 0; i++)
+        {
+            unsigned short r0, r1;
+            unsigned char r_indices[16];
+            unsigned int r_err;
+
+            if (!refine_endpoints(px, indices, e0, e1))
+                break;
+
+            r_err = fit_color_block(px, e0, e1, r0, r1, r_indices);
+
+            if (r_err >= err)
+                break;
+
+            err = r_err;
+            c0 = r0;
+            c1 = r1;
+            memcpy(indices, r_indices, 16);
+        }
+    }
+
+    unsigned int bits = 0;
+    for (i = 0; i < 16; i++)
+        bits |= (unsigned int)indices[i] << (i * 2);
+
+    out[0] = (unsigned char)(c0 & 0xFF);
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xFF);
+    out[3] = (unsigned char)(c1 >> 8);
+    out[4] = (unsigned char)(bits & 0xFF);
+    out[5] = (unsigned char)((bits >> 8) & 0xFF);
+    out[6] = (unsigned char)((bits >> 16) & 0xFF);
+    out[7] = (unsigned char)(bits >> 24);
+}
+
+static void alpha_palette(int a0, int a1, int palette[8])
+{
+    int i;
+
+    palette[0] = a0;
+    palette[1] = a1;
+
+    if (a0 > a1)
+    {
+        for (i = 1; i < 7; i++)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    }
+    else
+    {
+        for (i = 1; i < 5; i++)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+static unsigned int fit_alpha_block(const unsigned char px[64], int a0, int a1, unsigned char indices[16])
+{
+    int palette[8];
+    unsigned int total = 0;
+    int i, k;
+
+    alpha_palette(a0, a1, palette);
+
+    for (i = 0; i < 16; i++)
+    {
+        int best = 0x7FFFFFFF;
+
+        for (k = 0; k < 8; k++)
+        {
+            int d = px[i * 4 + 3] - palette[k];
+            d *= d;
+
+            if (d < best)
+            {
+                best = d;
+                indices[i] = (unsigned char)k;
+            }
+        }
+
+        total += best;
+    }
+
+    return total;
+}
+
+static void encode_alpha_block(const unsigned char px[64], quality q, unsigned char out[8])
+{
+    int lo = 255, hi = 0;
+    int inner_lo = 255, inner_hi = 0;
+    int a0, a1;
+    unsigned char indices[16];
+    unsigned int err;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        int a = px[i * 4 + 3];
+
+        if (a < lo) lo = a;
+        if (a > hi) hi = a;
+
+        // Range without the values the six value mode has for free
+        if (a != 0 && a < inner_lo) inner_lo = a;
+        if (a != 255 && a > inner_hi) inner_hi = a;
+    }
+
+    // Eight value mode, a0 > a1
+    a0 = hi;
+    a1 = lo;
+    if (a0 == a1)
+    {
+        memset(indices, 0, 16);
+        err = 0;
+    }
+    else
+    {
+        err = fit_alpha_block(px, a0, a1, indices);
+    }
+
+    // Six value mode plus 0 and 255, a0 <= a1
+    if (q != QUALITY_FAST && err != 0 && (lo == 0 || hi == 255))
+    {
+        unsigned char six_indices[16];
+        int s0 = inner_lo <= inner_hi ? inner_lo : 0;
+        int s1 = inner_lo <= inner_hi ? inner_hi : 0;
+        unsigned int six_err = fit_alpha_block(px, s0, s1, six_indices);
+
+        if (six_err < err)
+        {
+            err = six_err;
+            a0 = s0;
+            a1 = s1;
+            memcpy(indices, six_indices, 16);
+        }
+    }
+
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+
+    unsigned long long bits = 0;
+    for (i = 0; i < 16; i++)
+        bits |= (unsigned long long)indices[i] << (i * 3);
+
+    for (i = 0; i < 6; i++)
+        out[2 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+static void fetch_block(const unsigned char * rgba, unsigned int width, unsigned int height, unsigned int stride,
+                        unsigned int bx, unsigned int by, unsigned char px[64])
+{
+    unsigned int x, y;
+
+    for (y = 0; y < 4; y++)
+    {
+        unsigned int sy = by * 4 + y;
+        if (sy >= height)
+            sy = height - 1;
+
+        for (x = 0; x < 4; x++)
+        {
+            unsigned int sx = bx * 4 + x;
+            if (sx >= width)
+                sx = width - 1;
+
+            memcpy(px + (y * 4 + x) * 4, rgba + (size_t)sy * stride + sx * 4, 4);
+        }
+    }
+}
+
+static void compress_rows(format f, quality q, const unsigned char * rgba,
+                          unsigned int width, unsigned int height, unsigned int stride,
+                          unsigned char * out, unsigned int first_row, unsigned int last_row)
+{
+    unsigned int blocks_x = (width + 3) / 4;
+    size_t bsize = block_size(f);
+    unsigned char px[64];
+    unsigned int bx, by;
+
+    for (by = first_row; by < last_row; by++)
+    {
+        unsigned char * dst = out + (size_t)by * blocks_x * bsize;
+
+        for (bx = 0; bx < blocks_x; bx++)
+        {
+            fetch_block(rgba, width, height, stride, bx, by, px);
+
+            if (f == FORMAT_BC3)
+            {
+                encode_alpha_block(px, q, dst);
+                encode_color_block(px, q, dst + 8);
+            }
+            else
+            {
+                encode_color_block(px, q, dst);
+            }
+
+            dst += bsize;
+        }
+    }
+}
+
+void compress(format f,
+              quality q,
+              const unsigned char * rgba,
+              unsigned int width,
+              unsigned int height,
+              unsigned int stride,
+              unsigned char * out,
+              unsigned int threads)
+{
+    unsigned int rows = (height + 3) / 4;
+    unsigned int i;
+
+    if (width == 0 || height == 0)
+        return;
+
+    if (stride == 0)
+        stride = width * 4;
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    if (threads > rows)
+        threads = rows;
+
+    // Contiguous runs of block rows per thread, the calling thread takes
+    // the first one
+    std::vector<std::thread> workers;
+    unsigned int per_thread = (rows + threads - 1) / threads;
+
+    for (i = 1; i < threads; i++)
+    {
+        unsigned int first = i * per_thread;
+        unsigned int last = first + per_thread < rows ? first + per_thread : rows;
+
+        if (first < last)
+            workers.push_back(std::thread(compress_rows, f, q, rgba, width, height, stride, out, first, last));
+    }
+
+    compress_rows(f, q, rgba, width, height, stride, out, 0, per_thread < rows ? per_thread : rows);
+
+    for (i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void decompress(format f,
+                const unsigned char * blocks,
+                unsigned int width,
+                unsigned int height,
+                unsigned char * rgba)
+{
+    unsigned int blocks_x = (width + 3) / 4;
+    unsigned int blocks_y = (height + 3) / 4;
+    size_t bsize = block_size(f);
+    unsigned int bx, by, i;
+
+    for (by = 0; by < blocks_y; by++)
+    {
+        for (bx = 0; bx < blocks_x; bx++)
+        {
+            const unsigned char * block = blocks + ((size_t)by * blocks_x + bx) * bsize;
+            const unsigned char * color = f == FORMAT_BC3 ? block + 8 : block;
+            int palette[4][3];
+            int alpha[8];
+            unsigned long long alpha_bits = 0;
+
+            unsigned short c0 = (unsigned short)(color[0] | (color[1] << 8));
+            unsigned short c1 = (unsigned short)(color[2] | (color[3] << 8));
+            unsigned int bits = color[4] | (color[5] << 8) | (color[6] << 16) | ((unsigned int)color[7] << 24);
+
+            // BC3 color blocks always decode in four color mode
+            color_palette(c0, c1, f == FORMAT_BC3 || c0 > c1, palette);
+
+            if (f == FORMAT_BC3)
+            {
+                alpha_palette(block[0], block[1], alpha);
+                for (i = 0; i < 6; i++)
+                    alpha_bits |= (unsigned long long)block[2 + i] << (i * 8);
+            }
+
+            for (i = 0; i < 16; i++)
+            {
+                unsigned int x = bx * 4 + (i & 3);
+                unsigned int y = by * 4 + (i >> 2);
+
+                if (x >= width || y >= height)
+                    continue;
+
+                unsigned char * p = rgba + ((size_t)y * width + x) * 4;
+                unsigned int index = (bits >> (i * 2)) & 3;
+
+                p[0] = (unsigned char)palette[index][0];
+                p[1] = (unsigned char)palette[index][1];
+                p[2] = (unsigned char)palette[index][2];
+                p[3] = f == FORMAT_BC3 ? (unsigned char)alpha[(alpha_bits >> (i * 3)) & 7] : 255;
+            }
+        }
+    }
+}
+
+double psnr(const unsigned char * a,
+            const unsigned char * b,
+            unsigned int width,
+            unsigned int height,
+            unsigned int channels)
+{
+    size_t count = (size_t)width * height;
+    double total = 0.0;
+    size_t i;
+    unsigned int c;
+
+    for (i = 0; i < count; i++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            double d = (double)a[i * 4 + c] - (double)b[i * 4 + c];
+            total += d * d;
+        }
+    }
+
+    if (total == 0.0)
+        return HUGE_VAL;
+
+    double mse = total / ((double)count * channels);
+
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+}
+
+}
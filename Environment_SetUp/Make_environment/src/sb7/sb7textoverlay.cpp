@@ -26,21 +26,18 @@
 #include <sb7textoverlay.h>
 
 #include <sb7ktx.h>
+#include <shader.h>
 
 namespace sb7
 {
 
 void text_overlay::init(int width, int height, const char* font)
 {
-    GLuint vs;
-    GLuint fs;
+    GLuint shaders[2];
 
     buffer_width = width;
     buffer_height = height;
 
-    vs = glCreateShader(GL_VERTEX_SHADER);
-    fs = glCreateShader(GL_FRAGMENT_SHADER);
-
     static const char * vs_source[] =
     {
         "#version 440 core\n"
@@ -73,19 +70,11 @@ void text_overlay::init(int width, int height, const char* font)
         "}\n"
     };
 
-    glShaderSource(vs, 1, vs_source, nullptr);
-    glCompileShader(vs);
-
-    glShaderSource(fs, 1, fs_source, nullptr);
-    glCompileShader(fs);
-
-    text_program = glCreateProgram();
-    glAttachShader(text_program, vs);
-    glAttachShader(text_program, fs);
-    glLinkProgram(text_program);
+    // Through the program binary cache, like every other program
+    shaders[0] = shader::from_string(vs_source[0], GL_VERTEX_SHADER);
+    shaders[1] = shader::from_string(fs_source[0], GL_FRAGMENT_SHADER);
 
-    glDeleteShader(fs);
-    glDeleteShader(vs);
+    text_program = program::link_from_shaders(shaders, 2, true);
 
     // glCreateVertexArrays(1, &vao);
     glGenVertexArrays(1, &vao);
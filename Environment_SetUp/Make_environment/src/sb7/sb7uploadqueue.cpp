@@ -0,0 +1,522 @@
+/*
+ * Upload queue
+ *
+ * The ring hands out space front to back and wraps to the start when the
+ * next reservation doesn't fit at the end; allocations are freed strictly
+ * in reservation order, so the free space is always the gap between the
+ * newest and the oldest live allocation.
+ */
+
+#include <sb7uploadqueue.h>
+#include <sb7ext.h>
+
+#include <cstdlib>
+
+namespace sb7
+{
+
+enum
+{
+    RING_ALIGNMENT = 256        // Keeps every copy offset legal for any texel type
+};
+
+upload_queue::upload_queue()
+    : running(false),
+      persistent(false),
+      ring(0),
+      base(NULL),
+      capacity(0),
+      head(0),
+      first_allocation(1),
+      next_batch(1),
+      completed_batch(0),
+      next_asset(1)
+{
+
+}
+
+upload_queue::~upload_queue()
+{
+    // Without a context there is nothing to unmap, just the fallback memory
+    if (!persistent)
+        free(base);
+}
+
+bool upload_queue::init(size_t ring_size)
+{
+    shutdown();
+
+    capacity = (ring_size + RING_ALIGNMENT - 1) & ~(size_t)(RING_ALIGNMENT - 1);
+    head = 0;
+
+    persistent = gl3wIsSupported(4, 4) || sb6IsExtensionSupported("GL_ARB_buffer_storage");
+
+    if (persistent)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &ring);
+        glBindBuffer(GL_COPY_READ_BUFFER, ring);
+        glBufferStorage(GL_COPY_READ_BUFFER, capacity, NULL, flags);
+        base = (unsigned char *)glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags);
+
+        if (!base)
+        {
+            glDeleteBuffers(1, &ring);
+            ring = 0;
+            persistent = false;
+        }
+    }
+
+    if (!persistent)
+        base = (unsigned char *)malloc(capacity);
+
+    if (!base)
+        return false;
+
+    std::lock_guard<std::mutex> l(lock);
+    running = true;
+
+    return true;
+}
+
+void upload_queue::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        // Turn away new reservations and anyone waiting for space. Regions
+        // still being filled aren't waited for, a load that was dropped
+        // would never queue its copy.
+        running = false;
+        space.notify_all();
+    }
+
+    if (base == NULL)
+        return;
+
+    // Whatever is queued still goes out, then everything is waited for
+    process();
+
+    while (!batches.empty())
+    {
+        glClientWaitSync(batches.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~(GLuint64)0);
+        retire();
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        // Ids keep counting up, so regions handed out before this never
+        // match an allocation again
+        first_allocation += (unsigned int)allocations.size();
+        allocations.clear();
+        head = 0;
+    }
+
+    if (persistent)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, ring);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glDeleteBuffers(1, &ring);
+        ring = 0;
+    }
+    else
+    {
+        free(base);
+    }
+
+    base = NULL;
+    persistent = false;
+}
+
+upload_queue::asset upload_queue::begin(resident_proc callback, void * user)
+{
+    std::lock_guard<std::mutex> l(lock);
+    asset_state& state = assets[next_asset];
+
+    state.copies = 0;
+    state.batch = 0;
+    state.finished = false;
+    state.callback = callback;
+    state.user = user;
+
+    return next_asset++;
+}
+
+void upload_queue::finish(asset a)
+{
+    std::lock_guard<std::mutex> l(lock);
+    std::map<asset, asset_state>::iterator it = assets.find(a);
+
+    if (it != assets.end())
+        it->second.finished = true;
+}
+
+bool upload_queue::is_resident(asset a)
+{
+    std::lock_guard<std::mutex> l(lock);
+
+    return a != 0 && a < next_asset && assets.find(a) == assets.end();
+}
+
+bool upload_queue::reserve(size_t size, region& r, bool wait)
+{
+    std::unique_lock<std::mutex> l(lock);
+    size_t aligned = (size + RING_ALIGNMENT - 1) & ~(size_t)(RING_ALIGNMENT - 1);
+
+    if (aligned == 0)
+        aligned = RING_ALIGNMENT;
+
+    while (running && aligned <= capacity)
+    {
+        size_t offset = 0;
+        bool fits;
+
+        if (allocations.empty())
+        {
+            fits = true;
+        }
+        else
+        {
+            size_t tail = allocations.front().offset;
+
+            if (head > tail)
+            {
+                // Live space is [tail, head), try the end then the start
+                fits = true;
+                if (head + aligned <= capacity)
+                    offset = head;
+                else if (aligned > tail)
+                    fits = false;
+            }
+            else
+            {
+                // Wrapped, live space is [tail, end) and [0, head)
+                offset = head;
+                fits = head + aligned <= tail;
+            }
+        }
+
+        if (fits)
+        {
+            allocation alloc;
+
+            alloc.offset = offset;
+            alloc.size = aligned;
+            alloc.batch = 0;
+            alloc.queued = false;
+            alloc.cancelled = false;
+
+            allocations.push_back(alloc);
+            head = offset + aligned;
+
+            r.data = base + offset;
+            r.size = size;
+            r.id = first_allocation + (unsigned int)allocations.size() - 1;
+
+            return true;
+        }
+
+        if (!wait)
+            break;
+
+        space.wait(l);
+    }
+
+    return false;
+}
+
+void upload_queue::cancel(const region& r)
+{
+    std::lock_guard<std::mutex> l(lock);
+
+    if (!is_outstanding(r))
+        return;
+
+    allocations[r.id - first_allocation].cancelled = true;
+
+    if (free_allocations())
+        space.notify_all();
+}
+
+// Whether r was reserved since the last shutdown() and hasn't been queued
+// or cancelled. Called with the lock held.
+bool upload_queue::is_outstanding(const region& r) const
+{
+    if (!running || r.id < first_allocation || r.id - first_allocation >= allocations.size())
+        return false;
+
+    const allocation& alloc = allocations[r.id - first_allocation];
+
+    return !alloc.queued && !alloc.cancelled;
+}
+
+void upload_queue::queue(command& c, const region& r)
+{
+    std::lock_guard<std::mutex> l(lock);
+    std::map<asset, asset_state>::iterator it = assets.find(c.owner);
+
+    if (!is_outstanding(r))
+        return;
+
+    allocations[r.id - first_allocation].queued = true;
+
+    c.id = r.id;
+    c.offset = (unsigned char *)r.data - base;
+    c.size = r.size;
+
+    commands.push_back(c);
+
+    if (it != assets.end())
+        it->second.copies++;
+}
+
+void upload_queue::buffer_data(asset a, const region& r, GLuint buffer, GLenum usage)
+{
+    command c;
+
+    c.kind = COMMAND_BUFFER_DATA;
+    c.owner = a;
+    c.name = buffer;
+    c.usage = usage;
+
+    queue(c, r);
+}
+
+void upload_queue::buffer_sub_data(asset a, const region& r, GLuint buffer, GLintptr offset)
+{
+    command c;
+
+    c.kind = COMMAND_BUFFER_SUB_DATA;
+    c.owner = a;
+    c.name = buffer;
+    c.dst_offset = offset;
+
+    queue(c, r);
+}
+
+void upload_queue::tex_sub_image(asset a, const region& r, GLuint texture, GLenum face, GLint level,
+                                 GLint x, GLint y, GLint z, GLsizei width, GLsizei height, GLsizei depth,
+                                 GLenum format, GLenum type)
+{
+    command c;
+
+    c.kind = COMMAND_TEX_SUB_IMAGE;
+    c.owner = a;
+    c.name = texture;
+    c.face = face;
+    c.level = level;
+    c.x = x;
+    c.y = y;
+    c.z = z;
+    c.width = width;
+    c.height = height;
+    c.depth = depth;
+    c.format = format;
+    c.type = type;
+
+    queue(c, r);
+}
+
+void upload_queue::issue(const command& c)
+{
+    // Sources are offsets into the bound ring, or plain pointers without one
+    const void * src = persistent ? (const void *)c.offset : (const void *)(base + c.offset);
+    GLenum target;
+
+    switch (c.kind)
+    {
+        case COMMAND_BUFFER_DATA:
+            glBindBuffer(GL_COPY_WRITE_BUFFER, c.name);
+            if (persistent)
+            {
+                glBufferData(GL_COPY_WRITE_BUFFER, c.size, NULL, c.usage);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, c.offset, 0, c.size);
+            }
+            else
+            {
+                glBufferData(GL_COPY_WRITE_BUFFER, c.size, src, c.usage);
+            }
+            break;
+        case COMMAND_BUFFER_SUB_DATA:
+            glBindBuffer(GL_COPY_WRITE_BUFFER, c.name);
+            if (persistent)
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, c.offset, c.dst_offset, c.size);
+            else
+                glBufferSubData(GL_COPY_WRITE_BUFFER, c.dst_offset, c.size, src);
+            break;
+        case COMMAND_TEX_SUB_IMAGE:
+            target = c.face;
+            if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z)
+                target = GL_TEXTURE_CUBE_MAP;
+
+            glBindTexture(target, c.name);
+
+            switch (target)
+            {
+                case GL_TEXTURE_1D:
+                    if (c.type == GL_NONE)
+                        glCompressedTexSubImage1D(c.face, c.level, c.x, c.width, c.format, (GLsizei)c.size, src);
+                    else
+                        glTexSubImage1D(c.face, c.level, c.x, c.width, c.format, c.type, src);
+                    break;
+                case GL_TEXTURE_3D:
+                case GL_TEXTURE_2D_ARRAY:
+                case GL_TEXTURE_CUBE_MAP_ARRAY:
+                    if (c.type == GL_NONE)
+                        glCompressedTexSubImage3D(c.face, c.level, c.x, c.y, c.z, c.width, c.height, c.depth, c.format, (GLsizei)c.size, src);
+                    else
+                        glTexSubImage3D(c.face, c.level, c.x, c.y, c.z, c.width, c.height, c.depth, c.format, c.type, src);
+                    break;
+                default:
+                    if (c.type == GL_NONE)
+                        glCompressedTexSubImage2D(c.face, c.level, c.x, c.y, c.width, c.height, c.format, (GLsizei)c.size, src);
+                    else
+                        glTexSubImage2D(c.face, c.level, c.x, c.y, c.width, c.height, c.format, c.type, src);
+                    break;
+            }
+            break;
+    }
+}
+
+// Pops allocations off the front of the ring once nothing can read them.
+// Called with the lock held, true if any space came back.
+bool upload_queue::free_allocations()
+{
+    bool freed = false;
+
+    while (!allocations.empty() &&
+           (allocations.front().cancelled ||
+            (allocations.front().batch != 0 && allocations.front().batch <= completed_batch)))
+    {
+        allocations.pop_front();
+        first_allocation++;
+        freed = true;
+    }
+
+    return freed;
+}
+
+void upload_queue::retire()
+{
+    std::vector<std::pair<asset, asset_state> > landed;
+    size_t i;
+
+    // Fences signal in order, so stop at the first one still pending
+    while (!batches.empty())
+    {
+        GLenum status = glClientWaitSync(batches.front().fence, 0, 0);
+
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(batches.front().fence);
+        completed_batch = batches.front().id;
+        batches.pop_front();
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        std::map<asset, asset_state>::iterator it;
+        bool freed = free_allocations();
+
+        for (it = assets.begin(); it != assets.end(); )
+        {
+            if (it->second.finished && it->second.copies == 0 && it->second.batch <= completed_batch)
+            {
+                landed.push_back(*it);
+                assets.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        if (freed)
+            space.notify_all();
+    }
+
+    // Outside the lock, so callbacks can queue more work
+    for (i = 0; i < landed.size(); i++)
+    {
+        if (landed[i].second.callback)
+            landed[i].second.callback(landed[i].first, landed[i].second.user);
+    }
+}
+
+unsigned int upload_queue::process()
+{
+    std::vector<command> work;
+    GLint unpack_alignment;
+    unsigned int id;
+    size_t i;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        work.swap(commands);
+    }
+
+    if (!work.empty())
+    {
+        id = next_batch++;
+
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        if (persistent)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, ring);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+        }
+
+        for (i = 0; i < work.size(); i++)
+            issue(work[i]);
+
+        if (persistent)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+        batch b;
+        b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        b.id = id;
+        batches.push_back(b);
+
+        std::lock_guard<std::mutex> l(lock);
+
+        for (i = 0; i < work.size(); i++)
+        {
+            std::map<asset, asset_state>::iterator it = assets.find(work[i].owner);
+
+            allocations[work[i].id - first_allocation].batch = id;
+
+            if (it != assets.end())
+            {
+                it->second.copies--;
+                it->second.batch = id;
+            }
+        }
+    }
+
+    retire();
+
+    std::lock_guard<std::mutex> l(lock);
+
+    return (unsigned int)assets.size();
+}
+
+size_t upload_queue::bytes_in_flight()
+{
+    std::lock_guard<std::mutex> l(lock);
+    size_t total = 0;
+    size_t i;
+
+    for (i = 0; i < allocations.size(); i++)
+        total += allocations[i].size;
+
+    return total;
+}
+
+}
@@ -0,0 +1,350 @@
+/*
+ * Virtual file system
+ *
+ * The mounts, the path cache and the counters share one lock. Searching a
+ * directory mount is a stat under that lock, which is fine for the handful
+ * of files a search happens for; everything after that is a cache hit.
+ */
+
+#include <sb7vfs.h>
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace sb7
+{
+
+namespace vfs
+{
+
+enum
+{
+    MOUNT_DIRECTORY,
+    MOUNT_ARCHIVE,
+    MOUNT_MEMORY
+};
+
+struct mount_point
+{
+    int                         kind;
+    std::string                 prefix;         // Normalized, empty for the root
+    std::string                 directory;      // Native, ends in a separator
+    std::unique_ptr<archive>    pack;
+    std::string                 name;           // Memory mounts hold one file
+    const unsigned char *       data;
+    size_t                      size;
+    unsigned int                type;
+};
+
+struct state
+{
+    std::mutex                                  lock;
+    std::vector<std::unique_ptr<mount_point> >  mounts;     // Searched back to front
+    std::unordered_map<std::string, location>   cache;
+    stats                                       counters;
+};
+
+static state& get_state()
+{
+    static state s;
+    return s;
+}
+
+static bool is_absolute(const char * path)
+{
+    return path[0] == '/' || path[0] == '\\' || (path[0] != 0 && path[1] == ':');
+}
+
+std::string native_path(const char * path)
+{
+    std::string out(path);
+    size_t i;
+
+    for (i = 0; i < out.size(); i++)
+    {
+#ifdef _WIN32
+        if (out[i] == '/')
+            out[i] = '\\';
+#else
+        if (out[i] == '\\')
+            out[i] = '/';
+#endif
+    }
+
+    return out;
+}
+
+static void add_mount(std::unique_ptr<mount_point> m, const char * at)
+{
+    state& s = get_state();
+
+    m->prefix = archive::normalize(at ? at : "");
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    s.mounts.push_back(std::move(m));
+    s.cache.clear();
+}
+
+bool mount(const char * directory, const char * at)
+{
+    std::unique_ptr<mount_point> m(new mount_point);
+    std::error_code ec;
+
+    m->kind = MOUNT_DIRECTORY;
+    m->directory = native_path(directory);
+
+    if (!std::filesystem::is_directory(m->directory, ec))
+        return false;
+
+#ifdef _WIN32
+    if (m->directory.back() != '\\')
+        m->directory += '\\';
+#else
+    if (m->directory.back() != '/')
+        m->directory += '/';
+#endif
+
+    add_mount(std::move(m), at);
+
+    return true;
+}
+
+bool mount_archive(const char * filename, const char * at)
+{
+    std::unique_ptr<mount_point> m(new mount_point);
+
+    m->kind = MOUNT_ARCHIVE;
+    m->pack.reset(new archive);
+
+    if (!m->pack->open(native_path(filename).c_str()))
+        return false;
+
+    add_mount(std::move(m), at);
+
+    return true;
+}
+
+void mount_memory(const char * name, const void * data, size_t size, unsigned int type)
+{
+    std::unique_ptr<mount_point> m(new mount_point);
+
+    m->kind = MOUNT_MEMORY;
+    m->name = archive::normalize(name);
+    m->data = (const unsigned char *)data;
+    m->size = size;
+    m->type = type;
+
+    add_mount(std::move(m), "");
+}
+
+void unmount_all()
+{
+    state& s = get_state();
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    s.mounts.clear();
+    s.cache.clear();
+}
+
+// Looks for the normalized path in one mount
+static bool search(const mount_point& m, const std::string& key, location& where)
+{
+    std::string rest;
+    std::error_code ec;
+
+    if (m.kind == MOUNT_MEMORY)
+    {
+        if (key != m.name)
+            return false;
+
+        where.data = m.data;
+        where.size = m.size;
+        where.type = m.type;
+
+        return true;
+    }
+
+    if (m.prefix.empty())
+        rest = key;
+    else if (key.size() > m.prefix.size() && key.compare(0, m.prefix.size(), m.prefix) == 0 && key[m.prefix.size()] == '/')
+        rest = key.substr(m.prefix.size() + 1);
+    else
+        return false;
+
+    if (m.kind == MOUNT_ARCHIVE)
+        return m.pack->find(rest.c_str(), where.data, where.size, &where.type);
+
+    where.disk_path = m.directory + native_path(rest.c_str());
+
+    return std::filesystem::is_regular_file(where.disk_path, ec);
+}
+
+// Same as locate(), fresh is set if the answer didn't come from the cache
+static bool resolve(const char * path, location& where, bool& fresh)
+{
+    state& s = get_state();
+    std::error_code ec;
+
+    where.disk_path.clear();
+    where.data = NULL;
+    where.size = 0;
+    where.type = ARCHIVE_RAW;
+    fresh = true;
+
+    if (!path || !path[0])
+        return false;
+
+    if (is_absolute(path))
+    {
+        where.disk_path = native_path(path);
+        return std::filesystem::is_regular_file(where.disk_path, ec);
+    }
+
+    std::string key = archive::normalize(path);
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    std::unordered_map<std::string, location>::const_iterator it = s.cache.find(key);
+
+    if (it != s.cache.end())
+    {
+        where = it->second;
+        fresh = false;
+        s.counters.cache_hits++;
+        return true;
+    }
+
+    s.counters.searches++;
+
+    for (size_t i = s.mounts.size(); i-- > 0; )
+    {
+        location found;
+
+        found.data = NULL;
+        found.size = 0;
+        found.type = ARCHIVE_RAW;
+
+        if (search(*s.mounts[i], key, found))
+        {
+            s.cache[key] = found;
+            where = found;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool locate(const char * path, location& where)
+{
+    bool fresh;
+
+    return resolve(path, where, fresh);
+}
+
+// Drops a cached path that turned out to be stale
+static void forget(const char * path)
+{
+    state& s = get_state();
+    std::string key = archive::normalize(path);
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    s.cache.erase(key);
+}
+
+void get_stats(stats& out)
+{
+    state& s = get_state();
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    out = s.counters;
+}
+
+void reset_stats()
+{
+    state& s = get_state();
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    s.counters = stats();
+}
+
+file::file()
+    : base(NULL),
+      length(0),
+      kind(ARCHIVE_RAW)
+{
+
+}
+
+file::~file()
+{
+    close();
+}
+
+bool file::open(const char * path)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    location where;
+    bool fresh = true;
+    int attempt;
+
+    close();
+
+    // A cached file on disk may have gone since, in which case search again
+    for (attempt = 0; attempt < 2 && resolve(path, where, fresh); attempt++)
+    {
+        if (where.data)
+        {
+            base = where.data;
+            length = where.size;
+            kind = where.type;
+            break;
+        }
+
+        if (mapping.open(where.disk_path.c_str()))
+        {
+            base = mapping.data();
+            length = mapping.size();
+            kind = ARCHIVE_RAW;
+            break;
+        }
+
+        if (fresh)
+            break;
+
+        forget(path);
+    }
+
+    state& s = get_state();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> l(s.lock);
+
+    s.counters.opens++;
+    s.counters.failed += base == NULL;
+    s.counters.bytes += length;
+    s.counters.open_time += elapsed;
+
+    return base != NULL;
+}
+
+void file::close()
+{
+    mapping.close();
+    base = NULL;
+    length = 0;
+    kind = ARCHIVE_RAW;
+}
+
+}
+
+}
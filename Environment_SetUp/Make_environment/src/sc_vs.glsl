@@ -2,8 +2,7 @@
 
 in vec4 cube_vertex; //Currently being drawn point (of a triangle)
 
-uniform mat4 perspective; // Perspective transform
-uniform mat4 toCamera;    // world to Camera transform (should have no translation for skycube)
+#include "camera.glsl" // toCamera should have no translation for the skycube
 
 out vec4 texture_coordinates; //Ouput to fragment shader
                                                                   
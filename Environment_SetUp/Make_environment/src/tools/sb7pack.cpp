@@ -0,0 +1,254 @@
+/*
+ * Asset packer
+ *
+ * Packs loose assets into one sb7 archive (see sb7archive.h):
+ *
+ *     sb7pack <archive> <file or directory>...
+ *
+ * Directories are packed recursively. Assets are named by the paths they
+ * were packed from, so run it from the directory the application runs from
+ * and pass the same relative paths the application loads.
+ *
+ * Anything that gets converted at load time is converted here instead, once:
+ * OBJ files become clustered .sbm meshes (the o/g groups ride along in the
+ * comment chunk) and bitmaps become RGBA .ktx textures. .sbm and .ktx files
+ * go in as they are, GLSL as shaders and everything else raw.
+ */
+
+#include <sb7archive.h>
+#include <sb7ktx.h>
+#include <sb7objectwriter.h>
+
+#include <loadingFunctions.h>
+#include <skybox.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::string extension(const std::string& path)
+{
+    std::string ext = std::filesystem::path(path).extension().string();
+
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+    return ext;
+}
+
+static bool read_file(const std::string& path, std::vector<unsigned char>& data)
+{
+    std::ifstream in(path, std::ios::binary);
+
+    if (!in)
+        return false;
+
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    return !in.bad();
+}
+
+// Same data load_obj and cluster_obj build from an OBJ (see packed_mesh)
+static bool pack_obj(const std::vector<unsigned char>& text, std::vector<unsigned char>& out)
+{
+    std::vector<vmath::vec4> vertices, normals;
+    std::vector<vmath::vec2> uvs;
+    std::vector<SB6M_SUB_OBJECT_DECL> groups, clusters;
+    std::vector<SB6M_CLUSTER_DECL> group_bounds, cluster_bounds;
+    std::vector<std::string> group_names;
+    std::ostringstream comment;
+    GLuint count = 0;
+    size_t i;
+
+    {
+        std::istringstream in(std::string(text.begin(), text.end()));
+
+        parse_obj(in, vertices, uvs, normals, count, groups, group_names, group_bounds);
+    }
+
+    if (vertices.empty())
+        return false;
+
+    cluster_obj(vertices, uvs, normals, groups, clusters, cluster_bounds);
+
+    for (i = 0; i < groups.size(); i++)
+        comment << "g " << groups[i].first << " " << groups[i].count << " " << group_names[i] << "\n";
+
+    sb7::object_writer writer;
+
+    // Positions first so they can be uploaded on their own
+    std::vector<unsigned char> data;
+    unsigned int n = (unsigned int)vertices.size();
+
+    data.insert(data.end(), (const unsigned char *)&vertices[0], (const unsigned char *)(&vertices[0] + n));
+    writer.add_attrib("position", 4, GL_FLOAT, 0, 0, 0);
+
+    if (uvs.size() == n)
+    {
+        writer.add_attrib("texcoord", 2, GL_FLOAT, 0, 0, (unsigned int)data.size());
+        data.insert(data.end(), (const unsigned char *)&uvs[0], (const unsigned char *)(&uvs[0] + n));
+    }
+
+    if (normals.size() == n)
+    {
+        writer.add_attrib("normal", 4, GL_FLOAT, 0, 0, (unsigned int)data.size());
+        data.insert(data.end(), (const unsigned char *)&normals[0], (const unsigned char *)(&normals[0] + n));
+    }
+
+    writer.set_vertex_data(&data[0], (unsigned int)data.size(), n);
+    writer.set_sub_objects(clusters);
+    writer.set_clusters(cluster_bounds);
+    writer.set_comment(comment.str().c_str());
+    writer.write(out);
+
+    return true;
+}
+
+// Same pixels load_cubemap gets from a bitmap
+static bool pack_bmp(const std::vector<unsigned char>& bmp, std::vector<unsigned char>& out)
+{
+    sb7::ktx::file::header h;
+    unsigned int width, height;
+    unsigned char * pixels;
+
+    pixels = decodeCubeSide(bmp.data(), bmp.size(), width, height);
+
+    if (!pixels)
+        return false;
+
+    memset(&h, 0, sizeof(h));
+    h.gltype = GL_UNSIGNED_BYTE;
+    h.gltypesize = 1;
+    h.glformat = GL_RGBA;
+    h.glinternalformat = GL_RGBA8;
+    h.glbaseinternalformat = GL_RGBA;
+    h.pixelwidth = width;
+    h.pixelheight = height;
+    h.faces = 1;
+    h.miplevels = 1;
+
+    const void * image = pixels;
+    unsigned int image_size = width * height * 4;
+
+    sb7::ktx::file::write(out, h, &image, &image_size);
+
+    delete [] pixels;
+
+    return true;
+}
+
+static bool pack(sb7::archive_writer& writer, const std::string& path)
+{
+    std::string ext = extension(path);
+    std::vector<unsigned char> data;
+    std::vector<unsigned char> converted;
+    sb7::ARCHIVE_TYPE type = sb7::ARCHIVE_RAW;
+
+    if (!read_file(path, data))
+    {
+        fprintf(stderr, "sb7pack: can't read %s\n", path.c_str());
+        return false;
+    }
+
+    if (ext == ".obj")
+    {
+        if (!pack_obj(data, converted))
+        {
+            fprintf(stderr, "sb7pack: no triangles in %s\n", path.c_str());
+            return false;
+        }
+
+        data.swap(converted);
+        type = sb7::ARCHIVE_MESH;
+    }
+    else if (ext == ".bmp")
+    {
+        // Still packed, just not converted
+        if (pack_bmp(data, converted))
+        {
+            data.swap(converted);
+            type = sb7::ARCHIVE_TEXTURE;
+        }
+        else
+        {
+            fprintf(stderr, "sb7pack: %s isn't a bitmap that can be loaded, packed as it is\n", path.c_str());
+        }
+    }
+    else if (ext == ".sbm")
+    {
+        type = sb7::ARCHIVE_MESH;
+    }
+    else if (ext == ".ktx")
+    {
+        type = sb7::ARCHIVE_TEXTURE;
+    }
+    else if (ext == ".glsl" || ext == ".vert" || ext == ".frag" || ext == ".geom" ||
+             ext == ".tesc" || ext == ".tese" || ext == ".comp" || ext == ".vs" || ext == ".fs")
+    {
+        type = sb7::ARCHIVE_SHADER;
+    }
+
+    printf("%-48s %10u bytes\n", sb7::archive::normalize(path.c_str()).c_str(), (unsigned int)data.size());
+
+    writer.add(path.c_str(), type, data);
+
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    sb7::archive_writer writer;
+    bool ok = true;
+    int i;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: sb7pack <archive> <file or directory>...\n");
+        return 1;
+    }
+
+    for (i = 2; i < argc; i++)
+    {
+        std::error_code ec;
+
+        if (!std::filesystem::is_directory(argv[i], ec))
+        {
+            ok &= pack(writer, argv[i]);
+            continue;
+        }
+
+        // Sorted so the same tree always packs into the same archive
+        std::vector<std::string> files;
+
+        for (std::filesystem::recursive_directory_iterator it(argv[i], ec), end; !ec && it != end; it.increment(ec))
+        {
+            // Never pack an archive into itself
+            if (it->is_regular_file(ec) && extension(it->path().string()) != ".sb7a")
+                files.push_back(it->path().string());
+        }
+
+        std::sort(files.begin(), files.end());
+
+        for (size_t f = 0; f < files.size(); f++)
+            ok &= pack(writer, files[f]);
+    }
+
+    if (!ok)
+        return 1;
+
+    if (!writer.save(argv[1]))
+    {
+        fprintf(stderr, "sb7pack: can't write %s\n", argv[1]);
+        return 1;
+    }
+
+    printf("%u assets packed into %s\n", (unsigned int)writer.count(), argv[1]);
+
+    return 0;
+}
@@ -1,10 +1,13 @@
 #version 450 core  
 
+out gl_PerVertex { vec4 gl_Position; }; //Has to be spelled out when the stage is its own (separable) program
 out vec4 vs_color; //Ouput to fragment shader
+#ifdef LIT
+out vec3 vs_world; //World position, the fragment shader works the face normal out from it
+#endif
 
 uniform mat4 transform; //Transformation matrix
-uniform mat4 perspective; //Perspective transform
-uniform mat4 toCamera; //world to Camera transform
+#include "camera.glsl"
 
 in vec4 obj_vertex; //Currently being drawn point (of a triangle)
                                                                   
@@ -22,5 +25,9 @@ void main(void) {
     //                                                             VVVVVVVVVV Pulled in via attribute from buffer
     gl_Position = perspective * toCamera * translate * transform * obj_vertex;
 
+#ifdef LIT
+    vs_world = vec3(translate * transform * obj_vertex);
+#endif
+
     vs_color = vec4(0.5,0.5,0.5,1.0);                          
 }                                                                 
\ No newline at end of file